@@ -4,31 +4,97 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../src/batch.c \
+../src/bpred.c \
 ../src/bus.c \
 ../src/cache.c \
+../src/cachesim.c \
+../src/checkpoint.c \
+../src/counters.c \
 ../src/cpu.c \
 ../src/device.c \
 ../src/display.c \
+../src/dma.c \
+../src/error.c \
+../src/interval.c \
+../src/isa.c \
+../src/libcall.c \
+../src/loader.c \
 ../src/main.c \
-../src/ram.c 
+../src/pmu.c \
+../src/profiler.c \
+../src/ram.c \
+../src/rvemu.c \
+../src/sampling.c \
+../src/snapshot.c \
+../src/stats.c \
+../src/timing.c \
+../src/tracer.c \
+../src/user.c \
+../src/vector.c \
+../src/virtio_blk.c 
 
 OBJS += \
+./src/batch.o \
+./src/bpred.o \
 ./src/bus.o \
 ./src/cache.o \
+./src/cachesim.o \
+./src/checkpoint.o \
+./src/counters.o \
 ./src/cpu.o \
 ./src/device.o \
 ./src/display.o \
+./src/dma.o \
+./src/error.o \
+./src/interval.o \
+./src/isa.o \
+./src/libcall.o \
+./src/loader.o \
 ./src/main.o \
-./src/ram.o 
+./src/pmu.o \
+./src/profiler.o \
+./src/ram.o \
+./src/rvemu.o \
+./src/sampling.o \
+./src/snapshot.o \
+./src/stats.o \
+./src/timing.o \
+./src/tracer.o \
+./src/user.o \
+./src/vector.o \
+./src/virtio_blk.o 
 
 C_DEPS += \
+./src/batch.d \
+./src/bpred.d \
 ./src/bus.d \
 ./src/cache.d \
+./src/cachesim.d \
+./src/checkpoint.d \
+./src/counters.d \
 ./src/cpu.d \
 ./src/device.d \
 ./src/display.d \
+./src/dma.d \
+./src/error.d \
+./src/interval.d \
+./src/isa.d \
+./src/libcall.d \
+./src/loader.d \
 ./src/main.d \
-./src/ram.d 
+./src/pmu.d \
+./src/profiler.d \
+./src/ram.d \
+./src/rvemu.d \
+./src/sampling.d \
+./src/snapshot.d \
+./src/stats.d \
+./src/timing.d \
+./src/tracer.d \
+./src/user.d \
+./src/vector.d \
+./src/virtio_blk.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
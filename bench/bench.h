@@ -0,0 +1,31 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//console data register of the emulator
+#define BENCH_CONSOLE ((volatile uint8_t *)0xFFFFFFFFFFFF1000UL)
+
+void *memcpy(void *dst,const void *src,size_t n);
+void *memset(void *dst,int c,size_t n);
+
+void bench_putc(char c);
+void bench_puts(const char *s);
+void bench_put_hex(uint64_t x);
+
+//"name: checksum",the harness compares it with the baseline
+void bench_result(const char *name,uint64_t checksum);
+
+static inline uint64_t bench_rand(uint64_t *state)//xorshift64
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+#endif
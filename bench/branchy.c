@@ -0,0 +1,77 @@
+/*
+ * data dependent branches:random comparisons,binary search and
+ * collatz sequences.
+ */
+#include "bench.h"
+
+#define DATA_SIZE 4096
+#define ROUNDS 16
+
+static uint32_t data[DATA_SIZE];
+static uint32_t sorted[DATA_SIZE];
+
+static int search(uint32_t key)
+{
+	int lo = 0,hi = DATA_SIZE - 1,mid;
+
+	while(lo <= hi){
+		mid = (lo + hi) >> 1;
+		if(sorted[mid] == key) return mid;
+		if(sorted[mid] < key){
+			lo = mid + 1;
+		}else{
+			hi = mid - 1;
+		}
+	}
+	return -1;
+}
+
+static uint64_t collatz(uint64_t n)
+{
+	uint64_t steps = 0;
+
+	while(n != 1){
+		if(n & 1){
+			n = n + (n << 1) + 1;
+		}else{
+			n >>= 1;
+		}
+		steps++;
+	}
+	return steps;
+}
+
+int bench_main(void)
+{
+	uint64_t seed = 0x853c49e6748fea9bUL;
+	uint64_t sum = 0;
+	uint32_t pivot;
+
+	for(int i = 0;i<DATA_SIZE;i++){
+		data[i] = bench_rand(&seed);
+		sorted[i] = i*3;
+	}
+
+	for(int r = 0;r<ROUNDS;r++){
+		pivot = bench_rand(&seed);
+		for(int i = 0;i<DATA_SIZE;i++){//unpredictable
+			if(data[i] < pivot){
+				sum += data[i] & 0xff;
+			}else if(data[i] & 1){
+				sum ^= i;
+			}else{
+				sum -= 3;
+			}
+		}
+		for(int i = 0;i<DATA_SIZE/4;i++){
+			sum += search(bench_rand(&seed) % (DATA_SIZE*3));
+		}
+	}
+
+	for(uint64_t n = 1;n<3000;n++){
+		sum += collatz(n);
+	}
+
+	bench_result("branchy",sum);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * coremark style integer kernels:linked list processing,matrix
+ * multiply,a state machine and crc16 over the results.
+ */
+#include "bench.h"
+
+#define ITERATIONS 40
+#define LIST_SIZE 256
+#define MATRIX_N 16
+
+struct list_node{
+	struct list_node *next;
+	int16_t data;
+	int16_t idx;
+};
+
+static struct list_node nodes[LIST_SIZE];
+static int16_t mat_a[MATRIX_N*MATRIX_N];
+static int16_t mat_b[MATRIX_N*MATRIX_N];
+static int32_t mat_c[MATRIX_N*MATRIX_N];
+static char input[512];
+
+static uint16_t crc16(uint16_t crc,uint16_t data)
+{
+	for(int i = 0;i<16;i++){
+		if((crc ^ data) & 1){
+			crc = (crc >> 1) ^ 0xa001;
+		}else{
+			crc >>= 1;
+		}
+		data >>= 1;
+	}
+	return crc;
+}
+
+static struct list_node *list_init(uint64_t *seed)
+{
+	for(int i = 0;i<LIST_SIZE;i++){
+		nodes[i].next = i + 1 < LIST_SIZE ? &nodes[i + 1] : NULL;
+		nodes[i].data = bench_rand(seed) & 0x7fff;
+		nodes[i].idx = i;
+	}
+	return &nodes[0];
+}
+
+static struct list_node *list_reverse(struct list_node *list)
+{
+	struct list_node *prev = NULL,*next;
+
+	while(list){
+		next = list->next;
+		list->next = prev;
+		prev = list;
+		list = next;
+	}
+	return prev;
+}
+
+static struct list_node *list_find(struct list_node *list,int16_t data)
+{
+	while(list && (list->data & 0xff) != data){
+		list = list->next;
+	}
+	return list;
+}
+
+//bottom up merge sort,by data or by idx
+static struct list_node *list_sort(struct list_node *list,int by_idx)
+{
+	struct list_node *p,*q,*e,*tail;
+	int insize = 1,nmerges,psize,qsize;
+
+	while(1){
+		p = list;
+		list = tail = NULL;
+		nmerges = 0;
+
+		while(p){
+			nmerges++;
+			q = p;
+			psize = 0;
+			for(int i = 0;i<insize && q;i++){
+				psize++;
+				q = q->next;
+			}
+			qsize = insize;
+
+			while(psize > 0 || (qsize > 0 && q)){
+				if(psize == 0){
+					e = q; q = q->next; qsize--;
+				}else if(qsize == 0 || !q){
+					e = p; p = p->next; psize--;
+				}else if(by_idx ? p->idx <= q->idx : p->data <= q->data){
+					e = p; p = p->next; psize--;
+				}else{
+					e = q; q = q->next; qsize--;
+				}
+				if(tail){
+					tail->next = e;
+				}else{
+					list = e;
+				}
+				tail = e;
+			}
+			p = q;
+		}
+		tail->next = NULL;
+
+		if(nmerges <= 1) return list;
+		insize *= 2;
+	}
+}
+
+static uint16_t bench_list(struct list_node **list,uint16_t crc)
+{
+	struct list_node *found;
+
+	for(int i = 0;i<8;i++){
+		found = list_find(*list,i*29 & 0xff);
+		crc = crc16(crc,found ? found->idx : 0xffff);
+	}
+	*list = list_reverse(*list);
+	*list = list_sort(*list,0);
+	crc = crc16(crc,(*list)->data);
+	*list = list_sort(*list,1);
+	crc = crc16(crc,(*list)->next->idx);
+	return crc;
+}
+
+static uint16_t bench_matrix(int16_t val,uint16_t crc)
+{
+	int32_t sum = 0;
+
+	for(int i = 0;i<MATRIX_N*MATRIX_N;i++){
+		mat_a[i] += val;
+	}
+	for(int i = 0;i<MATRIX_N;i++){
+		for(int j = 0;j<MATRIX_N;j++){
+			int32_t acc = 0;
+			for(int k = 0;k<MATRIX_N;k++){
+				acc += (int32_t)mat_a[i*MATRIX_N + k] * mat_b[k*MATRIX_N + j];
+			}
+			mat_c[i*MATRIX_N + j] = acc;
+			sum += (acc >> 2) & 0x7f;
+		}
+	}
+	return crc16(crc,sum);
+}
+
+enum{START,INT,HEX,INVALID,NR_STATES};
+
+static uint16_t bench_state(uint16_t crc)
+{
+	int counts[NR_STATES] = {0};
+	int state = START;
+	char c;
+
+	for(char *p = input;*p;p++){
+		c = *p;
+		if(c == ','){
+			counts[state]++;
+			state = START;
+			continue;
+		}
+		switch(state){
+		case START:
+			if(c >= '0' && c <= '9') state = INT;
+			else if(c == 'x') state = HEX;
+			else state = INVALID;
+			break;
+		case INT:
+			if(c < '0' || c > '9') state = INVALID;
+			break;
+		case HEX:
+			if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) state = INVALID;
+			break;
+		default:
+			break;
+		}
+	}
+	for(int i = 0;i<NR_STATES;i++){
+		crc = crc16(crc,counts[i]);
+	}
+	return crc;
+}
+
+int bench_main(void)
+{
+	static const char *tokens[] = {"5012","x1f3a","-874","77","xzz9","120003","xbeef","1.5"};
+	uint64_t seed = 0x2545f4914f6cdd1dUL;
+	struct list_node *list = list_init(&seed);
+	uint16_t crc = 0;
+	int pos = 0;
+
+	for(int i = 0;i<MATRIX_N*MATRIX_N;i++){
+		mat_a[i] = bench_rand(&seed) & 0xff;
+		mat_b[i] = bench_rand(&seed) & 0xff;
+	}
+	while(pos < (int)sizeof(input) - 16){
+		for(const char *t = tokens[bench_rand(&seed) & 7];*t;t++){
+			input[pos++] = *t;
+		}
+		input[pos++] = ',';
+	}
+	input[pos] = 0;
+
+	for(int i = 0;i<ITERATIONS;i++){
+		crc = bench_list(&list,crc);
+		crc = bench_matrix(i,crc);
+		crc = bench_state(crc);
+	}
+
+	bench_result("coremark",crc);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * a small stack bytecode interpreter with switch dispatch,running an
+ * iterative fibonacci and a nested counting loop.
+ */
+#include "bench.h"
+
+enum{
+	OP_PUSH,//imm
+	OP_LOAD,//slot
+	OP_STORE,//slot
+	OP_ADD,
+	OP_SUB,
+	OP_AND,
+	OP_DUP,
+	OP_JNZ,//target
+	OP_JMP,//target
+	OP_HALT,
+};
+
+#define NR_SLOTS 8
+
+static int64_t run(const int32_t *code,int64_t *slots)
+{
+	int64_t stack[64];
+	int sp = 0,pc = 0;
+	int64_t a;
+
+	while(1){
+		switch(code[pc++]){
+		case OP_PUSH:
+			stack[sp++] = code[pc++];
+			break;
+		case OP_LOAD:
+			stack[sp++] = slots[code[pc++]];
+			break;
+		case OP_STORE:
+			slots[code[pc++]] = stack[--sp];
+			break;
+		case OP_ADD:
+			a = stack[--sp];
+			stack[sp - 1] += a;
+			break;
+		case OP_SUB:
+			a = stack[--sp];
+			stack[sp - 1] -= a;
+			break;
+		case OP_AND:
+			a = stack[--sp];
+			stack[sp - 1] &= a;
+			break;
+		case OP_DUP:
+			stack[sp] = stack[sp - 1];
+			sp++;
+			break;
+		case OP_JNZ:
+			if(stack[--sp]){
+				pc = code[pc];
+			}else{
+				pc++;
+			}
+			break;
+		case OP_JMP:
+			pc = code[pc];
+			break;
+		case OP_HALT:
+			return sp ? stack[sp - 1] : 0;
+		}
+	}
+}
+
+/*
+ * slot0 = n,slot1 = a,slot2 = b
+ * while(n){ t = a + b; a = b; b = t & mask; n--; } return a
+ */
+static const int32_t fib[] = {
+	OP_PUSH,0,OP_STORE,1,
+	OP_PUSH,1,OP_STORE,2,
+	/*8*/ OP_LOAD,0,OP_JNZ,15,
+	OP_LOAD,1,OP_HALT,
+	/*15*/ OP_LOAD,1,OP_LOAD,2,OP_ADD,OP_PUSH,0xfffffff,OP_AND,
+	OP_LOAD,2,OP_STORE,1,OP_STORE,2,
+	OP_LOAD,0,OP_PUSH,1,OP_SUB,OP_STORE,0,
+	OP_JMP,8,
+};
+
+/*
+ * slot0 = outer,slot3 = inner,slot4 = acc
+ */
+static const int32_t loops[] = {
+	/*0*/ OP_LOAD,0,OP_JNZ,7,
+	OP_LOAD,4,OP_HALT,
+	/*7*/ OP_PUSH,100,OP_STORE,3,
+	/*11*/ OP_LOAD,4,OP_LOAD,3,OP_ADD,OP_STORE,4,
+	OP_LOAD,3,OP_PUSH,1,OP_SUB,OP_DUP,OP_STORE,3,
+	OP_JNZ,11,
+	OP_LOAD,0,OP_PUSH,1,OP_SUB,OP_STORE,0,
+	OP_JMP,0,
+};
+
+int bench_main(void)
+{
+	int64_t slots[NR_SLOTS];
+	uint64_t sum = 0;
+
+	for(int i = 0;i<20;i++){
+		memset(slots,0,sizeof(slots));
+		slots[0] = 1000 + i;
+		sum += run(fib,slots);
+
+		memset(slots,0,sizeof(slots));
+		slots[0] = 200;
+		sum ^= run(loops,slots);
+	}
+
+	bench_result("interp",sum);
+	return 0;
+}
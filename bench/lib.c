@@ -0,0 +1,63 @@
+#include "bench.h"
+
+//the compiler may emit calls to these for struct copies and clears
+void *memcpy(void *dst,const void *src,size_t n)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	if((((uintptr_t)d | (uintptr_t)s | n) & 7) == 0){
+		for(size_t i = 0;i<n;i += 8){
+			*(uint64_t *)(d + i) = *(const uint64_t *)(s + i);
+		}
+		return dst;
+	}
+	for(size_t i = 0;i<n;i++){
+		d[i] = s[i];
+	}
+	return dst;
+}
+
+void *memset(void *dst,int c,size_t n)
+{
+	uint8_t *d = dst;
+
+	for(size_t i = 0;i<n;i++){
+		d[i] = c;
+	}
+	return dst;
+}
+
+#ifdef BENCH_HOST
+#include <stdio.h>
+void bench_putc(char c)
+{
+	putchar(c);
+}
+#else
+void bench_putc(char c)
+{
+	*BENCH_CONSOLE = c;
+}
+#endif
+
+void bench_puts(const char *s)
+{
+	while(*s) bench_putc(*s++);
+}
+
+void bench_put_hex(uint64_t x)
+{
+	bench_puts("0x");
+	for(int i = 60;i>=0;i -= 4){
+		bench_putc("0123456789abcdef"[(x >> i) & 0xf]);
+	}
+}
+
+void bench_result(const char *name,uint64_t checksum)
+{
+	bench_puts(name);
+	bench_puts(": ");
+	bench_put_hex(checksum);
+	bench_putc('\n');
+}
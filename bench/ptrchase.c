@@ -0,0 +1,45 @@
+/*
+ * pointer chasing through a random cycle,every load depends on the
+ * previous one.the working set grows from level 1 to beyond level 2.
+ */
+#include "bench.h"
+
+#define MAX_NODES (512*1024) //4M of pointers
+#define STEPS (256*1024)
+
+static uint64_t next[MAX_NODES];
+
+static uint64_t chase(uint64_t nr_nodes,uint64_t *seed)
+{
+	uint64_t idx = 0,j,tmp;
+
+	//a single cycle through all nodes,sattolo's algorithm
+	for(uint64_t i = 0;i<nr_nodes;i++){
+		next[i] = i;
+	}
+	for(uint64_t i = nr_nodes - 1;i>0;i--){
+		j = bench_rand(seed) % i;
+		tmp = next[i];
+		next[i] = next[j];
+		next[j] = tmp;
+	}
+
+	for(int i = 0;i<STEPS;i++){
+		idx = next[idx];
+	}
+	return idx;
+}
+
+int bench_main(void)
+{
+	uint64_t seed = 0x9e3779b97f4a7c15UL;
+	uint64_t sum = 0;
+
+	//16K,256K and 4M working sets
+	for(uint64_t nr_nodes = 2*1024;nr_nodes<=MAX_NODES;nr_nodes *= 16){
+		sum = (sum << 7) ^ chase(nr_nodes,&seed);
+	}
+
+	bench_result("ptrchase",sum);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# run the guest benchmarks under rvemu and report wall time,guest
+# instructions,MIPS and cache hit rates as json lines.
+#
+#   ./run_bench.py --build                      build with the cross compiler first
+#   ./run_bench.py --save-baseline base.json    store the results
+#   ./run_bench.py --baseline base.json         compare,exit 1 on a regression
+#
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+BENCHS = ["coremark", "stream", "ptrchase", "branchy", "interp"]
+
+
+def run_one(rvemu, name, repeat):
+    binary = os.path.join(BENCH_DIR, name + ".bin")
+    best = None
+
+    with tempfile.TemporaryDirectory() as tmp:
+        stats_file = os.path.join(tmp, "stats.json")
+        out_file = os.path.join(tmp, "console.txt")
+
+        for _ in range(repeat):
+            start = time.monotonic()
+            # -q turns off the instruction trace of debug builds,it would be timed instead of the core
+            ret = subprocess.run([rvemu, "-q", "-j", stats_file, "-o", out_file, binary],
+                                 stdout=subprocess.DEVNULL)
+            wall = time.monotonic() - start
+            if ret.returncode != 0:
+                sys.exit("%s: rvemu exited with %d" % (name, ret.returncode))
+
+            with open(stats_file) as f:
+                stats = json.load(f)
+            with open(out_file) as f:
+                console = f.read()
+
+            if best is None or wall < best["wall_seconds"]:
+                best = {
+                    "name": name,
+                    "wall_seconds": round(wall, 6),
+                    "instructions": stats["instructions"],
+                    "mips": stats["mips"],
+                    "caches": {k: v["hit_rate"] for k, v in stats["caches"].items()},
+                    "checksum": console.strip().split(": ")[-1],
+                }
+    return best
+
+
+def compare(results, baseline, threshold):
+    failed = False
+
+    for r in results:
+        base = baseline.get(r["name"])
+        if base is None:
+            print("%-10s no baseline" % r["name"], file=sys.stderr)
+            continue
+
+        ratio = r["mips"] / base["mips"] if base["mips"] else 0
+        status = "ok"
+        if r["checksum"] != base["checksum"] or r["instructions"] != base["instructions"]:
+            status = "MISMATCH"  # the guest did not run the same way
+            failed = True
+        elif ratio < 1 - threshold:
+            status = "REGRESSION"
+            failed = True
+
+        print("%-10s %10.3f MIPS  baseline %10.3f  %+6.1f%%  %s" %
+              (r["name"], r["mips"], base["mips"], (ratio - 1) * 100, status), file=sys.stderr)
+
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="rvemu benchmark harness")
+    parser.add_argument("--rvemu", default=os.path.join(BENCH_DIR, "..", "Debug", "rvemu"),
+                        help="emulator to time,an -O2 build gives comparable MIPS")
+    parser.add_argument("--build", action="store_true", help="run make in the bench directory first")
+    parser.add_argument("--repeat", type=int, default=3, help="runs per benchmark,the fastest is kept")
+    parser.add_argument("--baseline", help="compare against this baseline file")
+    parser.add_argument("--save-baseline", help="write the results as a baseline file")
+    parser.add_argument("--threshold", type=float, default=0.05, help="allowed MIPS drop,0.05 is 5%%")
+    parser.add_argument("benchs", nargs="*", default=BENCHS)
+    args = parser.parse_args()
+
+    if args.build:
+        subprocess.run(["make", "-C", BENCH_DIR], check=True)
+
+    results = []
+    for name in args.benchs:
+        r = run_one(args.rvemu, name, args.repeat)
+        print(json.dumps(r))
+        sys.stdout.flush()
+        results.append(r)
+
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump({r["name"]: r for r in results}, f, indent=1)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.threshold):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,54 @@
+/*
+ * stream style bandwidth kernels on integer arrays larger than the
+ * level 2 cache,then block copies with memcpy.
+ */
+#include "bench.h"
+
+#define ARRAY_SIZE (64*1024) //512K per array
+#define NTIMES 4
+#define COPY_SIZE (256*1024)
+
+static uint64_t a[ARRAY_SIZE];
+static uint64_t b[ARRAY_SIZE];
+static uint64_t c[ARRAY_SIZE];
+static uint8_t src[COPY_SIZE];
+static uint8_t dst[COPY_SIZE];
+
+int bench_main(void)
+{
+	uint64_t sum = 0;
+
+	for(int i = 0;i<ARRAY_SIZE;i++){
+		a[i] = i;
+		b[i] = 2;
+	}
+
+	for(int k = 0;k<NTIMES;k++){
+		for(int i = 0;i<ARRAY_SIZE;i++)//copy
+			c[i] = a[i];
+		for(int i = 0;i<ARRAY_SIZE;i++)//scale
+			b[i] = c[i] + (c[i] << 1);
+		for(int i = 0;i<ARRAY_SIZE;i++)//add
+			c[i] = a[i] + b[i];
+		for(int i = 0;i<ARRAY_SIZE;i++)//triad
+			a[i] = b[i] + c[i] + (c[i] << 1);
+	}
+	for(int i = 0;i<ARRAY_SIZE;i += 64){
+		sum += a[i] ^ b[i] ^ c[i];
+	}
+
+	for(int i = 0;i<COPY_SIZE;i++){
+		src[i] = i ^ (i >> 8);
+	}
+	for(int k = 0;k<NTIMES;k++){
+		memcpy(dst,src,COPY_SIZE);
+		memcpy(src + 8,dst,COPY_SIZE - 8);//aligned
+		memcpy(dst + 1,src,COPY_SIZE - 1);//byte copy
+	}
+	for(int i = 0;i<COPY_SIZE;i += 97){
+		sum = (sum << 1 | sum >> 63) ^ dst[i];
+	}
+
+	bench_result("stream",sum);
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BATCH_COMPARE_CHUNK (64*1024) //console output is compared in chunks
+
+/*
+ * batch mode,many short guest programs on a pool of worker threads.
+ * a manifest line is "image expected_output [max_instructions]",
+ * expected_output is - when only the exit is checked,# starts a comment.
+ * every worker creates one vm and resets it between the tests,
+ * the results are written as json lines while the tests finish.
+ */
+struct batch_test{
+	char *image;
+	char *expected;//NULL if not checked
+	uint64_t limit;//instructions,UINT64_MAX for none
+};
+
+enum batch_result{
+	BATCH_PASS,
+	BATCH_FAIL,//output differs
+	BATCH_TIMEOUT,//instruction limit reached
+	BATCH_ERROR,//load error or fatal error of the guest
+	NR_BATCH_RESULTS,
+};
+
+struct batch{
+	struct batch_test *tests;
+	uint32_t nr_tests;
+	uint32_t next;//next test to run,taken atomically
+
+	uint64_t ram_size;
+
+	FILE *out;
+	pthread_mutex_t out_lock;
+
+	uint32_t results[NR_BATCH_RESULTS];
+	uint64_t overhead_ns;//reset,load and comparison,summed over the tests
+};
+
+struct batch *alloc_batch(char *manifest,uint64_t ram_size,uint64_t limit);
+int run_batch(struct batch *batch,int jobs,FILE *out);
+void report_batch(struct batch *batch,int jobs,double seconds,FILE *f);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef __BPRED_H__
+#define __BPRED_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+//#define __BPRED_DEBUG__
+
+//log2 of the table entries
+#define BPRED_DEFAULT_BIMODAL_BITS 12
+#define BPRED_DEFAULT_GSHARE_BITS 12 //the global history is as long
+#define BPRED_DEFAULT_TAGE_BITS 10 //per tagged table,the base table has 2 more
+#define BPRED_DEFAULT_BTB_BITS 9
+#define BPRED_DEFAULT_RAS_DEPTH 16
+#define BPRED_MAX_BITS 24
+#define BPRED_MAX_RAS_DEPTH 64
+
+#define BPRED_TAGE_TABLES 4
+#define BPRED_TAGE_TAG_BITS 9
+#define BPRED_TAGE_U_RESET (256*1024) //useful bits are aged every so many updates
+
+#define BPRED_TOP_SITES 20
+
+enum bpred_kind{
+	BPRED_BIMODAL,
+	BPRED_GSHARE,
+	BPRED_TAGE,
+	BPRED_BTB,//targets of taken branches,jumps and indirect jumps
+	BPRED_RAS,//targets of returns
+	NR_BPRED_KINDS,
+};
+
+struct tage_entry{
+	int8_t ctr;//-4..3,taken if >= 0
+	uint8_t u;//0..3
+	uint16_t tag;
+};
+
+struct btb_entry{
+	uint64_t pc;
+	uint64_t target;
+};
+
+//a static control transfer instruction
+struct bpred_site{
+	uint64_t pc;
+	char type;//b branch,j jump,c call,r return,i indirect jump
+	uint64_t execs;
+	uint64_t taken;
+	uint64_t misses[NR_BPRED_KINDS];
+};
+
+/*
+ * branch prediction unit model,every predictor sees every control
+ * transfer so they are compared on the same run.
+ * conditional branches go to the direction predictors,taken transfers
+ * look up their target in the btb,returns pop the ras.calls and returns
+ * follow the jal/jalr rd/rs1 link register(x1,x5) hints of the isa.
+ * the predictors do not change the execution or the timing model.
+ */
+struct bpred{
+	int bimodal_bits;
+	int gshare_bits;
+	int tage_bits;
+	int btb_bits;
+	int ras_depth;
+
+	uint64_t history;//global history,1 for taken,newest in bit 0
+
+	uint8_t *bimodal;//2 bit counters
+	uint8_t *gshare;
+	uint8_t *tage_base;
+	struct tage_entry *tage[BPRED_TAGE_TABLES];
+	uint64_t tage_updates;
+
+	struct btb_entry *btb;
+
+	uint64_t *ras;//circular,overflow drops the oldest
+	int ras_top;
+	int ras_count;
+
+	uint64_t predictions[NR_BPRED_KINDS];
+	uint64_t misses[NR_BPRED_KINDS];
+	uint64_t start_instret;
+
+	struct bpred_site *sites;//hash table by pc
+	uint64_t nr_sites;
+	uint64_t table_size;
+};
+
+struct bpred *start_bpred(struct cpu *cpu,int bimodal_bits,int gshare_bits,int tage_bits,int btb_bits,int ras_depth);
+void bpred_update(struct cpu *cpu,uint64_t pc,uint64_t next_pc);
+void bpred_native_return(struct cpu *cpu);
+void free_bpred(struct bpred *bpred);
+void report_bpred(struct bpred *bpred,uint64_t instret,FILE *f);
+
+#endif
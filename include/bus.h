@@ -3,13 +3,42 @@
 
 #include "device.h"
 
+/*
+ * device lookup is a radix tree indexed by page number.
+ * a leaf is the device owning the whole page,or BUS_MIXED_PAGE when
+ * the page is shared,then the sorted region map is searched.
+ */
+#define BUS_PAGE_SHIFT 12
+#define BUS_LEVEL_BITS 13
+#define BUS_LEVELS 4  //4*13+12 = 64 bits
+#define BUS_LEVEL_SIZE (1UL<<BUS_LEVEL_BITS)
+
+#define BUS_MIXED_PAGE ((struct device *)1)
+
 struct bus{
 	int nr_devices;
-	struct device *devices;
+	struct device *devices;//sorted by start address
+	struct device **regions;//the same devices in an array,for binary search
+
+	uint64_t low_addr;//no device below this address,ram fast path
+	void **page_table;
+
+	uint64_t irq_pending;//one bit per interrupt line,updated atomically
+	int poll_request;
+
+	//set by alloc_cpu(),for devices accessing guest memory
+	struct ram *ram;
+	struct cpu *cpu;
 };
 
 struct bus* alloc_bus();
+void free_bus(struct bus *bus);
 void add_device(struct bus *bus,struct device *dev);
 struct device* find_device(struct bus *bus,uint64_t addr);
+void sync_devices(struct bus *bus);
+void reset_devices(struct bus *bus);
+void bus_set_irq(struct bus *bus,int irq,int level);
+void bus_request_poll(struct bus *bus);
+void poll_devices(struct bus *bus);
 
 #endif
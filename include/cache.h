@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+struct ram;
+struct cpu;
+
 //#define __CACHE_DEBUG_INFO__
 //#define __CACHE_DEBUG_LRU__
 
@@ -38,6 +41,7 @@ struct cache {
 	struct cache *next_level;
 	struct cache *next;//cache list
 	struct cache_entry *entrys;
+	uint64_t *used_sets;//one bit per set that has held a line,see invalid_all_caches()
 
 	uint64_t entrys_count;
 	uint64_t size;
@@ -55,6 +59,23 @@ struct cache {
 
 	struct ram *ram;
 	struct cpu *cpu;
+
+	//line lookups,a level 2 access is a level 1 miss
+	uint64_t hits;
+	uint64_t misses;
+};
+
+//read-modify-write operations of the A extension
+enum amo_op{
+	AMO_SWAP,
+	AMO_ADD,
+	AMO_XOR,
+	AMO_AND,
+	AMO_OR,
+	AMO_MIN,
+	AMO_MAX,
+	AMO_MINU,
+	AMO_MAXU,
 };
 
 struct cache_line_info {
@@ -63,7 +84,8 @@ struct cache_line_info {
 	struct cache *cache;
 };
 
-void print_caches(void);
+void print_caches(struct cpu *cpu);
+struct cache *get_caches(struct cpu *cpu);
 
 void put_byte_to_cache(struct cache *cache,uint64_t addr,uint8_t x);
 void put_word_to_cache(struct cache *cache,uint64_t addr,uint16_t x);
@@ -74,6 +96,22 @@ uint8_t get_byte_from_cache(struct cache *cache,uint64_t addr);
 uint16_t get_word_from_cache(struct cache *cache,uint64_t addr);
 uint32_t get_dword_from_cache(struct cache *cache,uint64_t addr);
 uint64_t get_qword_from_cache(struct cache *cache,uint64_t addr);
+
+uint64_t amo_to_cache(struct cache *cache,uint64_t addr,int size,enum amo_op op,uint64_t x);
+uint64_t load_reserved_from_cache(struct cache *cache,uint64_t addr,int size);
+int store_conditional_to_cache(struct cache *cache,uint64_t addr,int size,uint64_t x);
+
+void get_data_from_cache(struct cache *cache,uint64_t addr,uint8_t *pdata,uint64_t len);
+void put_data_to_cache(struct cache *cache,uint64_t addr,uint8_t *pdata,uint64_t len);
+void writeback_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len);
+void invalid_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len);
+void flush_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len);
+void flush_all_caches(struct cpu *cpu);
+void invalid_all_caches(struct cpu *cpu);
+
+int peek_qword_from_caches(struct cpu *cpu,uint64_t addr,uint64_t *x);
+
+void reload_cache_line(struct cache *cache,struct cache_entry *line);
 void init_cache(struct cache *cache,struct cpu *cpu,char *name,int level,struct ram *ram,struct cache *next);
 
 #endif
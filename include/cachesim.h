@@ -0,0 +1,83 @@
+#ifndef __CACHESIM_H__
+#define __CACHESIM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "cpu.h"
+#include "cache.h"
+
+//#define __CACHESIM_DEBUG__
+
+#define CACHESIM_RING_SIZE (64*1024) //accesses,a power of 2
+#define CACHESIM_MAX_CONSUMERS 64 //the level 1 sets,each consumer owns some of them
+#define CACHESIM_SPINS 1000 //polls before yielding the cpu
+
+enum cachesim_type{
+	CACHESIM_FETCH,
+	CACHESIM_LOAD,
+	CACHESIM_STORE,
+};
+
+//one cache line access
+struct cachesim_access{
+	uint64_t pc;
+	uint64_t addr;
+	uint8_t size;
+	uint8_t type;
+};
+
+//single producer single consumer ring,the indexes are free running
+struct cachesim_ring{
+	struct cachesim_access *buf;
+	uint64_t head __attribute__((aligned(64)));//consumer
+	uint64_t tail __attribute__((aligned(64)));//producer
+	uint64_t cached_head;//producer's copy of head,read again when the ring looks full
+	uint64_t full_waits;
+};
+
+//tags only copy of the caches of cache.c,same geometry,lru and coherency
+struct cachesim_line{
+	uint64_t tag;
+	uint64_t stamp;//last access,the smallest is the lru line
+	uint8_t state;//CACHE_LINE_COHERENCY_*
+};
+
+struct cachesim_cache{
+	struct cachesim_line *lines;
+	uint64_t sets;
+	uint64_t ways;
+	int idx_bits;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+struct cachesim_consumer{
+	struct cachesim_ring ring;
+	struct cachesim_cache caches[3];//icache,dcache,cache
+	uint64_t clock;
+	uint64_t accesses;
+	int stop;
+	pthread_t thread;
+};
+
+/*
+ * decoupled cache statistics.
+ * the cpu runs functionally on ram and pushes every cache line access
+ * into a lock free ring,consumer threads run the cache model.
+ * the cache lines are split among the consumers by set,every cache
+ * level is indexed by the same low line address bits,so each consumer
+ * sees all the accesses of its sets in order and the counts are exact.
+ * device accesses and cache maintenance are not modelled.
+ */
+struct cachesim{
+	int nr_consumers;
+	struct cachesim_consumer *consumers;
+};
+
+struct cachesim *start_cachesim(struct cpu *cpu,int nr_consumers);
+void cachesim_access(struct cpu *cpu,uint64_t addr,int size,enum cachesim_type type);
+void stop_cachesim(struct cpu *cpu);
+void report_cachesim(struct cachesim *sim,FILE *f);
+
+#endif
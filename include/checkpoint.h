@@ -0,0 +1,105 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+#include "cpu.h"
+#include "bus.h"
+#include "ram.h"
+
+//#define __CHECKPOINT_DEBUG__
+
+#define CHECKPOINT_MAGIC "RVEMUCKP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_RECORD_MAGIC 0x54504b43 //"CKPT"
+
+#define CHECKPOINT_LAST_SEQ UINT32_MAX
+
+/*
+ * a checkpoint file is a file header followed by a chain of records.
+ * every record holds the full machine state,the pages written since the
+ * previous record and a page table.identical pages are stored once and
+ * shared by offset,offset 0 means a zero page.
+ */
+struct checkpoint_file_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t ram_size;
+};
+
+struct checkpoint_record_header{
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t instret;
+	uint64_t prev_offset;//previous record in the chain,0 for the first one
+	uint64_t record_size;
+	uint64_t nr_pages;
+	uint64_t page_table_offset;
+};
+
+struct checkpoint_page_entry{
+	uint64_t page;
+	uint64_t data_offset;
+};
+
+struct checkpoint_hash_entry{
+	uint64_t hash;
+	uint64_t data_offset;
+};
+
+struct checkpoint{
+	int fd;
+	char *filename;
+	struct ram *ram;
+
+	uint32_t seq;
+	uint64_t last_record_offset;
+
+	//content hash of every stored page,used to share identical pages
+	struct checkpoint_hash_entry *hash_table;
+	uint64_t hash_table_size;
+	uint64_t hash_table_used;
+
+	uint64_t *page_offsets;//latest stored data of each ram page
+};
+
+struct checkpoint_record_index{
+	uint32_t seq;
+	uint64_t state_offset;
+	uint64_t nr_pages;
+	struct checkpoint_page_entry *entrys;
+};
+
+#define CHECKPOINT_NO_RECORD UINT32_MAX
+
+/*
+ * a checkpoint file opened for restoring,the records are indexed once.
+ * it remembers the record loaded into a ram,a later restore into the same
+ * ram only reads the pages written since or changed by the records.
+ * a reader is used by one thread at a time.
+ */
+struct checkpoint_reader{
+	int fd;
+	char *filename;
+	uint64_t ram_size;
+
+	struct checkpoint_record_index *records;
+	uint32_t nr_records;
+
+	struct ram *ram;
+	uint32_t loaded;//record in ram,CHECKPOINT_NO_RECORD if none
+	uint64_t *page_offsets;//stored data of each page in that record,0 for a zero page
+};
+
+struct checkpoint *create_checkpoint(char *filename,struct ram *ram);
+void write_checkpoint(struct checkpoint *ckpt,struct cpu *cpu);
+void close_checkpoint(struct checkpoint *ckpt);
+
+struct cpu *restore_checkpoint(struct bus *bus,char *filename,uint32_t seq);
+
+struct checkpoint_reader *open_checkpoint_reader(char *filename);
+void close_checkpoint_reader(struct checkpoint_reader *reader);
+struct cpu *reader_restore_checkpoint(struct checkpoint_reader *reader,struct bus *bus,uint32_t seq);
+void reload_checkpoint(struct checkpoint_reader *reader,struct cpu *cpu,uint32_t seq);
+
+#endif
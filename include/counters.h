@@ -0,0 +1,59 @@
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define COUNTERS_BLOCK_MAX_LEN 64
+#define COUNTERS_TOP_BLOCKS 20
+
+//opcode | funct3<<7 | bit 30<<10,fields that are immediates are cleared
+#define COUNTERS_NR_KEYS 4096
+
+enum inst_class{
+	INST_CLASS_ALU,
+	INST_CLASS_LOAD,
+	INST_CLASS_STORE,
+	INST_CLASS_ATOMIC,
+	INST_CLASS_VECTOR,
+	INST_CLASS_BRANCH_TAKEN,
+	INST_CLASS_BRANCH_NOT_TAKEN,
+	INST_CLASS_JUMP,
+	INST_CLASS_CSR,
+	INST_CLASS_FENCE,
+	INST_CLASS_SYSTEM,
+	INST_CLASS_OTHER,
+	NR_INST_CLASSES,
+};
+
+/*
+ * a basic block ends at a branch,jump or system instruction.
+ * its instructions are decoded once,execution only counts blocks.
+ */
+struct block_counter{
+	uint64_t pc;
+	uint64_t execs;
+	uint64_t taken;//the last instruction is a taken branch
+	uint32_t len;
+	uint16_t keys[COUNTERS_BLOCK_MAX_LEN];
+};
+
+struct counters{
+	struct block_counter *blocks;//hash table by pc
+	uint64_t nr_blocks;
+	uint64_t table_size;
+
+	struct block_counter *cur;
+	uint64_t block_left;//instructions left in cur
+
+	//instructions of blocks left early,by an interrupt
+	uint64_t loose_keys[COUNTERS_NR_KEYS];
+};
+
+struct counters *start_counters(struct cpu *cpu);
+void counters_end_block(struct cpu *cpu);
+void counters_break_block(struct cpu *cpu);
+void dump_counters(struct counters *counters,FILE *f);
+
+#endif
@@ -3,13 +3,46 @@
 
 #include <stdint.h>
 #include "cache.h"
+#include "pmu.h"
+#include "vector.h"
 
-#define __CPU_EXEC_INST_DEBUG__
+struct user;
+struct profiler;
+struct counters;
+struct timing;
+struct bpred;
+struct cachesim;
+struct libcalls;
+
+#define __CPU_EXEC_INST_DEBUG__ //print the instructions when not quiet,see cpu_exec.h
+
+#define CSR_MSTATUS 0x300
+#define CSR_MIE     0x304
+#define CSR_MTVEC   0x305
+#define CSR_MEPC    0x341
+#define CSR_MCAUSE  0x342
+#define CSR_MTVAL   0x343
+#define CSR_MIP     0x344
+
+#define MSTATUS_MIE  (1UL<<3)
+#define MSTATUS_MPIE (1UL<<7)
+#define MSTATUS_MPP  (3UL<<11)
+
+#define MIP_MEIP (1UL<<11)
+
+#define CAUSE_INTERRUPT (1UL<<63)
+#define CAUSE_MACHINE_EXTERNAL_INTERRUPT 11
+#define CAUSE_ILLEGAL_INSTRUCTION 2
+#define CAUSE_LOAD_ADDRESS_MISALIGNED 4
+#define CAUSE_STORE_ADDRESS_MISALIGNED 6
+
+#define RESERVATION_NONE UINT64_MAX
 
 struct cpu {
 	uint64_t regfile[32];
 	uint64_t pc;
 	uint64_t csrs[4096];
+	uint8_t vregs[32][VLENB] __attribute__((aligned(32)));//v0-v31,see vector.h
 
 	union inst {
 		struct  {
@@ -70,11 +103,39 @@ struct cpu {
 	struct cache icache;// 1-level instruction cache
 	struct cache dcache;// 1-level data cache
 	struct cache cache;//2-level cache
+	struct cache *caches;//all caches above,for coherency
 
 	struct bus *bus;
+	struct ram *ram;
+
+	uint64_t instret;//executed instructions
+
+	uint64_t reservation;//address of the last lr,RESERVATION_NONE when there is none
+	uint64_t reserved_value;//loaded by the lr
+
+	struct user *user;//linux syscalls are handled by the host,NULL for bare metal
+	int halted;//stopped by the guest,e.g. exit() in user mode
+
+	struct profiler *profiler;
+	uint64_t sample_at;//instret of the next profiler sample,UINT64_MAX when off
+
+	struct counters *counters;//instruction mix,NULL when off
+	struct timing *timing;//pipeline timing model,NULL when off
+	struct bpred *bpred;//branch predictors,NULL when off
+	struct cachesim *cachesim;//cache statistics on other threads,NULL when off
+	struct libcalls *libcalls;//libc routines run by the host,NULL when off
+
+	uint32_t pmu_counters[NR_PMU_EVENTS];//hpmcounters counting each event,see pmu.h
+
+	int functional;//memory accesses bypass the caches,see sampling.h
+	int quiet;//no messages,e.g. when an interval is replayed
 };
 
 void dump_registers(struct cpu *cpu);
+int bitmanip_inst(uint32_t inst);
+int cpu_run_for(struct cpu *cpu,uint64_t count);
 void cpu_run(struct cpu *cpu);
 struct cpu* alloc_cpu(struct ram *ram,struct bus *bus);
+void reset_cpu(struct cpu *cpu);
+void free_cpu(struct cpu *cpu);
 #endif
@@ -0,0 +1,234 @@
+/*
+ * the run loop of cpu_run_for(),included by cpu.c once for each executor.
+ * EXEC_NAME names the loop,EXEC_FLAGS are the features compiled into it:
+ * EXEC_CACHES  memory is accessed through cache.c,otherwise ram is accessed directly
+ * EXEC_STATS   timing,counters,profiler,branch predictors and pmu branch events
+ * EXEC_TRACE   every instruction is printed
+ * a feature left out costs nothing,see exec_flags() in cpu.c.
+ * the instructions are generated from isa.def.
+ */
+
+#if EXEC_FLAGS & EXEC_CACHES
+#define FETCH(addr)        get_dword_from_cache(&cpu->icache,addr)
+#define LOAD(size,addr)    cached_load(cpu,addr,size)
+#define STORE(size,addr,x) cached_store(cpu,addr,size,x)
+#else
+#define FETCH(addr)        direct_fetch(cpu,addr)
+#define LOAD(size,addr)    direct_load(cpu,addr,size)
+#define STORE(size,addr,x) direct_store(cpu,addr,size,x)
+#endif
+
+#if EXEC_FLAGS & EXEC_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
+
+#if EXEC_FLAGS & EXEC_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...)
+#endif
+
+#define X1 get_register(cpu,rs1)
+#define X2 get_register(cpu,rs2)
+#define SET_RD(x) set_register(cpu,rd,x)
+#define DONE goto done
+#define ILLEGAL {illegal_instruction(cpu);goto done;}
+
+//the immediate of each format,sign extended
+#define IMM_R    0
+#define IMM_I    ((int64_t)((int32_t)inst >> 20))
+#define IMM_IU   ((int64_t)(inst >> 20))
+#define IMM_SH   IMM_I
+#define IMM_L    IMM_I
+#define IMM_JR   IMM_I
+#define IMM_S    ((int64_t)((int32_t)(inst & 0xFE000000) >> 20) | (inst >> 7 & 0x1F))
+#define IMM_B    ((int64_t)((int32_t)(inst & 0x80000000) >> 19) | (inst << 4 & 0x800) | (inst >> 20 & 0x7E0) | (inst >> 7 & 0x1E))
+#define IMM_U    ((int64_t)((int32_t)inst >> 12))
+#define IMM_J    ((int64_t)((int32_t)(inst & 0x80000000) >> 11) | (inst & 0xFF000) | (inst >> 9 & 0x800) | (inst >> 20 & 0x7FE))
+#define IMM_CSR  0
+#define IMM_CSRI 0
+#define IMM_A    0
+#define IMM_N    0
+#define IMM_V    0
+#define IMM_X    0
+
+#define TRACE_R(name)    TRACE("%s\tx%d,x%d,x%d\n",name,rd,rs1,rs2)
+#define TRACE_I(name)    TRACE("%s\tx%d,x%d,%ld\n",name,rd,rs1,imm)
+#define TRACE_IU(name)   TRACE("%s\tx%d,x%d,%lu\n",name,rd,rs1,(uint64_t)imm)
+#define TRACE_SH(name)   TRACE("%s\tx%d,x%d,%ld\n",name,rd,rs1,imm & 0x3F)
+#define TRACE_L(name)    TRACE("%s\tx%d,%ld(x%d)\n",name,rd,imm,rs1)
+#define TRACE_JR(name)   TRACE_L(name)
+#define TRACE_S(name)    TRACE("%s\tx%d,%ld(x%d)\n",name,rs2,imm,rs1)
+#define TRACE_B(name)    TRACE("%s\tx%d,x%d,%ld\n",name,rs1,rs2,imm)
+#define TRACE_U(name)    TRACE("%s\tx%d,%ld\n",name,rd,imm)
+#define TRACE_J(name)    TRACE_U(name)
+#define TRACE_CSR(name)  TRACE("%s\tx%d,0x%lx,x%d\n",name,rd,csr,rs1)
+#define TRACE_CSRI(name) TRACE("%s\tx%d,0x%lx,%d\n",name,rd,csr,rs1)
+#define TRACE_A(name)    TRACE("%s\tx%d,x%d,(x%d)\n",name,rd,rs2,rs1)
+#define TRACE_N(name)    TRACE("%s\n",name)
+#define TRACE_V(name)    TRACE("%s\t0x%08x\n",name,inst)
+#define TRACE_X(name)
+
+//a call or tail call may enter a routine done by the host,see libcall.h.the predictor has seen the jump to it
+#define LIBCALL    if(cpu->libcalls && rd <= 1) libcall(cpu,pc);
+
+//after the instruction,a csr may turn a feature on or off,e.g. a pmu event
+#define AFTER_B    STATS(if(cpu->pmu_counters[PMU_EVENT_BRANCH]) pmu_count(cpu,PMU_EVENT_BRANCH); \
+		if(cpu->pmu_counters[PMU_EVENT_BRANCH_TAKEN] && cpu->pc != pc + 4) pmu_count(cpu,PMU_EVENT_BRANCH_TAKEN); \
+		if(cpu->bpred) bpred_update(cpu,pc,cpu->pc);)
+#define AFTER_J    STATS(if(cpu->bpred) bpred_update(cpu,pc,cpu->pc);) LIBCALL
+#define AFTER_JR   AFTER_J
+#define AFTER_CSR  reselect = exec_flags(cpu) != (EXEC_FLAGS);
+#define AFTER_CSRI AFTER_CSR
+#define AFTER_R
+#define AFTER_I
+#define AFTER_IU
+#define AFTER_SH
+#define AFTER_L
+#define AFTER_S
+#define AFTER_U
+#define AFTER_A
+#define AFTER_N
+#define AFTER_V
+#define AFTER_X
+
+/*
+ * execute at most *count instructions,*count is left with the rest.
+ * return 1 when the guest has returned to pc 0 or halted,
+ * 0 when the count is done or an other executor has to run.
+ */
+static int EXEC_NAME(struct cpu *cpu,uint64_t *count)
+{
+	uint64_t n = *count;
+	uint64_t pc,csr;
+	uint32_t inst;
+	int rd,rs1,rs2;
+	int reselect = 0;
+
+	while(n){
+		n--;
+		pc = cpu->pc;
+		inst = FETCH(pc);
+		cpu->inst.instruction = inst;
+		cpu->pc = pc + 4;
+		STATS(if(cpu->timing) timing_fetched(cpu);)
+
+		rd = inst >> 7 & 0x1F;
+		rs1 = inst >> 15 & 0x1F;
+		rs2 = inst >> 20 & 0x1F;
+		csr = inst >> 20;
+		switch(decode_inst(inst)){
+#define INST(id,name,mask,match,format,...) \
+		case INST_##id:{ \
+			const int64_t imm = IMM_##format; \
+			(void)imm; \
+			__VA_ARGS__ \
+			TRACE_##format(name); \
+			AFTER_##format \
+		}break;
+#include "isa.def"
+#undef INST
+		default:
+			unknown_instruction(cpu);
+			break;
+		}
+done:
+		cpu->instret++;
+		STATS(
+			if(cpu->timing) timing_executed(cpu);
+			if(cpu->counters && --cpu->counters->block_left == 0){
+				counters_end_block(cpu);
+			}
+		)
+		if(cpu->halted){
+			sync_devices(cpu->bus);
+			*count = n;
+			return 1;
+		}
+		if(cpu->pc == 0){
+			sync_devices(cpu->bus);
+			if(!cpu->quiet) printf("All instructions have been executed\n");
+			*count = n;
+			return 1;
+		}
+		STATS(
+			if(cpu->instret >= __atomic_load_n(&cpu->sample_at,__ATOMIC_RELAXED)){
+				profiler_sample(cpu);
+			}
+		)
+		if(cpu->bus->poll_request){
+			poll_devices(cpu->bus);
+		}
+		if(cpu->bus->irq_pending || (cpu->csrs[CSR_MIP] & MIP_MEIP)){
+			cpu_check_interrupts(cpu);
+		}
+		if(reselect) break;
+	}
+
+	*count = n;
+	return 0;
+}
+
+#undef FETCH
+#undef LOAD
+#undef STORE
+#undef STATS
+#undef TRACE
+#undef X1
+#undef X2
+#undef SET_RD
+#undef DONE
+#undef ILLEGAL
+#undef IMM_R
+#undef IMM_I
+#undef IMM_IU
+#undef IMM_SH
+#undef IMM_L
+#undef IMM_JR
+#undef IMM_S
+#undef IMM_B
+#undef IMM_U
+#undef IMM_J
+#undef IMM_CSR
+#undef IMM_CSRI
+#undef IMM_A
+#undef IMM_N
+#undef IMM_V
+#undef IMM_X
+#undef TRACE_R
+#undef TRACE_I
+#undef TRACE_IU
+#undef TRACE_SH
+#undef TRACE_L
+#undef TRACE_JR
+#undef TRACE_S
+#undef TRACE_B
+#undef TRACE_U
+#undef TRACE_J
+#undef TRACE_CSR
+#undef TRACE_CSRI
+#undef TRACE_A
+#undef TRACE_N
+#undef TRACE_V
+#undef TRACE_X
+#undef LIBCALL
+#undef AFTER_B
+#undef AFTER_J
+#undef AFTER_JR
+#undef AFTER_CSR
+#undef AFTER_CSRI
+#undef AFTER_R
+#undef AFTER_I
+#undef AFTER_IU
+#undef AFTER_SH
+#undef AFTER_L
+#undef AFTER_S
+#undef AFTER_U
+#undef AFTER_A
+#undef AFTER_N
+#undef AFTER_V
+#undef AFTER_X
+#undef EXEC_NAME
+#undef EXEC_FLAGS
@@ -3,17 +3,73 @@
 
 #include <stdint.h>
 
+//reads have no side effect,so the region may be held in the caches
+#define DEVICE_FLAG_CACHEABLE 0x1
+
 struct device;
+struct bus;
 
 typedef uint8_t (*device_read_byte_func)(struct device *dev,uint64_t addr);
 typedef void (*device_write_byte_func)(struct device *dev,uint64_t addr,uint8_t data);
 
+//size is 1,2,4 or 8 bytes
+typedef uint64_t (*device_read_func)(struct device *dev,uint64_t addr,int size);
+typedef void (*device_write_func)(struct device *dev,uint64_t addr,int size,uint64_t data);
+
+typedef void (*device_read_block_func)(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len);
+typedef void (*device_write_block_func)(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len);
+
+//finish host side work on the cpu thread,requested with bus_request_poll()
+typedef void (*device_poll_func)(struct device *dev);
+
+//wait until the host side work of the device is done
+typedef void (*device_sync_func)(struct device *dev);
+
+//snapshot support,the state is saved to/restored from fd at its current offset
+typedef void (*device_save_func)(struct device *dev,int fd);
+typedef void (*device_restore_func)(struct device *dev,int fd,uint64_t size);
+
+//stop the host threads of the device and free it
+typedef void (*device_free_func)(struct device *dev);
+
+//back to the power on state,pending host side work is dropped or finished
+typedef void (*device_reset_func)(struct device *dev);
+
+/*
+ * a device implements the byte callbacks,the sized callbacks or both.
+ * the block callbacks are optional,accesses are split when they are missing.
+ */
 struct device{
 	struct device *next;
+	const char *name;//shown in traces
 	uint64_t start_addr,end_addr;
+	uint32_t flags;
+
+	struct bus *bus;//set by add_device()
+	int irq;//interrupt line,-1 if none
 
 	device_read_byte_func  read_byte_func;
 	device_write_byte_func write_byte_func;
+
+	device_read_func  read_func;
+	device_write_func write_func;
+
+	device_read_block_func  read_block_func;
+	device_write_block_func write_block_func;
+
+	device_poll_func    poll_func;
+	device_sync_func    sync_func;
+	device_save_func    save_func;
+	device_restore_func restore_func;
+	device_free_func    free_func;
+	device_reset_func   reset_func;
 };
 
+int device_readable(struct device *dev);
+int device_writable(struct device *dev);
+uint64_t device_read(struct device *dev,uint64_t addr,int size);
+void device_write(struct device *dev,uint64_t addr,int size,uint64_t data);
+void device_read_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len);
+void device_write_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len);
+
 #endif
@@ -4,14 +4,64 @@
 #define DISPLAY_START_PHY_ADDR 0xFFFFFFFFFFFF1000
 #define DISPLAY_END_PHY_ADDR   0xFFFFFFFFFFFFFFFF
 
-#define DISPLAY_CHAR_PHY_ADDR 0xFFFFFFFFFFFF1000
+/*
+ * uart style console
+ * DATA:       write queues a byte for output,read takes an input byte
+ * STATUS:     DISPLAY_STATUS_* bits
+ * IRQ_ENABLE: DISPLAY_IRQ_* bits,the irq line is raised while an enabled condition holds
+ */
+#define DISPLAY_CHAR_PHY_ADDR       0xFFFFFFFFFFFF1000
+#define DISPLAY_STATUS_PHY_ADDR     0xFFFFFFFFFFFF1008
+#define DISPLAY_IRQ_ENABLE_PHY_ADDR 0xFFFFFFFFFFFF1010
 
+#define DISPLAY_STATUS_RX_READY (1<<0)
+#define DISPLAY_STATUS_TX_EMPTY (1<<1)
+
+#define DISPLAY_IRQ_RX (1<<0)
+
+#define DISPLAY_IRQ 1
+
+#define DISPLAY_TX_FIFO_SIZE (64*1024)
+#define DISPLAY_RX_FIFO_SIZE 4096
+#define DISPLAY_FLUSH_TIMEOUT_MS 10
+
+#include <stdint.h>
+#include <pthread.h>
 #include "device.h"
 
+//single producer single consumer ring
+struct display_fifo{
+	uint8_t *buf;
+	uint64_t size;
+	uint64_t head;//consumer
+	uint64_t tail;//producer
+};
+
 struct display{
 	struct device dev;
+
+	//tx,the cpu produces and the writer thread drains in batches
+	struct display_fifo tx;
+	int out_fd;
+	int stdio;//out_fd is stdout,written through stdio in order with the messages of the emulator
+	int flush_request;
+	int stop;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t tx_cond;
+	pthread_cond_t drained_cond;
+
+	//rx,the reader thread produces and the cpu consumes
+	struct display_fifo rx;
+	int in_fd;
+	pthread_t reader;
+
+	uint32_t irq_enable;
+
+	struct display *next;//for flushing at exit
 };
 
-struct device * alloc_display();
+//out_fd receives the console output,in_fd feeds the input,-1 if none
+struct device * alloc_display(int out_fd,int in_fd);
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef __DMA_H__
+#define __DMA_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "device.h"
+
+//#define __DMA_DEBUG__
+
+#define DMA_START_PHY_ADDR 0x10002000
+#define DMA_END_PHY_ADDR   0x10003000
+#define DMA_IRQ 3
+
+#define DMA_RING_SIZE_MAX 4096 //descriptors,a power of 2
+
+//registers,64 bits wide
+#define DMA_RING_BASE  0x00
+#define DMA_RING_SIZE  0x08
+#define DMA_HEAD       0x10 //written by the driver,next free descriptor
+#define DMA_TAIL       0x18 //descriptors before it are done
+#define DMA_STATUS     0x20
+#define DMA_IRQ_ENABLE 0x28
+#define DMA_IRQ_STATUS 0x30 //write 1 to clear
+#define DMA_CTRL       0x38
+
+#define DMA_STATUS_BUSY  0x1
+#define DMA_STATUS_ERROR 0x2
+
+#define DMA_IRQ_DONE  0x1
+#define DMA_IRQ_ERROR 0x2
+
+#define DMA_CTRL_RESET 0x1
+
+//descriptor flags
+#define DMA_DESC_IRQ       0x1 //raise DMA_IRQ_DONE when this descriptor is done
+#define DMA_DESC_SRC_FIXED 0x2 //device fifo,read every byte from src
+#define DMA_DESC_DST_FIXED 0x4 //device fifo,write every byte to dst
+
+//descriptor status,written by the device
+#define DMA_DESC_PENDING 0x0
+#define DMA_DESC_DONE    0x1
+#define DMA_DESC_ERROR   0x2
+
+struct dma_desc{
+	uint64_t src;
+	uint64_t dst;
+	uint64_t len;
+	uint32_t flags;
+	uint32_t status;
+};
+
+struct dma_xfer{
+	uint64_t desc_addr;
+	uint64_t src,dst,len;
+	uint32_t flags;
+	uint32_t status;
+
+	//host pointers when the range is in ram,NULL for a device
+	uint8_t *src_ptr;
+	uint8_t *dst_ptr;
+};
+
+/*
+ * ram to ram copies run on the worker thread,transfers touching a
+ * device are handed back to the cpu thread.counters are free running,
+ * ring index = counter % ring_size.
+ */
+struct dma{
+	struct device dev;
+
+	uint64_t ring_base;
+	uint32_t ring_size;
+	uint32_t irq_enable;
+	uint32_t irq_status;
+	uint32_t status;
+
+	struct dma_xfer *xfers;
+	uint32_t submitted;//parsed on the doorbell
+	uint32_t completed;//done by the worker
+	uint32_t published;//visible to the guest through DMA_TAIL
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int device_wait;//worker waits for the cpu thread
+	int stop;
+	pthread_t worker;
+};
+
+struct device *alloc_dma();
+
+#endif
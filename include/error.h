@@ -0,0 +1,27 @@
+#ifndef __ERROR_H__
+#define __ERROR_H__
+
+#include <setjmp.h>
+
+#define ERROR_MSG_SIZE 256
+
+/*
+ * fatal errors of the machine.
+ * without a handler the message is printed and the process exits.
+ * a library call installs a handler on its thread,fatal() then jumps
+ * back to it with the message so the error becomes a return code.
+ * it is only called on the cpu thread with no device lock held,
+ * threads of the devices have no handler and never call it,a failed
+ * transfer or request is reported to the guest by the device instead.
+ */
+struct error_handler{
+	jmp_buf env;
+	char msg[ERROR_MSG_SIZE];
+};
+
+void fatal(const char *fmt,...) __attribute__((noreturn,format(printf,1,2)));
+struct error_handler *set_error_handler(struct error_handler *handler);
+//called before the message is printed when there is no handler,e.g. to write out the console
+void set_fatal_hook(void (*hook)(void));
+
+#endif
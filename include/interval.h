@@ -0,0 +1,42 @@
+#ifndef __INTERVAL_H__
+#define __INTERVAL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "bus.h"
+#include "sampling.h"
+
+//#define __INTERVAL_DEBUG__
+
+/*
+ * parallel interval simulation.
+ * the guest first runs functionally,writing a checkpoint every interval
+ * instructions.then every interval is simulated with the caches by a pool
+ * of threads,each one owns a machine and restores the checkpoints into it.
+ * the caches are warmed with the last warm instructions of the previous
+ * interval,which are reached functionally from its checkpoint.
+ */
+struct interval_sim{
+	char *filename;//checkpoint file,record i is taken at base + i*interval
+	uint64_t base;
+	uint64_t interval;
+	uint64_t warm;
+	uint64_t total;//instret at the end of the functional run
+	uint32_t nr_intervals;
+
+	uint32_t next;//next interval to simulate,taken atomically
+	uint64_t *insns;
+	struct cache_counts *counts;//counts of each interval,without the warm up
+};
+
+//every worker gets a bus of its own,with the devices the checkpoints hold,freed when it is done
+typedef struct bus *(*alloc_interval_bus_func)(void);
+
+struct interval_sim *alloc_interval_sim(char *filename,uint64_t base,uint64_t interval,uint64_t warm,uint64_t total);
+void free_interval_sim(struct interval_sim *sim);
+void simulate_intervals(struct interval_sim *sim,int jobs,alloc_interval_bus_func alloc_bus_func);
+void merge_intervals(struct interval_sim *sim,struct cpu *cpu);
+void report_intervals(struct interval_sim *sim,FILE *f);
+
+#endif
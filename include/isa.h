@@ -0,0 +1,47 @@
+#ifndef __ISA_H__
+#define __ISA_H__
+
+#include <stdint.h>
+
+//#define __ISA_DEBUG__
+
+//one id for each line of isa.def
+enum inst_id{
+	INST_NONE,
+#define INST(id,name,mask,match,format,...) INST_##id,
+#include "isa.def"
+#undef INST
+	NR_INSTS,
+};
+
+struct inst_desc{
+	const char *name;
+	uint32_t mask;
+	uint32_t match;
+};
+
+/*
+ * the instructions that may match an opcode and funct3,
+ * in the order of isa.def,see decode_inst() in cpu.c.
+ */
+struct decode_entry{
+	uint32_t mask;
+	uint32_t match;
+	uint32_t id;
+};
+
+struct decode_bucket{
+	uint16_t first;
+	uint16_t nr;
+};
+
+#define DECODE_NR_BUCKETS 256
+#define DECODE_BUCKET(inst) (((inst) >> 2 & 0x1F) | ((inst) >> 7 & 0xE0))//opcode[6:2] and funct3
+
+extern const struct inst_desc inst_descs[NR_INSTS];
+extern struct decode_bucket decode_buckets[DECODE_NR_BUCKETS];
+extern struct decode_entry decode_entries[];
+
+void init_isa(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __LIBCALL_H__
+#define __LIBCALL_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct cpu;
+
+//#define __LIBCALL_DEBUG__
+
+#define LIBCALL_CHUNK_SIZE 4096 //bytes moved through the caches at once
+
+//guest routines run by the host
+enum libcall_func{
+	LIBCALL_MEMCPY,
+	LIBCALL_MEMMOVE,
+	LIBCALL_MEMSET,
+	LIBCALL_STRLEN,
+	LIBCALL_MEMCMP,
+	NR_LIBCALL_FUNCS,
+};
+
+/*
+ * the entries are found in the elf symbols.
+ * a call or tail call to an entry is done on ram and returns to ra,
+ * so the instructions of the routine are not counted.
+ * when a range is not all ram,e.g. a device,the guest runs the routine.
+ */
+struct libcalls{
+	uint64_t start[NR_LIBCALL_FUNCS];//0 when not found
+	uint64_t end[NR_LIBCALL_FUNCS];
+
+	uint64_t calls[NR_LIBCALL_FUNCS];//done natively
+	uint64_t bytes[NR_LIBCALL_FUNCS];
+	uint64_t fallbacks[NR_LIBCALL_FUNCS];//left to the guest
+};
+
+struct libcalls *alloc_libcalls(char *elf_file);
+int libcall(struct cpu *cpu,uint64_t from);
+void report_libcalls(struct libcalls *lc,FILE *f);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stdint.h>
+#include "ram.h"
+
+//#define __LOADER_DEBUG__
+
+struct elf_image{
+	uint64_t entry;
+	uint64_t phdr;//address of the program headers in ram,0 if not loaded
+	uint64_t phent;
+	uint64_t phnum;
+	uint64_t end;//end of the highest segment
+	uint32_t flags;//e_flags,the abi and the c extension
+};
+
+struct elf_symbol{
+	uint64_t addr;
+	uint64_t size;
+	char *name;
+};
+
+//function symbols sorted by address
+struct elf_symtab{
+	struct elf_symbol *symbols;
+	uint64_t nr_symbols;
+};
+
+int is_elf_file(char *filename);
+void load_elf(struct ram *ram,char *filename,struct elf_image *image);
+struct elf_symtab *load_elf_symbols(char *filename);
+struct elf_symbol *find_elf_symbol(struct elf_symtab *symtab,uint64_t addr);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __PMU_H__
+#define __PMU_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct cpu;
+
+//#define __PMU_DEBUG__
+
+#define CSR_MCOUNTEREN    0x306
+#define CSR_MCOUNTINHIBIT 0x320
+#define CSR_MHPMEVENT3    0x323
+#define CSR_MCYCLE        0xB00
+#define CSR_MINSTRET      0xB02
+#define CSR_MHPMCOUNTER3  0xB03
+#define CSR_CYCLE         0xC00
+#define CSR_INSTRET       0xC02
+#define CSR_HPMCOUNTER3   0xC03
+
+#define MCOUNTEREN_CY (1UL<<0)
+#define MCOUNTEREN_IR (1UL<<2)
+
+#define PMU_FIRST_COUNTER 3
+#define PMU_NR_COUNTERS   29 //hpmcounter3..31
+
+/*
+ * events of mhpmevent3..31,0 counts nothing.
+ * the caches are only counted when they are simulated on the cpu thread,
+ * not while they are bypassed,see sampling.h and cachesim.h.
+ */
+enum pmu_event{
+	PMU_EVENT_NONE,
+	PMU_EVENT_L1I_MISS,
+	PMU_EVENT_L1D_MISS,
+	PMU_EVENT_L2_MISS,
+	PMU_EVENT_WRITEBACK,//modified lines written to ram
+	PMU_EVENT_INVALIDATION,//lines dropped to keep the caches coherent
+	PMU_EVENT_BRANCH,//conditional branches
+	PMU_EVENT_BRANCH_TAKEN,
+	NR_PMU_EVENTS,
+};
+
+int pmu_csr(uint64_t csr);
+uint64_t pmu_read_csr(struct cpu *cpu,uint64_t csr);
+void pmu_write_csr(struct cpu *cpu,uint64_t csr,uint64_t x);
+void pmu_update(struct cpu *cpu);
+void pmu_count(struct cpu *cpu,enum pmu_event event);
+
+int parse_pmu_events(char *list,uint8_t *events);
+void program_pmu(struct cpu *cpu,uint8_t *events,int n);
+void report_pmu(struct cpu *cpu,FILE *f);
+
+#endif
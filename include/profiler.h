@@ -0,0 +1,43 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "cpu.h"
+
+//#define __PROFILER_DEBUG__
+
+#define PROFILER_MAX_FRAMES 64
+#define PROFILER_DEFAULT_FOLDED_FILE "rvemu.folded"
+
+/*
+ * a sample is stored as [nr_frames,instructions,icache misses,dcache misses,
+ * cache misses,pc,return addresses...] in one growing buffer,counts are the
+ * deltas since the previous sample.symbolization is done at the end.
+ */
+#define PROFILER_SAMPLE_HEADER 5
+
+struct profiler{
+	struct cpu *cpu;
+	uint64_t period;//instructions between samples,0 when sampling on timer ticks
+	int hz;
+	char *folded_file;
+	char *elf_file;//symbols,NULL to report addresses
+
+	uint64_t *buf;
+	uint64_t buf_used;
+	uint64_t buf_size;
+	uint64_t nr_samples;
+
+	uint64_t last_instret;
+	uint64_t last_misses[3];
+
+	pthread_t timer;
+	int stop;
+};
+
+struct profiler *start_profiler(struct cpu *cpu,uint64_t period,int hz,char *folded_file,char *elf_file);
+void profiler_sample(struct cpu *cpu);
+void stop_profiler(struct profiler *prof);
+
+#endif
@@ -7,13 +7,31 @@
 
 #include <stdint.h>
 
+#define RAM_PAGE_SHIFT 12
+#define RAM_PAGE_SIZE (1UL<<RAM_PAGE_SHIFT)
+
 struct ram {
 	uint8_t *data;
 	uint64_t size;
+
+	//one bit per page,set when the page is written
+	uint64_t *dirty_bitmap;
+	uint64_t nr_pages;
+
+	int mapped;//data is mapped from a file
 };
 
 void load_data_from_file(struct ram*ram,uint64_t addr,char *filename);
 void write_to_ram(struct ram*ram,uint64_t addr,uint64_t size,uint8_t *data);
 void read_from_ram(struct ram*ram,uint64_t addr,uint64_t size,uint8_t *data);
 struct ram *alloc_ram(uint64_t size);
+struct ram *map_ram_from_file(int fd,uint64_t offset,uint64_t size);
+void free_ram(struct ram *ram);
+
+uint8_t *ram_ptr(struct ram *ram,uint64_t addr,uint64_t size);
+void ram_mark_dirty(struct ram *ram,uint64_t addr,uint64_t size);
+int ram_test_and_clear_dirty(struct ram *ram,uint64_t page);
+int ram_page_is_zero(struct ram *ram,uint64_t page);
+uint64_t ram_page_size(struct ram *ram,uint64_t page);
+uint64_t ram_zero_dirty(struct ram *ram);
 #endif
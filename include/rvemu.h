@@ -0,0 +1,54 @@
+#ifndef __RVEMU_H__
+#define __RVEMU_H__
+
+#include <stdint.h>
+
+/*
+ * librvemu,the emulator as a library.
+ * every vm owns its ram,cpu,caches and devices,so vms may be created
+ * and run on different threads.a vm is used by one thread at a time.
+ * errors are returned,see rvemu_error().after an error the vm can
+ * only be reset or destroyed.
+ */
+
+#define RVEMU_OK 0
+#define RVEMU_STOPPED 1 //the guest returned to pc 0 or halted
+#define RVEMU_ERROR -1
+
+#define RVEMU_DEFAULT_RAM_SIZE (50*1024*1024)
+
+struct rvemu_vm;
+
+struct rvemu_config{
+	uint64_t ram_size;//0 for RVEMU_DEFAULT_RAM_SIZE
+	int out_fd;//console output
+	int in_fd;//console input,-1 if none
+};
+
+//*vm is set on errors too,to read the error before destroying it
+int rvemu_create(struct rvemu_config *config,struct rvemu_vm **vm);
+void rvemu_destroy(struct rvemu_vm *vm);
+
+//a raw image is loaded at address 0,an elf file at its addresses and pc is set to its entry
+int rvemu_load_file(struct rvemu_vm *vm,char *filename);
+int rvemu_load(struct rvemu_vm *vm,uint64_t addr,void *data,uint64_t size);
+
+//execute at most count instructions,*executed may be NULL
+int rvemu_run(struct rvemu_vm *vm,uint64_t count,uint64_t *executed);
+
+//wait for the devices,e.g. until the console output is written
+void rvemu_sync(struct rvemu_vm *vm);
+
+/*
+ * back to the state after rvemu_create() for the next program,much
+ * cheaper than a new vm: only the ram pages written are zeroed and the
+ * caches are invalidated without a writeback.
+ */
+int rvemu_reset(struct rvemu_vm *vm);
+
+uint64_t rvemu_get_pc(struct rvemu_vm *vm);
+uint64_t rvemu_get_reg(struct rvemu_vm *vm,int idx);
+uint64_t rvemu_instret(struct rvemu_vm *vm);
+const char *rvemu_error(struct rvemu_vm *vm);
+
+#endif
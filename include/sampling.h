@@ -0,0 +1,62 @@
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+
+//#define __SAMPLING_DEBUG__
+
+#define SAMPLING_DEFAULT_WARM 100000
+#define SAMPLING_DEFAULT_MEASURE 10000
+
+//cycles of the cpi model,one per instruction plus the miss latencies
+#define SAMPLING_CACHE_LATENCY 10 //level 1 miss served by the level 2 cache
+#define SAMPLING_MEMORY_LATENCY 100 //level 2 miss
+
+#define SAMPLING_Z 1.96 //95% confidence
+#define SAMPLING_TARGET_ERROR 0.03 //relative error the window count is suggested for
+
+enum sample_metric{
+	SAMPLE_CPI,
+	SAMPLE_ICACHE_MISS_RATE,
+	SAMPLE_DCACHE_MISS_RATE,
+	SAMPLE_CACHE_MISS_RATE,
+	SAMPLE_ICACHE_MPKI,
+	SAMPLE_DCACHE_MPKI,
+	SAMPLE_CACHE_MPKI,
+	NR_SAMPLE_METRICS,
+};
+
+//hits and misses of icache,dcache and cache
+struct cache_counts{
+	uint64_t hits[3];
+	uint64_t misses[3];
+};
+
+/*
+ * systematic sampling,every period instructions one unit is simulated
+ * with the caches: warm instructions to refill them,then measure
+ * instructions whose counts are kept.the rest of the period runs
+ * functionally with the caches bypassed and empty.
+ */
+struct sampler{
+	uint64_t period;
+	uint64_t warm;
+	uint64_t measure;
+
+	uint64_t pos;//instructions into the current period
+	struct cache_counts start;//counts when the measure window began
+
+	uint64_t nr_windows;
+	double sum[NR_SAMPLE_METRICS];
+	double sum_sq[NR_SAMPLE_METRICS];
+};
+
+struct sampler *alloc_sampler(uint64_t period,uint64_t warm,uint64_t measure);
+int sampler_run_for(struct sampler *sampler,struct cpu *cpu,uint64_t count);
+void read_cache_counts(struct cpu *cpu,struct cache_counts *counts);
+void sampler_add_window(struct sampler *sampler,uint64_t insns,struct cache_counts *start,struct cache_counts *end);
+void report_sampler(struct sampler *sampler,uint64_t total,FILE *f);
+
+#endif
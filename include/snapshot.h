@@ -0,0 +1,33 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include "cpu.h"
+#include "bus.h"
+
+//#define __SNAPSHOT_DEBUG__
+
+#define SNAPSHOT_MAGIC "RVEMUSNP"
+#define SNAPSHOT_VERSION 3
+
+//ram image offset in the file,aligned so that it can be mmaped on any host page size
+#define SNAPSHOT_RAM_ALIGN (64*1024)
+
+struct snapshot_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t ram_size;
+	uint64_t ram_offset;
+};
+
+void write_full(int fd,void *buf,uint64_t size);
+void read_full(int fd,void *buf,uint64_t size);
+
+void save_machine_state(struct cpu *cpu,int fd);
+void restore_machine_state(struct cpu *cpu,int fd);
+
+void save_snapshot(struct cpu *cpu,char *filename);
+struct cpu *restore_snapshot(struct bus *bus,char *filename);
+
+#endif
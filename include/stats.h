@@ -0,0 +1,11 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include "cpu.h"
+
+//run statistics as one json object,for the benchmark harness
+void write_stats(FILE *f,struct cpu *cpu,double seconds);
+void write_stats_file(char *filename,struct cpu *cpu,double seconds);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "sampling.h"
+
+//#define __TIMING_DEBUG__
+
+#define TIMING_DEFAULT_STAGES 5
+#define TIMING_MIN_STAGES 5 //at least IF,ID,EX,MEM,WB
+
+//cycles of an access,a level 1 hit is taken by the IF/MEM stage itself
+#define TIMING_DEFAULT_L1_LATENCY 1
+#define TIMING_DEFAULT_L2_LATENCY 10
+#define TIMING_DEFAULT_MEMORY_LATENCY 100
+
+enum timing_stall{
+	STALL_RAW,//waiting for a result,only without forwarding
+	STALL_LOAD_USE,//waiting for a load
+	STALL_BRANCH,//fetch redirected by a taken branch,jump or trap
+	STALL_ICACHE,//fetch missed the icache
+	STALL_DCACHE,//the MEM stage missed the dcache,the whole pipeline waits
+	NR_STALLS,
+};
+
+/*
+ * cycle approximate in-order pipeline,one instruction issued per cycle.
+ * the stages before EX are the front end,MEM and WB follow EX.
+ * the instruction and data accesses are run through the caches as usual,
+ * their latency comes from the level that served them.
+ * branches are predicted not taken and resolved in EX,jal in the stage
+ * before it.when several stalls overlap,the cycles are charged in the
+ * order dcache,branch,icache,data.
+ */
+struct timing{
+	int stages;
+	int forwarding;
+	uint64_t l1_latency;
+	uint64_t l2_latency;
+	uint64_t memory_latency;
+	uint64_t front;//stages from IF to EX
+
+	uint64_t insns;
+	uint64_t pc;//of the instruction in flight
+	uint64_t issue;//cycle the last instruction entered EX
+	uint64_t fetch_start;//cycle the last fetch began
+	uint64_t fetch_done;//and ended,after the icache latency
+	uint64_t redirect;//earliest fetch after a taken branch
+	uint64_t mem_ready;//earliest issue after the last memory access
+	uint64_t next_pc;//where the last instruction went
+	uint64_t native_target;//the last jump entered a routine run by the host,0 if not,see libcall.h
+
+	uint64_t ready[32];//earliest issue of a reader of the register
+	uint8_t loaded[32];//the register was written by a load
+
+	struct cache_counts seen;//cache counts at the last access
+	uint64_t stalls[NR_STALLS];
+};
+
+struct timing *start_timing(struct cpu *cpu,int stages,int forwarding,uint64_t l1_latency,uint64_t l2_latency,uint64_t memory_latency);
+void timing_fetched(struct cpu *cpu);
+void timing_executed(struct cpu *cpu);
+uint64_t timing_cycles(struct timing *timing);
+void report_timing(struct timing *timing,FILE *f);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+//#define __TRACER_DEBUG__
+
+#define TRACER_DEFAULT_FILE "rvemu.trace.json"
+#define TRACER_CHUNK_EVENTS 4096
+#define TRACER_THREAD_EVENTS (1UL<<20) //events kept for each thread,the later ones are dropped
+
+/*
+ * event categories,selected with their sampling rates,
+ * see parse_tracer_categories().
+ */
+enum tracer_category{
+	TRACER_CACHE,//misses and line fills
+	TRACER_COHERENCY,//lines invalidated in the other caches
+	TRACER_WRITEBACK,//modified lines written to ram
+	TRACER_DEVICE,//accesses through the bus and host side device work
+	TRACER_TRAP,//traps,mret and syscalls
+	TRACER_SCHED,//harts running on host threads
+	NR_TRACER_CATEGORIES,
+};
+
+struct tracer_event{
+	uint64_t ts;//ns since the tracer started
+	uint64_t dur;//spans only
+	const char *name;
+	const char *arg;//cache,device or executor,NULL when none
+	uint64_t addr;
+	uint64_t x;//size,cause,instructions...,see arg_names in tracer.c
+	uint8_t cat;
+	uint8_t span;
+};
+
+struct tracer_chunk{
+	struct tracer_chunk *next;
+	uint32_t nr;//published with a release store,the reader takes nr events
+	struct tracer_event events[TRACER_CHUNK_EVENTS];
+};
+
+/*
+ * events of one host thread,only the thread writes them
+ * and the writer of the trace reads what is published,no lock is taken.
+ */
+struct tracer_buffer{
+	struct tracer_buffer *next;//all the buffers
+	struct tracer_chunk *first,*last;
+	uint64_t nr_events;
+	uint64_t dropped;
+	uint32_t tid;
+	const char *name;
+	uint32_t skip[NR_TRACER_CATEGORIES];//events left out before the next sampled one
+};
+
+extern uint32_t tracer_categories;//a bit for each category traced,0 when off
+
+#define TRACER_ON(cat) (tracer_categories >> (cat) & 1)
+
+/*
+ * a span is timed by tracer_begin() and recorded by tracer_end() on the same thread,
+ * tracer_begin() returns 0 when the event is not sampled.
+ */
+uint64_t tracer_begin(enum tracer_category cat);
+void tracer_end(enum tracer_category cat,const char *name,uint64_t begin,const char *arg,uint64_t addr,uint64_t x);
+void tracer_instant(enum tracer_category cat,const char *name,const char *arg,uint64_t addr,uint64_t x);
+void tracer_thread_name(const char *name);
+
+int parse_tracer_categories(char *list,uint32_t *rates);
+void start_tracer(uint32_t *rates);
+void stop_tracer(char *file);
+
+#endif
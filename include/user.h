@@ -0,0 +1,61 @@
+#ifndef __USER_H__
+#define __USER_H__
+
+#include <stdint.h>
+#include "cpu.h"
+
+//#define __USER_SYSCALL_DEBUG__
+
+#define USER_STACK_SIZE (8*1024*1024)
+
+//riscv64 linux syscall numbers
+#define USER_SYS_GETCWD          17
+#define USER_SYS_IOCTL           29
+#define USER_SYS_OPENAT          56
+#define USER_SYS_CLOSE           57
+#define USER_SYS_LSEEK           62
+#define USER_SYS_READ            63
+#define USER_SYS_WRITE           64
+#define USER_SYS_READV           65
+#define USER_SYS_WRITEV          66
+#define USER_SYS_NEWFSTATAT      79
+#define USER_SYS_FSTAT           80
+#define USER_SYS_EXIT            93
+#define USER_SYS_EXIT_GROUP      94
+#define USER_SYS_SET_TID_ADDRESS 96
+#define USER_SYS_SET_ROBUST_LIST 99
+#define USER_SYS_CLOCK_GETTIME   113
+#define USER_SYS_RT_SIGACTION    134
+#define USER_SYS_RT_SIGPROCMASK  135
+#define USER_SYS_UNAME           160
+#define USER_SYS_GETPID          172
+#define USER_SYS_GETUID          174
+#define USER_SYS_GETEUID         175
+#define USER_SYS_GETGID          176
+#define USER_SYS_GETEGID         177
+#define USER_SYS_GETTID          178
+#define USER_SYS_BRK             214
+#define USER_SYS_MUNMAP          215
+#define USER_SYS_MMAP            222
+#define USER_SYS_MPROTECT        226
+#define USER_SYS_PRLIMIT64       261
+#define USER_SYS_GETRANDOM       278
+
+/*
+ * user mode runs a static linux binary without a kernel,ecall is
+ * handled by the host.ram is the address space:the image at its link
+ * address,brk above it,mmap growing down from the stack at the top.
+ */
+struct user{
+	uint64_t brk_start;
+	uint64_t brk;
+	uint64_t mmap_bottom;//lowest mapped address
+	uint64_t stack_bottom;
+
+	int exit_code;
+};
+
+struct user *setup_user(struct cpu *cpu,char *filename,int argc,char *argv[],char *envp[]);
+void do_syscall(struct cpu *cpu);
+
+#endif
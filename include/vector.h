@@ -0,0 +1,101 @@
+#ifndef __VECTOR_H__
+#define __VECTOR_H__
+
+#include <stdint.h>
+
+struct cpu;
+
+//#define __VECTOR_DEBUG__
+//#define __VECTOR_SCALAR__ //no host simd kernels,e.g. to check them
+
+#define VLEN  256 //bits of a vector register
+#define VLENB (VLEN/8)
+#define ELEN  64
+
+#define CSR_VSTART 0x008
+#define CSR_VXSAT  0x009
+#define CSR_VXRM   0x00A
+#define CSR_VCSR   0x00F
+#define CSR_VL     0xC20
+#define CSR_VTYPE  0xC21
+#define CSR_VLENB  0xC22
+
+#define VTYPE_VLMUL (7UL<<0)
+#define VTYPE_VSEW  (7UL<<3)
+#define VTYPE_VTA   (1UL<<6)
+#define VTYPE_VMA   (1UL<<7)
+#define VTYPE_VILL  (1UL<<63)
+
+/*
+ * vector ops applied element by element,
+ * the host kernels of each op and element width are in vector.c.
+ */
+enum vector_op{
+	VOP_NONE,
+	VOP_ADD,
+	VOP_SUB,
+	VOP_RSUB,
+	VOP_MINU,
+	VOP_MIN,
+	VOP_MAXU,
+	VOP_MAX,
+	VOP_AND,
+	VOP_OR,
+	VOP_XOR,
+	VOP_SLL,
+	VOP_SRL,
+	VOP_SRA,
+	VOP_MUL,
+	VOP_MULH,
+	VOP_MULHU,
+	VOP_MULHSU,
+	VOP_DIVU,
+	VOP_DIV,
+	VOP_REMU,
+	VOP_REM,
+	VOP_MACC,
+	VOP_NMSAC,
+	VOP_MADD,
+	VOP_NMSUB,
+	VOP_FADD,
+	VOP_FSUB,
+	VOP_FMUL,
+	VOP_FDIV,
+	VOP_FMIN,
+	VOP_FMAX,
+	VOP_FSGNJ,
+	VOP_FSGNJN,
+	VOP_FSGNJX,
+	VOP_FMACC,
+	VOP_FNMACC,
+	VOP_FMSAC,
+	VOP_FNMSAC,
+	NR_VECTOR_OPS,
+};
+
+//compares writing a mask
+enum vector_cmp{
+	VCMP_NONE,
+	VCMP_EQ,
+	VCMP_NE,
+	VCMP_LTU,
+	VCMP_LT,
+	VCMP_LEU,
+	VCMP_LE,
+	VCMP_GTU,
+	VCMP_GT,
+	VCMP_FEQ,
+	VCMP_FNE,
+	VCMP_FLT,
+	VCMP_FLE,
+};
+
+void init_vector(struct cpu *cpu);
+int vector_exec(struct cpu *cpu);
+int vector_load_store(struct cpu *cpu,int store);
+
+int vector_csr(uint64_t csr);
+uint64_t vector_read_csr(struct cpu *cpu,uint64_t csr);
+void vector_write_csr(struct cpu *cpu,uint64_t csr,uint64_t x);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef __VIRTIO_BLK_H__
+#define __VIRTIO_BLK_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "device.h"
+
+//#define __VIRTIO_BLK_DEBUG__
+
+#define VIRTIO_BLK_START_PHY_ADDR 0x10001000
+#define VIRTIO_BLK_END_PHY_ADDR   0x10002000
+#define VIRTIO_BLK_IRQ 2
+
+#define VIRTIO_BLK_QUEUE_SIZE 128 //default queue depth
+#define VIRTIO_BLK_QUEUE_SIZE_MAX 1024
+#define VIRTIO_BLK_SEG_MAX 126
+#define VIRTIO_BLK_IO_THREADS 4
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+//virtio-mmio registers(version 2)
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000
+#define VIRTIO_MMIO_VERSION             0x004
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_VENDOR_ID           0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES     0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES     0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_READY         0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK       0x064
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW    0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW    0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH   0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION   0x0fc
+#define VIRTIO_MMIO_CONFIG              0x100
+
+#define VIRTIO_MMIO_MAGIC 0x74726976 //"virt"
+#define VIRTIO_VENDOR_ID  0x554d4552 //"RVMU"
+#define VIRTIO_ID_BLOCK 2
+
+#define VIRTIO_F_VERSION_1     32
+#define VIRTIO_BLK_F_SEG_MAX   2
+#define VIRTIO_BLK_F_RO        5
+#define VIRTIO_BLK_F_FLUSH     9
+
+#define VIRTIO_INT_USED_RING 1
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_ID_BYTES 20
+
+struct virtq_desc{
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct virtio_blk_req{
+	struct virtio_blk_req *next;
+
+	uint16_t head;//descriptor chain
+	uint32_t type;
+	uint64_t sector;
+
+	//guest buffers,used in place in ram
+	struct iovec iov[VIRTIO_BLK_SEG_MAX];
+	uint64_t iov_addr[VIRTIO_BLK_SEG_MAX];
+	int nr_iov;
+
+	uint64_t status_addr;
+	uint8_t status;
+	uint32_t len;//bytes written to guest memory
+};
+
+struct virtio_blk_queue{
+	uint32_t num;
+	uint32_t ready;
+	uint64_t desc_addr;
+	uint64_t driver_addr;//avail ring
+	uint64_t device_addr;//used ring
+	uint16_t last_avail_idx;
+	uint16_t used_idx;
+};
+
+struct virtio_blk{
+	struct device dev;
+
+	int fd;
+	uint64_t capacity;//in sectors
+	int read_only;
+	uint32_t queue_size_max;
+
+	uint32_t status;
+	uint32_t device_features_sel;
+	uint32_t driver_features_sel;
+	uint64_t driver_features;
+	uint32_t interrupt_status;
+	struct virtio_blk_queue queue;
+
+	//requests handed to the io threads and completions handed back
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct virtio_blk_req *work,*work_tail;
+	struct virtio_blk_req *done;
+	int inflight;
+	int stop;
+
+	int nr_threads;
+	pthread_t *threads;
+};
+
+struct device *alloc_virtio_blk(char *filename,uint32_t queue_size,int nr_threads);
+
+#endif
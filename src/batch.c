@@ -0,0 +1,274 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "rvemu.h"
+#include "tracer.h"
+#include "error.h"
+
+static const char *result_names[NR_BATCH_RESULTS] = {"pass","fail","timeout","error"};
+
+struct batch_worker{
+	struct batch *batch;
+	struct rvemu_vm *vm;
+	int used;//the vm ran a test,reset it first
+	FILE *output;//console output of the current test
+	uint8_t buf[2][BATCH_COMPARE_CHUNK];
+	pthread_t thread;
+};
+
+static void add_test(struct batch *batch,uint32_t *size,char *image,char *expected,uint64_t limit)
+{
+	struct batch_test *test;
+
+	if(batch->nr_tests == *size){
+		*size = *size ? *size*2 : 256;
+		batch->tests = realloc(batch->tests,*size * sizeof(struct batch_test));
+		if(batch->tests == NULL){
+			fatal("alloc batch tests error(%s)\n",strerror(errno));
+		}
+	}
+
+	test = batch->tests + batch->nr_tests++;
+	test->image = strdup(image);
+	test->expected = strcmp(expected,"-") ? strdup(expected) : NULL;
+	test->limit = limit;
+	if(test->image == NULL || (strcmp(expected,"-") && test->expected == NULL)){
+		fatal("alloc batch test error(%s)\n",strerror(errno));
+	}
+}
+
+struct batch *alloc_batch(char *manifest,uint64_t ram_size,uint64_t limit)
+{
+	struct batch *batch = malloc(sizeof(struct batch));
+	FILE *f;
+	char *line = NULL,*image,*expected,*max;
+	size_t len = 0;
+	uint32_t size = 0,nr = 0;
+
+	if(batch == NULL){
+		fatal("alloc batch error(%s)\n",strerror(errno));
+	}
+	memset(batch,0,sizeof(struct batch));
+	batch->ram_size = ram_size;
+	pthread_mutex_init(&batch->out_lock,NULL);
+
+	f = fopen(manifest,"r");
+	if(f == NULL){
+		fatal("open %s file error(%s)\n",manifest,strerror(errno));
+	}
+	while(getline(&line,&len,f) != -1){
+		nr++;
+		image = strtok(line," \t\r\n");
+		if(image == NULL || image[0] == '#') continue;
+
+		expected = strtok(NULL," \t\r\n");
+		max = strtok(NULL," \t\r\n");
+		if(expected == NULL){
+			fatal("%s:%u: no expected output\n",manifest,nr);
+		}
+		add_test(batch,&size,image,expected,max ? strtoull(max,NULL,0) : limit);
+	}
+	free(line);
+	fclose(f);
+
+	return batch;
+}
+
+static uint64_t ns_between(struct timespec *a,struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec)*1000000000UL + b->tv_nsec - a->tv_nsec;
+}
+
+//1 if the console output is the content of the expected file
+static int compare_output(struct batch_worker *worker,char *expected)
+{
+	int out_fd = fileno(worker->output);
+	int fd = open(expected,O_RDONLY);
+	off_t off = 0;
+	ssize_t n,m;
+	int same = 1;
+
+	if(fd == -1) return -1;
+
+	while(same){
+		n = read(fd,worker->buf[0],BATCH_COMPARE_CHUNK);
+		m = pread(out_fd,worker->buf[1],BATCH_COMPARE_CHUNK,off);
+		if(n == -1 || m == -1){
+			same = -1;
+			break;
+		}
+		//the output file is read in the chunks of the expected one
+		if(m < n || memcmp(worker->buf[0],worker->buf[1],n)){
+			same = 0;
+		}else if(n < BATCH_COMPARE_CHUNK){
+			same = m == n;
+			break;
+		}
+		off += n;
+	}
+
+	close(fd);
+	return same;
+}
+
+//a string of the manifest or an error message,with the json escapes
+static void write_json_string(FILE *f,const char *s)
+{
+	fputc('"',f);
+	for(;*s;s++){
+		if(*s == '"' || *s == '\\'){
+			fprintf(f,"\\%c",*s);
+		}else if((unsigned char)*s < 0x20){
+			fprintf(f,"\\u%04x",*s);
+		}else{
+			fputc(*s,f);
+		}
+	}
+	fputc('"',f);
+}
+
+static void run_test(struct batch_worker *worker,uint32_t i)
+{
+	struct batch *batch = worker->batch;
+	struct batch_test *test = batch->tests + i;
+	struct rvemu_vm *vm = worker->vm;
+	struct timespec t0,t1,t2,t3;
+	enum batch_result result;
+	uint64_t executed = 0,overhead;
+	const char *msg = NULL;
+	int ret,same;
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	ret = worker->used ? rvemu_reset(vm) : RVEMU_OK;
+	worker->used = 1;
+	//the display is idle after the reset,its writes start at 0 again
+	if(ftruncate(fileno(worker->output),0) == -1 || lseek(fileno(worker->output),0,SEEK_SET) == -1){
+		fatal("truncate batch output error(%s)\n",strerror(errno));
+	}
+	if(ret == RVEMU_OK) ret = rvemu_load_file(vm,test->image);
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+
+	if(ret == RVEMU_OK){
+		ret = rvemu_run(vm,test->limit,&executed);
+		rvemu_sync(vm);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&t2);
+
+	switch(ret){
+	case RVEMU_STOPPED:
+		result = BATCH_PASS;
+		if(test->expected){
+			same = compare_output(worker,test->expected);
+			if(same == -1){
+				result = BATCH_ERROR;
+				msg = strerror(errno);
+			}else if(!same){
+				result = BATCH_FAIL;
+			}
+		}
+		break;
+	case RVEMU_OK:
+		result = BATCH_TIMEOUT;
+		break;
+	default:
+		result = BATCH_ERROR;
+		msg = rvemu_error(vm);
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&t3);
+	overhead = ns_between(&t0,&t1) + ns_between(&t2,&t3);
+
+	pthread_mutex_lock(&batch->out_lock);
+	batch->results[result]++;
+	batch->overhead_ns += overhead;
+
+	fprintf(batch->out,"{\"test\":%u,\"image\":",i);
+	write_json_string(batch->out,test->image);
+	fprintf(batch->out,",\"result\":\"%s\",\"instructions\":%lu,\"a0\":%lu,\"run_us\":%.3f,\"overhead_us\":%.3f",
+			result_names[result],executed,rvemu_get_reg(vm,10),ns_between(&t1,&t2)/1e3,overhead/1e3);
+	if(msg){
+		fprintf(batch->out,",\"error\":");
+		write_json_string(batch->out,msg);
+	}
+	fprintf(batch->out,"}\n");
+	fflush(batch->out);
+	pthread_mutex_unlock(&batch->out_lock);
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch_worker *worker = arg;
+	struct batch *batch = worker->batch;
+	uint32_t i;
+
+	tracer_thread_name("batch");
+	while((i = __atomic_fetch_add(&batch->next,1,__ATOMIC_RELAXED)) < batch->nr_tests){
+		run_test(worker,i);
+	}
+	return NULL;
+}
+
+//return the number of tests not passed
+int run_batch(struct batch *batch,int jobs,FILE *out)
+{
+	struct batch_worker *workers;
+	struct rvemu_config config;
+
+	if(jobs > batch->nr_tests) jobs = batch->nr_tests;
+	if(jobs == 0) return 0;
+
+	workers = calloc(jobs,sizeof(struct batch_worker));
+	if(workers == NULL){
+		fatal("alloc batch workers error(%s)\n",strerror(errno));
+	}
+	batch->out = out;
+
+	//the vms are created once,the tests only reset them
+	for(int i = 0;i<jobs;i++){
+		workers[i].batch = batch;
+		workers[i].output = tmpfile();
+		if(workers[i].output == NULL){
+			fatal("create batch output error(%s)\n",strerror(errno));
+		}
+
+		config.ram_size = batch->ram_size;
+		config.out_fd = fileno(workers[i].output);
+		config.in_fd = -1;
+		if(rvemu_create(&config,&workers[i].vm) != RVEMU_OK){
+			fatal("create batch vm error(%s)\n",workers[i].vm ? rvemu_error(workers[i].vm) : strerror(errno));
+		}
+	}
+	for(int i = 0;i<jobs;i++){
+		if(pthread_create(&workers[i].thread,NULL,batch_worker,workers + i)){
+			fatal("create batch worker error\n");
+		}
+	}
+	for(int i = 0;i<jobs;i++){
+		pthread_join(workers[i].thread,NULL);
+		rvemu_destroy(workers[i].vm);
+		fclose(workers[i].output);
+	}
+
+	free(workers);
+	return batch->nr_tests - batch->results[BATCH_PASS];
+}
+
+void report_batch(struct batch *batch,int jobs,double seconds,FILE *f)
+{
+	fprintf(f,"batch: %u tests on %d threads in %.3f seconds",batch->nr_tests,jobs,seconds);
+	for(int i = 0;i<NR_BATCH_RESULTS;i++){
+		fprintf(f,",%u %s",batch->results[i],result_names[i]);
+	}
+	fprintf(f,"\n");
+	if(batch->nr_tests){
+		fprintf(f,"overhead per test %.3f us(reset,load and comparison)\n",batch->overhead_ns/1e3/batch->nr_tests);
+	}
+}
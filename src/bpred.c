@@ -0,0 +1,370 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bpred.h"
+#include "cpu.h"
+#include "error.h"
+
+#define IS_LINK(r) ((r) == 1 || (r) == 5)
+
+static const char *kind_names[NR_BPRED_KINDS] = {"bimodal","gshare","tage","btb","ras"};
+
+//history lengths of the tagged tables,geometric
+static const int tage_lengths[BPRED_TAGE_TABLES] = {5,12,26,56};
+
+static void *alloc_table(uint64_t n,uint64_t size)
+{
+	void *table = calloc(n,size);
+	if(table == NULL){
+		fatal("alloc branch predictor error(%s)\n",strerror(errno));
+	}
+	return table;
+}
+
+struct bpred *start_bpred(struct cpu *cpu,int bimodal_bits,int gshare_bits,int tage_bits,int btb_bits,int ras_depth)
+{
+	struct bpred *bpred;
+
+	if(bimodal_bits < 1 || bimodal_bits > BPRED_MAX_BITS || gshare_bits < 1 || gshare_bits > BPRED_MAX_BITS ||
+			tage_bits < 1 || tage_bits > BPRED_MAX_BITS || btb_bits < 1 || btb_bits > BPRED_MAX_BITS ||
+			ras_depth < 1 || ras_depth > BPRED_MAX_RAS_DEPTH){
+		fatal("%s: bad predictor sizes(%d,%d,%d,%d,%d)\n",__func__,bimodal_bits,gshare_bits,tage_bits,btb_bits,ras_depth);
+	}
+	bpred = alloc_table(1,sizeof(struct bpred));
+
+	bpred->bimodal_bits = bimodal_bits;
+	bpred->gshare_bits = gshare_bits;
+	bpred->tage_bits = tage_bits;
+	bpred->btb_bits = btb_bits;
+	bpred->ras_depth = ras_depth;
+
+	//counters start weakly not taken
+	bpred->bimodal = alloc_table(1UL<<bimodal_bits,1);
+	memset(bpred->bimodal,1,1UL<<bimodal_bits);
+	bpred->gshare = alloc_table(1UL<<gshare_bits,1);
+	memset(bpred->gshare,1,1UL<<gshare_bits);
+	bpred->tage_base = alloc_table(1UL<<(tage_bits + 2),1);
+	memset(bpred->tage_base,1,1UL<<(tage_bits + 2));
+	for(int i = 0;i<BPRED_TAGE_TABLES;i++){
+		bpred->tage[i] = alloc_table(1UL<<tage_bits,sizeof(struct tage_entry));
+	}
+	bpred->btb = alloc_table(1UL<<btb_bits,sizeof(struct btb_entry));
+	bpred->ras = alloc_table(ras_depth,sizeof(uint64_t));
+
+	bpred->start_instret = cpu->instret;
+	cpu->bpred = bpred;
+	return bpred;
+}
+
+void free_bpred(struct bpred *bpred)
+{
+	free(bpred->bimodal);
+	free(bpred->gshare);
+	free(bpred->tage_base);
+	for(int i = 0;i<BPRED_TAGE_TABLES;i++){
+		free(bpred->tage[i]);
+	}
+	free(bpred->btb);
+	free(bpred->ras);
+	free(bpred->sites);
+	free(bpred);
+}
+
+static int counter_taken(uint8_t c)
+{
+	return c >= 2;
+}
+
+static void counter_update(uint8_t *c,int taken)
+{
+	if(taken && *c < 3) (*c)++;
+	if(!taken && *c > 0) (*c)--;
+}
+
+//the last len bits of the history folded into bits bits
+static uint64_t fold_history(uint64_t history,int len,int bits)
+{
+	uint64_t mask = (1UL<<bits) - 1;
+	uint64_t x = 0;
+
+	if(len < 64) history &= (1UL<<len) - 1;
+	while(history){
+		x ^= history & mask;
+		history >>= bits;
+	}
+	return x;
+}
+
+static uint64_t tage_index(struct bpred *bpred,int t,uint64_t pc)
+{
+	uint64_t mask = (1UL<<bpred->tage_bits) - 1;
+
+	return ((pc >> 2) ^ (pc >> (2 + bpred->tage_bits)) ^ fold_history(bpred->history,tage_lengths[t],bpred->tage_bits)) & mask;
+}
+
+//0 is an empty entry
+static uint16_t tage_tag(struct bpred *bpred,int t,uint64_t pc)
+{
+	uint64_t mask = (1UL<<BPRED_TAGE_TAG_BITS) - 1;
+	uint64_t h = bpred->history;
+
+	return (((pc >> 2) ^ fold_history(h,tage_lengths[t],BPRED_TAGE_TAG_BITS) ^
+			(fold_history(h,tage_lengths[t],BPRED_TAGE_TAG_BITS - 1) << 1)) & mask) + 1;
+}
+
+/*
+ * the longest history table whose tag matches provides the prediction,
+ * the base table when none does.a misprediction allocates an entry in
+ * a longer table,useful bits protect entries that beat the alternative.
+ */
+static int tage_predict(struct bpred *bpred,uint64_t pc,int taken)
+{
+	struct tage_entry *entrys[BPRED_TAGE_TABLES],*e;
+	uint16_t tags[BPRED_TAGE_TABLES];
+	uint8_t *base = bpred->tage_base + ((pc >> 2) & ((1UL<<(bpred->tage_bits + 2)) - 1));
+	int provider = -1,alt = -1;
+	int pred,alt_pred;
+	int allocated = 0;
+
+	for(int t = BPRED_TAGE_TABLES - 1;t >= 0;t--){
+		entrys[t] = bpred->tage[t] + tage_index(bpred,t,pc);
+		tags[t] = tage_tag(bpred,t,pc);
+		if(entrys[t]->tag != tags[t]) continue;
+		if(provider < 0){
+			provider = t;
+		}else if(alt < 0){
+			alt = t;
+		}
+	}
+
+	alt_pred = alt >= 0 ? entrys[alt]->ctr >= 0 : counter_taken(*base);
+	pred = provider >= 0 ? entrys[provider]->ctr >= 0 : counter_taken(*base);
+
+	if(provider >= 0){
+		e = entrys[provider];
+		if(pred != alt_pred){
+			if(pred == taken && e->u < 3) e->u++;
+			if(pred != taken && e->u > 0) e->u--;
+		}
+		if(taken && e->ctr < 3) e->ctr++;
+		if(!taken && e->ctr > -4) e->ctr--;
+	}else{
+		counter_update(base,taken);
+	}
+
+	if(pred != taken){
+		for(int t = provider + 1;t<BPRED_TAGE_TABLES;t++){
+			if(entrys[t]->u) continue;
+			entrys[t]->tag = tags[t];
+			entrys[t]->ctr = taken ? 0 : -1;
+			allocated = 1;
+			break;
+		}
+		for(int t = provider + 1;t<BPRED_TAGE_TABLES && !allocated;t++){
+			entrys[t]->u--;
+		}
+	}
+
+	if(++bpred->tage_updates % BPRED_TAGE_U_RESET == 0){
+		for(int t = 0;t<BPRED_TAGE_TABLES;t++){
+			for(uint64_t i = 0;i<(1UL<<bpred->tage_bits);i++){
+				bpred->tage[t][i].u >>= 1;
+			}
+		}
+	}
+	return pred;
+}
+
+static void grow_sites(struct bpred *bpred)
+{
+	struct bpred_site *old = bpred->sites;
+	uint64_t old_size = bpred->table_size;
+	uint64_t i;
+
+	bpred->table_size = old_size ? old_size*2 : 1024;
+	bpred->sites = alloc_table(bpred->table_size,sizeof(struct bpred_site));
+
+	for(uint64_t j = 0;j<old_size;j++){
+		if(old[j].type == 0) continue;
+		i = (old[j].pc >> 2) & (bpred->table_size - 1);
+		while(bpred->sites[i].type) i = (i + 1) & (bpred->table_size - 1);
+		bpred->sites[i] = old[j];
+	}
+	free(old);
+}
+
+static struct bpred_site *lookup_site(struct bpred *bpred,uint64_t pc,char type)
+{
+	struct bpred_site *site;
+	uint64_t i;
+
+	if((bpred->nr_sites + 1)*2 > bpred->table_size){
+		grow_sites(bpred);
+	}
+
+	i = (pc >> 2) & (bpred->table_size - 1);
+	while(1){
+		site = bpred->sites + i;
+		if(site->type == 0) break;
+		if(site->pc == pc) return site;
+		i = (i + 1) & (bpred->table_size - 1);
+	}
+
+	site->pc = pc;
+	site->type = type;
+	bpred->nr_sites++;
+	return site;
+}
+
+static void predicted(struct bpred *bpred,struct bpred_site *site,enum bpred_kind kind,int hit)
+{
+	bpred->predictions[kind]++;
+	if(!hit){
+		bpred->misses[kind]++;
+		site->misses[kind]++;
+	}
+}
+
+static void ras_push(struct bpred *bpred,uint64_t addr)
+{
+	bpred->ras_top = (bpred->ras_top + 1) % bpred->ras_depth;
+	bpred->ras[bpred->ras_top] = addr;
+	if(bpred->ras_count < bpred->ras_depth) bpred->ras_count++;
+}
+
+//0 when empty
+static uint64_t ras_pop(struct bpred *bpred)
+{
+	uint64_t addr;
+
+	if(bpred->ras_count == 0) return 0;
+
+	addr = bpred->ras[bpred->ras_top];
+	bpred->ras_top = (bpred->ras_top + bpred->ras_depth - 1) % bpred->ras_depth;
+	bpred->ras_count--;
+	return addr;
+}
+
+//the control transfer instruction at pc went to next_pc
+void bpred_update(struct cpu *cpu,uint64_t pc,uint64_t next_pc)
+{
+	struct bpred *bpred = cpu->bpred;
+	uint32_t inst = cpu->inst.instruction;
+	int rd = (inst >> 7) & 0x1f,rs1 = (inst >> 15) & 0x1f;
+	int taken = next_pc != pc + 4;
+	struct bpred_site *site;
+	struct btb_entry *btb;
+	uint8_t *c;
+	char type;
+
+	switch(inst & 0x7f){
+	case 0x63:
+		type = 'b';
+		break;
+	case 0x6F:
+		type = IS_LINK(rd) ? 'c' : 'j';
+		break;
+	default://jalr
+		if(IS_LINK(rs1) && (!IS_LINK(rd) || rd != rs1)){
+			type = 'r';
+		}else{
+			type = IS_LINK(rd) ? 'c' : 'i';
+		}
+		break;
+	}
+
+	site = lookup_site(bpred,pc,type);
+	site->execs++;
+	if(taken) site->taken++;
+
+	if(type == 'b'){
+		c = bpred->bimodal + ((pc >> 2) & ((1UL<<bpred->bimodal_bits) - 1));
+		predicted(bpred,site,BPRED_BIMODAL,counter_taken(*c) == taken);
+		counter_update(c,taken);
+
+		c = bpred->gshare + (((pc >> 2) ^ bpred->history) & ((1UL<<bpred->gshare_bits) - 1));
+		predicted(bpred,site,BPRED_GSHARE,counter_taken(*c) == taken);
+		counter_update(c,taken);
+
+		predicted(bpred,site,BPRED_TAGE,tage_predict(bpred,pc,taken) == taken);
+
+		bpred->history = bpred->history << 1 | taken;
+	}
+
+	if(type == 'r'){
+		predicted(bpred,site,BPRED_RAS,ras_pop(bpred) == next_pc);
+		if(IS_LINK(rd)) ras_push(bpred,pc + 4);//coroutine swap
+	}else if(taken){
+		btb = bpred->btb + ((pc >> 2) & ((1UL<<bpred->btb_bits) - 1));
+		predicted(bpred,site,BPRED_BTB,btb->pc == pc && btb->target == next_pc);
+		btb->pc = pc;
+		btb->target = next_pc;
+	}
+	if(type == 'c'){
+		ras_push(bpred,pc + 4);
+	}
+
+#ifdef __BPRED_DEBUG__
+	printf("bpred: pc 0x%lx %c -> 0x%lx\n",pc,type,next_pc);
+#endif
+}
+
+//a routine run by the host returned without its ret,its entry is dropped
+void bpred_native_return(struct cpu *cpu)
+{
+	ras_pop(cpu->bpred);
+}
+
+static int site_cmp(const void *a,const void *b)
+{
+	const struct bpred_site *x = *(struct bpred_site **)a,*y = *(struct bpred_site **)b;
+	uint64_t nx = 0,ny = 0;
+
+	for(int i = 0;i<NR_BPRED_KINDS;i++){
+		nx += x->misses[i];
+		ny += y->misses[i];
+	}
+	return nx < ny ? 1 : nx > ny ? -1 : 0;
+}
+
+void report_bpred(struct bpred *bpred,uint64_t instret,FILE *f)
+{
+	uint64_t insns = instret - bpred->start_instret;
+	uint64_t sizes[NR_BPRED_KINDS] = {
+		1UL<<bpred->bimodal_bits,1UL<<bpred->gshare_bits,
+		BPRED_TAGE_TABLES*(1UL<<bpred->tage_bits) + (1UL<<(bpred->tage_bits + 2)),
+		1UL<<bpred->btb_bits,bpred->ras_depth,
+	};
+	struct bpred_site **top;
+	uint64_t n = 0;
+
+	fprintf(f,"branch prediction(%lu instructions):\n",insns);
+	fprintf(f,"  %-10s %10s %14s %14s %10s %10s\n","predictor","entries","predictions","mispredicts","rate","mpki");
+	for(int i = 0;i<NR_BPRED_KINDS;i++){
+		fprintf(f,"  %-10s %10lu %14lu %14lu %9.4f%% %10.3f\n",kind_names[i],sizes[i],bpred->predictions[i],bpred->misses[i],
+				bpred->predictions[i] ? bpred->misses[i]*100.0/bpred->predictions[i] : 0.0,
+				insns ? bpred->misses[i]*1000.0/insns : 0.0);
+	}
+
+	top = malloc((bpred->nr_sites + 1) * sizeof(struct bpred_site *));
+	if(top == NULL){
+		fatal("alloc branch predictor report error(%s)\n",strerror(errno));
+	}
+	for(uint64_t i = 0;i<bpred->table_size;i++){
+		if(bpred->sites[i].type) top[n++] = bpred->sites + i;
+	}
+	qsort(top,n,sizeof(struct bpred_site *),site_cmp);
+
+	//target misses of returns are the ras ones
+	fprintf(f,"control transfers(%lu),top %d by mispredicts:\n",n,BPRED_TOP_SITES);
+	fprintf(f,"  %-18s %4s %12s %12s %10s %10s %10s %10s\n","pc","type","execs","taken","bimodal","gshare","tage","target");
+	for(uint64_t i = 0;i<n && i<BPRED_TOP_SITES;i++){
+		fprintf(f,"  0x%-16lx %4c %12lu %12lu %10lu %10lu %10lu %10lu\n",top[i]->pc,top[i]->type,top[i]->execs,top[i]->taken,
+				top[i]->misses[BPRED_BIMODAL],top[i]->misses[BPRED_GSHARE],top[i]->misses[BPRED_TAGE],
+				top[i]->misses[BPRED_BTB] + top[i]->misses[BPRED_RAS]);
+	}
+	free(top);
+}
@@ -5,46 +5,225 @@
 #include <assert.h>
 
 #include "bus.h"
+#include "error.h"
+
+static void *alloc_table(void)
+{
+	void **table = calloc(BUS_LEVEL_SIZE,sizeof(void *));
+	if(table == NULL){
+		fatal("alloc bus page table error(%s)\n",strerror(errno));
+	}
+	return table;
+}
 
 struct bus* alloc_bus()
 {
 	struct bus *bus = malloc(sizeof(struct bus));
 	if(bus == NULL){
-		printf("alloc bus error(%s)\n",strerror(errno));
-		exit(-1);
+		fatal("alloc bus error(%s)\n",strerror(errno));
 	}
 
 	memset(bus,0,sizeof(struct bus));
+	bus->low_addr = UINT64_MAX;
+	bus->page_table = alloc_table();
 
 	return bus;
 }
 
+static void free_table(void **table,int level)
+{
+	if(level < BUS_LEVELS - 1){
+		for(uint64_t i = 0;i<BUS_LEVEL_SIZE;i++){
+			if(table[i]) free_table(table[i],level + 1);
+		}
+	}
+	free(table);
+}
+
+//the devices are freed too,after their host work is done
+void free_bus(struct bus *bus)
+{
+	struct device *dev,*next;
+
+	for(dev = bus->devices;dev;dev = next){
+		next = dev->next;
+		if(dev->free_func) dev->free_func(dev);
+	}
+
+	free_table(bus->page_table,0);
+	free(bus->regions);
+	free(bus);
+}
+
+static uint64_t get_level_idx(uint64_t page,int level)
+{
+	return (page >> ((BUS_LEVELS - 1 - level)*BUS_LEVEL_BITS)) & (BUS_LEVEL_SIZE - 1);
+}
+
+static struct device **get_page_slot(struct bus *bus,uint64_t page)
+{
+	void **table = bus->page_table;
+	uint64_t idx;
+
+	for(int level = 0;level < BUS_LEVELS - 1;level++){
+		idx = get_level_idx(page,level);
+		if(table[idx] == NULL){
+			table[idx] = alloc_table();
+		}
+		table = table[idx];
+	}
+
+	return (struct device **)&table[get_level_idx(page,BUS_LEVELS - 1)];
+}
+
+static void map_device_pages(struct bus *bus,struct device *dev)
+{
+	uint64_t first = dev->start_addr >> BUS_PAGE_SHIFT;
+	uint64_t last = (dev->end_addr - 1) >> BUS_PAGE_SHIFT;
+	uint64_t page_start,page_end;
+	struct device **slot;
+
+	for(uint64_t page = first;;page++){
+		page_start = page << BUS_PAGE_SHIFT;
+		page_end = page_start + (1UL<<BUS_PAGE_SHIFT) - 1;//inclusive,the last page ends at 2^64-1
+		slot = get_page_slot(bus,page);
+
+		if(*slot == NULL && dev->start_addr <= page_start && page_end < dev->end_addr){
+			*slot = dev;
+		}else{
+			*slot = BUS_MIXED_PAGE;
+		}
+
+		if(page == last) break;
+	}
+}
+
+//index of the first region starting above addr
+static int search_regions(struct bus *bus,uint64_t addr)
+{
+	int lo = 0,hi = bus->nr_devices;
+	int mid;
+
+	while(lo < hi){
+		mid = (lo + hi)/2;
+		if(bus->regions[mid]->start_addr <= addr){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
 void add_device(struct bus *bus,struct device *dev)
 {
+	struct device **regions;
+	int pos;
+
 	assert(bus != NULL);
 	assert(dev != NULL && dev->next == NULL);
 
-	if(bus->devices == NULL){
+	if(dev->start_addr >= dev->end_addr){
+		fatal("%s: bad device range(0x%lx-0x%lx)\n",__func__,dev->start_addr,dev->end_addr);
+	}
+
+	pos = search_regions(bus,dev->start_addr);
+	if((pos > 0 && bus->regions[pos - 1]->end_addr > dev->start_addr) ||
+			(pos < bus->nr_devices && bus->regions[pos]->start_addr < dev->end_addr)){
+		fatal("%s: device range(0x%lx-0x%lx) overlaps another device\n",__func__,dev->start_addr,dev->end_addr);
+	}
+
+	regions = realloc(bus->regions,(bus->nr_devices + 1) * sizeof(struct device *));
+	if(regions == NULL){
+		fatal("alloc bus regions error(%s)\n",strerror(errno));
+	}
+	memmove(regions + pos + 1,regions + pos,(bus->nr_devices - pos) * sizeof(struct device *));
+	regions[pos] = dev;
+	bus->regions = regions;
+	bus->nr_devices++;
+
+	dev->next = pos + 1 < bus->nr_devices ? regions[pos + 1] : NULL;
+	if(pos == 0){
 		bus->devices = dev;
-		dev->next = NULL;
 	}else{
-		dev->next = bus->devices;
-		bus->devices = dev;
+		regions[pos - 1]->next = dev;
+	}
+
+	dev->bus = bus;
+	if(dev->start_addr < bus->low_addr){
+		bus->low_addr = dev->start_addr;
 	}
+
+	map_device_pages(bus,dev);
 }
 
 struct device* find_device(struct bus *bus,uint64_t addr)
 {
-	struct device *dev = bus->devices;
-	struct device *ret = NULL;
+	void **table = bus->page_table;
+	struct device *dev;
+	int pos;
 
-	while(dev){
-		if(dev->start_addr<= addr && addr <dev->end_addr){
-			ret = dev;
-			break;
-		}
-		dev = dev->next;
+	if(addr < bus->low_addr){//ram
+		return NULL;
+	}
+
+	for(int level = 0;level < BUS_LEVELS - 1;level++){
+		table = table[get_level_idx(addr >> BUS_PAGE_SHIFT,level)];
+		if(table == NULL) return NULL;
+	}
+
+	dev = table[get_level_idx(addr >> BUS_PAGE_SHIFT,BUS_LEVELS - 1)];
+	if(dev != BUS_MIXED_PAGE){
+		return dev;
 	}
 
-	return ret;
+	pos = search_regions(bus,addr);
+	if(pos > 0 && addr < bus->regions[pos - 1]->end_addr){
+		return bus->regions[pos - 1];
+	}
+	return NULL;
+}
+
+void sync_devices(struct bus *bus)
+{
+	for(struct device *dev = bus->devices;dev;dev = dev->next){
+		if(dev->sync_func) dev->sync_func(dev);
+	}
+}
+
+void reset_devices(struct bus *bus)
+{
+	for(struct device *dev = bus->devices;dev;dev = dev->next){
+		if(dev->reset_func) dev->reset_func(dev);
+	}
+	__atomic_store_n(&bus->irq_pending,0,__ATOMIC_RELAXED);
+	__atomic_store_n(&bus->poll_request,0,__ATOMIC_RELAXED);
+}
+
+//may be called from device threads
+void bus_set_irq(struct bus *bus,int irq,int level)
+{
+	if(irq < 0) return;
+
+	if(level){
+		__atomic_fetch_or(&bus->irq_pending,1UL<<irq,__ATOMIC_RELEASE);
+	}else{
+		__atomic_fetch_and(&bus->irq_pending,~(1UL<<irq),__ATOMIC_RELEASE);
+	}
+}
+
+//may be called from device threads
+void bus_request_poll(struct bus *bus)
+{
+	__atomic_store_n(&bus->poll_request,1,__ATOMIC_RELEASE);
+}
+
+void poll_devices(struct bus *bus)
+{
+	__atomic_store_n(&bus->poll_request,0,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for(struct device *dev = bus->devices;dev;dev = dev->next){
+		if(dev->poll_func) dev->poll_func(dev);
+	}
 }
@@ -3,6 +3,10 @@
 #include "device.h"
 #include "cpu.h"
 #include "bus.h"
+#include "cachesim.h"
+#include "pmu.h"
+#include "tracer.h"
+#include "error.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -10,8 +14,6 @@
 #include <malloc.h>
 #include <assert.h>
 
-static struct cache *caches = NULL;
-
 
 static uint64_t get_addr_tag(struct cache *cache,uint64_t addr)
 {
@@ -54,17 +56,16 @@ void init_cache(struct cache *cache,struct cpu *cpu,char *name,int level,struct
 
 		break;
 	default:
-		printf("cache level(%d) error!(%s)\n",level,__func__);
-		exit(-1);
+		fatal("cache level(%d) error!(%s)\n",level,__func__);
 		break;
 	}
 
-	if(caches == NULL){
+	if(cpu->caches == NULL){
 		cache->next = NULL;
-		caches = cache;
+		cpu->caches = cache;
 	} else {
-		cache->next = caches;
-		caches = cache;
+		cache->next = cpu->caches;
+		cpu->caches = cache;
 	}
 
 	cache->line_size = line_size;
@@ -86,11 +87,15 @@ void init_cache(struct cache *cache,struct cpu *cpu,char *name,int level,struct
 
 	cache->entrys = malloc(cache->entrys_count * sizeof(struct cache_entry));
 	if(cache->entrys == NULL){
-		printf("alloc cache memory error:%s",strerror(errno));
-		exit(-1);
+		fatal("alloc cache memory error:%s",strerror(errno));
 	}
 	memset(cache->entrys,0,cache->entrys_count * sizeof(struct cache_entry));
 
+	cache->used_sets = calloc((cache->entrys_count/cache->ways + 63)/64,sizeof(uint64_t));
+	if(cache->used_sets == NULL){
+		fatal("alloc cache used sets error:%s",strerror(errno));
+	}
+
 #ifdef __CACHE_DEBUG_INFO__
 	printf("cache level:%d,cache name:%s,cache size:%ld\n",cache->level,cache->name,cache->size);
 	printf("cache line size:%ld cache entrys_count:%ld cache ways:%ld\n",cache->line_size,cache->entrys_count,cache->ways);
@@ -104,7 +109,12 @@ static void make_line_accessed(struct cache_line_info line_info)
 {
 	struct cache_entry *line = line_info.set + line_info.idx_in_set;
 	struct cache_entry *set  = line_info.set;
+	uint64_t set_idx;
+
 	if(set->head == NULL){
+		set_idx = (set - line_info.cache->entrys)/line_info.cache->ways;
+		line_info.cache->used_sets[set_idx/64] |= 1UL<<(set_idx%64);
+
 		set->head = line;
 		line->next = line;
 		line->prev = line;
@@ -182,7 +192,7 @@ static struct cache_line_info find_in_other_cache(struct cache *current_cache,ui
 {
 	struct cache_line_info line_info,ret;
 
-	struct cache *cache = caches;
+	struct cache *cache = current_cache->cpu->caches;
 	while(cache){
 		if(cache != current_cache){
 			line_info = find_in_cache(cache, addr);
@@ -229,7 +239,7 @@ static uint64_t get_addr_from_lineinfo(struct cache_line_info line_info)
 	struct cache_entry *line = line_info.set + line_info.idx_in_set;
 
 
-	return (line->tag << cache->tag_offset) | (((cache->entrys - line)/cache->ways)<<cache->idx_offset);
+	return (line->tag << cache->tag_offset) | (((line - cache->entrys)/cache->ways)<<cache->idx_offset);
 }
 
 static void writeback_cache_line(struct cache_line_info line_info)
@@ -238,17 +248,55 @@ static void writeback_cache_line(struct cache_line_info line_info)
 	struct cache_entry *line = line_info.set + line_info.idx_in_set;
 	uint64_t addr = get_addr_from_lineinfo(line_info);
 	struct ram *ram;
+	uint64_t begin;
 
 #ifdef __CACHE_DEBUG_LRU__
 	printf("lru writeback: cache name:%s addr:0x%lx\n",cache->name,addr);
 #endif
 
+	if(cache->cpu->pmu_counters[PMU_EVENT_WRITEBACK]) pmu_count(cache->cpu,PMU_EVENT_WRITEBACK);
+
 	while(!cache->ram){
 		cache = cache->next_level;
 	}
 	ram = cache->ram;
 
+	begin = tracer_begin(TRACER_WRITEBACK);
 	write_to_ram(ram, addr, CACHE_LINE_SIZE, line->data);
+	if(begin) tracer_end(TRACER_WRITEBACK,"writeback",begin,line_info.cache->name,addr,CACHE_LINE_SIZE);
+}
+
+//last level fill,from a cacheable device or from ram
+static void fill_line_from_memory(struct cache *cache,uint64_t addr,uint8_t *data)
+{
+	struct device *dev = find_device(cache->cpu->bus, addr);
+
+	while(!cache->ram){
+		cache = cache->next_level;
+	}
+
+	if(dev != NULL && (dev->flags & DEVICE_FLAG_CACHEABLE) && device_readable(dev)){
+		device_read_block(dev, addr, data, CACHE_LINE_SIZE);
+	}else{
+		read_from_ram(cache->ram, addr, CACHE_LINE_SIZE, data);
+	}
+}
+
+/*
+ * refill a clean line from ram,
+ * used when a line is restored without its data.
+ */
+void reload_cache_line(struct cache *cache,struct cache_entry *line)
+{
+	struct cache_line_info line_info;
+	uint64_t addr;
+
+	line_info.cache = cache;
+	line_info.set = cache->entrys + ((line - cache->entrys)/cache->ways)*cache->ways;
+	line_info.idx_in_set = line - line_info.set;
+	addr = get_addr_from_lineinfo(line_info);
+
+	fill_line_from_memory(cache, addr, line->data);
 }
 
 static void *read_line_from_ram(struct cache *cache,uint64_t addr)
@@ -256,6 +304,7 @@ static void *read_line_from_ram(struct cache *cache,uint64_t addr)
 	void *data;
 	struct cache_line_info lru_line_info = find_lru_line_in_cache(cache, addr);
 	struct cache_entry *lru_line = lru_line_info.set+lru_line_info.idx_in_set;
+	uint64_t begin = tracer_begin(TRACER_CACHE);
 
 	if(lru_line->coherency_state == CACHE_LINE_COHERENCY_MODIFIED_STATE){
 		writeback_cache_line(lru_line_info);
@@ -269,12 +318,13 @@ static void *read_line_from_ram(struct cache *cache,uint64_t addr)
 		data = read_line_from_ram(cache->next_level,addr);
 		memcpy(lru_line->data,data,CACHE_LINE_SIZE);
 	}else{
-		read_from_ram(cache->ram, addr, CACHE_LINE_SIZE, lru_line->data);
+		fill_line_from_memory(cache, addr, lru_line->data);
 	}
 
 	lru_line->tag = get_addr_tag(cache, addr);
 	lru_line->coherency_state = CACHE_LINE_COHERENCY_SHARED_STATE;
 	make_line_accessed(lru_line_info);
+	if(begin) tracer_end(TRACER_CACHE,"fill",begin,cache->name,addr,CACHE_LINE_SIZE);
 	return lru_line->data;
 }
 
@@ -298,22 +348,38 @@ static void *read_line_from_other_cache(struct cache *current,struct cache *othe
 	return lru_line->data;
 }
 
-static void invalid_other_cache_lines(struct cache*cur,uint64_t addr)
+static void invalid_other_cache_lines(struct cpu *cpu,struct cache*cur,uint64_t addr)
 {
 	struct cache_line_info line_info;
-	struct cache *cache = caches;
+	struct cache *cache = cpu->caches;
+
+	if((cpu->reservation & ~(uint64_t)(CACHE_LINE_SIZE - 1)) == addr){//the line of the lr is written
+		cpu->reservation = RESERVATION_NONE;
+	}
 	while(cache){
 		if(cache != cur){
 			line_info = find_in_cache(cache, addr);
 
 			if(line_info.idx_in_set != -1){
 				(line_info.set + line_info.idx_in_set)->coherency_state = CACHE_LINE_COHERENCY_INVALID_STATE;
+				if(cpu->pmu_counters[PMU_EVENT_INVALIDATION]) pmu_count(cpu,PMU_EVENT_INVALIDATION);
+				if(TRACER_ON(TRACER_COHERENCY)) tracer_instant(TRACER_COHERENCY,"invalidate",cache->name,addr,CACHE_LINE_SIZE);
 			}
 		}
 		cache = cache->next;
 	}
 }
 
+static void count_miss(struct cache *cache,uint64_t addr)
+{
+	struct cpu *cpu = cache->cpu;
+	enum pmu_event event = cache->level == 2 ? PMU_EVENT_L2_MISS :
+			cache == &cpu->icache ? PMU_EVENT_L1I_MISS : PMU_EVENT_L1D_MISS;
+
+	if(cpu->pmu_counters[event]) pmu_count(cpu,event);
+	if(TRACER_ON(TRACER_CACHE)) tracer_instant(TRACER_CACHE,"miss",cache->name,addr,CACHE_LINE_SIZE);
+}
+
 static void read_write_cache_line(struct cache *cache,uint64_t addr,void *data,uint8_t read)
 {
 	struct cache_line_info other_line_info;
@@ -324,99 +390,537 @@ static void read_write_cache_line(struct cache *cache,uint64_t addr,void *data,u
 
 	if(read){//read
 		if(line_info.idx_in_set == -1){//not found in local cache
+			cache->misses++;
+			count_miss(cache,addr);
 			other_line_info = find_in_other_cache(cache, addr);
 			if(other_line_info.idx_in_set == -1){//read from memory
+				if(cache->next_level){
+					cache->next_level->misses++;
+					count_miss(cache->next_level,addr);
+				}
 				line_data = read_line_from_ram(cache,addr);
 				memcpy(data,line_data,CACHE_LINE_SIZE);
 			} else { // found in other local cache
+				if(cache->next_level) cache->next_level->hits++;
 				line_data = read_line_from_other_cache(cache,other_line_info.cache,addr);
 				memcpy(data,line_data,CACHE_LINE_SIZE);
 			}
 		}else{//found in local cache
+			cache->hits++;
 			memcpy(data,(line_info.set + line_info.idx_in_set)->data,CACHE_LINE_SIZE);
 			make_line_accessed(line_info);
 		}
 	}else{//write,must hit
 		assert(line_info.idx_in_set != -1);
-		invalid_other_cache_lines(line_info.cache,addr);
+		invalid_other_cache_lines(cache->cpu,line_info.cache,addr);
 		memcpy((line_info.set + line_info.idx_in_set)->data,data,CACHE_LINE_SIZE);
 		(line_info.set + line_info.idx_in_set)->coherency_state = CACHE_LINE_COHERENCY_MODIFIED_STATE;
 	}
 }
 
-uint8_t get_byte_from_cache(struct cache *cache,uint64_t addr)
+//memory path,the access is split at cache line boundaries
+static uint64_t read_from_cache(struct cache *cache,uint64_t addr,int size)
 {
-	uint8_t data[CACHE_LINE_SIZE] = {0};
+	uint8_t data[CACHE_LINE_SIZE];
 	uint64_t base_addr = (addr & (~(uint64_t)(CACHE_LINE_SIZE - 1)));
 	uint64_t offset = addr - base_addr;
+	uint64_t x = 0;
+
 	read_write_cache_line(cache, base_addr, data, 1);//read
+	for(int i = 0;i<size;i++){
+		if(offset == CACHE_LINE_SIZE){
+			base_addr += CACHE_LINE_SIZE;
+			offset = 0;
+			read_write_cache_line(cache, base_addr, data, 1);//read
+		}
+		x |= (uint64_t)data[offset++] << (i*8);
+	}
 
-	return data[offset];
+	return x;
 }
 
-uint16_t get_word_from_cache(struct cache *cache,uint64_t addr)
+static void write_to_cache(struct cache *cache,uint64_t addr,int size,uint64_t x)// read before write
 {
-	return (uint16_t)get_byte_from_cache(cache,addr) | (uint16_t)(get_byte_from_cache(cache,addr+1)<<8);
+	uint8_t data[CACHE_LINE_SIZE];
+	uint64_t base_addr = (addr & (~(uint64_t)(CACHE_LINE_SIZE - 1)));
+	uint64_t offset = addr - base_addr;
+
+	read_write_cache_line(cache, base_addr, data, 1);//read
+	for(int i = 0;i<size;i++){
+		if(offset == CACHE_LINE_SIZE){
+			read_write_cache_line(cache, base_addr, data, 0);//write
+			base_addr += CACHE_LINE_SIZE;
+			offset = 0;
+			read_write_cache_line(cache, base_addr, data, 1);//read
+		}
+		data[offset++] = x >> (i*8);
+	}
+	read_write_cache_line(cache, base_addr, data, 0);//write
 }
 
-uint32_t get_dword_from_cache(struct cache *cache,uint64_t addr)
+/*
+ * uncached devices are accessed with one sized callback,
+ * cacheable devices are read through the caches.
+ */
+static uint64_t load_from_cache(struct cache *cache,uint64_t addr,int size)
+{
+	struct device *dev = find_device(cache->cpu->bus, addr);
+	uint64_t x = 0;
+
+	if(dev != NULL && device_readable(dev) && (!(dev->flags & DEVICE_FLAG_CACHEABLE) || cache->cpu->functional)){ // read device
+		return device_read(dev, addr, size);
+	}
+
+	if(cache->cpu->functional){//caches bypassed
+		if(cache->cpu->cachesim){
+			cachesim_access(cache->cpu, addr, size, cache == &cache->cpu->icache ? CACHESIM_FETCH : CACHESIM_LOAD);
+		}
+		read_from_ram(cache->cpu->ram, addr, size, (uint8_t *)&x);
+		return x;
+	}
+
+	return read_from_cache(cache, addr, size);
+}
+
+static void invalid_device_lines(struct device *dev,uint64_t addr,uint64_t len)
 {
-	return (uint32_t)get_word_from_cache(cache,addr) | (uint32_t)get_word_from_cache(cache,addr+2)<<16;
+	uint64_t base_addr;
+
+	if(!(dev->flags & DEVICE_FLAG_CACHEABLE)) return;
+
+	//drop the stale copies
+	for(base_addr = addr & (~(uint64_t)(CACHE_LINE_SIZE - 1));base_addr < addr + len;base_addr += CACHE_LINE_SIZE){
+		invalid_other_cache_lines(dev->bus->cpu, NULL, base_addr);
+	}
 }
 
-uint64_t get_qword_from_cache(struct cache *cache,uint64_t addr)
+uint8_t get_byte_from_cache(struct cache *cache,uint64_t addr)
 {
-	return (uint64_t)get_dword_from_cache(cache,addr) | (uint64_t)get_dword_from_cache(cache,addr+4)<<32;
+	return load_from_cache(cache, addr, 1);
 }
 
-void put_byte_to_cache(struct cache *cache,uint64_t addr,uint8_t x)// read before write
+uint16_t get_word_from_cache(struct cache *cache,uint64_t addr)
 {
+	return load_from_cache(cache, addr, 2);
+}
 
-	struct cpu *cpu = cache->cpu;
-	struct device *dev;
-	dev = find_device(cpu->bus, addr);
+uint32_t get_dword_from_cache(struct cache *cache,uint64_t addr)
+{
+	return load_from_cache(cache, addr, 4);
+}
 
-	uint8_t data[CACHE_LINE_SIZE] = {0};
-	uint64_t base_addr = (addr & (~(uint64_t)(CACHE_LINE_SIZE - 1)));
-	uint64_t offset = addr - base_addr;
+uint64_t get_qword_from_cache(struct cache *cache,uint64_t addr)
+{
+	return load_from_cache(cache, addr, 8);
+}
 
-	if(dev == NULL || dev->write_byte_func == NULL){ // write memory
-		read_write_cache_line(cache, base_addr, data, 1);//read
-		data[offset] = x;
-		read_write_cache_line(cache, base_addr, data, 0);//write
+static void store_to_cache(struct cache *cache,uint64_t addr,int size,uint64_t x)
+{
+	struct device *dev = find_device(cache->cpu->bus, addr);
+
+	if(dev == NULL || !device_writable(dev)){ // write memory
+		if(cache->cpu->functional){//caches bypassed
+			if(cache->cpu->cachesim) cachesim_access(cache->cpu, addr, size, CACHESIM_STORE);
+			write_to_ram(cache->cpu->ram, addr, size, (uint8_t *)&x);
+		}else{
+			write_to_cache(cache, addr, size, x);
+		}
 	} else {
-		dev->write_byte_func(dev,addr,x);
+		device_write(dev, addr, size, x);
+		invalid_device_lines(dev, addr, size);
 	}
 }
 
+void put_byte_to_cache(struct cache *cache,uint64_t addr,uint8_t x)
+{
+	store_to_cache(cache, addr, 1, x);
+}
+
 void put_word_to_cache(struct cache *cache,uint64_t addr,uint16_t x)
 {
-	put_byte_to_cache(cache,addr,x);
-	put_byte_to_cache(cache,addr+1,x>>8);
+	store_to_cache(cache, addr, 2, x);
 }
 
 void put_dword_to_cache(struct cache *cache,uint64_t addr,uint32_t x)
 {
-	put_word_to_cache(cache,addr,x);
-	put_word_to_cache(cache,addr+2,x>>16);
+	store_to_cache(cache, addr, 4, x);
 }
 
 void put_qword_to_cache(struct cache *cache,uint64_t addr,uint64_t x)
 {
-	put_dword_to_cache(cache,addr,x);
-	put_dword_to_cache(cache,addr+4,x>>32);
+	store_to_cache(cache, addr, 8, x);
 }
 
-void put_data_to_cache(struct cache *cache,uint64_t addr,uint64_t pdata,uint64_t len)
+static uint64_t amo_value(enum amo_op op,int size,uint64_t old,uint64_t x)
 {
+	int64_t a = size == 4 ? (int32_t)old : (int64_t)old;
+	int64_t b = size == 4 ? (int32_t)x : (int64_t)x;
+	uint64_t ua = size == 4 ? (uint32_t)old : old;
+	uint64_t ub = size == 4 ? (uint32_t)x : x;
+
+	switch(op){
+	case AMO_SWAP:
+		return x;
+	case AMO_ADD:
+		return old + x;
+	case AMO_XOR:
+		return old ^ x;
+	case AMO_AND:
+		return old & x;
+	case AMO_OR:
+		return old | x;
+	case AMO_MIN:
+		return a < b ? old : x;
+	case AMO_MAX:
+		return a > b ? old : x;
+	case AMO_MINU:
+		return ua < ub ? old : x;
+	default://AMO_MAXU
+		return ua > ub ? old : x;
+	}
+}
+
+static uint32_t amo_ram_dword(uint32_t *p,enum amo_op op,uint32_t x)
+{
+	uint32_t old;
+
+	switch(op){
+	case AMO_SWAP:
+		return __atomic_exchange_n(p,x,__ATOMIC_SEQ_CST);
+	case AMO_ADD:
+		return __atomic_fetch_add(p,x,__ATOMIC_SEQ_CST);
+	case AMO_XOR:
+		return __atomic_fetch_xor(p,x,__ATOMIC_SEQ_CST);
+	case AMO_AND:
+		return __atomic_fetch_and(p,x,__ATOMIC_SEQ_CST);
+	case AMO_OR:
+		return __atomic_fetch_or(p,x,__ATOMIC_SEQ_CST);
+	default://min and max have no host instruction
+		old = __atomic_load_n(p,__ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(p,&old,amo_value(op,4,old,x),1,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED));
+		return old;
+	}
+}
+
+static uint64_t amo_ram_qword(uint64_t *p,enum amo_op op,uint64_t x)
+{
+	uint64_t old;
+
+	switch(op){
+	case AMO_SWAP:
+		return __atomic_exchange_n(p,x,__ATOMIC_SEQ_CST);
+	case AMO_ADD:
+		return __atomic_fetch_add(p,x,__ATOMIC_SEQ_CST);
+	case AMO_XOR:
+		return __atomic_fetch_xor(p,x,__ATOMIC_SEQ_CST);
+	case AMO_AND:
+		return __atomic_fetch_and(p,x,__ATOMIC_SEQ_CST);
+	case AMO_OR:
+		return __atomic_fetch_or(p,x,__ATOMIC_SEQ_CST);
+	default:
+		old = __atomic_load_n(p,__ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(p,&old,amo_value(op,8,old,x),1,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED));
+		return old;
+	}
+}
+
+//ram of an aligned access when the caches are bypassed,NULL when the model is used
+static uint8_t *atomic_ram_ptr(struct cache *cache,uint64_t addr,int size,enum cachesim_type type)
+{
+	struct cpu *cpu = cache->cpu;
+	uint8_t *p;
+
+	if(!cpu->functional || find_device(cpu->bus, addr) != NULL) return NULL;
+	p = ram_ptr(cpu->ram, addr, size);
+	if(p == NULL) return NULL;
+
+	if(cpu->cachesim) cachesim_access(cpu, addr, size, type);
+	if(type == CACHESIM_STORE) ram_mark_dirty(cpu->ram, addr, size);
+	return p;
+}
+
+/*
+ * addr is aligned to size,4 or 8.return the old value.
+ * ram is updated with host atomics when the caches are bypassed,
+ * so device threads writing ram at the same time are not lost.
+ * otherwise the read and the write go through the caches back to back.
+ */
+uint64_t amo_to_cache(struct cache *cache,uint64_t addr,int size,enum amo_op op,uint64_t x)
+{
+	uint8_t *p = atomic_ram_ptr(cache, addr, size, CACHESIM_STORE);
+	uint64_t old;
+
+	if(p){
+		return size == 4 ? amo_ram_dword((uint32_t *)p, op, x) : amo_ram_qword((uint64_t *)p, op, x);
+	}
+
+	old = load_from_cache(cache, addr, size);
+	store_to_cache(cache, addr, size, amo_value(op, size, old, x));
+	return old;
+}
 
+//the reservation is dropped by a write to its line,see invalid_other_cache_lines()
+uint64_t load_reserved_from_cache(struct cache *cache,uint64_t addr,int size)
+{
+	struct cpu *cpu = cache->cpu;
+	uint8_t *p = atomic_ram_ptr(cache, addr, size, CACHESIM_LOAD);
+	uint64_t x;
+
+	if(p){
+		x = size == 4 ? __atomic_load_n((uint32_t *)p,__ATOMIC_SEQ_CST) : __atomic_load_n((uint64_t *)p,__ATOMIC_SEQ_CST);
+	}else{
+		x = load_from_cache(cache, addr, size);
+	}
+
+	cpu->reservation = addr;
+	cpu->reserved_value = x;
+	return x;
+}
+
+/*
+ * return 0 when x is stored,1 when the reservation is lost.
+ * bypassed caches do not see the writes,the value loaded by the lr
+ * must then still be in ram.
+ */
+int store_conditional_to_cache(struct cache *cache,uint64_t addr,int size,uint64_t x)
+{
+	struct cpu *cpu = cache->cpu;
+	uint64_t expected = cpu->reserved_value;
+	uint32_t expected_dword = expected;
+	uint8_t *p;
+
+	if(cpu->reservation != addr) return 1;
+	cpu->reservation = RESERVATION_NONE;
+
+	p = atomic_ram_ptr(cache, addr, size, CACHESIM_STORE);
+	if(p){
+		if(size == 4){
+			return !__atomic_compare_exchange_n((uint32_t *)p,&expected_dword,(uint32_t)x,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+		}
+		return !__atomic_compare_exchange_n((uint64_t *)p,&expected,x,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+	}
+
+	store_to_cache(cache, addr, size, x);
+	return 0;
+}
+
+/*
+ * read guest memory for the emulator itself,e.g. to walk the stack.
+ * no line is filled or made accessed and no counter changes.
+ * return 0 if addr is not in ram.
+ */
+int peek_qword_from_caches(struct cpu *cpu,uint64_t addr,uint64_t *x)
+{
+	struct cache_line_info line_info;
+	struct cache_entry *line;
+
+	if(addr & 7) return 0;
+
+	for(struct cache *cache = cpu->caches;cache;cache = cache->next){
+		line_info = find_in_cache(cache, addr);
+		if(line_info.idx_in_set != -1){
+			line = line_info.set + line_info.idx_in_set;
+			memcpy(x,line->data + (addr & (CACHE_LINE_SIZE - 1)),8);
+			return 1;
+		}
+	}
+
+	if(ram_ptr(cpu->ram,addr,8) == NULL) return 0;
+	memcpy(x,cpu->ram->data + addr,8);
+	return 1;
+}
+
+//bulk access,one block callback for devices,one line access per cache line for memory
+void get_data_from_cache(struct cache *cache,uint64_t addr,uint8_t *pdata,uint64_t len)
+{
+	uint8_t data[CACHE_LINE_SIZE];
+	uint64_t base_addr,offset,n;
+	struct device *dev = find_device(cache->cpu->bus, addr);
+
+	if(dev != NULL && device_readable(dev) && (!(dev->flags & DEVICE_FLAG_CACHEABLE) || cache->cpu->functional)){ // read device
+		device_read_block(dev, addr, pdata, len);
+		return;
+	}
+
+	while(len){
+		base_addr = (addr & (~(uint64_t)(CACHE_LINE_SIZE - 1)));
+		offset = addr - base_addr;
+		n = CACHE_LINE_SIZE - offset < len ? CACHE_LINE_SIZE - offset : len;
+
+		if(cache->cpu->functional){//caches bypassed
+			if(cache->cpu->cachesim) cachesim_access(cache->cpu, addr, n, CACHESIM_LOAD);
+			read_from_ram(cache->cpu->ram, addr, n, pdata);
+		}else{
+			read_write_cache_line(cache, base_addr, data, 1);//read
+			memcpy(pdata, data + offset, n);
+		}
+
+		addr += n;
+		pdata += n;
+		len -= n;
+	}
+}
+
+void put_data_to_cache(struct cache *cache,uint64_t addr,uint8_t *pdata,uint64_t len)
+{
+	uint8_t data[CACHE_LINE_SIZE];
+	uint64_t base_addr,offset,n;
+	struct device *dev = find_device(cache->cpu->bus, addr);
+
+	if(dev != NULL && device_writable(dev)){ // write device
+		device_write_block(dev, addr, pdata, len);
+		invalid_device_lines(dev, addr, len);
+		return;
+	}
+
+	while(len){
+		base_addr = (addr & (~(uint64_t)(CACHE_LINE_SIZE - 1)));
+		offset = addr - base_addr;
+		n = CACHE_LINE_SIZE - offset < len ? CACHE_LINE_SIZE - offset : len;
+
+		if(cache->cpu->functional){//caches bypassed
+			if(cache->cpu->cachesim) cachesim_access(cache->cpu, addr, n, CACHESIM_STORE);
+			write_to_ram(cache->cpu->ram, addr, n, pdata);
+		}else{
+			read_write_cache_line(cache, base_addr, data, 1);//read
+			memcpy(data + offset, pdata, n);
+			read_write_cache_line(cache, base_addr, data, 0);//write
+		}
+
+		addr += n;
+		pdata += n;
+		len -= n;
+	}
+}
+
+#define CACHE_RANGE_WRITEBACK 1
+#define CACHE_RANGE_INVALID   2
+
+static void sync_cache_line(struct cache_line_info line_info,int op)
+{
+	struct cache_entry *line = line_info.set + line_info.idx_in_set;
+
+	if((op & CACHE_RANGE_WRITEBACK) && line->coherency_state == CACHE_LINE_COHERENCY_MODIFIED_STATE){
+		writeback_cache_line(line_info);
+		line->coherency_state = CACHE_LINE_COHERENCY_SHARED_STATE;
+	}
+	if(op & CACHE_RANGE_INVALID){
+		line->coherency_state = CACHE_LINE_COHERENCY_INVALID_STATE;
+	}
+}
+
+static void sync_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len,int op)
+{
+	struct cache_line_info line_info;
+	struct cache *cache;
+	uint64_t base_addr,end,line_addr;
+
+	if(len == 0) return;
+
+	base_addr = addr & (~(uint64_t)(CACHE_LINE_SIZE - 1));
+	end = addr + len;
+
+	if((op & CACHE_RANGE_INVALID) && cpu->reservation >= base_addr && cpu->reservation < end){//ram changed under the lr
+		cpu->reservation = RESERVATION_NONE;
+	}
+
+	for(cache = cpu->caches;cache;cache = cache->next){
+		if(end - base_addr > cache->size){//walk the whole cache instead
+			line_info.cache = cache;
+			for(uint64_t i = 0;i<cache->entrys_count;i++){
+				line_info.set = cache->entrys + (i/cache->ways)*cache->ways;
+				line_info.idx_in_set = i%cache->ways;
+				if(!line_valid(cache->entrys + i)) continue;
+
+				line_addr = get_addr_from_lineinfo(line_info);
+				if(line_addr + CACHE_LINE_SIZE > addr && line_addr < end){
+					sync_cache_line(line_info,op);
+				}
+			}
+			continue;
+		}
+
+		for(line_addr = base_addr;line_addr < end;line_addr += CACHE_LINE_SIZE){
+			line_info = find_in_cache(cache, line_addr);
+			if(line_info.idx_in_set != -1){
+				sync_cache_line(line_info,op);
+			}
+		}
+	}
+}
+
+/*
+ * keep the caches coherent with agents accessing ram directly.
+ * writeback: modified lines are written to ram and stay valid.
+ * invalid:   lines are dropped,call it after ram has been changed.
+ * flush:     both,call it before ram is changed.
+ */
+void writeback_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	sync_cache_range(cpu,addr,len,CACHE_RANGE_WRITEBACK);
+}
+
+void invalid_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	sync_cache_range(cpu,addr,len,CACHE_RANGE_INVALID);
+}
+
+void flush_cache_range(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	sync_cache_range(cpu,addr,len,CACHE_RANGE_WRITEBACK|CACHE_RANGE_INVALID);
+}
+
+//write back and drop every line,e.g. before the caches are bypassed
+void flush_all_caches(struct cpu *cpu)
+{
+	struct cache_line_info line_info;
+	struct cache *cache;
+
+	for(cache = cpu->caches;cache;cache = cache->next){
+		line_info.cache = cache;
+		for(uint64_t i = 0;i<cache->entrys_count;i++){
+			if(!line_valid(cache->entrys + i)) continue;
+
+			line_info.set = cache->entrys + (i/cache->ways)*cache->ways;
+			line_info.idx_in_set = i%cache->ways;
+			sync_cache_line(line_info,CACHE_RANGE_WRITEBACK|CACHE_RANGE_INVALID);
+		}
+	}
+}
+
+/*
+ * drop every line without writing it back,the counts start again.
+ * only the sets that have held a line are cleared.
+ */
+void invalid_all_caches(struct cpu *cpu)
+{
+	uint64_t word,set_idx;
+
+	for(struct cache *cache = cpu->caches;cache;cache = cache->next){
+		for(uint64_t i = 0;i<(cache->entrys_count/cache->ways + 63)/64;i++){
+			word = cache->used_sets[i];
+			cache->used_sets[i] = 0;
+			while(word){
+				set_idx = i*64 + __builtin_ctzl(word);
+				word &= word - 1;
+				memset(cache->entrys + set_idx*cache->ways,0,cache->ways * sizeof(struct cache_entry));
+			}
+		}
+		cache->hits = 0;
+		cache->misses = 0;
+	}
+}
+
+struct cache *get_caches(struct cpu *cpu)
+{
+	return cpu->caches;
 }
 
-void print_caches(void)
+void print_caches(struct cpu *cpu)
 {
 	struct cache *cache = NULL;
 
-	cache = caches;
+	cache = cpu->caches;
 	printf("all caches:\n");
 	while(cache){
 		printf("\t%s\n",cache->name);
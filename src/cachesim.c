@@ -0,0 +1,235 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "cachesim.h"
+#include "cpu.h"
+#include "cache.h"
+#include "tracer.h"
+#include "error.h"
+
+static void init_cachesim_cache(struct cachesim_cache *cache,uint64_t size,uint64_t ways)
+{
+	cache->ways = ways;
+	cache->sets = size/CACHE_LINE_SIZE/ways;
+	cache->idx_bits = __builtin_ctzl(cache->sets);
+	cache->lines = calloc(cache->sets*ways,sizeof(struct cachesim_line));
+	if(cache->lines == NULL){
+		fatal("alloc cache simulation error(%s)\n",strerror(errno));
+	}
+}
+
+static struct cachesim_line *find_line(struct cachesim_cache *cache,uint64_t line)
+{
+	struct cachesim_line *set = cache->lines + (line & (cache->sets - 1))*cache->ways;
+	uint64_t tag = line >> cache->idx_bits;
+
+	for(uint64_t i = 0;i<cache->ways;i++){
+		if(set[i].state != CACHE_LINE_COHERENCY_INVALID_STATE && set[i].tag == tag) return set + i;
+	}
+	return NULL;
+}
+
+//an invalid way first,else the least recently used one,dirty victims need no work
+static void fill_line(struct cachesim_consumer *c,struct cachesim_cache *cache,uint64_t line)
+{
+	struct cachesim_line *set = cache->lines + (line & (cache->sets - 1))*cache->ways;
+	struct cachesim_line *victim = set;
+
+	for(uint64_t i = 0;i<cache->ways;i++){
+		if(set[i].state == CACHE_LINE_COHERENCY_INVALID_STATE){
+			victim = set + i;
+			break;
+		}
+		if(set[i].stamp < victim->stamp) victim = set + i;
+	}
+
+	victim->tag = line >> cache->idx_bits;
+	victim->state = CACHE_LINE_COHERENCY_SHARED_STATE;
+	victim->stamp = ++c->clock;
+}
+
+static const char *cache_names[3] = {"icache","dcache","cache"};
+
+//same counts as read_write_cache_line()
+static void simulate_access(struct cachesim_consumer *c,struct cachesim_access *access)
+{
+	struct cachesim_cache *l1 = c->caches + (access->type == CACHESIM_FETCH ? 0 : 1);
+	struct cachesim_cache *other = c->caches + (access->type == CACHESIM_FETCH ? 1 : 0);
+	struct cachesim_cache *l2 = c->caches + 2;
+	uint64_t line = access->addr / CACHE_LINE_SIZE;
+	struct cachesim_line *l;
+
+	l = find_line(l1,line);
+	if(l){
+		l1->hits++;
+		l->stamp = ++c->clock;
+	}else{
+		l1->misses++;
+		if(TRACER_ON(TRACER_CACHE)) tracer_instant(TRACER_CACHE,"miss",cache_names[l1 - c->caches],line * CACHE_LINE_SIZE,CACHE_LINE_SIZE);
+		if(find_line(other,line) || find_line(l2,line)){
+			l2->hits++;
+		}else{
+			l2->misses++;
+			if(TRACER_ON(TRACER_CACHE)) tracer_instant(TRACER_CACHE,"miss",cache_names[2],line * CACHE_LINE_SIZE,CACHE_LINE_SIZE);
+			fill_line(c,l2,line);
+		}
+		fill_line(c,l1,line);
+	}
+
+	//a write leaves the only copy,modified
+	if(access->type == CACHESIM_STORE){
+		if((l = find_line(other,line))) l->state = CACHE_LINE_COHERENCY_INVALID_STATE;
+		if((l = find_line(l2,line))) l->state = CACHE_LINE_COHERENCY_INVALID_STATE;
+		find_line(l1,line)->state = CACHE_LINE_COHERENCY_MODIFIED_STATE;
+	}
+	c->accesses++;
+
+#ifdef __CACHESIM_DEBUG__
+	printf("cachesim: pc 0x%lx addr 0x%lx size %d type %d\n",access->pc,access->addr,access->size,access->type);
+#endif
+}
+
+static void *cachesim_consumer(void *arg)
+{
+	struct cachesim_consumer *c = arg;
+	struct cachesim_ring *ring = &c->ring;
+	uint64_t head = ring->head,tail;
+	int spins = 0;
+
+	tracer_thread_name("cachesim");
+	while(1){
+		tail = __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE);
+		if(head == tail){
+			//the last tail is stored before stop
+			if(__atomic_load_n(&c->stop,__ATOMIC_ACQUIRE) && head == __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE)){
+				break;
+			}
+			if(++spins > CACHESIM_SPINS){
+				sched_yield();
+				spins = 0;
+			}
+			continue;
+		}
+
+		while(head != tail){
+			simulate_access(c,ring->buf + (head & (CACHESIM_RING_SIZE - 1)));
+			head++;
+		}
+		__atomic_store_n(&ring->head,head,__ATOMIC_RELEASE);
+		spins = 0;
+	}
+
+	return NULL;
+}
+
+struct cachesim *start_cachesim(struct cpu *cpu,int nr_consumers)
+{
+	struct cachesim *sim = malloc(sizeof(struct cachesim));
+	struct cachesim_consumer *c;
+
+	if(sim == NULL){
+		fatal("alloc cache simulation error(%s)\n",strerror(errno));
+	}
+	sim->nr_consumers = nr_consumers;
+	sim->consumers = memalign(64,nr_consumers*sizeof(struct cachesim_consumer));
+	if(sim->consumers == NULL){
+		fatal("alloc cache simulation error(%s)\n",strerror(errno));
+	}
+	memset(sim->consumers,0,nr_consumers*sizeof(struct cachesim_consumer));
+
+	for(int i = 0;i<nr_consumers;i++){
+		c = sim->consumers + i;
+		c->ring.buf = malloc(CACHESIM_RING_SIZE*sizeof(struct cachesim_access));
+		if(c->ring.buf == NULL){
+			fatal("alloc cache simulation ring error(%s)\n",strerror(errno));
+		}
+		init_cachesim_cache(c->caches + 0,LEVEL_1_SIZE,LEVEL_1_WAYS);
+		init_cachesim_cache(c->caches + 1,LEVEL_1_SIZE,LEVEL_1_WAYS);
+		init_cachesim_cache(c->caches + 2,LEVEL_2_SIZE,LEVEL_2_WAYS);
+	}
+	for(int i = 0;i<nr_consumers;i++){
+		if(pthread_create(&sim->consumers[i].thread,NULL,cachesim_consumer,sim->consumers + i)){
+			fatal("create cache simulation thread error\n");
+		}
+	}
+
+	cpu->functional = 1;
+	cpu->cachesim = sim;
+	return sim;
+}
+
+static void ring_push(struct cachesim_ring *ring,uint64_t pc,uint64_t addr,int size,enum cachesim_type type)
+{
+	uint64_t tail = ring->tail;
+	struct cachesim_access *access;
+	int spins = 0;
+
+	if(tail - ring->cached_head == CACHESIM_RING_SIZE){
+		ring->cached_head = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE);
+		if(tail - ring->cached_head == CACHESIM_RING_SIZE) ring->full_waits++;
+		while(tail - ring->cached_head == CACHESIM_RING_SIZE){
+			if(++spins > CACHESIM_SPINS){
+				sched_yield();
+				spins = 0;
+			}
+			ring->cached_head = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE);
+		}
+	}
+
+	access = ring->buf + (tail & (CACHESIM_RING_SIZE - 1));
+	access->pc = pc;
+	access->addr = addr;
+	access->size = size;
+	access->type = type;
+	__atomic_store_n(&ring->tail,tail + 1,__ATOMIC_RELEASE);
+}
+
+//an access of the cpu,split at the cache line boundary
+void cachesim_access(struct cpu *cpu,uint64_t addr,int size,enum cachesim_type type)
+{
+	struct cachesim *sim = cpu->cachesim;
+	uint64_t pc = type == CACHESIM_FETCH ? addr : cpu->pc - 4;
+	uint64_t line = addr / CACHE_LINE_SIZE;
+	uint64_t last = (addr + size - 1) / CACHE_LINE_SIZE;
+
+	ring_push(&sim->consumers[line & (sim->nr_consumers - 1)].ring,pc,addr,size,type);
+	if(last != line){
+		ring_push(&sim->consumers[last & (sim->nr_consumers - 1)].ring,pc,last*CACHE_LINE_SIZE,size,type);
+	}
+}
+
+//drain the rings,the counts are added to the caches of the cpu
+void stop_cachesim(struct cpu *cpu)
+{
+	struct cachesim *sim = cpu->cachesim;
+	struct cache *caches[3] = {&cpu->icache,&cpu->dcache,&cpu->cache};
+	struct cachesim_consumer *c;
+
+	for(int i = 0;i<sim->nr_consumers;i++){
+		c = sim->consumers + i;
+		__atomic_store_n(&c->stop,1,__ATOMIC_RELEASE);
+		pthread_join(c->thread,NULL);
+		for(int j = 0;j<3;j++){
+			caches[j]->hits += c->caches[j].hits;
+			caches[j]->misses += c->caches[j].misses;
+		}
+	}
+
+	cpu->cachesim = NULL;
+}
+
+void report_cachesim(struct cachesim *sim,FILE *f)
+{
+	uint64_t accesses = 0,full_waits = 0;
+
+	for(int i = 0;i<sim->nr_consumers;i++){
+		accesses += sim->consumers[i].accesses;
+		full_waits += sim->consumers[i].ring.full_waits;
+	}
+	fprintf(f,"cache simulation: %lu line accesses on %d threads,ring full %lu times\n",accesses,sim->nr_consumers,full_waits);
+}
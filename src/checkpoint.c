@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "cpu.h"
+#include "ram.h"
+#include "bus.h"
+#include "error.h"
+
+#define PAGE_OFFSET_NONE UINT64_MAX
+
+static uint64_t hash_page(uint8_t *data,uint64_t size)//FNV-1a
+{
+	uint64_t hash = 0xcbf29ce484222325UL;
+
+	for(uint64_t i = 0;i<size;i++){
+		hash ^= data[i];
+		hash *= 0x100000001b3UL;
+	}
+	return hash;
+}
+
+static int same_as_stored(struct checkpoint *ckpt,uint64_t data_offset,uint8_t *data,uint64_t size)
+{
+	uint8_t buf[RAM_PAGE_SIZE];
+
+	if(pread(ckpt->fd,buf,size,data_offset) != size){
+		fatal("read %s file error(%s)\n",ckpt->filename,strerror(errno));
+	}
+	return memcmp(buf,data,size) == 0;
+}
+
+static void insert_hash(struct checkpoint *ckpt,uint64_t hash,uint64_t data_offset);
+
+static void grow_hash_table(struct checkpoint *ckpt)
+{
+	struct checkpoint_hash_entry *old = ckpt->hash_table;
+	uint64_t old_size = ckpt->hash_table_size;
+
+	ckpt->hash_table_size = old_size ? old_size*2 : 1024;
+	ckpt->hash_table_used = 0;
+	ckpt->hash_table = calloc(ckpt->hash_table_size,sizeof(struct checkpoint_hash_entry));
+	if(ckpt->hash_table == NULL){
+		fatal("alloc checkpoint hash table error(%s)\n",strerror(errno));
+	}
+
+	for(uint64_t i = 0;i<old_size;i++){
+		if(old[i].data_offset) insert_hash(ckpt,old[i].hash,old[i].data_offset);
+	}
+	free(old);
+}
+
+static void insert_hash(struct checkpoint *ckpt,uint64_t hash,uint64_t data_offset)
+{
+	uint64_t i;
+
+	if((ckpt->hash_table_used + 1)*2 > ckpt->hash_table_size){
+		grow_hash_table(ckpt);
+	}
+
+	i = hash & (ckpt->hash_table_size - 1);
+	while(ckpt->hash_table[i].data_offset){
+		i = (i + 1) & (ckpt->hash_table_size - 1);
+	}
+	ckpt->hash_table[i].hash = hash;
+	ckpt->hash_table[i].data_offset = data_offset;
+	ckpt->hash_table_used++;
+}
+
+//return the offset of an identical stored page,0 if none
+static uint64_t lookup_hash(struct checkpoint *ckpt,uint64_t hash,uint8_t *data,uint64_t size)
+{
+	uint64_t i;
+
+	if(ckpt->hash_table_size == 0) return 0;
+
+	i = hash & (ckpt->hash_table_size - 1);
+	while(ckpt->hash_table[i].data_offset){
+		if(ckpt->hash_table[i].hash == hash && same_as_stored(ckpt,ckpt->hash_table[i].data_offset,data,size)){
+			return ckpt->hash_table[i].data_offset;
+		}
+		i = (i + 1) & (ckpt->hash_table_size - 1);
+	}
+	return 0;
+}
+
+struct checkpoint *create_checkpoint(char *filename,struct ram *ram)
+{
+	struct checkpoint_file_header hdr;
+	struct checkpoint *ckpt = malloc(sizeof(struct checkpoint));
+	if(ckpt == NULL){
+		fatal("alloc checkpoint error(%s)\n",strerror(errno));
+	}
+	memset(ckpt,0,sizeof(struct checkpoint));
+
+	ckpt->fd = open(filename,O_RDWR|O_CREAT|O_TRUNC,0644);
+	if(ckpt->fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+	ckpt->filename = filename;
+	ckpt->ram = ram;
+
+	ckpt->page_offsets = malloc(ram->nr_pages * sizeof(uint64_t));
+	if(ckpt->page_offsets == NULL){
+		fatal("alloc checkpoint page table error(%s)\n",strerror(errno));
+	}
+	for(uint64_t i = 0;i<ram->nr_pages;i++){
+		ckpt->page_offsets[i] = PAGE_OFFSET_NONE;
+	}
+
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,CHECKPOINT_MAGIC,sizeof(hdr.magic));
+	hdr.version = CHECKPOINT_VERSION;
+	hdr.page_size = RAM_PAGE_SIZE;
+	hdr.ram_size = ram->size;
+	write_full(ckpt->fd,&hdr,sizeof(hdr));
+
+	//the first record must hold every page
+	ram_mark_dirty(ram,0,ram->size);
+
+	return ckpt;
+}
+
+void write_checkpoint(struct checkpoint *ckpt,struct cpu *cpu)
+{
+	struct checkpoint_record_header hdr;
+	struct checkpoint_page_entry *entrys;
+	struct ram *ram = ckpt->ram;
+	uint64_t nr_entrys = 0;
+	uint64_t record_offset,data_offset,hash,size;
+	uint8_t *data;
+
+	entrys = malloc(ram->nr_pages * sizeof(struct checkpoint_page_entry));
+	if(entrys == NULL){
+		fatal("alloc checkpoint page entrys error(%s)\n",strerror(errno));
+	}
+
+	record_offset = lseek(ckpt->fd,0,SEEK_END);
+	memset(&hdr,0,sizeof(hdr));
+	write_full(ckpt->fd,&hdr,sizeof(hdr));
+
+	save_machine_state(cpu,ckpt->fd);
+
+	for(uint64_t page = 0;page<ram->nr_pages;page++){
+		if(!ram_test_and_clear_dirty(ram,page)) continue;
+
+		if(ram_page_is_zero(ram,page)){
+			data_offset = 0;
+		}else{
+			data = ram->data + (page << RAM_PAGE_SHIFT);
+			size = ram_page_size(ram,page);
+			hash = hash_page(data,size);
+
+			data_offset = lookup_hash(ckpt,hash,data,size);
+			if(data_offset == 0){
+				data_offset = lseek(ckpt->fd,0,SEEK_CUR);
+				write_full(ckpt->fd,data,size);
+				insert_hash(ckpt,hash,data_offset);
+			}
+		}
+
+		if(ckpt->page_offsets[page] == data_offset) continue;//written back unchanged
+
+		ckpt->page_offsets[page] = data_offset;
+		entrys[nr_entrys].page = page;
+		entrys[nr_entrys].data_offset = data_offset;
+		nr_entrys++;
+	}
+
+	hdr.page_table_offset = lseek(ckpt->fd,0,SEEK_CUR);
+	write_full(ckpt->fd,entrys,nr_entrys * sizeof(struct checkpoint_page_entry));
+
+	hdr.magic = CHECKPOINT_RECORD_MAGIC;
+	hdr.seq = ckpt->seq++;
+	hdr.instret = cpu->instret;
+	hdr.prev_offset = ckpt->last_record_offset;
+	hdr.record_size = lseek(ckpt->fd,0,SEEK_CUR) - record_offset;
+	hdr.nr_pages = nr_entrys;
+	if(pwrite(ckpt->fd,&hdr,sizeof(hdr),record_offset) != sizeof(hdr)){
+		fatal("write %s file error(%s)\n",ckpt->filename,strerror(errno));
+	}
+	ckpt->last_record_offset = record_offset;
+
+#ifdef __CHECKPOINT_DEBUG__
+	printf("%s: seq:%d instret:%ld pages:%ld record_size:%ld\n",__func__,hdr.seq,hdr.instret,hdr.nr_pages,hdr.record_size);
+#endif
+
+	free(entrys);
+}
+
+void close_checkpoint(struct checkpoint *ckpt)
+{
+	close(ckpt->fd);
+	free(ckpt->hash_table);
+	free(ckpt->page_offsets);
+	free(ckpt);
+}
+
+static int open_checkpoint(char *filename,struct checkpoint_file_header *file_hdr)
+{
+	int fd = open(filename,O_RDONLY);
+	if(fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+
+	read_full(fd,file_hdr,sizeof(struct checkpoint_file_header));
+	if(memcmp(file_hdr->magic,CHECKPOINT_MAGIC,sizeof(file_hdr->magic)) ||
+			file_hdr->version != CHECKPOINT_VERSION || file_hdr->page_size != RAM_PAGE_SIZE){
+		fatal("%s is not a checkpoint file\n",filename);
+	}
+	return fd;
+}
+
+//the chain is walked and the page tables of all records are read,once
+struct checkpoint_reader *open_checkpoint_reader(char *filename)
+{
+	struct checkpoint_file_header file_hdr;
+	struct checkpoint_record_header hdr;
+	struct checkpoint_reader *reader;
+	struct checkpoint_record_index *rec;
+	uint64_t offset,file_size,nr_pages,size = 0;
+
+	reader = calloc(1,sizeof(struct checkpoint_reader));
+	if(reader == NULL){
+		fatal("alloc checkpoint reader error(%s)\n",strerror(errno));
+	}
+	reader->fd = open_checkpoint(filename,&file_hdr);
+	reader->filename = filename;
+	reader->ram_size = file_hdr.ram_size;
+	reader->loaded = CHECKPOINT_NO_RECORD;
+
+	nr_pages = (file_hdr.ram_size + RAM_PAGE_SIZE - 1) >> RAM_PAGE_SHIFT;
+	reader->page_offsets = calloc(nr_pages,sizeof(uint64_t));
+	if(reader->page_offsets == NULL){
+		fatal("alloc checkpoint page table error(%s)\n",strerror(errno));
+	}
+
+	file_size = lseek(reader->fd,0,SEEK_END);
+	offset = sizeof(struct checkpoint_file_header);
+	while(offset < file_size){
+		if(pread(reader->fd,&hdr,sizeof(hdr),offset) != sizeof(hdr) || hdr.magic != CHECKPOINT_RECORD_MAGIC){
+			break;//truncated record
+		}
+
+		if(reader->nr_records == size){
+			size = size ? size*2 : 64;
+			reader->records = realloc(reader->records,size * sizeof(struct checkpoint_record_index));
+			if(reader->records == NULL){
+				fatal("alloc checkpoint records error(%s)\n",strerror(errno));
+			}
+		}
+		rec = reader->records + reader->nr_records++;
+		rec->seq = hdr.seq;
+		rec->state_offset = offset + sizeof(hdr);
+		rec->nr_pages = hdr.nr_pages;
+		rec->entrys = malloc(hdr.nr_pages * sizeof(struct checkpoint_page_entry) + 1);
+		if(rec->entrys == NULL){
+			fatal("alloc checkpoint page entrys error(%s)\n",strerror(errno));
+		}
+		lseek(reader->fd,hdr.page_table_offset,SEEK_SET);
+		read_full(reader->fd,rec->entrys,hdr.nr_pages * sizeof(struct checkpoint_page_entry));
+
+		offset += hdr.record_size;
+	}
+	return reader;
+}
+
+void close_checkpoint_reader(struct checkpoint_reader *reader)
+{
+	for(uint32_t i = 0;i<reader->nr_records;i++){
+		free(reader->records[i].entrys);
+	}
+	free(reader->records);
+	free(reader->page_offsets);
+	close(reader->fd);
+	free(reader);
+}
+
+static uint32_t find_record(struct checkpoint_reader *reader,uint32_t seq)
+{
+	if(seq == CHECKPOINT_LAST_SEQ && reader->nr_records){
+		return reader->nr_records - 1;
+	}
+	for(uint32_t i = 0;i<reader->nr_records;i++){
+		if(reader->records[i].seq == seq) return i;
+	}
+	fatal("%s: no checkpoint %u in %s\n",__func__,seq,reader->filename);
+}
+
+static void apply_record(struct checkpoint_reader *reader,struct ram *ram,uint32_t r)
+{
+	struct checkpoint_record_index *rec = reader->records + r;
+
+	for(uint64_t i = 0;i<rec->nr_pages;i++){
+		reader->page_offsets[rec->entrys[i].page] = rec->entrys[i].data_offset;
+		ram_mark_dirty(ram,rec->entrys[i].page << RAM_PAGE_SHIFT,1);
+	}
+}
+
+/*
+ * bring ram to record r.the dirty pages are the ones that differ from the
+ * record loaded before,written by the guest since or changed by the records
+ * in between,only they are read.going back or into another ram reads all.
+ * return the offset of the machine state of the record.
+ */
+static uint64_t load_record(struct checkpoint_reader *reader,struct ram *ram,uint32_t r)
+{
+	uint64_t word,page,size;
+	uint32_t i = 0;
+
+	if(reader->loaded != CHECKPOINT_NO_RECORD && reader->ram == ram && reader->loaded <= r){
+		i = reader->loaded + 1;
+	}else{
+		memset(reader->page_offsets,0,ram->nr_pages * sizeof(uint64_t));
+		ram_mark_dirty(ram,0,ram->size);
+	}
+	for(;i<=r;i++){
+		apply_record(reader,ram,i);
+	}
+
+	for(uint64_t w = 0;w<(ram->nr_pages + 63)/64;w++){
+		if(ram->dirty_bitmap[w] == 0) continue;
+
+		word = __atomic_exchange_n(&ram->dirty_bitmap[w],0,__ATOMIC_RELAXED);
+		while(word){
+			page = w*64 + __builtin_ctzl(word);
+			word &= word - 1;
+			size = ram_page_size(ram,page);
+			if(reader->page_offsets[page] == 0){
+				memset(ram->data + (page << RAM_PAGE_SHIFT),0,size);
+			}else if(pread(reader->fd,ram->data + (page << RAM_PAGE_SHIFT),size,reader->page_offsets[page]) != size){
+				fatal("read %s file error(%s)\n",reader->filename,strerror(errno));
+			}
+		}
+	}
+
+	reader->loaded = r;
+	reader->ram = ram;
+	return reader->records[r].state_offset;
+}
+
+struct cpu *restore_checkpoint(struct bus *bus,char *filename,uint32_t seq)
+{
+	struct checkpoint_reader *reader = open_checkpoint_reader(filename);
+	struct cpu *cpu = reader_restore_checkpoint(reader,bus,seq);
+
+	close_checkpoint_reader(reader);
+	return cpu;
+}
+
+struct cpu *reader_restore_checkpoint(struct checkpoint_reader *reader,struct bus *bus,uint32_t seq)
+{
+	uint32_t r = find_record(reader,seq);
+	uint64_t state_offset;
+	struct ram *ram;
+	struct cpu *cpu;
+
+	ram = alloc_ram(reader->ram_size);
+	state_offset = load_record(reader,ram,r);
+
+	cpu = alloc_cpu(ram,bus);
+	lseek(reader->fd,state_offset,SEEK_SET);
+	restore_machine_state(cpu,reader->fd);
+
+#ifdef __CHECKPOINT_DEBUG__
+	printf("%s: %s seq:%d pc:0x%lx instret:%ld\n",__func__,reader->filename,seq,cpu->pc,cpu->instret);
+#endif
+
+	return cpu;
+}
+
+//restore into an existing machine,its ram must have the size of the checkpoint
+void reload_checkpoint(struct checkpoint_reader *reader,struct cpu *cpu,uint32_t seq)
+{
+	uint32_t r = find_record(reader,seq);
+	uint64_t state_offset;
+
+	if(reader->ram_size != cpu->ram->size){
+		fatal("%s: ram size mismatch(%ld != %ld)\n",__func__,reader->ram_size,cpu->ram->size);
+	}
+	state_offset = load_record(reader,cpu->ram,r);
+
+	lseek(reader->fd,state_offset,SEEK_SET);
+	restore_machine_state(cpu,reader->fd);
+}
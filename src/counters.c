@@ -0,0 +1,326 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "counters.h"
+#include "cpu.h"
+#include "cache.h"
+#include "error.h"
+
+static const char *class_names[NR_INST_CLASSES] = {
+	"alu","load","store","atomic","vector","branch_taken","branch_not_taken","jump","csr","fence","system","other",
+};
+
+static uint16_t inst_key(uint32_t inst)
+{
+	uint32_t opcode = inst & 0x7f;
+	uint32_t funct3 = (inst >> 12) & 7;
+	uint32_t bit30 = (inst >> 30) & 1;
+
+	switch(opcode){
+	case 0x37://lui
+	case 0x17://auipc
+	case 0x6F://jal
+		funct3 = 0;
+		bit30 = 0;
+		break;
+	case 0x33:
+	case 0x3B:
+		break;
+	case 0x13:
+	case 0x1B:
+		if(funct3 != 5) bit30 = 0;//srai,sraiw
+		break;
+	default:
+		bit30 = 0;
+		break;
+	}
+	if(bitmanip_inst(inst)) return opcode | 1 << 11;//one key per opcode
+	return opcode | funct3 << 7 | bit30 << 10;
+}
+
+static enum inst_class key_class(uint16_t key)
+{
+	switch(key & 0x7f){
+	case 0x13:
+	case 0x1B:
+	case 0x33:
+	case 0x3B:
+	case 0x37:
+	case 0x17:
+		return INST_CLASS_ALU;
+	case 0x3:
+	case 0x07:
+		return INST_CLASS_LOAD;
+	case 0x23:
+	case 0x27:
+		return INST_CLASS_STORE;
+	case 0x2F:
+		return INST_CLASS_ATOMIC;
+	case 0x57:
+		return INST_CLASS_VECTOR;
+	case 0x63:
+		return INST_CLASS_BRANCH_TAKEN;//split by the block's taken count
+	case 0x6F:
+	case 0x67:
+		return INST_CLASS_JUMP;
+	case 0xF:
+		return INST_CLASS_FENCE;
+	case 0x73:
+		return (key >> 7 & 7) ? INST_CLASS_CSR : INST_CLASS_SYSTEM;
+	default:
+		return INST_CLASS_OTHER;
+	}
+}
+
+static const char *key_name(uint16_t key)
+{
+	static const char *alu[8] = {"addi","slli","slti","sltiu","xori","srli","ori","andi"};
+	static const char *aluw[8] = {"addiw","slliw","?","?","?","srliw","?","?"};
+	static const char *reg[8] = {"add","sll","slt","sltu","xor","srl","or","and"};
+	static const char *regw[8] = {"addw","sllw","?","?","?","srlw","?","?"};
+	static const char *load[8] = {"lb","lh","lw","ld","lbu","lhu","lwu","?"};
+	static const char *store[8] = {"sb","sh","sw","sd","?","?","?","?"};
+	static const char *branch[8] = {"beq","bne","?","?","blt","bge","bltu","bgeu"};
+	static const char *csr[8] = {"system","csrrw","csrrs","csrrc","?","csrrwi","csrrsi","csrrci"};
+	static const char *vector[8] = {"opivv","opfvv","opmvv","opivi","opivx","opfvf","opmvx","vsetvl"};
+	static const char *vload[8] = {"vload.8","?","?","?","?","vload.16","vload.32","vload.64"};
+	static const char *vstore[8] = {"vstore.8","?","?","?","?","vstore.16","vstore.32","vstore.64"};
+	int funct3 = key >> 7 & 7;
+	int bit30 = key >> 10 & 1;
+
+	if(key >> 11){//Zba,Zbb and Zbs
+		switch(key & 0x7f){
+		case 0x13:
+			return "bitmanip.i";
+		case 0x1B:
+			return "bitmanip.iw";
+		case 0x33:
+			return "bitmanip";
+		default:
+			return "bitmanip.w";
+		}
+	}
+
+	switch(key & 0x7f){
+	case 0x13:
+		return bit30 ? "srai" : alu[funct3];
+	case 0x1B:
+		return bit30 ? "sraiw" : aluw[funct3];
+	case 0x33:
+		return bit30 ? (funct3 ? "sra" : "sub") : reg[funct3];
+	case 0x3B:
+		return bit30 ? (funct3 ? "sraw" : "subw") : regw[funct3];
+	case 0x37:
+		return "lui";
+	case 0x17:
+		return "auipc";
+	case 0x3:
+		return load[funct3];
+	case 0x23:
+		return store[funct3];
+	case 0x07://one key per element width
+		return vload[funct3];
+	case 0x27:
+		return vstore[funct3];
+	case 0x57:
+		return vector[funct3];
+	case 0x2F://lr,sc and the amos share the key
+		return funct3 == 2 ? "atomic.w" : funct3 == 3 ? "atomic.d" : "?";
+	case 0x63:
+		return branch[funct3];
+	case 0x6F:
+		return "jal";
+	case 0x67:
+		return "jalr";
+	case 0xF:
+		return funct3 ? "fence.i" : "fence";
+	case 0x73:
+		return csr[funct3];
+	default:
+		return "?";
+	}
+}
+
+static int ends_block(uint16_t key)
+{
+	switch(key_class(key)){
+	case INST_CLASS_BRANCH_TAKEN:
+	case INST_CLASS_JUMP:
+	case INST_CLASS_SYSTEM:
+		return 1;
+	default:
+		return (key & 0x7f) == 0xF && (key >> 7 & 7);//fence.i
+	}
+}
+
+//instruction words are read without touching the caches
+static uint32_t peek_inst(struct cpu *cpu,uint64_t pc)
+{
+	uint64_t x = 0;
+
+	peek_qword_from_caches(cpu,pc & ~7UL,&x);
+	return x >> ((pc & 4)*8);
+}
+
+static void decode_block(struct cpu *cpu,struct block_counter *block)
+{
+	block->len = 0;
+	while(block->len < COUNTERS_BLOCK_MAX_LEN){
+		block->keys[block->len] = inst_key(peek_inst(cpu,block->pc + 4*block->len));
+		if(ends_block(block->keys[block->len++])) break;
+	}
+}
+
+static void grow_blocks(struct counters *counters);
+
+static struct block_counter *lookup_block(struct cpu *cpu,struct counters *counters,uint64_t pc)
+{
+	struct block_counter *block;
+	uint64_t i;
+
+	if((counters->nr_blocks + 1)*2 > counters->table_size){
+		grow_blocks(counters);
+	}
+
+	i = (pc >> 2) & (counters->table_size - 1);
+	while(1){
+		block = counters->blocks + i;
+		if(block->len == 0) break;
+		if(block->pc == pc) return block;
+		i = (i + 1) & (counters->table_size - 1);
+	}
+
+	block->pc = pc;
+	decode_block(cpu,block);
+	counters->nr_blocks++;
+	return block;
+}
+
+static void grow_blocks(struct counters *counters)
+{
+	struct block_counter *old = counters->blocks;
+	uint64_t old_size = counters->table_size;
+	uint64_t cur = 0,i;
+
+	counters->table_size = old_size ? old_size*2 : 4096;
+	counters->blocks = calloc(counters->table_size,sizeof(struct block_counter));
+	if(counters->blocks == NULL){
+		fatal("alloc block counters error(%s)\n",strerror(errno));
+	}
+
+	for(uint64_t j = 0;j<old_size;j++){
+		if(old[j].len == 0) continue;
+		i = (old[j].pc >> 2) & (counters->table_size - 1);
+		while(counters->blocks[i].len) i = (i + 1) & (counters->table_size - 1);
+		counters->blocks[i] = old[j];
+		if(counters->cur == old + j) cur = i;
+	}
+	if(counters->cur) counters->cur = counters->blocks + cur;
+	free(old);
+}
+
+static void enter_block(struct cpu *cpu,struct counters *counters)
+{
+	counters->cur = lookup_block(cpu,counters,cpu->pc);
+	counters->block_left = counters->cur->len;
+}
+
+struct counters *start_counters(struct cpu *cpu)
+{
+	struct counters *counters = malloc(sizeof(struct counters));
+	if(counters == NULL){
+		fatal("alloc counters error(%s)\n",strerror(errno));
+	}
+	memset(counters,0,sizeof(struct counters));
+
+	cpu->counters = counters;
+	enter_block(cpu,counters);
+	return counters;
+}
+
+//the last instruction of the block has been executed
+void counters_end_block(struct cpu *cpu)
+{
+	struct counters *counters = cpu->counters;
+	struct block_counter *block = counters->cur;
+
+	block->execs++;
+	if(cpu->pc != block->pc + 4*block->len) block->taken++;
+	enter_block(cpu,counters);
+}
+
+//control left the block before its end,e.g. for an interrupt
+void counters_break_block(struct cpu *cpu)
+{
+	struct counters *counters = cpu->counters;
+	struct block_counter *block = counters->cur;
+
+	for(uint64_t i = 0;i<block->len - counters->block_left;i++){
+		counters->loose_keys[block->keys[i]]++;
+	}
+	enter_block(cpu,counters);
+}
+
+static int block_cmp(const void *a,const void *b)
+{
+	const struct block_counter *x = *(struct block_counter **)a,*y = *(struct block_counter **)b;
+	uint64_t nx = x->execs*x->len,ny = y->execs*y->len;
+
+	return nx < ny ? 1 : nx > ny ? -1 : 0;
+}
+
+void dump_counters(struct counters *counters,FILE *f)
+{
+	uint64_t classes[NR_INST_CLASSES] = {0};
+	uint64_t *keys;
+	uint64_t total = 0,not_taken = 0,n = 0;
+	struct block_counter *block,**top;
+
+	keys = malloc(COUNTERS_NR_KEYS * sizeof(uint64_t));
+	top = malloc((counters->nr_blocks + 1) * sizeof(struct block_counter *));
+	if(keys == NULL || top == NULL){
+		fatal("alloc counters dump error(%s)\n",strerror(errno));
+	}
+	memcpy(keys,counters->loose_keys,COUNTERS_NR_KEYS * sizeof(uint64_t));
+
+	for(uint64_t i = 0;i<counters->table_size;i++){
+		block = counters->blocks + i;
+		if(block->len == 0) continue;
+		top[n++] = block;
+		for(uint32_t j = 0;j<block->len;j++){
+			keys[block->keys[j]] += block->execs;
+		}
+		if(key_class(block->keys[block->len - 1]) == INST_CLASS_BRANCH_TAKEN){
+			not_taken += block->execs - block->taken;
+		}
+	}
+
+	for(int i = 0;i<COUNTERS_NR_KEYS;i++){
+		classes[key_class(i)] += keys[i];
+		total += keys[i];
+	}
+	classes[INST_CLASS_BRANCH_TAKEN] -= not_taken;
+	classes[INST_CLASS_BRANCH_NOT_TAKEN] += not_taken;
+
+	fprintf(f,"instruction mix(%lu instructions):\n",total);
+	for(int i = 0;i<NR_INST_CLASSES;i++){
+		fprintf(f,"  %-18s %14lu %6.2f%%\n",class_names[i],classes[i],total ? classes[i]*100.0/total : 0.0);
+	}
+
+	fprintf(f,"opcodes:\n");
+	for(int i = 0;i<COUNTERS_NR_KEYS;i++){
+		if(keys[i]) fprintf(f,"  %-18s %14lu %6.2f%%\n",key_name(i),keys[i],keys[i]*100.0/total);
+	}
+
+	qsort(top,n,sizeof(struct block_counter *),block_cmp);
+	fprintf(f,"basic blocks(%lu),top %d by instructions:\n",n,COUNTERS_TOP_BLOCKS);
+	for(uint64_t i = 0;i<n && i<COUNTERS_TOP_BLOCKS;i++){
+		fprintf(f,"  0x%-16lx len:%-3u execs:%-12lu taken:%lu\n",top[i]->pc,top[i]->len,top[i]->execs,top[i]->taken);
+	}
+
+	free(keys);
+	free(top);
+}
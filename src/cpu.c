@@ -7,14 +7,24 @@
 #include "cpu.h"
 #include "cache.h"
 #include "bus.h"
+#include "user.h"
+#include "profiler.h"
+#include "counters.h"
+#include "timing.h"
+#include "bpred.h"
+#include "pmu.h"
+#include "vector.h"
+#include "isa.h"
+#include "libcall.h"
+#include "tracer.h"
+#include "error.h"
 
 struct cpu* alloc_cpu(struct ram *ram,struct bus *bus)
 {
 	struct cpu *cpu = malloc(sizeof(struct cpu));
 
 	if(cpu == NULL) {
-		printf("alloc cpu error:%s",strerror(errno));
-		exit(-1);
+		fatal("alloc cpu error:%s",strerror(errno));
 	}
 	memset(cpu,0,sizeof(struct cpu));
 
@@ -23,11 +33,49 @@ struct cpu* alloc_cpu(struct ram *ram,struct bus *bus)
 	init_cache(&cpu->cache,cpu,"cache",2,ram,NULL);
 
 	cpu->regfile[2]	= ram->size;//sp
+	cpu->sample_at = UINT64_MAX;
+	cpu->reservation = RESERVATION_NONE;
+	init_vector(cpu);
+	init_isa();
 
 	cpu->bus = bus;
+	cpu->ram = ram;
+	bus->ram = ram;
+	bus->cpu = cpu;
 	return cpu;
 }
 
+//ram and bus are not freed
+//power on state,the caches are emptied without a writeback
+void reset_cpu(struct cpu *cpu)
+{
+	memset(cpu->regfile,0,sizeof(cpu->regfile));
+	memset(cpu->csrs,0,sizeof(cpu->csrs));
+	memset(cpu->pmu_counters,0,sizeof(cpu->pmu_counters));
+	cpu->regfile[2] = cpu->ram->size;//sp
+	cpu->pc = 0;
+	cpu->instret = 0;
+	cpu->reservation = RESERVATION_NONE;
+	init_vector(cpu);
+	cpu->halted = 0;
+	cpu->functional = 0;
+	invalid_all_caches(cpu);
+}
+
+void free_cpu(struct cpu *cpu)
+{
+	for(struct cache *cache = cpu->caches;cache;cache = cache->next){
+		free(cache->entrys);
+		free(cache->used_sets);
+	}
+	if(cpu->counters){
+		free(cpu->counters->blocks);
+		free(cpu->counters);
+	}
+	free(cpu->timing);
+	if(cpu->bpred) free_bpred(cpu->bpred);
+	free(cpu);
+}
 
 static uint64_t get_register(struct cpu *cpu,int idx)
 {
@@ -50,601 +98,560 @@ void dump_registers(struct cpu *cpu)
 }
 
 
-static void cpu_fetch(struct cpu *cpu)
+static void cpu_trap(struct cpu *cpu,uint64_t cause,uint64_t tval)
 {
-	cpu->inst.instruction = get_dword_from_cache(&cpu->icache, cpu->pc);
-	cpu->pc += 4;
+	uint64_t mstatus = cpu->csrs[CSR_MSTATUS];
+	uint64_t mtvec = cpu->csrs[CSR_MTVEC];
+
+	cpu->csrs[CSR_MEPC] = cpu->pc;
+	cpu->csrs[CSR_MCAUSE] = cause;
+	cpu->csrs[CSR_MTVAL] = tval;
+
+	mstatus = (mstatus & ~MSTATUS_MPIE) | ((mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+	mstatus = (mstatus & ~MSTATUS_MIE) | MSTATUS_MPP;
+	cpu->csrs[CSR_MSTATUS] = mstatus;
+
+	if((mtvec & 3) == 1 && (cause & CAUSE_INTERRUPT)){//vectored
+		cpu->pc = (mtvec & ~(uint64_t)3) + 4*(cause & ~CAUSE_INTERRUPT);
+	}else{
+		cpu->pc = mtvec & ~(uint64_t)3;
+	}
+
+	if(cpu->counters){
+		counters_break_block(cpu);
+	}
+	if(TRACER_ON(TRACER_TRAP)){
+		tracer_instant(TRACER_TRAP,(cause & CAUSE_INTERRUPT) ? "interrupt" : "exception",NULL,cpu->csrs[CSR_MEPC],cause & ~CAUSE_INTERRUPT);
+	}
 }
 
-static void cpu_exec(struct cpu *cpu)
+static void cpu_check_interrupts(struct cpu *cpu)
 {
-	int64_t sign_imm_64;
-	uint64_t unsign_imm_64;
-	uint8_t rd_idx;
-	uint8_t rs1_idx;
-	uint8_t rs2_idx;
-
-	uint64_t orig_pc_plus4;
-	int64_t mem_sign_data;
-	int64_t tmp_int64_t;
-	int64_t tmp_int32_t;
-
-	uint64_t csr;
-	switch(cpu->inst.r_type.opcode){
-	case 0x1B://I type
-		unsign_imm_64 = (uint64_t)cpu->inst.i_type.imm11_0;
-		sign_imm_64 = (int64_t)cpu->inst.i_type.imm11_0;
-		if(sign_imm_64 & 0x800){
-			sign_imm_64 |= (~0x7ff);
-		}
-		rd_idx = cpu->inst.i_type.rd;
-		rs1_idx = cpu->inst.i_type.rs1;
-		switch(cpu->inst.i_type.funct3){
-		case 0://addiw
-			tmp_int64_t =  get_register(cpu,rs1_idx) + sign_imm_64;
-			tmp_int64_t = (tmp_int64_t<<32)>>32;
-			set_register(cpu, rd_idx, tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("addiw\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
+	if(__atomic_load_n(&cpu->bus->irq_pending,__ATOMIC_ACQUIRE)){
+		cpu->csrs[CSR_MIP] |= MIP_MEIP;
+	}else{
+		cpu->csrs[CSR_MIP] &= ~MIP_MEIP;
+	}
+
+	if((cpu->csrs[CSR_MSTATUS] & MSTATUS_MIE) && (cpu->csrs[CSR_MIE] & cpu->csrs[CSR_MIP] & MIP_MEIP)){
+		cpu_trap(cpu,CAUSE_INTERRUPT | CAUSE_MACHINE_EXTERNAL_INTERRUPT,0);
+	}
+}
+
+static void cpu_mret(struct cpu *cpu)
+{
+	uint64_t mstatus = cpu->csrs[CSR_MSTATUS];
+
+	mstatus = (mstatus & ~MSTATUS_MIE) | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+	mstatus |= MSTATUS_MPIE;
+	cpu->csrs[CSR_MSTATUS] = mstatus;
+
+	cpu->pc = cpu->csrs[CSR_MEPC];
+	if(TRACER_ON(TRACER_TRAP)) tracer_instant(TRACER_TRAP,"mret",NULL,cpu->pc,0);
+}
+
+//synchronous trap of the instruction just fetched,user mode has no handler and stops like on a signal
+static void cpu_exception(struct cpu *cpu,uint64_t cause,uint64_t tval)
+{
+	if(cpu->user){
+		if(!cpu->quiet) dump_registers(cpu);
+		fatal("%s: exception %lu(pc:0x%lx inst:0x%x tval:0x%lx)\n",__func__,cause,cpu->pc-4,cpu->inst.instruction,tval);
+	}
+	cpu->pc -= 4;
+	cpu_trap(cpu,cause,tval);
+}
+
+static void illegal_instruction(struct cpu *cpu)
+{
+	cpu_exception(cpu,CAUSE_ILLEGAL_INSTRUCTION,cpu->inst.instruction);
+}
+
+/*
+ * csrs 0xc00-0xfff are read only,user mode has no machine csr
+ * and reads the counters enabled by mcounteren.
+ */
+static int csr_accessible(struct cpu *cpu,uint64_t csr,int write)
+{
+	if(write && (csr >> 10) == 3) return 0;
+	if(cpu->user){
+		if(csr >> 8 & 3) return 0;
+		if(csr >= CSR_CYCLE && csr < CSR_CYCLE + 32) return cpu->csrs[CSR_MCOUNTEREN] >> (csr - CSR_CYCLE) & 1;
+	}
+	return 1;
+}
+
+static uint64_t read_csr(struct cpu *cpu,uint64_t csr)
+{
+	if(vector_csr(csr)) return vector_read_csr(cpu,csr);
+	return pmu_csr(csr) ? pmu_read_csr(cpu,csr) : cpu->csrs[csr];
+}
+
+static void write_csr(struct cpu *cpu,uint64_t csr,uint64_t x)
+{
+	if(pmu_csr(csr)){
+		pmu_write_csr(cpu,csr,x);
+	}else if(vector_csr(csr)){
+		vector_write_csr(cpu,csr,x);
+	}else{
+		cpu->csrs[csr] = x;
+	}
+}
+
+/*
+ * Zba,Zbb and Zbs share the opcodes of the base shifts and arithmetic,
+ * return 1 for their encodings,see cpu_exec_bitmanip().
+ */
+int bitmanip_inst(uint32_t inst)
+{
+	uint32_t funct3 = (inst >> 12) & 7;
+	uint32_t funct7 = inst >> 25;
+
+	switch(inst & 0x7f){
+	case 0x13:
+		return (funct3 & 3) == 1 && (inst >> 26) & 0x2F;//not slli,srli,srai
+	case 0x1B:
+		return (funct3 & 3) == 1 && (funct7 & ~0x20);//not slliw,srliw,sraiw
+	case 0x33:
+		return (funct7 & ~0x20) || (funct7 && funct3 != 0 && funct3 != 5);//not add,sub,sra...
+	case 0x3B:
+		return (funct7 & ~0x20) != 0;
+	default:
+		return 0;
+	}
+}
+
+//the host lzcnt,tzcnt,popcnt,andn and bswap are used when it has them,chosen when the program is loaded
+#if defined(__x86_64__)
+#define HOST_BITMANIP __attribute__((target_clones("arch=x86-64-v3","default")))
+#else
+#define HOST_BITMANIP
 #endif
+
+//the encodings of isa.def,return 0 when the instruction is not one of them
+static HOST_BITMANIP int cpu_exec_bitmanip(struct cpu *cpu)
+{
+	uint32_t funct3 = cpu->inst.r_type.funct3;
+	uint32_t funct7 = cpu->inst.r_type.funct7;
+	uint32_t imm = cpu->inst.i_type.imm11_0;
+	uint32_t shamt = imm & 0x3F;
+	uint64_t a = get_register(cpu, cpu->inst.r_type.rs1);
+	uint64_t b = get_register(cpu, cpu->inst.r_type.rs2);
+	uint32_t w;
+	uint64_t x;
+
+	switch(cpu->inst.r_type.opcode){
+	case 0x33:
+		switch(funct7 << 3 | funct3){
+		case 0x10 << 3 | 2:
+			x = (a << 1) + b;
 			break;
-		case 1://slliw
-			tmp_int64_t = get_register(cpu,rs1_idx) << (sign_imm_64&0x3F);
-			tmp_int64_t = (tmp_int64_t<<32)>>32;
-			set_register(cpu, rd_idx, tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("slliw\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
+		case 0x10 << 3 | 4:
+			x = (a << 2) + b;
 			break;
-		case 5://srliw,sraiw
-			if( !(cpu->inst.i_type.imm11_0>>6) ){//srliw
-				tmp_int64_t = get_register(cpu,rs1_idx) >> (sign_imm_64&0x3F);
-				tmp_int64_t = (tmp_int64_t<<32)>>32;
-				set_register(cpu, rd_idx, tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("srliw\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
-			}else{//sraiw
-				tmp_int32_t = get_register(cpu,rs1_idx);
-				tmp_int32_t = tmp_int32_t>> (sign_imm_64&0x3F);
-				tmp_int64_t = tmp_int32_t;
-				set_register(cpu, rd_idx, tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("sraiw\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
-			}
+		case 0x10 << 3 | 6:
+			x = (a << 3) + b;
 			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.r_type.opcode,cpu->pc-4,cpu->inst.r_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
+		case 0x20 << 3 | 7:
+			x = a & ~b;
 			break;
-		}
-		break;
-	case 0x13:
-		unsign_imm_64 = (uint64_t)cpu->inst.i_type.imm11_0;
-		sign_imm_64 = (int64_t)cpu->inst.i_type.imm11_0;
-		if(sign_imm_64 & 0x800){
-			sign_imm_64 |= (~0x7ff);
-		}
-		rd_idx = cpu->inst.i_type.rd;
-		rs1_idx = cpu->inst.i_type.rs1;
-		switch(cpu->inst.i_type.funct3){
-		case 0://I type , addi
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) + sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("addi\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
-#endif
+		case 0x20 << 3 | 6:
+			x = a | ~b;
 			break;
-		case 2://I type , slti
-			set_register(cpu, rd_idx, (int64_t)get_register(cpu,rs1_idx) < sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("slti\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
-#endif
+		case 0x20 << 3 | 4:
+			x = ~(a ^ b);
 			break;
-		case 3://I type , sltiu
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) < unsign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sltiu\tx%d,x%d,%lu\n",rd_idx,rs1_idx,unsign_imm_64);
-#endif
+		case 0x05 << 3 | 4:
+			x = (int64_t)a < (int64_t)b ? a : b;
 			break;
-		case 4://I type , xori
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) ^ sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("xori\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
-#endif
+		case 0x05 << 3 | 5:
+			x = a < b ? a : b;
 			break;
-		case 6://I type , ori
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) | sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("ori\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
-#endif
+		case 0x05 << 3 | 6:
+			x = (int64_t)a > (int64_t)b ? a : b;
 			break;
-		case 7://I type , andi
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) & sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("andi\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64);
-#endif
+		case 0x05 << 3 | 7:
+			x = a > b ? a : b;
 			break;
-		case 1://I type , slli
-			set_register(cpu, rd_idx, get_register(cpu,rs1_idx) << (sign_imm_64&0x3F));
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("slli\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
+		case 0x30 << 3 | 1:
+			x = (a << (b & 0x3F)) | (a >> (-b & 0x3F));
 			break;
-		case 5://srli,srai
-			if( !(cpu->inst.i_type.imm11_0>>6) ){//srli
-				set_register(cpu, rd_idx, get_register(cpu,rs1_idx) >> (sign_imm_64&0x3F));
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("srli\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
-			}else{//srai
-				set_register(cpu, rd_idx, (int64_t)get_register(cpu,rs1_idx) >> (sign_imm_64&0x3F));
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("srai\tx%d,x%d,%ld\n",rd_idx,rs1_idx,sign_imm_64&0x3F);
-#endif
-			}
+		case 0x30 << 3 | 5:
+			x = (a >> (b & 0x3F)) | (a << (-b & 0x3F));
 			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.i_type.opcode,cpu->pc-4,cpu->inst.i_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
+		case 0x24 << 3 | 1:
+			x = a & ~(1UL << (b & 0x3F));
+			break;
+		case 0x24 << 3 | 5:
+			x = (a >> (b & 0x3F)) & 1;
+			break;
+		case 0x14 << 3 | 1:
+			x = a | (1UL << (b & 0x3F));
 			break;
+		case 0x34 << 3 | 1:
+			x = a ^ (1UL << (b & 0x3F));
+			break;
+		default:
+			return 0;
 		}
 		break;
-	case 0x33:
-		rd_idx = cpu->inst.r_type.rd;
-		rs1_idx = cpu->inst.r_type.rs1;
-		rs2_idx = cpu->inst.r_type.rs2;
-		switch(cpu->inst.r_type.funct3){
-		case 0://R type , add,sub
-			if(!(cpu->inst.r_type.funct7)){//add
-				set_register(cpu,rd_idx,get_register(cpu,rs1_idx) + get_register(cpu,rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("add\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			} else {
-				set_register(cpu,rd_idx,get_register(cpu,rs1_idx) - get_register(cpu,rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("sub\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			}
+	case 0x3B:
+		switch(funct7 << 3 | funct3){
+		case 0x04 << 3 | 0:
+			x = (uint32_t)a + b;
 			break;
-		case 1://R type , sll
-			set_register(cpu,rd_idx,(get_register(cpu,rs1_idx) << (get_register(cpu,rs2_idx)&0x3F)) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sll\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		case 0x04 << 3 | 4:
+			if(cpu->inst.r_type.rs2) return 0;
+			x = (uint16_t)a;
 			break;
-		case 2://R type , slt
-			set_register(cpu,rd_idx,(int64_t)get_register(cpu,rs1_idx) < (int64_t)get_register(cpu,rs2_idx) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("slt\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		case 0x10 << 3 | 2:
+			x = ((uint64_t)(uint32_t)a << 1) + b;
 			break;
-		case 3://R type , sltu
-			set_register(cpu,rd_idx,get_register(cpu,rs1_idx) < get_register(cpu,rs2_idx) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sltu\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		case 0x10 << 3 | 4:
+			x = ((uint64_t)(uint32_t)a << 2) + b;
 			break;
-		case 4://R type , xor
-			set_register(cpu,rd_idx,get_register(cpu,rs1_idx) ^ get_register(cpu,rs2_idx) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("xor\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		case 0x10 << 3 | 6:
+			x = ((uint64_t)(uint32_t)a << 3) + b;
 			break;
-		case 5://R type , srl,sra
-			if(!cpu->inst.r_type.funct7){//srl
-				set_register(cpu,rd_idx,(get_register(cpu,rs1_idx) >> (get_register(cpu,rs2_idx)&0x3F)) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("srl\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			} else{//sra
-				set_register(cpu,rd_idx,((int64_t)get_register(cpu,rs1_idx) >> (get_register(cpu,rs2_idx)&0x3F)) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("sra\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			}
+		case 0x30 << 3 | 1:
+			w = a;
+			x = (int32_t)((w << (b & 0x1F)) | (w >> (-b & 0x1F)));
 			break;
-		case 6://R type , or
-			set_register(cpu,rd_idx,get_register(cpu,rs1_idx) | get_register(cpu,rs2_idx) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("or\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			break;
-		case 7://R type , and
-			set_register(cpu,rd_idx,get_register(cpu,rs1_idx) & get_register(cpu,rs2_idx) );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("and\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		case 0x30 << 3 | 5:
+			w = a;
+			x = (int32_t)((w >> (b & 0x1F)) | (w << (-b & 0x1F)));
 			break;
 		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.r_type.opcode,cpu->pc-4,cpu->inst.r_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
+			return 0;
 		}
 		break;
-	case 0x3B://R type
-		rd_idx = cpu->inst.r_type.rd;
-		rs1_idx = cpu->inst.r_type.rs1;
-		rs2_idx = cpu->inst.r_type.rs2;
-		switch(cpu->inst.r_type.funct3){
-		case 0://addw,subw
-			if(!(cpu->inst.r_type.funct7)){//addw
-				tmp_int32_t = get_register(cpu,rs1_idx) + get_register(cpu,rs2_idx);
-				tmp_int64_t = tmp_int32_t;
-				set_register(cpu,rd_idx,tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("addw\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			} else {//subw
-				tmp_int32_t = get_register(cpu,rs1_idx) - get_register(cpu,rs2_idx);
-				tmp_int64_t = tmp_int32_t;
-				set_register(cpu,rd_idx,tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("subw\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+	case 0x13:
+		if(funct3 == 1){
+			switch(imm >> 6){
+			case 0x12:
+				x = a & ~(1UL << shamt);
+				break;
+			case 0x0A:
+				x = a | (1UL << shamt);
+				break;
+			case 0x1A:
+				x = a ^ (1UL << shamt);
+				break;
+			case 0x18:
+				switch(shamt){
+				case 0:
+					x = a ? __builtin_clzll(a) : 64;
+					break;
+				case 1:
+					x = a ? __builtin_ctzll(a) : 64;
+					break;
+				case 2:
+					x = __builtin_popcountll(a);
+					break;
+				case 4:
+					x = (int8_t)a;
+					break;
+				case 5:
+					x = (int16_t)a;
+					break;
+				default:
+					return 0;
+				}
+				break;
+			default:
+				return 0;
 			}
-			break;
-		case 1://sllw
-			tmp_int32_t = (get_register(cpu,rs1_idx) << (get_register(cpu,rs2_idx)&0x3F));
-			tmp_int64_t = tmp_int32_t;
-			set_register(cpu,rd_idx,tmp_int64_t );
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sllw\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			break;
-		case 5://srlw,sraw
-			if(!cpu->inst.r_type.funct7){//srlw
-				tmp_int32_t = (get_register(cpu,rs1_idx) >> (get_register(cpu,rs2_idx)&0x3F));
-				tmp_int64_t = tmp_int32_t;
-				set_register(cpu,rd_idx,tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("srlw\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
-			} else{//sraw
-				tmp_int32_t = get_register(cpu,rs1_idx);
-				tmp_int32_t = tmp_int32_t >> (get_register(cpu,rs2_idx)&0x3F);
-				tmp_int64_t = tmp_int32_t;
-				set_register(cpu,rd_idx,tmp_int64_t);
-#ifdef __CPU_EXEC_INST_DEBUG__
-				printf("sraw\tx%d,x%d,x%d\n",rd_idx,rs1_idx,rs2_idx);
-#endif
+		}else{
+			switch(imm){
+			case 0x6B8:
+				x = __builtin_bswap64(a);
+				break;
+			case 0x287://every non zero byte becomes 0xff
+				x = (((a & 0x7F7F7F7F7F7F7F7FUL) + 0x7F7F7F7F7F7F7F7FUL) | a) & 0x8080808080808080UL;
+				x = (x >> 7) * 0xFF;
+				break;
+			default:
+				switch(imm >> 6){
+				case 0x18:
+					x = (a >> shamt) | (a << (-shamt & 0x3F));
+					break;
+				case 0x12:
+					x = (a >> shamt) & 1;
+					break;
+				default:
+					return 0;
+				}
+				break;
 			}
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.r_type.opcode,cpu->pc-4,cpu->inst.r_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-		}
-		break;
-	case 0x37://U lui
-		rd_idx = cpu->inst.u_type.rd;
-		sign_imm_64 = cpu->inst.u_type.imm31_12;
-		if(sign_imm_64 & 0x80000){
-			sign_imm_64 |= (~0x7FFFF);
 		}
-		set_register(cpu,rd_idx,sign_imm_64<<12);
-#ifdef __CPU_EXEC_INST_DEBUG__
-		printf("lui\tx%d,%ld\n",rd_idx,sign_imm_64);
-#endif
 		break;
-	case 0x17://U auipc
-		rd_idx = cpu->inst.u_type.rd;
-		sign_imm_64 = cpu->inst.u_type.imm31_12;
-		if(sign_imm_64 & 0x80000){
-			sign_imm_64 |= (~0x7FFFF);
+	case 0x1B:
+		w = a;
+		if(funct3 == 1 && (imm >> 6) == 0x02){
+			x = (uint64_t)w << shamt;
+		}else if(funct3 == 1 && funct7 == 0x30){
+			switch(imm & 0x1F){
+			case 0:
+				x = w ? __builtin_clz(w) : 32;
+				break;
+			case 1:
+				x = w ? __builtin_ctz(w) : 32;
+				break;
+			case 2:
+				x = __builtin_popcount(w);
+				break;
+			default:
+				return 0;
+			}
+		}else if(funct3 == 5 && funct7 == 0x30){
+			x = (int32_t)((w >> (imm & 0x1F)) | (w << (-imm & 0x1F)));
+		}else{
+			return 0;
 		}
-		set_register(cpu,rd_idx,(sign_imm_64<<12) + cpu->pc - 4);
-#ifdef __CPU_EXEC_INST_DEBUG__
-		printf("auipc\tx%d,%ld\n",rd_idx,sign_imm_64);
-#endif
 		break;
-	case 0x6F://J jal
-		rd_idx = cpu->inst.j_type.rd;
-		sign_imm_64 = (cpu->inst.j_type.imm10_1<<1) | (cpu->inst.j_type.imm11<<11)
-				| 	(cpu->inst.j_type.imm19_12<<12) | (cpu->inst.j_type.imm20<<20);
-		if(cpu->inst.j_type.imm20){
-			sign_imm_64 |= (~0xFFFFF);
-		}
+	default:
+		return 0;
+	}
 
-		set_register(cpu,rd_idx,cpu->pc);
-		cpu->pc = (cpu->pc-4) + (sign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-		printf("jal\tx%d,%ld\n",rd_idx,sign_imm_64);
-#endif
+	set_register(cpu, cpu->inst.r_type.rd, x);
+	return 1;
+}
+
+//lr,sc and the amos,all of them on naturally aligned words and double words
+//return 1 when the address is misaligned
+static int cpu_exec_atomic(struct cpu *cpu)
+{
+	static const int ops[32] = {[0x00] = AMO_ADD,[0x01] = AMO_SWAP,[0x04] = AMO_XOR,[0x08] = AMO_OR,[0x0C] = AMO_AND,
+			[0x10] = AMO_MIN,[0x14] = AMO_MAX,[0x18] = AMO_MINU,[0x1C] = AMO_MAXU};
+	int funct5 = cpu->inst.r_type.funct7 >> 2;
+	uint64_t addr = get_register(cpu, cpu->inst.r_type.rs1);
+	uint64_t src = get_register(cpu, cpu->inst.r_type.rs2);
+	int size = cpu->inst.r_type.funct3 == 2 ? 4 : 8;
+	uint64_t x;
+
+	if(addr & (size - 1)){
+		cpu_exception(cpu,funct5 == 0x02 ? CAUSE_LOAD_ADDRESS_MISALIGNED : CAUSE_STORE_ADDRESS_MISALIGNED,addr);
+		return 1;
+	}
+
+	switch(funct5){
+	case 0x02://lr
+		x = load_reserved_from_cache(&cpu->dcache, addr, size);
 		break;
-	case 0x67://I jalr
-		rd_idx = cpu->inst.i_type.rd;
-		rs1_idx = cpu->inst.i_type.rs1;
-		orig_pc_plus4 = cpu->pc;
-		sign_imm_64 = (int64_t)cpu->inst.i_type.imm11_0;
-		if(sign_imm_64 & 0x800){
-			sign_imm_64 |= (~0x7ff);
-		}
-		cpu->pc = ( (get_register(cpu, rs1_idx) + sign_imm_64) & (~(uint64_t)(1)) );
-		set_register(cpu, rd_idx, orig_pc_plus4);
-#ifdef __CPU_EXEC_INST_DEBUG__
-		printf("jalr\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
+	case 0x03://sc
+		x = store_conditional_to_cache(&cpu->dcache, addr, size, src);
 		break;
-	case 0x63://B type
-		rs1_idx = cpu->inst.b_type.rs1;
-		rs2_idx = cpu->inst.b_type.rs2;
-		sign_imm_64 = (cpu->inst.b_type.imm4_1<<1) |
-					  (cpu->inst.b_type.imm10_5<<5) |
-					  (cpu->inst.b_type.imm_11<<11) |
-					  (cpu->inst.b_type.imm12<<12);
-		if(cpu->inst.b_type.imm12){
-			sign_imm_64 |= (~0xFFF);
-		}
-		switch(cpu->inst.b_type.funct3){
-		case 0://beq
-			if(get_register(cpu, rs1_idx) == get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("beq\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		case 1://bne
-			if(get_register(cpu, rs1_idx) != get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("bne\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		case 4://blt
-			if((int64_t)get_register(cpu, rs1_idx) < (int64_t)get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("blt\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		case 5://bge
-			if((int64_t)get_register(cpu, rs1_idx) >= (int64_t)get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("bge\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		case 6://bltu
-			if(get_register(cpu, rs1_idx) < get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("bltu\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		case 7://bgeu
-			if(get_register(cpu, rs1_idx) >= get_register(cpu, rs2_idx)){
-				cpu->pc = cpu->pc-4 + sign_imm_64;
-			}
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("bgeu\tx%d,x%d,%ld\n",rs1_idx,rs2_idx,sign_imm_64);
-#endif
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.b_type.opcode,cpu->pc-4,cpu->inst.b_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
-		}
+	default:
+		x = amo_to_cache(&cpu->dcache, addr, size, ops[funct5], src);
 		break;
-	case 0x3://I load
-		rs1_idx = cpu->inst.i_type.rs1;
-		rd_idx = cpu->inst.i_type.rd;
-		sign_imm_64 = cpu->inst.i_type.imm11_0;
-		if(sign_imm_64 & 0x800){
-			sign_imm_64 |=(~0x7FF);
-		}
-		switch(cpu->inst.i_type.funct3){
-		case 0://lb
-			mem_sign_data = get_byte_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			mem_sign_data = (mem_sign_data<<56)>>56;
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lb\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 1://lh
-			mem_sign_data = get_word_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			mem_sign_data = (mem_sign_data<<48)>>48;
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lh\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 2://lw
-			mem_sign_data = get_dword_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			mem_sign_data = (mem_sign_data<<32)>>32;
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lw\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 4://lbu
-			mem_sign_data = get_byte_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lbu\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 5://lhu
-			mem_sign_data = get_word_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lhu\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 6://lwu
-			mem_sign_data = get_dword_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("lwu\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 3://ld
-			mem_sign_data = get_qword_from_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64);
-			set_register(cpu, rd_idx, mem_sign_data);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("ld\tx%d,%ld(x%d)\n",rd_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.i_type.opcode,cpu->pc-4,cpu->inst.i_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
-		}
+	}
+	if(size == 4) x = (int64_t)(int32_t)x;
+	set_register(cpu, cpu->inst.r_type.rd, x);
+	return 0;
+}
+
+static void unknown_instruction(struct cpu *cpu)
+{
+	if(!cpu->quiet) dump_registers(cpu);
+	fatal("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.r_type.opcode,cpu->pc-4,cpu->inst.r_type.funct3);
+}
+
+//the first line of isa.def matching inst,INST_NONE when there is none
+static enum inst_id decode_inst(uint32_t inst)
+{
+	struct decode_bucket bucket = decode_buckets[DECODE_BUCKET(inst)];
+	struct decode_entry *entry = &decode_entries[bucket.first];
+
+	for(int i = 0;i<bucket.nr;i++,entry++){
+		if((inst & entry->mask) == entry->match) return entry->id;
+	}
+	return INST_NONE;
+}
+
+static uint64_t cached_load(struct cpu *cpu,uint64_t addr,int size)
+{
+	switch(size){
+	case 1:
+		return get_byte_from_cache(&cpu->dcache, addr);
+	case 2:
+		return get_word_from_cache(&cpu->dcache, addr);
+	case 4:
+		return get_dword_from_cache(&cpu->dcache, addr);
+	default:
+		return get_qword_from_cache(&cpu->dcache, addr);
+	}
+}
+
+static void cached_store(struct cpu *cpu,uint64_t addr,int size,uint64_t x)
+{
+	switch(size){
+	case 1:
+		put_byte_to_cache(&cpu->dcache, addr, x);
 		break;
-	case 0x23://S store
-		rs2_idx = cpu->inst.s_type.rs2;
-		rs1_idx = cpu->inst.s_type.rs1;
-		sign_imm_64 = (cpu->inst.s_type.imm4_0) | (cpu->inst.s_type.imm11_5<<5);
-		if(sign_imm_64 & 0x800){
-			sign_imm_64 |=(~0x7FF);
-		}
-		switch(cpu->inst.s_type.funct3){
-		case 0://sb
-			put_byte_to_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64, get_register(cpu, rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sb\tx%d,%ld(x%d)\n",rs2_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 1://sh
-			put_word_to_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64, get_register(cpu, rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sh\tx%d,%ld(x%d)\n",rs2_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 2://sw
-			put_dword_to_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64, get_register(cpu, rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sw\tx%d,%ld(x%d)\n",rs2_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		case 3://sd
-			put_qword_to_cache(&cpu->dcache, get_register(cpu, rs1_idx) + sign_imm_64, get_register(cpu, rs2_idx));
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("sd\tx%d,%ld(x%d)\n",rs2_idx,sign_imm_64,rs1_idx);
-#endif
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.s_type.opcode,cpu->pc-4,cpu->inst.s_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
-		}
+	case 2:
+		put_word_to_cache(&cpu->dcache, addr, x);
 		break;
-	case 0xF://fence,fence.i
-		switch(cpu->inst.i_type.funct3){
-		case 0://fence
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("fence\n");
-#endif
-			break;
-		case 1://fence.i
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("fence.i\n");
-#endif
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.i_type.opcode,cpu->pc-4,cpu->inst.i_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
-		}
+	case 4:
+		put_dword_to_cache(&cpu->dcache, addr, x);
 		break;
-	case 0x73:
-		switch(cpu->inst.i_type.funct3){
-		case 0://ecall,ebreak
-			break;
-		case 1://csrrw
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->csrs[csr];
-			cpu->csrs[csr] = get_register(cpu, cpu->inst.i_type.rs1);
-			set_register(cpu, cpu->inst.i_type.rd, unsign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrw\tx%d,0x%lx,x%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
-#endif
-			break;
-		case 2://csrrs
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->csrs[csr];
-			cpu->csrs[csr] =unsign_imm_64 | get_register(cpu, cpu->inst.i_type.rs1);
-			set_register(cpu, cpu->inst.i_type.rd, unsign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrs\tx%d,0x%lx,x%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
-#endif
-			break;
-		case 3://csrrc
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->csrs[csr];
-			cpu->csrs[csr] =unsign_imm_64 & ~get_register(cpu, cpu->inst.i_type.rs1);
-			set_register(cpu, cpu->inst.i_type.rd, unsign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrc\tx%d,0x%lx,x%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
-#endif
-			break;
-		case 5://csrrwi
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->inst.i_type.rs1;
-			set_register(cpu, cpu->inst.i_type.rd, cpu->csrs[csr]);
-			cpu->csrs[csr] = unsign_imm_64;
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrwi\tx%d,0x%lx,%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
-#endif
-			break;
-		case 6://csrrsi
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->csrs[csr];
-			cpu->csrs[csr] =unsign_imm_64 | cpu->inst.i_type.rs1;
-			set_register(cpu, cpu->inst.i_type.rd, unsign_imm_64);
+	default:
+		put_qword_to_cache(&cpu->dcache, addr, x);
+		break;
+	}
+}
+
+//ram below the devices,NULL when the access has to go through cache.c
+static uint8_t *direct_ram_ptr(struct cpu *cpu,uint64_t addr,int size)
+{
+	struct ram *ram = cpu->ram;
+
+	if(addr >= cpu->bus->low_addr || addr >= ram->size || size > ram->size - addr) return NULL;
+	return ram->data + addr;
+}
+
+//the caches are bypassed and not simulated,like load_from_cache() in functional mode
+static uint64_t direct_load(struct cpu *cpu,uint64_t addr,int size)
+{
+	uint8_t *p = direct_ram_ptr(cpu,addr,size);
+	uint64_t x = 0;
+
+	if(p == NULL) return cached_load(cpu,addr,size);
+	memcpy(&x,p,size);
+	return x;
+}
+
+static uint32_t direct_fetch(struct cpu *cpu,uint64_t pc)
+{
+	uint8_t *p = direct_ram_ptr(cpu,pc,4);
+	uint32_t x;
+
+	if(p == NULL) return get_dword_from_cache(&cpu->icache, pc);
+	memcpy(&x,p,4);
+	return x;
+}
+
+static void direct_store(struct cpu *cpu,uint64_t addr,int size,uint64_t x)
+{
+	uint8_t *p = direct_ram_ptr(cpu,addr,size);
+	uint64_t page = addr >> RAM_PAGE_SHIFT;
+
+	if(p == NULL){
+		cached_store(cpu,addr,size,x);
+		return;
+	}
+	memcpy(p,&x,size);
+	//most stores are to pages already dirty
+	if(!(__atomic_load_n(&cpu->ram->dirty_bitmap[page/64],__ATOMIC_RELAXED) >> (page%64) & 1) ||
+			(addr + size - 1) >> RAM_PAGE_SHIFT != page){
+		ram_mark_dirty(cpu->ram,addr,size);
+	}
+}
+
+#define EXEC_CACHES 1
+#define EXEC_STATS  2
+#define EXEC_TRACE  4
+
+//the executor for the features turned on
+static int exec_flags(struct cpu *cpu)
+{
+	int flags = 0;
+
+	if(!cpu->functional || cpu->cachesim) flags |= EXEC_CACHES;
+	if(cpu->timing || cpu->counters || cpu->profiler || cpu->bpred ||
+			cpu->pmu_counters[PMU_EVENT_BRANCH] || cpu->pmu_counters[PMU_EVENT_BRANCH_TAKEN]){
+		flags |= EXEC_STATS;
+	}
 #ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrsi\tx%d,0x%lx,%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
+	if(!cpu->quiet) flags |= EXEC_TRACE;
 #endif
-			break;
-		case 7://csrrci
-			csr = cpu->inst.i_type.imm11_0;
-			unsign_imm_64 = cpu->csrs[csr];
-			cpu->csrs[csr] =unsign_imm_64 & ~cpu->inst.i_type.rs1;
-			set_register(cpu, cpu->inst.i_type.rd, unsign_imm_64);
-#ifdef __CPU_EXEC_INST_DEBUG__
-			printf("csrrci\tx%d,0x%lx,%d\n",cpu->inst.i_type.rd,csr,cpu->inst.i_type.rs1);
+	return flags;
+}
+
+#define EXEC_NAME run_direct
+#define EXEC_FLAGS 0
+#include "cpu_exec.h"
+#define EXEC_NAME run_cached
+#define EXEC_FLAGS EXEC_CACHES
+#include "cpu_exec.h"
+#define EXEC_NAME run_direct_stats
+#define EXEC_FLAGS EXEC_STATS
+#include "cpu_exec.h"
+#define EXEC_NAME run_cached_stats
+#define EXEC_FLAGS (EXEC_CACHES | EXEC_STATS)
+#include "cpu_exec.h"
+#ifdef __CPU_EXEC_INST_DEBUG__
+#define EXEC_NAME run_direct_trace
+#define EXEC_FLAGS EXEC_TRACE
+#include "cpu_exec.h"
+#define EXEC_NAME run_cached_trace
+#define EXEC_FLAGS (EXEC_CACHES | EXEC_TRACE)
+#include "cpu_exec.h"
+#define EXEC_NAME run_direct_stats_trace
+#define EXEC_FLAGS (EXEC_STATS | EXEC_TRACE)
+#include "cpu_exec.h"
+#define EXEC_NAME run_cached_stats_trace
+#define EXEC_FLAGS (EXEC_CACHES | EXEC_STATS | EXEC_TRACE)
+#include "cpu_exec.h"
 #endif
-			break;
-		default:
-			printf("%s: unknow instruction(opcode:0x%x pc:0x%lx func3:0x%x)\n",__func__,cpu->inst.i_type.opcode,cpu->pc-4,cpu->inst.i_type.funct3);
-			dump_registers(cpu);
-			exit(-1);
-			break;
+
+static int (*const executors[])(struct cpu *cpu,uint64_t *count) = {
+	[0] = run_direct,
+	[EXEC_CACHES] = run_cached,
+	[EXEC_STATS] = run_direct_stats,
+	[EXEC_CACHES | EXEC_STATS] = run_cached_stats,
+#ifdef __CPU_EXEC_INST_DEBUG__
+	[EXEC_TRACE] = run_direct_trace,
+	[EXEC_CACHES | EXEC_TRACE] = run_cached_trace,
+	[EXEC_STATS | EXEC_TRACE] = run_direct_stats_trace,
+	[EXEC_CACHES | EXEC_STATS | EXEC_TRACE] = run_cached_stats_trace,
+#endif
+};
+
+static const char *const executor_names[] = {
+	[0] = "direct",
+	[EXEC_CACHES] = "cached",
+	[EXEC_STATS] = "direct_stats",
+	[EXEC_CACHES | EXEC_STATS] = "cached_stats",
+	[EXEC_TRACE] = "direct_trace",
+	[EXEC_CACHES | EXEC_TRACE] = "cached_trace",
+	[EXEC_STATS | EXEC_TRACE] = "direct_stats_trace",
+	[EXEC_CACHES | EXEC_STATS | EXEC_TRACE] = "cached_stats_trace",
+};
+
+//a sched span for each run of an executor
+static int run_traced(struct cpu *cpu,int flags,uint64_t *count)
+{
+	uint64_t begin = tracer_begin(TRACER_SCHED);
+	uint64_t pc = cpu->pc,left = *count;
+	int ret;
+
+	ret = executors[flags](cpu,count);
+	if(begin) tracer_end(TRACER_SCHED,"run",begin,executor_names[flags],pc,left - *count);
+	return ret;
+}
+
+/*
+ * execute at most count instructions.
+ * return 1 when the guest has returned to pc 0 or halted,otherwise 0.
+ */
+int cpu_run_for(struct cpu *cpu,uint64_t count)
+{
+	int flags;
+
+	while(count){
+		flags = exec_flags(cpu);
+		if(TRACER_ON(TRACER_SCHED)){
+			if(run_traced(cpu,flags,&count)) return 1;
+			continue;
 		}
-		break;
-	default:
-		printf("%s: unknow instruction(opcode:0x%x pc:0x%lx)\n",__func__,cpu->inst.r_type.opcode,cpu->pc-4);
-		dump_registers(cpu);
-		exit(-1);
-		break;
+		if(executors[flags](cpu,&count)) return 1;
 	}
+
+	return 0;
 }
 
 void cpu_run(struct cpu *cpu)
 {
-	while(1){
-		cpu_fetch(cpu);
-		cpu_exec(cpu);
-		if(cpu->pc == 0){
-			printf("All instructions have been executed\n");
-//			dump_registers(cpu);
-			exit(0);
-		}
-	}
+	while(!cpu_run_for(cpu,UINT64_MAX));
 }
 
 
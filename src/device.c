@@ -1 +1,131 @@
+#include <stdlib.h>
 #include "device.h"
+#include "tracer.h"
+
+int device_readable(struct device *dev)
+{
+	return dev->read_func != NULL || dev->read_byte_func != NULL;
+}
+
+int device_writable(struct device *dev)
+{
+	return dev->write_func != NULL || dev->write_byte_func != NULL;
+}
+
+static uint64_t read_device(struct device *dev,uint64_t addr,int size)
+{
+	uint64_t x = 0;
+
+	if(dev->read_func){
+		return dev->read_func(dev,addr,size);
+	}
+
+	for(int i = 0;i<size;i++){
+		x |= (uint64_t)dev->read_byte_func(dev,addr + i) << (i*8);
+	}
+	return x;
+}
+
+static void write_device(struct device *dev,uint64_t addr,int size,uint64_t data)
+{
+	if(dev->write_func){
+		dev->write_func(dev,addr,size,data);
+		return;
+	}
+
+	for(int i = 0;i<size;i++){
+		dev->write_byte_func(dev,addr + i,data >> (i*8));
+	}
+}
+
+static void read_device_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len)
+{
+	uint64_t i = 0,x;
+
+	if(dev->read_block_func){
+		dev->read_block_func(dev,addr,buf,len);
+		return;
+	}
+
+	for(;i + 8 <= len;i += 8){
+		x = read_device(dev,addr + i,8);
+		for(int j = 0;j<8;j++){
+			buf[i + j] = x >> (j*8);
+		}
+	}
+	for(;i<len;i++){
+		buf[i] = read_device(dev,addr + i,1);
+	}
+}
+
+static void write_device_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len)
+{
+	uint64_t i = 0,x;
+
+	if(dev->write_block_func){
+		dev->write_block_func(dev,addr,buf,len);
+		return;
+	}
+
+	for(;i + 8 <= len;i += 8){
+		x = 0;
+		for(int j = 0;j<8;j++){
+			x |= (uint64_t)buf[i + j] << (j*8);
+		}
+		write_device(dev,addr + i,8,x);
+	}
+	for(;i<len;i++){
+		write_device(dev,addr + i,1,buf[i]);
+	}
+}
+
+//the accesses through the bus,traced as device spans
+uint64_t device_read(struct device *dev,uint64_t addr,int size)
+{
+	uint64_t begin,x;
+
+	if(!TRACER_ON(TRACER_DEVICE)) return read_device(dev,addr,size);
+	begin = tracer_begin(TRACER_DEVICE);
+	x = read_device(dev,addr,size);
+	tracer_end(TRACER_DEVICE,"read",begin,dev->name,addr,size);
+	return x;
+}
+
+void device_write(struct device *dev,uint64_t addr,int size,uint64_t data)
+{
+	uint64_t begin;
+
+	if(!TRACER_ON(TRACER_DEVICE)){
+		write_device(dev,addr,size,data);
+		return;
+	}
+	begin = tracer_begin(TRACER_DEVICE);
+	write_device(dev,addr,size,data);
+	tracer_end(TRACER_DEVICE,"write",begin,dev->name,addr,size);
+}
+
+void device_read_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len)
+{
+	uint64_t begin;
+
+	if(!TRACER_ON(TRACER_DEVICE)){
+		read_device_block(dev,addr,buf,len);
+		return;
+	}
+	begin = tracer_begin(TRACER_DEVICE);
+	read_device_block(dev,addr,buf,len);
+	tracer_end(TRACER_DEVICE,"read_block",begin,dev->name,addr,len);
+}
+
+void device_write_block(struct device *dev,uint64_t addr,uint8_t *buf,uint64_t len)
+{
+	uint64_t begin;
+
+	if(!TRACER_ON(TRACER_DEVICE)){
+		write_device_block(dev,addr,buf,len);
+		return;
+	}
+	begin = tracer_begin(TRACER_DEVICE);
+	write_device_block(dev,addr,buf,len);
+	tracer_end(TRACER_DEVICE,"write_block",begin,dev->name,addr,len);
+}
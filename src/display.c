@@ -3,28 +3,403 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "display.h"
+#include "bus.h"
+#include "snapshot.h"
+#include "tracer.h"
+#include "error.h"
 
-static void display_write_byte(struct device *dev,uint64_t addr,uint8_t data)
+static struct display *displays = NULL;
+static pthread_mutex_t displays_lock = PTHREAD_MUTEX_INITIALIZER;
+static int display_exit_registered = 0;
+
+static void init_fifo(struct display_fifo *fifo,uint64_t size)
+{
+	fifo->buf = malloc(size);
+	if(fifo->buf == NULL){
+		fatal("alloc display fifo error(%s)\n",strerror(errno));
+	}
+	fifo->size = size;
+	fifo->head = 0;
+	fifo->tail = 0;
+}
+
+static uint64_t fifo_count(struct display_fifo *fifo)
+{
+	return __atomic_load_n(&fifo->tail,__ATOMIC_ACQUIRE) - __atomic_load_n(&fifo->head,__ATOMIC_ACQUIRE);
+}
+
+static int fifo_push(struct display_fifo *fifo,uint8_t c)
+{
+	uint64_t tail = fifo->tail;
+
+	if(tail - __atomic_load_n(&fifo->head,__ATOMIC_ACQUIRE) == fifo->size){
+		return 0;
+	}
+	fifo->buf[tail & (fifo->size - 1)] = c;
+	__atomic_store_n(&fifo->tail,tail + 1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+static int fifo_pop(struct display_fifo *fifo,uint8_t *c)
+{
+	uint64_t head = fifo->head;
+
+	if(__atomic_load_n(&fifo->tail,__ATOMIC_ACQUIRE) == head){
+		return 0;
+	}
+	*c = fifo->buf[head & (fifo->size - 1)];
+	__atomic_store_n(&fifo->head,head + 1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+//write out everything queued,at most two write calls.
+//stdout goes through stdio,after what the emulator printed so far
+static void display_drain(struct display *dp)
 {
-	if(addr == DISPLAY_CHAR_PHY_ADDR){
-		putchar(data);
-		fflush(stdout);
-	} else{
-		printf("%s: write error addr\n",__func__);
-		exit(-1);
+	struct display_fifo *fifo = &dp->tx;
+	uint64_t head = fifo->head;
+	uint64_t count = fifo_count(fifo);
+	uint64_t off,n;
+	ssize_t ret;
+
+	while(count){
+		off = head & (fifo->size - 1);
+		n = fifo->size - off < count ? fifo->size - off : count;
+
+		if(dp->stdio){
+			ret = fwrite(fifo->buf + off,1,n,stdout) == n && fflush(stdout) == 0 ? (ssize_t)n : -1;
+		}else{
+			ret = write(dp->out_fd,fifo->buf + off,n);
+		}
+		if(ret == -1){
+			if(errno == EINTR && !dp->stdio) continue;//stdio may have written a part
+			fprintf(stderr,"%s: write error(%s)\n",__func__,strerror(errno));
+			ret = n;//drop
+		}
+
+		head += ret;
+		count -= ret;
+		__atomic_store_n(&fifo->head,head,__ATOMIC_RELEASE);
 	}
 }
 
-struct device * alloc_display()
+static void *display_writer(void *arg)
+{
+	struct display *dp = arg;
+	struct timespec deadline;
+
+	tracer_thread_name("display_writer");
+	pthread_mutex_lock(&dp->lock);
+	while(1){
+		while(fifo_count(&dp->tx) == 0 && !dp->stop){
+			pthread_cond_broadcast(&dp->drained_cond);
+			pthread_cond_wait(&dp->tx_cond,&dp->lock);
+		}
+		if(fifo_count(&dp->tx) == 0 && dp->stop){
+			break;
+		}
+
+		//batch until a newline,a half full fifo or the timeout
+		if(!dp->flush_request && !dp->stop){
+			clock_gettime(CLOCK_REALTIME,&deadline);
+			deadline.tv_nsec += DISPLAY_FLUSH_TIMEOUT_MS * 1000000L;
+			if(deadline.tv_nsec >= 1000000000L){
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			while(!dp->flush_request && !dp->stop){
+				if(pthread_cond_timedwait(&dp->tx_cond,&dp->lock,&deadline) == ETIMEDOUT) break;
+			}
+		}
+		dp->flush_request = 0;
+
+		pthread_mutex_unlock(&dp->lock);
+		display_drain(dp);
+		pthread_mutex_lock(&dp->lock);
+		pthread_cond_broadcast(&dp->drained_cond);
+	}
+	pthread_cond_broadcast(&dp->drained_cond);
+	pthread_mutex_unlock(&dp->lock);
+
+	return NULL;
+}
+
+static void display_kick_writer(struct display *dp,int flush)
+{
+	pthread_mutex_lock(&dp->lock);
+	if(flush) dp->flush_request = 1;
+	pthread_cond_signal(&dp->tx_cond);
+	pthread_mutex_unlock(&dp->lock);
+}
+
+static void display_put_char(struct display *dp,uint8_t c)
+{
+	uint64_t count;
+
+	while(!fifo_push(&dp->tx,c)){//full,wait for the writer
+		pthread_mutex_lock(&dp->lock);
+		dp->flush_request = 1;
+		pthread_cond_signal(&dp->tx_cond);
+		while(fifo_count(&dp->tx) == dp->tx.size){
+			pthread_cond_wait(&dp->drained_cond,&dp->lock);
+		}
+		pthread_mutex_unlock(&dp->lock);
+	}
+
+	count = fifo_count(&dp->tx);
+	if(c == '\n' || count >= dp->tx.size/2){
+		display_kick_writer(dp,1);
+	}else if(count == 1){//start the batch timeout
+		display_kick_writer(dp,0);
+	}
+}
+
+static void display_update_irq(struct display *dp)
+{
+	int level;
+
+	if(dp->dev.bus == NULL) return;
+
+	level = (dp->irq_enable & DISPLAY_IRQ_RX) && fifo_count(&dp->rx);
+	bus_set_irq(dp->dev.bus,dp->dev.irq,level);
+
+	//input may have arrived after the count,do not lose it
+	if(!level && (dp->irq_enable & DISPLAY_IRQ_RX) && fifo_count(&dp->rx)){
+		bus_set_irq(dp->dev.bus,dp->dev.irq,1);
+	}
+}
+
+static void *display_reader(void *arg)
+{
+	struct display *dp = arg;
+	uint8_t buf[256];
+	ssize_t ret;
+
+	tracer_thread_name("display_reader");
+	while(1){
+		ret = read(dp->in_fd,buf,sizeof(buf));
+		if(ret == -1 && errno == EINTR) continue;
+		if(ret <= 0) break;
+
+		for(ssize_t i = 0;i<ret;i++){
+			while(!fifo_push(&dp->rx,buf[i])){//guest is not reading
+				display_update_irq(dp);
+				usleep(1000);
+			}
+		}
+		display_update_irq(dp);
+	}
+
+	return NULL;
+}
+
+static uint64_t display_read(struct device *dev,uint64_t addr,int size)
+{
+	struct display *dp = (struct display *)dev;
+	uint64_t x = 0;
+	uint8_t c;
+
+	switch(addr){
+	case DISPLAY_CHAR_PHY_ADDR:
+		if(fifo_pop(&dp->rx,&c)){
+			x = c;
+			display_update_irq(dp);
+		}
+		break;
+	case DISPLAY_STATUS_PHY_ADDR:
+		if(fifo_count(&dp->rx)) x |= DISPLAY_STATUS_RX_READY;
+		if(fifo_count(&dp->tx) == 0) x |= DISPLAY_STATUS_TX_EMPTY;
+		break;
+	case DISPLAY_IRQ_ENABLE_PHY_ADDR:
+		x = dp->irq_enable;
+		break;
+	default:
+		fatal("%s: read error addr\n",__func__);
+		break;
+	}
+
+	return x;
+}
+
+static void display_write(struct device *dev,uint64_t addr,int size,uint64_t data)
+{
+	struct display *dp = (struct display *)dev;
+
+	switch(addr){
+	case DISPLAY_CHAR_PHY_ADDR:
+		display_put_char(dp,data & 0xff);
+		break;
+	case DISPLAY_STATUS_PHY_ADDR:
+		break;
+	case DISPLAY_IRQ_ENABLE_PHY_ADDR:
+		dp->irq_enable = data;
+		display_update_irq(dp);
+		break;
+	default:
+		fatal("%s: write error addr\n",__func__);
+		break;
+	}
+}
+
+static void display_sync(struct device *dev)
+{
+	struct display *dp = (struct display *)dev;
+
+	pthread_mutex_lock(&dp->lock);
+	dp->flush_request = 1;
+	pthread_cond_signal(&dp->tx_cond);
+	while(fifo_count(&dp->tx)){
+		pthread_cond_wait(&dp->drained_cond,&dp->lock);
+	}
+	pthread_mutex_unlock(&dp->lock);
+}
+
+//the tx fifo is empty after sync,only the pending input is saved
+static void display_save(struct device *dev,int fd)
+{
+	struct display *dp = (struct display *)dev;
+	uint64_t head = dp->rx.head;
+	uint64_t count = fifo_count(&dp->rx);
+	uint8_t c;
+
+	write_full(fd,&dp->irq_enable,sizeof(dp->irq_enable));
+	write_full(fd,&count,sizeof(count));
+	for(uint64_t i = 0;i<count;i++){
+		c = dp->rx.buf[(head + i) & (dp->rx.size - 1)];
+		write_full(fd,&c,1);
+	}
+}
+
+static void display_restore(struct device *dev,int fd,uint64_t size)
+{
+	struct display *dp = (struct display *)dev;
+	uint64_t count;
+	uint8_t c;
+
+	read_full(fd,&dp->irq_enable,sizeof(dp->irq_enable));
+	read_full(fd,&count,sizeof(count));
+	while(count--){
+		read_full(fd,&c,1);
+		fifo_push(&dp->rx,c);
+	}
+	display_update_irq(dp);
+}
+
+//the pending output is written before the writer stops
+static void display_stop(struct display *dp)
+{
+	pthread_mutex_lock(&dp->lock);
+	dp->stop = 1;
+	pthread_cond_signal(&dp->tx_cond);
+	pthread_mutex_unlock(&dp->lock);
+	pthread_join(dp->writer,NULL);
+}
+
+//the output queued so far is written before a fatal error is printed
+static void display_sync_all(void)
+{
+	pthread_mutex_lock(&displays_lock);
+	for(struct display *dp = displays;dp;dp = dp->next){
+		display_sync(&dp->dev);
+	}
+	pthread_mutex_unlock(&displays_lock);
+}
+
+static void display_exit(void)
+{
+	pthread_mutex_lock(&displays_lock);
+	for(struct display *dp = displays;dp;dp = dp->next){
+		display_stop(dp);
+	}
+	pthread_mutex_unlock(&displays_lock);
+}
+
+//queued output is written out,unread input is dropped
+static void display_reset(struct device *dev)
+{
+	struct display *dp = (struct display *)dev;
+
+	display_sync(dev);
+	__atomic_store_n(&dp->rx.head,__atomic_load_n(&dp->rx.tail,__ATOMIC_ACQUIRE),__ATOMIC_RELEASE);
+	dp->irq_enable = 0;
+	display_update_irq(dp);
+}
+
+static void display_free(struct device *dev)
+{
+	struct display *dp = (struct display *)dev;
+	struct display **p;
+
+	pthread_mutex_lock(&displays_lock);
+	for(p = &displays;*p != dp;p = &(*p)->next);
+	*p = dp->next;
+	pthread_mutex_unlock(&displays_lock);
+
+	display_stop(dp);
+	if(dp->in_fd != -1){//blocked in read()
+		pthread_cancel(dp->reader);
+		pthread_join(dp->reader,NULL);
+	}
+
+	pthread_mutex_destroy(&dp->lock);
+	pthread_cond_destroy(&dp->tx_cond);
+	pthread_cond_destroy(&dp->drained_cond);
+	free(dp->tx.buf);
+	free(dp->rx.buf);
+	free(dp);
+}
+
+struct device * alloc_display(int out_fd,int in_fd)
 {
 	struct display *dp = malloc(sizeof(struct display));
+	if(dp == NULL){
+		fatal("alloc display error(%s)\n",strerror(errno));
+	}
+	memset(dp,0,sizeof(struct display));
 
+	dp->dev.name = "display";
 	dp->dev.start_addr = DISPLAY_START_PHY_ADDR;
 	dp->dev.end_addr   = DISPLAY_END_PHY_ADDR;
-	dp->dev.read_byte_func  = NULL;
-	dp->dev.write_byte_func = display_write_byte;
+	dp->dev.irq = DISPLAY_IRQ;
+	dp->dev.read_func  = display_read;
+	dp->dev.write_func = display_write;
+	dp->dev.sync_func = display_sync;
+	dp->dev.save_func = display_save;
+	dp->dev.restore_func = display_restore;
+	dp->dev.free_func = display_free;
+	dp->dev.reset_func = display_reset;
+
+	init_fifo(&dp->tx,DISPLAY_TX_FIFO_SIZE);
+	init_fifo(&dp->rx,DISPLAY_RX_FIFO_SIZE);
+	dp->out_fd = out_fd;
+	dp->stdio = out_fd == STDOUT_FILENO;
+	dp->in_fd = in_fd;
+
+	pthread_mutex_init(&dp->lock,NULL);
+	pthread_cond_init(&dp->tx_cond,NULL);
+	pthread_cond_init(&dp->drained_cond,NULL);
+
+	if(pthread_create(&dp->writer,NULL,display_writer,dp)){
+		fatal("create display writer error\n");
+	}
+	if(in_fd != -1 && pthread_create(&dp->reader,NULL,display_reader,dp)){
+		fatal("create display reader error\n");
+	}
+
+	pthread_mutex_lock(&displays_lock);
+	if(!display_exit_registered){
+		atexit(display_exit);
+		set_fatal_hook(display_sync_all);
+		display_exit_registered = 1;
+	}
+	dp->next = displays;
+	displays = dp;
+	pthread_mutex_unlock(&displays_lock);
 
 	return (struct device *)dp;
 }
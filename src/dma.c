@@ -0,0 +1,424 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dma.h"
+#include "bus.h"
+#include "ram.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "tracer.h"
+#include "error.h"
+
+static struct dma_xfer *dma_xfer_at(struct dma *dma,uint32_t counter)
+{
+	return &dma->xfers[counter % DMA_RING_SIZE_MAX];
+}
+
+static void dma_update_irq(struct dma *dma)
+{
+	bus_set_irq(dma->dev.bus,dma->dev.irq,(dma->irq_status & dma->irq_enable) != 0);
+}
+
+//the range must be in ram or inside one device
+static int dma_check_range(struct dma *dma,uint64_t addr,uint64_t len,uint8_t **ptr)
+{
+	struct device *dev;
+
+	*ptr = ram_ptr(dma->dev.bus->ram,addr,len);
+	if(*ptr) return 1;
+
+	dev = find_device(dma->dev.bus,addr);
+	return dev && dev != &dma->dev && addr + len >= addr && addr + len <= dev->end_addr;
+}
+
+static void dma_device_xfer(struct dma *dma,struct dma_xfer *x)
+{
+	struct bus *bus = dma->dev.bus;
+	uint8_t *buf = x->src_ptr;
+
+	if(buf == NULL){
+		buf = x->dst_ptr;
+		if(buf == NULL){//device to device
+			buf = malloc(x->len);
+			if(buf == NULL){//the transfer fails,not the machine
+				x->status = DMA_DESC_ERROR;
+				return;
+			}
+		}
+
+		if(x->flags & DMA_DESC_SRC_FIXED){
+			for(uint64_t i = 0;i<x->len;i++){
+				buf[i] = device_read(find_device(bus,x->src),x->src,1);
+			}
+		}else{
+			device_read_block(find_device(bus,x->src),x->src,buf,x->len);
+		}
+	}
+
+	if(x->dst_ptr == NULL){
+		if(x->flags & DMA_DESC_DST_FIXED){
+			for(uint64_t i = 0;i<x->len;i++){
+				device_write(find_device(bus,x->dst),x->dst,1,buf[i]);
+			}
+		}else{
+			device_write_block(find_device(bus,x->dst),x->dst,buf,x->len);
+		}
+	}else{
+		ram_mark_dirty(bus->ram,x->dst,x->len);
+	}
+
+	if(x->src_ptr == NULL && x->dst_ptr == NULL){
+		free(buf);
+	}
+	x->status = DMA_DESC_DONE;
+}
+
+static void *dma_worker(void *arg)
+{
+	struct dma *dma = arg;
+	struct dma_xfer *x;
+	uint64_t begin;
+
+	tracer_thread_name("dma");
+	pthread_mutex_lock(&dma->lock);
+	while(!dma->stop){
+		if(dma->completed == dma->submitted || dma->device_wait){
+			pthread_cond_wait(&dma->work_cond,&dma->lock);
+			continue;
+		}
+		x = dma_xfer_at(dma,dma->completed);
+
+		if(x->status == DMA_DESC_PENDING){
+			if(x->src_ptr == NULL || x->dst_ptr == NULL){
+				dma->device_wait = 1;
+				pthread_cond_broadcast(&dma->done_cond);
+				pthread_mutex_unlock(&dma->lock);
+				bus_request_poll(dma->dev.bus);
+				pthread_mutex_lock(&dma->lock);
+				continue;
+			}
+
+			pthread_mutex_unlock(&dma->lock);
+			begin = tracer_begin(TRACER_DEVICE);
+			memmove(x->dst_ptr,x->src_ptr,x->len);
+			ram_mark_dirty(dma->dev.bus->ram,x->dst,x->len);
+			if(begin) tracer_end(TRACER_DEVICE,"copy",begin,dma->dev.name,x->dst,x->len);
+			x->status = DMA_DESC_DONE;
+			pthread_mutex_lock(&dma->lock);
+		}
+
+		dma->completed++;
+		pthread_cond_broadcast(&dma->done_cond);
+		pthread_mutex_unlock(&dma->lock);
+		bus_request_poll(dma->dev.bus);
+		pthread_mutex_lock(&dma->lock);
+	}
+	pthread_mutex_unlock(&dma->lock);
+
+	return NULL;
+}
+
+//parse the descriptors the driver added,on the cpu thread
+static void dma_doorbell(struct dma *dma,uint32_t head)
+{
+	struct bus *bus = dma->dev.bus;
+	struct cpu *cpu = bus->cpu;
+	struct dma_desc *desc;
+	struct dma_xfer *x;
+	uint32_t submitted;
+	int ok;
+
+	if(dma->ring_size == 0 || head >= dma->ring_size){
+		dma->status |= DMA_STATUS_ERROR;
+		return;
+	}
+
+	pthread_mutex_lock(&dma->lock);
+	submitted = dma->submitted;
+	pthread_mutex_unlock(&dma->lock);
+
+	while(submitted % dma->ring_size != head){
+		//ring full,the slot still holds a descriptor not published,a bad head from the driver
+		if(submitted - dma->published >= dma->ring_size){
+			dma->status |= DMA_STATUS_ERROR;
+			break;
+		}
+		x = dma_xfer_at(dma,submitted);
+		memset(x,0,sizeof(struct dma_xfer));
+		x->desc_addr = dma->ring_base + (submitted % dma->ring_size) * sizeof(struct dma_desc);
+
+		//the driver wrote the descriptor through the caches
+		writeback_cache_range(cpu,x->desc_addr,sizeof(struct dma_desc));
+		desc = (struct dma_desc *)ram_ptr(bus->ram,x->desc_addr,sizeof(struct dma_desc));
+		if(desc){
+			x->src = desc->src;
+			x->dst = desc->dst;
+			x->len = desc->len;
+			x->flags = desc->flags;
+		}
+
+		ok = desc && dma_check_range(dma,x->src,x->len,&x->src_ptr) &&
+				dma_check_range(dma,x->dst,x->len,&x->dst_ptr);
+		if(!ok){
+			x->status = DMA_DESC_ERROR;
+		}else{
+			if(x->src_ptr) writeback_cache_range(cpu,x->src,x->len);
+			if(x->dst_ptr) flush_cache_range(cpu,x->dst,x->len);
+		}
+
+#ifdef __DMA_DEBUG__
+		printf("%s: src:0x%lx dst:0x%lx len:%ld flags:0x%x ok:%d\n",__func__,x->src,x->dst,x->len,x->flags,ok);
+#endif
+		submitted++;
+	}
+
+	pthread_mutex_lock(&dma->lock);
+	dma->submitted = submitted;
+	pthread_cond_signal(&dma->work_cond);
+	pthread_mutex_unlock(&dma->lock);
+}
+
+//publish done descriptors to the guest,on the cpu thread
+static void dma_poll(struct device *dev)
+{
+	struct dma *dma = (struct dma *)dev;
+	struct bus *bus = dev->bus;
+	struct dma_xfer *x;
+	struct dma_desc *desc;
+	uint32_t completed;
+
+	pthread_mutex_lock(&dma->lock);
+	if(dma->device_wait){
+		x = dma_xfer_at(dma,dma->completed);
+		pthread_mutex_unlock(&dma->lock);
+		dma_device_xfer(dma,x);
+		pthread_mutex_lock(&dma->lock);
+		dma->device_wait = 0;
+		pthread_cond_signal(&dma->work_cond);
+	}
+	completed = dma->completed;
+	pthread_mutex_unlock(&dma->lock);
+
+	while(dma->published != completed){
+		x = dma_xfer_at(dma,dma->published);
+
+		//lines read while the transfer was running are stale
+		if(x->dst_ptr) invalid_cache_range(bus->cpu,x->dst,x->len);
+
+		flush_cache_range(bus->cpu,x->desc_addr,sizeof(struct dma_desc));
+		desc = (struct dma_desc *)ram_ptr(bus->ram,x->desc_addr,sizeof(struct dma_desc));
+		if(desc){
+			desc->status = x->status;
+			ram_mark_dirty(bus->ram,x->desc_addr,sizeof(struct dma_desc));
+		}
+
+		if(x->status == DMA_DESC_ERROR){
+			dma->status |= DMA_STATUS_ERROR;
+			dma->irq_status |= DMA_IRQ_ERROR;
+		}else if(x->flags & DMA_DESC_IRQ){
+			dma->irq_status |= DMA_IRQ_DONE;
+		}
+		dma->published++;
+	}
+
+	dma_update_irq(dma);
+}
+
+static void dma_sync(struct device *dev)
+{
+	struct dma *dma = (struct dma *)dev;
+
+	pthread_mutex_lock(&dma->lock);
+	while(dma->completed != dma->submitted){
+		if(dma->device_wait){
+			pthread_mutex_unlock(&dma->lock);
+			dma_poll(dev);
+			pthread_mutex_lock(&dma->lock);
+			continue;
+		}
+		pthread_cond_wait(&dma->done_cond,&dma->lock);
+	}
+	pthread_mutex_unlock(&dma->lock);
+
+	dma_poll(dev);
+}
+
+static void dma_reset(struct dma *dma)
+{
+	dma_sync(&dma->dev);
+
+	dma->ring_base = 0;
+	dma->ring_size = 0;
+	dma->irq_enable = 0;
+	dma->irq_status = 0;
+	dma->status = 0;
+	dma->submitted = dma->completed = dma->published = 0;
+	dma_update_irq(dma);
+}
+
+static uint64_t dma_reg(struct dma *dma,uint64_t reg)
+{
+	switch(reg){
+	case DMA_RING_BASE:
+		return dma->ring_base;
+	case DMA_RING_SIZE:
+		return dma->ring_size;
+	case DMA_HEAD:
+		return dma->ring_size ? dma->submitted % dma->ring_size : 0;
+	case DMA_TAIL:
+		return dma->ring_size ? dma->published % dma->ring_size : 0;
+	case DMA_STATUS:
+		return dma->status | (dma->published != dma->submitted ? DMA_STATUS_BUSY : 0);
+	case DMA_IRQ_ENABLE:
+		return dma->irq_enable;
+	case DMA_IRQ_STATUS:
+		return dma->irq_status;
+	default:
+		return 0;
+	}
+}
+
+static uint64_t dma_read(struct device *dev,uint64_t addr,int size)
+{
+	uint64_t off = addr - dev->start_addr;
+	uint64_t x = dma_reg((struct dma *)dev,off & ~7UL) >> ((off & 7)*8);
+
+	return size == 8 ? x : x & ((1UL << (size*8)) - 1);
+}
+
+static void dma_write(struct device *dev,uint64_t addr,int size,uint64_t data)
+{
+	struct dma *dma = (struct dma *)dev;
+	uint64_t off = addr - dev->start_addr;
+	uint64_t reg = off & ~7UL;
+	uint64_t shift = (off & 7)*8;
+	uint64_t mask = size == 8 ? ~0UL : ((1UL << (size*8)) - 1) << shift;
+
+	//narrow writes update a part of the register
+	data = (dma_reg(dma,reg) & ~mask) | ((data << shift) & mask);
+
+	switch(reg){
+	case DMA_RING_BASE:
+		dma->ring_base = data;
+		break;
+	case DMA_RING_SIZE:
+		if(data == 0 || data > DMA_RING_SIZE_MAX || (data & (data - 1)) || dma->published != dma->submitted){
+			dma->status |= DMA_STATUS_ERROR;
+		}else{
+			dma->ring_size = data;
+		}
+		break;
+	case DMA_HEAD:
+		dma_doorbell(dma,data);
+		break;
+	case DMA_STATUS:
+		dma->status &= ~(data & DMA_STATUS_ERROR);
+		break;
+	case DMA_IRQ_ENABLE:
+		dma->irq_enable = data;
+		dma_update_irq(dma);
+		break;
+	case DMA_IRQ_STATUS:
+		dma->irq_status &= ~data;
+		dma_update_irq(dma);
+		break;
+	case DMA_CTRL:
+		if(data & DMA_CTRL_RESET) dma_reset(dma);
+		break;
+	default:
+		break;
+	}
+}
+
+//called after sync,every descriptor is published
+static void dma_save(struct device *dev,int fd)
+{
+	struct dma *dma = (struct dma *)dev;
+
+	write_full(fd,&dma->ring_base,sizeof(dma->ring_base));
+	write_full(fd,&dma->ring_size,sizeof(dma->ring_size));
+	write_full(fd,&dma->irq_enable,sizeof(dma->irq_enable));
+	write_full(fd,&dma->irq_status,sizeof(dma->irq_status));
+	write_full(fd,&dma->status,sizeof(dma->status));
+	write_full(fd,&dma->published,sizeof(dma->published));
+}
+
+static void dma_restore(struct device *dev,int fd,uint64_t size)
+{
+	struct dma *dma = (struct dma *)dev;
+
+	read_full(fd,&dma->ring_base,sizeof(dma->ring_base));
+	read_full(fd,&dma->ring_size,sizeof(dma->ring_size));
+	read_full(fd,&dma->irq_enable,sizeof(dma->irq_enable));
+	read_full(fd,&dma->irq_status,sizeof(dma->irq_status));
+	read_full(fd,&dma->status,sizeof(dma->status));
+	read_full(fd,&dma->published,sizeof(dma->published));
+
+	pthread_mutex_lock(&dma->lock);
+	dma->submitted = dma->completed = dma->published;
+	pthread_mutex_unlock(&dma->lock);
+	dma_update_irq(dma);
+}
+
+static void dma_reset_device(struct device *dev)
+{
+	dma_reset((struct dma *)dev);
+}
+
+static void dma_free(struct device *dev)
+{
+	struct dma *dma = (struct dma *)dev;
+
+	pthread_mutex_lock(&dma->lock);
+	dma->stop = 1;
+	pthread_cond_broadcast(&dma->work_cond);
+	pthread_mutex_unlock(&dma->lock);
+	pthread_join(dma->worker,NULL);
+
+	pthread_mutex_destroy(&dma->lock);
+	pthread_cond_destroy(&dma->work_cond);
+	pthread_cond_destroy(&dma->done_cond);
+	free(dma->xfers);
+	free(dma);
+}
+
+struct device *alloc_dma()
+{
+	struct dma *dma = malloc(sizeof(struct dma));
+	if(dma == NULL){
+		fatal("alloc dma error(%s)\n",strerror(errno));
+	}
+	memset(dma,0,sizeof(struct dma));
+
+	dma->xfers = calloc(DMA_RING_SIZE_MAX,sizeof(struct dma_xfer));
+	if(dma->xfers == NULL){
+		fatal("alloc dma transfers error(%s)\n",strerror(errno));
+	}
+
+	dma->dev.name = "dma";
+	dma->dev.start_addr = DMA_START_PHY_ADDR;
+	dma->dev.end_addr   = DMA_END_PHY_ADDR;
+	dma->dev.irq = DMA_IRQ;
+	dma->dev.read_func  = dma_read;
+	dma->dev.write_func = dma_write;
+	dma->dev.poll_func = dma_poll;
+	dma->dev.sync_func = dma_sync;
+	dma->dev.save_func = dma_save;
+	dma->dev.restore_func = dma_restore;
+	dma->dev.free_func = dma_free;
+	dma->dev.reset_func = dma_reset_device;
+
+	pthread_mutex_init(&dma->lock,NULL);
+	pthread_cond_init(&dma->work_cond,NULL);
+	pthread_cond_init(&dma->done_cond,NULL);
+
+	if(pthread_create(&dma->worker,NULL,dma_worker,dma)){
+		fatal("create dma worker error\n");
+	}
+
+	return (struct device *)dma;
+}
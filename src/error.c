@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "error.h"
+
+static __thread struct error_handler *error_handler = NULL;
+static void (*fatal_hook)(void) = NULL;
+
+//return the previous handler,NULL to print and exit again
+struct error_handler *set_error_handler(struct error_handler *handler)
+{
+	struct error_handler *prev = error_handler;
+
+	error_handler = handler;
+	return prev;
+}
+
+void set_fatal_hook(void (*hook)(void))
+{
+	fatal_hook = hook;
+}
+
+void fatal(const char *fmt,...)
+{
+	struct error_handler *handler = error_handler;
+	va_list ap;
+	size_t len;
+
+	va_start(ap,fmt);
+	if(handler == NULL){
+		if(fatal_hook) fatal_hook();
+		vprintf(fmt,ap);
+		exit(-1);
+	}
+	vsnprintf(handler->msg,ERROR_MSG_SIZE,fmt,ap);
+	va_end(ap);
+
+	len = strlen(handler->msg);
+	if(len && handler->msg[len - 1] == '\n') handler->msg[len - 1] = 0;
+	longjmp(handler->env,1);
+}
@@ -0,0 +1,204 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "interval.h"
+#include "cpu.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "tracer.h"
+#include "error.h"
+
+struct interval_worker{
+	struct interval_sim *sim;
+	struct bus *bus;
+	struct cpu *cpu;
+	struct checkpoint_reader *reader;
+	pthread_t thread;
+};
+
+struct interval_sim *alloc_interval_sim(char *filename,uint64_t base,uint64_t interval,uint64_t warm,uint64_t total)
+{
+	struct interval_sim *sim = malloc(sizeof(struct interval_sim));
+	if(sim == NULL){
+		fatal("alloc interval simulation error(%s)\n",strerror(errno));
+	}
+	memset(sim,0,sizeof(struct interval_sim));
+
+	sim->filename = filename;
+	sim->base = base;
+	sim->interval = interval;
+	sim->warm = warm < interval ? warm : interval;
+	sim->total = total;
+	sim->nr_intervals = (total - base + interval - 1)/interval;
+
+	sim->insns = calloc(sim->nr_intervals + 1,sizeof(uint64_t));
+	sim->counts = calloc(sim->nr_intervals + 1,sizeof(struct cache_counts));
+	if(sim->insns == NULL || sim->counts == NULL){
+		fatal("alloc interval simulation error(%s)\n",strerror(errno));
+	}
+	return sim;
+}
+
+void free_interval_sim(struct interval_sim *sim)
+{
+	free(sim->insns);
+	free(sim->counts);
+	free(sim);
+}
+
+static void restore_interval(struct interval_worker *worker,uint32_t seq)
+{
+	if(worker->cpu == NULL){
+		worker->cpu = reader_restore_checkpoint(worker->reader,worker->bus,seq);
+		worker->cpu->quiet = 1;
+	}else{
+		reload_checkpoint(worker->reader,worker->cpu,seq);
+	}
+}
+
+static void simulate_interval(struct interval_worker *worker,uint32_t i)
+{
+	struct interval_sim *sim = worker->sim;
+	uint64_t start = sim->base + i*sim->interval;
+	uint64_t len = sim->total - start < sim->interval ? sim->total - start : sim->interval;
+	struct cache_counts begin,end;
+	struct cpu *cpu;
+
+	if(i > 0 && sim->warm){
+		restore_interval(worker,i - 1);
+		cpu = worker->cpu;
+		cpu->functional = 1;
+		cpu_run_for(cpu,sim->interval - sim->warm);
+		cpu->functional = 0;//the caches are empty,see the functional run
+		cpu_run_for(cpu,sim->warm);
+	}else{
+		restore_interval(worker,i);
+		cpu = worker->cpu;
+		cpu->functional = 0;
+	}
+
+	if(cpu->instret != start){
+		fatal("%s: interval %u starts at %lu instead of %lu\n",__func__,i,cpu->instret,start);
+	}
+
+	read_cache_counts(cpu,&begin);
+	cpu_run_for(cpu,len);
+	read_cache_counts(cpu,&end);
+
+	sim->insns[i] = cpu->instret - start;
+	for(int j = 0;j<3;j++){
+		sim->counts[i].hits[j] = end.hits[j] - begin.hits[j];
+		sim->counts[i].misses[j] = end.misses[j] - begin.misses[j];
+	}
+
+#ifdef __INTERVAL_DEBUG__
+	printf("interval %u: start %lu instructions %lu cache misses %lu\n",i,start,sim->insns[i],sim->counts[i].misses[2]);
+#endif
+}
+
+static void *interval_worker(void *arg)
+{
+	struct interval_worker *worker = arg;
+	struct interval_sim *sim = worker->sim;
+	uint32_t i;
+
+	tracer_thread_name("interval");
+	worker->reader = open_checkpoint_reader(sim->filename);
+	while((i = __atomic_fetch_add(&sim->next,1,__ATOMIC_RELAXED)) < sim->nr_intervals){
+		simulate_interval(worker,i);
+	}
+	close_checkpoint_reader(worker->reader);
+	return NULL;
+}
+
+void simulate_intervals(struct interval_sim *sim,int jobs,alloc_interval_bus_func alloc_bus_func)
+{
+	struct interval_worker *workers;
+
+	if(jobs > sim->nr_intervals) jobs = sim->nr_intervals;
+	if(jobs == 0) return;
+
+	workers = calloc(jobs,sizeof(struct interval_worker));
+	if(workers == NULL){
+		fatal("alloc interval workers error(%s)\n",strerror(errno));
+	}
+
+	//devices are set up here,the workers only restore into them
+	for(int i = 0;i<jobs;i++){
+		workers[i].sim = sim;
+		workers[i].bus = alloc_bus_func();
+	}
+	for(int i = 0;i<jobs;i++){
+		if(pthread_create(&workers[i].thread,NULL,interval_worker,workers + i)){
+			fatal("create interval worker error\n");
+		}
+	}
+	for(int i = 0;i<jobs;i++){
+		pthread_join(workers[i].thread,NULL);
+		if(workers[i].cpu){
+			free_ram(workers[i].cpu->ram);
+			free_cpu(workers[i].cpu);
+		}
+		free_bus(workers[i].bus);
+	}
+
+	free(workers);
+}
+
+//the counts of the caches of cpu are replaced by the sums of the intervals
+void merge_intervals(struct interval_sim *sim,struct cpu *cpu)
+{
+	struct cache *caches[3] = {&cpu->icache,&cpu->dcache,&cpu->cache};
+
+	for(int j = 0;j<3;j++){
+		caches[j]->hits = 0;
+		caches[j]->misses = 0;
+		for(uint32_t i = 0;i<sim->nr_intervals;i++){
+			caches[j]->hits += sim->counts[i].hits[j];
+			caches[j]->misses += sim->counts[i].misses[j];
+		}
+	}
+}
+
+static double interval_cpi(uint64_t insns,struct cache_counts *counts)
+{
+	return (insns + counts->hits[2]*SAMPLING_CACHE_LATENCY + counts->misses[2]*SAMPLING_MEMORY_LATENCY)/(double)insns;
+}
+
+void report_intervals(struct interval_sim *sim,FILE *f)
+{
+	static const char *names[3] = {"icache","dcache","cache"};
+	struct cache_counts sum;
+	uint64_t insns = 0,accesses;
+	double cpi,min_cpi = 0,max_cpi = 0;
+
+	memset(&sum,0,sizeof(sum));
+	for(uint32_t i = 0;i<sim->nr_intervals;i++){
+		insns += sim->insns[i];
+		for(int j = 0;j<3;j++){
+			sum.hits[j] += sim->counts[i].hits[j];
+			sum.misses[j] += sim->counts[i].misses[j];
+		}
+		if(sim->insns[i] == 0) continue;
+
+		cpi = interval_cpi(sim->insns[i],sim->counts + i);
+		if(min_cpi == 0 || cpi < min_cpi) min_cpi = cpi;
+		if(cpi > max_cpi) max_cpi = cpi;
+	}
+
+	fprintf(f,"intervals: %u of %lu instructions(warm %lu),%lu instructions simulated\n",
+			sim->nr_intervals,sim->interval,sim->warm,insns);
+	fprintf(f,"%-8s %14s %14s %10s %10s\n","cache","hits","misses","miss_rate","mpki");
+	for(int j = 0;j<3;j++){
+		accesses = sum.hits[j] + sum.misses[j];
+		fprintf(f,"%-8s %14lu %14lu %10.6f %10.3f\n",names[j],sum.hits[j],sum.misses[j],
+				accesses ? (double)sum.misses[j]/accesses : 0.0,insns ? sum.misses[j]*1000.0/insns : 0.0);
+	}
+	if(insns){
+		fprintf(f,"cpi %.6f,per interval %.6f - %.6f\n",interval_cpi(insns,&sum),min_cpi,max_cpi);
+	}
+}
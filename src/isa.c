@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <pthread.h>
+
+#include "isa.h"
+
+const struct inst_desc inst_descs[NR_INSTS] = {
+	[INST_NONE] = {"unknown",0,0},
+#define INST(id,name,mask,match,format,...) [INST_##id] = {name,mask,match},
+#include "isa.def"
+#undef INST
+};
+
+struct decode_bucket decode_buckets[DECODE_NR_BUCKETS];
+struct decode_entry decode_entries[NR_INSTS*8];//an instruction without funct3 is in 8 buckets
+
+static pthread_once_t isa_once = PTHREAD_ONCE_INIT;
+
+//an instruction is in the buckets its opcode and funct3 may take
+static void build_decode_buckets(void)
+{
+	uint32_t key,n = 0;
+
+	for(int bucket = 0;bucket<DECODE_NR_BUCKETS;bucket++){
+		key = (bucket & 0x1F) << 2 | 3 | (bucket >> 5) << 12;
+		decode_buckets[bucket].first = n;
+		for(int id = INST_NONE + 1;id<NR_INSTS;id++){
+			if((key ^ inst_descs[id].match) & inst_descs[id].mask & 0x707F) continue;
+			decode_entries[n].mask = inst_descs[id].mask;
+			decode_entries[n].match = inst_descs[id].match;
+			decode_entries[n].id = id;
+			n++;
+		}
+		decode_buckets[bucket].nr = n - decode_buckets[bucket].first;
+
+#ifdef __ISA_DEBUG__
+		if(decode_buckets[bucket].nr){
+			printf("%s: opcode 0x%x funct3 %d: %d instructions\n",__func__,key & 0x7F,bucket >> 5,decode_buckets[bucket].nr);
+		}
+#endif
+	}
+}
+
+//the tables are shared by all cpus,e.g. of interval workers
+void init_isa(void)
+{
+	pthread_once(&isa_once,build_decode_buckets);
+}
@@ -0,0 +1,257 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libcall.h"
+#include "cpu.h"
+#include "bus.h"
+#include "ram.h"
+#include "cache.h"
+#include "bpred.h"
+#include "timing.h"
+#include "loader.h"
+#include "error.h"
+
+static const char *func_names[NR_LIBCALL_FUNCS] = {
+	"memcpy","memmove","memset","strlen","memcmp",
+};
+
+struct libcalls *alloc_libcalls(char *elf_file)
+{
+	struct elf_symtab *symtab = load_elf_symbols(elf_file);
+	struct libcalls *lc;
+	int found = 0;
+
+	lc = malloc(sizeof(struct libcalls));
+	if(lc == NULL){
+		fatal("alloc libcalls error(%s)\n",strerror(errno));
+	}
+	memset(lc,0,sizeof(struct libcalls));
+
+	for(uint64_t i = 0;i<symtab->nr_symbols;i++){
+		for(int j = 0;j<NR_LIBCALL_FUNCS;j++){
+			if(lc->start[j] || symtab->symbols[i].addr == 0 || strcmp(symtab->symbols[i].name,func_names[j])) continue;//0 is undefined
+			lc->start[j] = symtab->symbols[i].addr;
+			lc->end[j] = symtab->symbols[i].addr + symtab->symbols[i].size;
+			found++;
+		}
+	}
+	if(found == 0){
+		fatal("no memcpy,memmove,memset,strlen or memcmp in the symbols of %s\n",elf_file);
+	}
+	return lc;
+}
+
+//the whole range is ram,below every device
+static int in_ram(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	uint64_t limit = cpu->bus->low_addr < cpu->ram->size ? cpu->bus->low_addr : cpu->ram->size;
+
+	return addr <= limit && len <= limit - addr;
+}
+
+//the caches are bypassed and not simulated,ram is accessed in place
+static int direct(struct cpu *cpu)
+{
+	return cpu->functional && cpu->cachesim == NULL;
+}
+
+static void drop_reservation(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	if(cpu->reservation >= (addr & ~(uint64_t)(CACHE_LINE_SIZE - 1)) && cpu->reservation < addr + len){
+		cpu->reservation = RESERVATION_NONE;
+	}
+}
+
+//otherwise through the data cache a chunk at a time,one line access per cache line
+static void copy_memory(struct cpu *cpu,uint64_t dst,uint64_t src,uint64_t len)
+{
+	uint8_t buf[LIBCALL_CHUNK_SIZE];
+	uint64_t n;
+
+	drop_reservation(cpu,dst,len);
+	if(direct(cpu)){
+		memmove(cpu->ram->data + dst,cpu->ram->data + src,len);
+		ram_mark_dirty(cpu->ram,dst,len);
+		return;
+	}
+
+	if(dst > src && dst - src < len){//overlapped,from the end
+		while(len){
+			n = len < LIBCALL_CHUNK_SIZE ? len : LIBCALL_CHUNK_SIZE;
+			len -= n;
+			get_data_from_cache(&cpu->dcache,src + len,buf,n);
+			put_data_to_cache(&cpu->dcache,dst + len,buf,n);
+		}
+		return;
+	}
+	while(len){
+		n = len < LIBCALL_CHUNK_SIZE ? len : LIBCALL_CHUNK_SIZE;
+		get_data_from_cache(&cpu->dcache,src,buf,n);
+		put_data_to_cache(&cpu->dcache,dst,buf,n);
+		src += n;
+		dst += n;
+		len -= n;
+	}
+}
+
+static void set_memory(struct cpu *cpu,uint64_t dst,uint8_t c,uint64_t len)
+{
+	uint8_t buf[LIBCALL_CHUNK_SIZE];
+	uint64_t n;
+
+	drop_reservation(cpu,dst,len);
+	if(direct(cpu)){
+		memset(cpu->ram->data + dst,c,len);
+		ram_mark_dirty(cpu->ram,dst,len);
+		return;
+	}
+
+	memset(buf,c,len < LIBCALL_CHUNK_SIZE ? len : LIBCALL_CHUNK_SIZE);
+	while(len){
+		n = len < LIBCALL_CHUNK_SIZE ? len : LIBCALL_CHUNK_SIZE;
+		put_data_to_cache(&cpu->dcache,dst,buf,n);
+		dst += n;
+		len -= n;
+	}
+}
+
+//return 0 when the string leaves ram,nothing has been changed then
+static int string_length(struct cpu *cpu,uint64_t s,uint64_t *len)
+{
+	uint8_t buf[CACHE_LINE_SIZE];
+	uint64_t addr = s,n;
+	uint8_t *p;
+
+	if(direct(cpu)){
+		if(!in_ram(cpu,s,0)) return 0;
+		n = (cpu->bus->low_addr < cpu->ram->size ? cpu->bus->low_addr : cpu->ram->size) - s;
+		p = memchr(cpu->ram->data + s,0,n);
+		if(p == NULL) return 0;
+		*len = p - (cpu->ram->data + s);
+		return 1;
+	}
+
+	//a line at a time,no line past the end is touched
+	while(1){
+		n = CACHE_LINE_SIZE - (addr & (CACHE_LINE_SIZE - 1));
+		if(!in_ram(cpu,addr,n)) return 0;
+		get_data_from_cache(&cpu->dcache,addr,buf,n);
+		p = memchr(buf,0,n);
+		if(p){
+			*len = addr + (p - buf) - s;
+			return 1;
+		}
+		addr += n;
+	}
+}
+
+//the difference of the first bytes not equal,like the c library
+static int compare_bytes(uint8_t *p1,uint8_t *p2,uint64_t len)
+{
+	uint64_t i = 0;
+
+	while(len - i >= 64 && memcmp(p1 + i,p2 + i,64) == 0){
+		i += 64;
+	}
+	for(;i<len;i++){
+		if(p1[i] != p2[i]) return p1[i] - p2[i];
+	}
+	return 0;
+}
+
+static int compare_memory(struct cpu *cpu,uint64_t s1,uint64_t s2,uint64_t len,uint64_t *compared)
+{
+	uint8_t buf1[LIBCALL_CHUNK_SIZE],buf2[LIBCALL_CHUNK_SIZE];
+	uint64_t n;
+	int diff = 0;
+
+	*compared = len;
+	if(direct(cpu)){
+		return compare_bytes(cpu->ram->data + s1,cpu->ram->data + s2,len);
+	}
+
+	while(len){
+		n = len < LIBCALL_CHUNK_SIZE ? len : LIBCALL_CHUNK_SIZE;
+		get_data_from_cache(&cpu->dcache,s1,buf1,n);
+		get_data_from_cache(&cpu->dcache,s2,buf2,n);
+		diff = compare_bytes(buf1,buf2,n);
+		if(diff) break;
+		s1 += n;
+		s2 += n;
+		len -= n;
+	}
+	*compared -= len;
+	return diff;
+}
+
+/*
+ * called after a jump,cpu->pc is the target and from the jump.
+ * return 1 when a routine has been done and cpu->pc is ra.
+ */
+int libcall(struct cpu *cpu,uint64_t from)
+{
+	struct libcalls *lc = cpu->libcalls;
+	uint64_t *a = &cpu->regfile[10];
+	uint64_t bytes,len;
+	int f;
+
+	if(cpu->pc == 0) return 0;//the guest returns to the loader,start is 0 for a routine not found
+
+	for(f = 0;f<NR_LIBCALL_FUNCS;f++){
+		if(lc->start[f] == cpu->pc) break;
+	}
+	if(f == NR_LIBCALL_FUNCS || (from >= lc->start[f] && from < lc->end[f])) return 0;//a loop of the routine
+
+	switch(f){
+	case LIBCALL_MEMCPY:
+	case LIBCALL_MEMMOVE:
+		if(!in_ram(cpu,a[0],a[2]) || !in_ram(cpu,a[1],a[2])) goto fallback;
+		copy_memory(cpu,a[0],a[1],a[2]);
+		bytes = a[2];
+		break;
+	case LIBCALL_MEMSET:
+		if(!in_ram(cpu,a[0],a[2])) goto fallback;
+		set_memory(cpu,a[0],a[1],a[2]);
+		bytes = a[2];
+		break;
+	case LIBCALL_STRLEN:
+		if(!string_length(cpu,a[0],&len)) goto fallback;
+		a[0] = len;
+		bytes = len + 1;
+		break;
+	default:
+		if(!in_ram(cpu,a[0],a[2]) || !in_ram(cpu,a[1],a[2])) goto fallback;
+		a[0] = (int64_t)compare_memory(cpu,a[0],a[1],a[2],&bytes);
+		break;
+	}
+
+#ifdef __LIBCALL_DEBUG__
+	printf("%s: %s from 0x%lx,%lu bytes = 0x%lx\n",__func__,func_names[f],from,bytes,a[0]);
+#endif
+
+	lc->calls[f]++;
+	lc->bytes[f] += bytes;
+	cpu->pc = cpu->regfile[1];
+
+	//the jump to the routine has been seen,its ret is not run
+	if(cpu->bpred) bpred_native_return(cpu);
+	if(cpu->timing) cpu->timing->native_target = lc->start[f];
+	return 1;
+
+fallback:
+	lc->fallbacks[f]++;
+	return 0;
+}
+
+void report_libcalls(struct libcalls *lc,FILE *f)
+{
+	fprintf(f,"native libc routines:\n");
+	for(int i = 0;i<NR_LIBCALL_FUNCS;i++){
+		if(lc->start[i] == 0) continue;
+		fprintf(f,"  %-8s 0x%-10lx %10lu calls %14lu bytes %10lu run by the guest\n",
+				func_names[i],lc->start[i],lc->calls[i],lc->bytes[i],lc->fallbacks[i]);
+	}
+}
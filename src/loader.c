@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+
+#include "loader.h"
+#include "ram.h"
+#include "error.h"
+
+int is_elf_file(char *filename)
+{
+	unsigned char ident[SELFMAG];
+	int fd = open(filename,O_RDONLY);
+	int ret;
+
+	if(fd == -1) return 0;
+	ret = read(fd,ident,SELFMAG) == SELFMAG && memcmp(ident,ELFMAG,SELFMAG) == 0;
+	close(fd);
+	return ret;
+}
+
+static void read_at(int fd,char *filename,void *buf,uint64_t size,uint64_t offset)
+{
+	if(pread(fd,buf,size,offset) != size){
+		fatal("read %s file error(%s)\n",filename,strerror(errno));
+	}
+}
+
+//ram is mapped at address 0,segments are loaded at their virtual address
+void load_elf(struct ram *ram,char *filename,struct elf_image *image)
+{
+	Elf64_Ehdr ehdr;
+	Elf64_Phdr phdr;
+	uint8_t *dst;
+	int fd;
+
+	fd = open(filename,O_RDONLY);
+	if(fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+
+	read_at(fd,filename,&ehdr,sizeof(ehdr),0);
+	if(memcmp(ehdr.e_ident,ELFMAG,SELFMAG) || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+			ehdr.e_machine != EM_RISCV || ehdr.e_type != ET_EXEC){
+		fatal("%s is not a static riscv64 executable\n",filename);
+	}
+
+	memset(image,0,sizeof(struct elf_image));
+	image->entry = ehdr.e_entry;
+	image->flags = ehdr.e_flags;
+	image->phent = ehdr.e_phentsize;
+	image->phnum = ehdr.e_phnum;
+
+	for(int i = 0;i<ehdr.e_phnum;i++){
+		read_at(fd,filename,&phdr,sizeof(phdr),ehdr.e_phoff + i*ehdr.e_phentsize);
+		if(phdr.p_type != PT_LOAD) continue;
+
+		dst = ram_ptr(ram,phdr.p_vaddr,phdr.p_memsz);
+		if(dst == NULL || phdr.p_filesz > phdr.p_memsz){
+			fatal("%s: segment 0x%lx-0x%lx does not fit in ram\n",filename,phdr.p_vaddr,phdr.p_vaddr + phdr.p_memsz);
+		}
+		read_at(fd,filename,dst,phdr.p_filesz,phdr.p_offset);
+		memset(dst + phdr.p_filesz,0,phdr.p_memsz - phdr.p_filesz);
+		ram_mark_dirty(ram,phdr.p_vaddr,phdr.p_memsz);
+
+		if(ehdr.e_phoff >= phdr.p_offset && ehdr.e_phoff < phdr.p_offset + phdr.p_filesz){
+			image->phdr = phdr.p_vaddr + ehdr.e_phoff - phdr.p_offset;
+		}
+		if(phdr.p_vaddr + phdr.p_memsz > image->end){
+			image->end = phdr.p_vaddr + phdr.p_memsz;
+		}
+
+#ifdef __LOADER_DEBUG__
+		printf("%s: load 0x%lx-0x%lx\n",filename,phdr.p_vaddr,phdr.p_vaddr + phdr.p_memsz);
+#endif
+	}
+
+	close(fd);
+}
+
+static int symbol_cmp(const void *a,const void *b)
+{
+	const struct elf_symbol *x = a,*y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+struct elf_symtab *load_elf_symbols(char *filename)
+{
+	struct elf_symtab *symtab;
+	Elf64_Ehdr ehdr;
+	Elf64_Shdr *shdrs,*strtab_shdr;
+	Elf64_Sym *syms;
+	char *strtab;
+	uint64_t nr_syms;
+	int fd;
+
+	symtab = malloc(sizeof(struct elf_symtab));
+	if(symtab == NULL){
+		fatal("alloc elf symbols error(%s)\n",strerror(errno));
+	}
+	memset(symtab,0,sizeof(struct elf_symtab));
+
+	fd = open(filename,O_RDONLY);
+	if(fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+
+	read_at(fd,filename,&ehdr,sizeof(ehdr),0);
+	if(memcmp(ehdr.e_ident,ELFMAG,SELFMAG) || ehdr.e_ident[EI_CLASS] != ELFCLASS64){
+		fatal("%s is not a 64 bit elf file\n",filename);
+	}
+
+	shdrs = malloc(ehdr.e_shnum * sizeof(Elf64_Shdr));
+	if(shdrs == NULL){
+		fatal("alloc elf section headers error(%s)\n",strerror(errno));
+	}
+	for(int i = 0;i<ehdr.e_shnum;i++){
+		read_at(fd,filename,shdrs + i,sizeof(Elf64_Shdr),ehdr.e_shoff + i*ehdr.e_shentsize);
+	}
+
+	for(int i = 0;i<ehdr.e_shnum;i++){
+		if(shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr.e_shnum) continue;
+
+		strtab_shdr = shdrs + shdrs[i].sh_link;
+		nr_syms = shdrs[i].sh_size / sizeof(Elf64_Sym);
+		syms = malloc(shdrs[i].sh_size);
+		strtab = malloc(strtab_shdr->sh_size + 1);
+		symtab->symbols = malloc(nr_syms * sizeof(struct elf_symbol));
+		if(syms == NULL || strtab == NULL || symtab->symbols == NULL){
+			fatal("alloc elf symbols error(%s)\n",strerror(errno));
+		}
+		read_at(fd,filename,syms,shdrs[i].sh_size,shdrs[i].sh_offset);
+		read_at(fd,filename,strtab,strtab_shdr->sh_size,strtab_shdr->sh_offset);
+		strtab[strtab_shdr->sh_size] = 0;
+
+		for(uint64_t j = 0;j<nr_syms;j++){
+			if(ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC || syms[j].st_name >= strtab_shdr->sh_size) continue;
+			symtab->symbols[symtab->nr_symbols].addr = syms[j].st_value;
+			symtab->symbols[symtab->nr_symbols].size = syms[j].st_size;
+			symtab->symbols[symtab->nr_symbols].name = strtab + syms[j].st_name;//strtab is kept
+			symtab->nr_symbols++;
+		}
+		free(syms);
+		break;
+	}
+	free(shdrs);
+	close(fd);
+
+	qsort(symtab->symbols,symtab->nr_symbols,sizeof(struct elf_symbol),symbol_cmp);
+
+#ifdef __LOADER_DEBUG__
+	printf("%s: %ld function symbols\n",filename,symtab->nr_symbols);
+#endif
+
+	return symtab;
+}
+
+//symbols without a size cover the space up to the next one
+struct elf_symbol *find_elf_symbol(struct elf_symtab *symtab,uint64_t addr)
+{
+	uint64_t lo = 0,hi = symtab->nr_symbols,mid;
+	struct elf_symbol *sym;
+
+	while(lo < hi){//first symbol above addr
+		mid = (lo + hi)/2;
+		if(symtab->symbols[mid].addr <= addr){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	if(lo == 0) return NULL;
+
+	sym = &symtab->symbols[lo - 1];
+	if(sym->size && addr >= sym->addr + sym->size) return NULL;
+	return sym;
+}
@@ -2,35 +2,483 @@
 #include <stdlib.h>
 #include <err.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include "cpu.h"
 #include "ram.h"
 #include "cache.h"
 #include "bus.h"
 #include "device.h"
 #include "display.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "virtio_blk.h"
+#include "dma.h"
+#include "user.h"
+#include "stats.h"
+#include "profiler.h"
+#include "counters.h"
+#include "sampling.h"
+#include "interval.h"
+#include "loader.h"
+#include "batch.h"
+#include "timing.h"
+#include "bpred.h"
+#include "cachesim.h"
+#include "pmu.h"
+#include "tracer.h"
+#include "libcall.h"
 
 struct ram *ram;
 struct cpu *cpu;
 struct bus *bus;
 struct device *dp;
+struct device *blk;
+struct device *dma;
+
+extern char **environ;
+
+static void usage(char *name)
+{
+	printf("Usage:%s [options] file_name\n",name);
+	printf("      %s [options] -u elf_file [args...]\n",name);
+	printf("      %s [options] -r snapshot_file\n",name);
+	printf("      %s [options] -R checkpoint_file [-k seq]\n",name);
+	printf("      %s [-J jobs] [-m size] [-n count] -B manifest\n",name);
+	printf("  -n count             stop after count instructions\n");
+	printf("  -s snapshot_file     save the machine state when stopped\n");
+	printf("  -r snapshot_file     restore the machine state instead of loading a file\n");
+	printf("  -c checkpoint_file   write incremental checkpoints\n");
+	printf("  -i interval          instructions between checkpoints\n");
+	printf("  -R checkpoint_file   restore the machine state from a checkpoint\n");
+	printf("  -k seq               checkpoint to restore,the last one by default\n");
+	printf("  -o file              write the console output to file\n");
+	printf("  -I file              feed the console input from file or pipe,- for stdin\n");
+	printf("  -u                   user mode,run a static linux binary with host syscalls\n");
+	printf("                       built with -march=rv64ia -mabi=lp64,no m,f,d or c\n");
+	printf("  -m size              ram size in MB,50 by default\n");
+	printf("  -j stats_file        write run statistics as json when stopped\n");
+	printf("  -P period            profile,sample the guest stack every period instructions\n");
+	printf("  -H hz                profile,sample on host timer ticks\n");
+	printf("  -F file              folded stacks output,%s by default\n",PROFILER_DEFAULT_FOLDED_FILE);
+	printf("  -E elf_file          symbols for the profile and -N,the loaded file in user mode\n");
+	printf("  -N                   run memcpy,memmove,memset,strlen and memcmp of the guest on the host,\n");
+	printf("                       their instructions are not counted\n");
+	printf("  -q                   quiet,no instruction trace or register dump,e.g. to time a debug build\n");
+	printf("  -C                   count the instruction mix,opcodes and basic blocks\n");
+	printf("  -S period            sampled simulation,simulate the caches for one window every period instructions\n");
+	printf("  -W warm              sampled or interval simulation,instructions to warm the caches,%d by default\n",SAMPLING_DEFAULT_WARM);
+	printf("  -M measure           sampled simulation,instructions measured per window,%d by default\n",SAMPLING_DEFAULT_MEASURE);
+	printf("  -J jobs              interval simulation,run functionally with checkpoints(-c,-i) then\n");
+	printf("                       simulate the caches of every interval on jobs threads,0 for all cpus\n");
+	printf("  -B manifest          batch mode,run the tests of manifest on -J threads and write the results\n");
+	printf("                       as json lines,-n limits the instructions of a test\n");
+	printf("  -t stages            timing model,in-order pipeline of stages(at least %d),0 for %d\n",TIMING_MIN_STAGES,TIMING_DEFAULT_STAGES);
+	printf("  -L l1,l2,memory      timing model,access latencies,%d,%d,%d by default\n",
+			TIMING_DEFAULT_L1_LATENCY,TIMING_DEFAULT_L2_LATENCY,TIMING_DEFAULT_MEMORY_LATENCY);
+	printf("  -D                   timing model without forwarding\n");
+	printf("  -p sizes             branch predictors,bimodal,gshare,tage,btb bits and ras depth,\n");
+	printf("                       %d,%d,%d,%d,%d by default,0 or missing fields for the defaults,\n",BPRED_DEFAULT_BIMODAL_BITS,
+			BPRED_DEFAULT_GSHARE_BITS,BPRED_DEFAULT_TAGE_BITS,BPRED_DEFAULT_BTB_BITS,BPRED_DEFAULT_RAS_DEPTH);
+	printf("                       at most %d bits and a ras depth of %d\n",BPRED_MAX_BITS,BPRED_MAX_RAS_DEPTH);
+	printf("  -A threads           decoupled cache statistics,run functionally and simulate the caches\n");
+	printf("                       on threads consumer threads,a power of 2 up to %d\n",CACHESIM_MAX_CONSUMERS);
+	printf("  -e events            performance counters,count the events on hpmcounter3 and up,readable in user mode,\n");
+	printf("                       l1i_miss,l1d_miss,l2_miss,writeback,invalidation,branch,branch_taken\n");
+	printf("  -X file              trace events as chrome trace json for perfetto,%s by default\n",TRACER_DEFAULT_FILE);
+	printf("  -x categories        traced events,all or cache,coherency,writeback,device,trap,sched,\n");
+	printf("                       category:rate keeps one event in rate,all by default\n");
+	printf("  -b image_file        attach a virtio block device backed by image_file\n");
+	printf("  -Q depth             virtio block queue depth,%d by default\n",VIRTIO_BLK_QUEUE_SIZE);
+	printf("  -T threads           virtio block io threads,%d by default\n",VIRTIO_BLK_IO_THREADS);
+	exit(-1);
+}
+
+static int interval_null_fd = -1;//console output of all interval machines
+
+//a machine for replaying intervals,same devices as the checkpoints without the console output
+static struct bus *alloc_interval_bus(void)
+{
+	struct bus *bus = alloc_bus();
+
+	add_device(bus, alloc_display(interval_null_fd,-1));
+	add_device(bus, alloc_dma());
+	return bus;
+}
 
 int main(int argc,char *argv[])
 {
-	if(argc != 2){
-		printf("Usage:%s file_name",argv[0]);
-		exit(-1);
+	char *save_file = NULL;
+	char *restore_file = NULL;
+	char *checkpoint_file = NULL;
+	char *restore_checkpoint_file = NULL;
+	uint32_t checkpoint_seq = CHECKPOINT_LAST_SEQ;
+	struct checkpoint *ckpt = NULL;
+	uint64_t count = UINT64_MAX;
+	uint64_t interval = UINT64_MAX;
+	uint64_t step;
+	int out_fd = STDOUT_FILENO;
+	int in_fd = -1;
+	char *blk_file = NULL;
+	uint32_t blk_queue_size = VIRTIO_BLK_QUEUE_SIZE;
+	int blk_threads = VIRTIO_BLK_IO_THREADS;
+	uint64_t ram_size = 50*1024*1024;//50M
+	struct user *user = NULL;
+	int user_mode = 0;
+	char *stats_file = NULL;
+	struct timespec start,end;
+	int halted = 0;
+	uint64_t profile_period = 0;
+	int profile_hz = 0;
+	char *folded_file = PROFILER_DEFAULT_FOLDED_FILE;
+	char *symbol_file = NULL;
+	struct profiler *prof = NULL;
+	int count_insts = 0;
+	uint64_t sample_period = 0;
+	uint64_t sample_warm = SAMPLING_DEFAULT_WARM;
+	uint64_t sample_measure = SAMPLING_DEFAULT_MEASURE;
+	struct sampler *sampler = NULL;
+	int interval_jobs = -1;
+	struct interval_sim *isim = NULL;
+	uint64_t interval_base = 0;
+	char *batch_file = NULL;
+	int timing_stages = -1;
+	int forwarding = 1;
+	uint64_t latencies[3] = {TIMING_DEFAULT_L1_LATENCY,TIMING_DEFAULT_L2_LATENCY,TIMING_DEFAULT_MEMORY_LATENCY};
+	char *p;
+	int bpred_sizes[5] = {0};
+	unsigned long bpred_size;
+	int branch_predict = 0;
+	int cachesim_threads = 0;
+	struct cachesim *csim = NULL;
+	uint8_t pmu_events[PMU_NR_COUNTERS];
+	int nr_pmu_events = 0;
+	int native_libcalls = 0;
+	int quiet = 0;
+	char *trace_file = NULL;
+	uint32_t trace_rates[NR_TRACER_CATEGORIES];
+	int trace = 0;
+	struct batch *batch;
+	int failed;
+	int opt;
+
+	while((opt = getopt(argc,argv,"+n:s:r:c:i:R:k:o:I:b:Q:T:um:j:P:H:F:E:CS:W:M:J:B:t:L:Dp:A:e:X:x:Nq")) != -1){
+		switch(opt){
+		case 'n':
+			count = strtoull(optarg,NULL,0);
+			break;
+		case 's':
+			save_file = optarg;
+			break;
+		case 'r':
+			restore_file = optarg;
+			break;
+		case 'c':
+			checkpoint_file = optarg;
+			break;
+		case 'i':
+			interval = strtoull(optarg,NULL,0);
+			break;
+		case 'R':
+			restore_checkpoint_file = optarg;
+			break;
+		case 'k':
+			checkpoint_seq = strtoul(optarg,NULL,0);
+			break;
+		case 'o':
+			out_fd = open(optarg,O_WRONLY|O_CREAT|O_TRUNC,0644);
+			if(out_fd == -1){
+				printf("open %s file error(%s)\n",optarg,strerror(errno));
+				exit(-1);
+			}
+			break;
+		case 'I':
+			in_fd = strcmp(optarg,"-") ? open(optarg,O_RDONLY) : STDIN_FILENO;
+			if(in_fd == -1){
+				printf("open %s file error(%s)\n",optarg,strerror(errno));
+				exit(-1);
+			}
+			break;
+		case 'b':
+			blk_file = optarg;
+			break;
+		case 'Q':
+			blk_queue_size = strtoul(optarg,NULL,0);
+			break;
+		case 'T':
+			blk_threads = atoi(optarg);
+			break;
+		case 'P':
+			profile_period = strtoull(optarg,NULL,0);
+			break;
+		case 'H':
+			profile_hz = atoi(optarg);
+			break;
+		case 'F':
+			folded_file = optarg;
+			break;
+		case 'E':
+			symbol_file = optarg;
+			break;
+		case 'S':
+			sample_period = strtoull(optarg,NULL,0);
+			break;
+		case 'W':
+			sample_warm = strtoull(optarg,NULL,0);
+			break;
+		case 'M':
+			sample_measure = strtoull(optarg,NULL,0);
+			break;
+		case 'J':
+			interval_jobs = atoi(optarg);
+			break;
+		case 'B':
+			batch_file = optarg;
+			break;
+		case 't':
+			timing_stages = atoi(optarg);
+			if(timing_stages == 0) timing_stages = TIMING_DEFAULT_STAGES;
+			break;
+		case 'L':
+			p = optarg;
+			for(int i = 0;i<3;i++){
+				latencies[i] = strtoull(p,&p,0);
+				if(i < 2 && *p++ != ',') usage(argv[0]);
+			}
+			break;
+		case 'D':
+			forwarding = 0;
+			break;
+		case 'A':
+			cachesim_threads = atoi(optarg);
+			break;
+		case 'e':
+			nr_pmu_events = parse_pmu_events(optarg,pmu_events);
+			if(nr_pmu_events <= 0) usage(argv[0]);
+			break;
+		case 'N':
+			native_libcalls = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'X':
+			trace_file = optarg;
+			break;
+		case 'x':
+			if(parse_tracer_categories(optarg,trace_rates)) usage(argv[0]);
+			trace = 1;
+			break;
+		case 'p':
+			p = optarg;
+			for(int i = 0;i<5 && *p;i++){
+				bpred_size = strtoul(p,&p,0);
+				if(bpred_size > (i < 4 ? BPRED_MAX_BITS : BPRED_MAX_RAS_DEPTH)) usage(argv[0]);
+				bpred_sizes[i] = bpred_size;
+				if(*p && *p++ != ',') usage(argv[0]);
+			}
+			branch_predict = 1;
+			break;
+		case 'C':
+			count_insts = 1;
+			break;
+		case 'j':
+			stats_file = optarg;
+			break;
+		case 'u':
+			user_mode = 1;
+			break;
+		case 'm':
+			ram_size = strtoull(optarg,NULL,0)*1024*1024;
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	//started before the devices,their threads name themselves
+	if(trace_file || trace){
+		if(trace_file == NULL) trace_file = TRACER_DEFAULT_FILE;
+		if(!trace) for(int i = 0;i<NR_TRACER_CATEGORIES;i++) trace_rates[i] = 1;
+		start_tracer(trace_rates);
+		tracer_thread_name("cpu");
+	}
+
+	//every test gets a fresh machine of its own
+	if(batch_file){
+		if(optind != argc || restore_file || restore_checkpoint_file || checkpoint_file || user_mode ||
+				blk_file || save_file || sample_period || profile_period || profile_hz || count_insts || timing_stages != -1 ||
+				branch_predict || cachesim_threads || nr_pmu_events || native_libcalls){
+			usage(argv[0]);
+		}
+		if(interval_jobs <= 0) interval_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+		batch = alloc_batch(batch_file,ram_size,count);
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		failed = run_batch(batch,interval_jobs,stdout);
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		if(trace_file) stop_tracer(trace_file);
+		report_batch(batch,interval_jobs,(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9,stderr);
+		return failed ? 1 : 0;
+	}
+
+	if(restore_file && restore_checkpoint_file){
+		usage(argv[0]);
+	}
+	if(user_mode && (restore_file || restore_checkpoint_file || optind >= argc)){
+		usage(argv[0]);
+	}
+	if((!user_mode && restore_file == NULL && restore_checkpoint_file == NULL && optind != argc - 1) ||
+			((restore_file != NULL || restore_checkpoint_file != NULL) && optind != argc)){
+		usage(argv[0]);
+	}
+	if(interval == 0 || blk_threads <= 0 || profile_hz < 0 || (profile_period && profile_hz)){
+		usage(argv[0]);
+	}
+	if(sample_period && (sample_measure == 0 || sample_warm + sample_measure > sample_period)){
+		usage(argv[0]);
+	}
+	//replayed intervals must not repeat host side effects
+	if(interval_jobs >= 0 && (checkpoint_file == NULL || interval == UINT64_MAX || sample_period || blk_file || user_mode)){
+		usage(argv[0]);
+	}
+	if(timing_stages != -1 && (timing_stages < TIMING_MIN_STAGES || interval_jobs >= 0)){
+		usage(argv[0]);
+	}
+	//the counts arrive late and the cpu must stay functional
+	if(cachesim_threads && (cachesim_threads < 0 || cachesim_threads > CACHESIM_MAX_CONSUMERS ||
+			(cachesim_threads & (cachesim_threads - 1)) || timing_stages != -1 || sample_period || interval_jobs >= 0)){
+		usage(argv[0]);
+	}
+	//the replayed intervals run the routines,their instructions must match
+	if(native_libcalls && ((symbol_file == NULL && !user_mode) || interval_jobs >= 0)){
+		usage(argv[0]);
+	}
+	if(interval_jobs == 0){
+		interval_jobs = sysconf(_SC_NPROCESSORS_ONLN);
 	}
 
 	bus = alloc_bus();
-	dp = alloc_display();
+	dp = alloc_display(out_fd,in_fd);
 	add_device(bus, dp);
+	dma = alloc_dma();
+	add_device(bus, dma);
+	if(blk_file){
+		blk = alloc_virtio_blk(blk_file,blk_queue_size,blk_threads);
+		add_device(bus, blk);
+	}
 
-	ram = alloc_ram(50*1024*1024);//50M
-	load_data_from_file(ram,0,argv[1]);
-	cpu = alloc_cpu(ram,bus);
+	if(restore_file){
+		cpu = restore_snapshot(bus,restore_file);
+		ram = cpu->ram;
+	}else if(restore_checkpoint_file){
+		cpu = restore_checkpoint(bus,restore_checkpoint_file,checkpoint_seq);
+		ram = cpu->ram;
+	}else if(user_mode){
+		ram = alloc_ram(ram_size);
+		cpu = alloc_cpu(ram,bus);
+		user = setup_user(cpu,argv[optind],argc - optind,argv + optind,environ);
+	}else{
+		ram = alloc_ram(ram_size);
+		load_data_from_file(ram,0,argv[optind]);
+		cpu = alloc_cpu(ram,bus);
+	}
+	if(quiet) cpu->quiet = 1;
 
-	cpu_run(cpu);
+	if(interval_jobs > 0){//the first pass is functional,the checkpoints hold empty caches
+		flush_all_caches(cpu);
+		cpu->functional = 1;
+		interval_base = cpu->instret;
+	}
 
+	if(checkpoint_file){
+		ckpt = create_checkpoint(checkpoint_file,ram);
+		write_checkpoint(ckpt,cpu);
+	}
+
+	if(symbol_file == NULL && user_mode) symbol_file = argv[optind];
+	if(native_libcalls){
+		cpu->libcalls = alloc_libcalls(symbol_file);
+	}
+	if(profile_period || profile_hz){
+		prof = start_profiler(cpu,profile_period,profile_hz,folded_file,symbol_file);
+	}
+
+	if(count_insts){
+		start_counters(cpu);
+	}
+	if(timing_stages != -1){
+		start_timing(cpu,timing_stages,forwarding,latencies[0],latencies[1],latencies[2]);
+	}
+	if(cachesim_threads){
+		csim = start_cachesim(cpu,cachesim_threads);
+	}
+	if(branch_predict){
+		start_bpred(cpu,bpred_sizes[0] ? bpred_sizes[0] : BPRED_DEFAULT_BIMODAL_BITS,
+				bpred_sizes[1] ? bpred_sizes[1] : BPRED_DEFAULT_GSHARE_BITS,
+				bpred_sizes[2] ? bpred_sizes[2] : BPRED_DEFAULT_TAGE_BITS,
+				bpred_sizes[3] ? bpred_sizes[3] : BPRED_DEFAULT_BTB_BITS,
+				bpred_sizes[4] ? bpred_sizes[4] : BPRED_DEFAULT_RAS_DEPTH);
+	}
+	if(nr_pmu_events){
+		program_pmu(cpu,pmu_events,nr_pmu_events);
+	}
+	if(sample_period){
+		sampler = alloc_sampler(sample_period,sample_warm,sample_measure);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	while(count){
+		step = count < interval ? count : interval;
+		if(count != UINT64_MAX) count -= step;
+
+		if(sampler ? sampler_run_for(sampler,cpu,step) : cpu_run_for(cpu,step)){
+			halted = 1;
+			break;
+		}
+
+		if(ckpt) write_checkpoint(ckpt,cpu);
+	}
+	if(ckpt) close_checkpoint(ckpt);
+	if(csim) stop_cachesim(cpu);
+	if(interval_jobs > 0){
+		isim = alloc_interval_sim(checkpoint_file,interval_base,interval,sample_warm,cpu->instret);
+		interval_null_fd = open("/dev/null",O_WRONLY);
+		if(interval_null_fd == -1){
+			printf("open /dev/null error(%s)\n",strerror(errno));
+			exit(-1);
+		}
+		simulate_intervals(isim,interval_jobs,alloc_interval_bus);
+		close(interval_null_fd);
+		merge_intervals(isim,cpu);
+		report_intervals(isim,stderr);
+		free_interval_sim(isim);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	if(prof) stop_profiler(prof);
+	if(trace_file) stop_tracer(trace_file);
+	if(cpu->counters) dump_counters(cpu->counters,stdout);
+	if(cpu->bpred) report_bpred(cpu->bpred,cpu->instret,stdout);
+	if(sampler) report_sampler(sampler,cpu->instret,stderr);
+	if(cpu->timing) report_timing(cpu->timing,stderr);
+	if(csim) report_cachesim(csim,stderr);
+	if(nr_pmu_events) report_pmu(cpu,stderr);
+	if(cpu->libcalls) report_libcalls(cpu->libcalls,stderr);
+
+	if(stats_file){
+		write_stats_file(stats_file,cpu,(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+	}
+	if(halted){
+		return user ? user->exit_code : 0;
+	}
+
+	if(save_file){
+		save_snapshot(cpu,save_file);
+	}
 
 	return 0;
 }
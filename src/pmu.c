@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmu.h"
+#include "cpu.h"
+#include "timing.h"
+
+static const char *event_names[NR_PMU_EVENTS] = {
+	"none","l1i_miss","l1d_miss","l2_miss","writeback","invalidation","branch","branch_taken",
+};
+
+//csrs whose value is not only kept in csrs[]
+int pmu_csr(uint64_t csr)
+{
+	return csr == CSR_MCOUNTINHIBIT ||
+			(csr >= CSR_MHPMEVENT3 && csr < CSR_MHPMEVENT3 + PMU_NR_COUNTERS) ||
+			csr == CSR_MCYCLE || csr == CSR_MINSTRET ||
+			(csr >= CSR_CYCLE && csr < CSR_HPMCOUNTER3 + PMU_NR_COUNTERS);
+}
+
+uint64_t pmu_read_csr(struct cpu *cpu,uint64_t csr)
+{
+	switch(csr){
+	case CSR_MCYCLE:
+	case CSR_CYCLE:
+		return cpu->timing ? timing_cycles(cpu->timing) : cpu->instret;
+	case CSR_MINSTRET:
+	case CSR_INSTRET:
+		return cpu->instret;
+	default:
+		if(csr >= CSR_HPMCOUNTER3 && csr < CSR_HPMCOUNTER3 + PMU_NR_COUNTERS){
+			return cpu->csrs[CSR_MHPMCOUNTER3 + csr - CSR_HPMCOUNTER3];
+		}
+		return cpu->csrs[csr];
+	}
+}
+
+//mcycle and minstret follow the run,writes are dropped
+void pmu_write_csr(struct cpu *cpu,uint64_t csr,uint64_t x)
+{
+	switch(csr){
+	case CSR_MCYCLE:
+	case CSR_MINSTRET:
+		break;
+	case CSR_MCOUNTINHIBIT:
+		cpu->csrs[csr] = x;
+		pmu_update(cpu);
+		break;
+	default://mhpmevent,unknown events count nothing
+		cpu->csrs[csr] = x < NR_PMU_EVENTS ? x : PMU_EVENT_NONE;
+		pmu_update(cpu);
+		break;
+	}
+
+#ifdef __PMU_DEBUG__
+	printf("pmu: csr 0x%lx = 0x%lx\n",csr,cpu->csrs[csr]);
+#endif
+}
+
+//rebuild the counters of each event,e.g. after the csrs have been restored
+void pmu_update(struct cpu *cpu)
+{
+	uint64_t inhibit = cpu->csrs[CSR_MCOUNTINHIBIT] >> PMU_FIRST_COUNTER;
+	uint64_t event;
+
+	memset(cpu->pmu_counters,0,sizeof(cpu->pmu_counters));
+	for(int i = 0;i<PMU_NR_COUNTERS;i++){
+		event = cpu->csrs[CSR_MHPMEVENT3 + i];
+		if(event != PMU_EVENT_NONE && event < NR_PMU_EVENTS && !(inhibit >> i & 1)){
+			cpu->pmu_counters[event] |= 1U << i;
+		}
+	}
+}
+
+//callers test cpu->pmu_counters[event] first,nothing is done for events no counter selects
+void pmu_count(struct cpu *cpu,enum pmu_event event)
+{
+	uint32_t mask = cpu->pmu_counters[event];
+
+	while(mask){
+		cpu->csrs[CSR_MHPMCOUNTER3 + __builtin_ctz(mask)]++;
+		mask &= mask - 1;
+	}
+}
+
+//a comma separated list of event names,return the number of events or -1
+int parse_pmu_events(char *list,uint8_t *events)
+{
+	char *p = list;
+	size_t len;
+	int n = 0,i;
+
+	while(*p){
+		len = strcspn(p,",");
+		for(i = 1;i<NR_PMU_EVENTS;i++){
+			if(strlen(event_names[i]) == len && !strncmp(p,event_names[i],len)) break;
+		}
+		if(i == NR_PMU_EVENTS || n == PMU_NR_COUNTERS) return -1;
+		events[n++] = i;
+
+		p += len;
+		if(*p) p++;
+	}
+	return n;
+}
+
+//count events on hpmcounter3 and up,readable from user mode with cycle and instret
+void program_pmu(struct cpu *cpu,uint8_t *events,int n)
+{
+	cpu->csrs[CSR_MCOUNTEREN] |= MCOUNTEREN_CY | MCOUNTEREN_IR;
+	for(int i = 0;i<n;i++){
+		cpu->csrs[CSR_MHPMEVENT3 + i] = events[i];
+		cpu->csrs[CSR_MCOUNTEREN] |= 1UL << (PMU_FIRST_COUNTER + i);
+	}
+	pmu_update(cpu);
+}
+
+void report_pmu(struct cpu *cpu,FILE *f)
+{
+	uint64_t event;
+
+	fprintf(f,"performance counters:\n");
+	for(int i = 0;i<PMU_NR_COUNTERS;i++){
+		event = cpu->csrs[CSR_MHPMEVENT3 + i];
+		if(event == PMU_EVENT_NONE || event >= NR_PMU_EVENTS) continue;
+		fprintf(f,"  hpmcounter%-2d %-18s %14lu\n",PMU_FIRST_COUNTER + i,event_names[event],cpu->csrs[CSR_MHPMCOUNTER3 + i]);
+	}
+}
@@ -0,0 +1,262 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "profiler.h"
+#include "cpu.h"
+#include "cache.h"
+#include "loader.h"
+#include "tracer.h"
+#include "error.h"
+
+#define NAME_SIZE 64
+
+struct profile_func{
+	char *name;
+	uint64_t samples;
+	uint64_t counts[4];//instructions,icache,dcache and cache misses
+};
+
+struct profile_stack{
+	char *folded;
+	uint64_t count;
+};
+
+static void read_misses(struct cpu *cpu,uint64_t *misses)
+{
+	misses[0] = cpu->icache.misses;
+	misses[1] = cpu->dcache.misses;
+	misses[2] = cpu->cache.misses;
+}
+
+static void *profiler_timer(void *arg)
+{
+	struct profiler *prof = arg;
+
+	tracer_thread_name("profiler");
+	while(!__atomic_load_n(&prof->stop,__ATOMIC_ACQUIRE)){
+		usleep(1000000/prof->hz);
+		__atomic_store_n(&prof->cpu->sample_at,0,__ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+struct profiler *start_profiler(struct cpu *cpu,uint64_t period,int hz,char *folded_file,char *elf_file)
+{
+	struct profiler *prof = malloc(sizeof(struct profiler));
+	if(prof == NULL){
+		fatal("alloc profiler error(%s)\n",strerror(errno));
+	}
+	memset(prof,0,sizeof(struct profiler));
+
+	prof->cpu = cpu;
+	prof->period = period;
+	prof->hz = hz;
+	prof->folded_file = folded_file;
+	prof->elf_file = elf_file;
+	prof->last_instret = cpu->instret;
+	read_misses(cpu,prof->last_misses);
+
+	cpu->profiler = prof;
+	if(period){
+		cpu->sample_at = cpu->instret + period;
+	}else if(pthread_create(&prof->timer,NULL,profiler_timer,prof)){
+		fatal("create profiler timer error\n");
+	}
+
+	return prof;
+}
+
+//frame pointer walk:the return address is at fp-8,the caller's fp at fp-16
+static int walk_stack(struct cpu *cpu,uint64_t *frames)
+{
+	uint64_t fp = cpu->regfile[8];
+	uint64_t ra,prev_fp;
+	int n = 0;
+
+	frames[n++] = cpu->pc;
+	while(n < PROFILER_MAX_FRAMES && fp){
+		if(!peek_qword_from_caches(cpu,fp - 8,&ra) || !peek_qword_from_caches(cpu,fp - 16,&prev_fp)){
+			break;
+		}
+		if(ra == 0) break;
+		frames[n++] = ra - 4;//the call
+		if(prev_fp <= fp) break;
+		fp = prev_fp;
+	}
+	return n;
+}
+
+void profiler_sample(struct cpu *cpu)
+{
+	struct profiler *prof = cpu->profiler;
+	uint64_t frames[PROFILER_MAX_FRAMES];
+	uint64_t misses[3];
+	uint64_t *s;
+	int n;
+
+	__atomic_store_n(&cpu->sample_at,prof->period ? cpu->instret + prof->period : UINT64_MAX,__ATOMIC_RELAXED);
+
+	n = walk_stack(cpu,frames);
+	if(prof->buf_used + PROFILER_SAMPLE_HEADER + n > prof->buf_size){
+		prof->buf_size = prof->buf_size ? prof->buf_size*2 : 65536;
+		prof->buf = realloc(prof->buf,prof->buf_size * sizeof(uint64_t));
+		if(prof->buf == NULL){
+			fatal("alloc profiler samples error(%s)\n",strerror(errno));
+		}
+	}
+
+	read_misses(cpu,misses);
+	s = prof->buf + prof->buf_used;
+	s[0] = n;
+	s[1] = cpu->instret - prof->last_instret;
+	for(int i = 0;i<3;i++){
+		s[2 + i] = misses[i] - prof->last_misses[i];
+		prof->last_misses[i] = misses[i];
+	}
+	memcpy(s + PROFILER_SAMPLE_HEADER,frames,n * sizeof(uint64_t));
+	prof->last_instret = cpu->instret;
+
+	prof->buf_used += PROFILER_SAMPLE_HEADER + n;
+	prof->nr_samples++;
+}
+
+static void symbolize(struct elf_symtab *symtab,uint64_t addr,char *name)
+{
+	struct elf_symbol *sym = symtab ? find_elf_symbol(symtab,addr) : NULL;
+
+	if(sym){
+		snprintf(name,NAME_SIZE,"%s",sym->name);
+	}else{
+		snprintf(name,NAME_SIZE,"0x%lx",addr);
+	}
+}
+
+static int stack_cmp(const void *a,const void *b)
+{
+	return strcmp(((struct profile_stack *)a)->folded,((struct profile_stack *)b)->folded);
+}
+
+static int func_name_cmp(const void *a,const void *b)
+{
+	return strcmp(((struct profile_func *)a)->name,((struct profile_func *)b)->name);
+}
+
+static int func_insns_cmp(const void *a,const void *b)
+{
+	const struct profile_func *x = a,*y = b;
+
+	return x->counts[0] < y->counts[0] ? 1 : x->counts[0] > y->counts[0] ? -1 : 0;
+}
+
+static void write_folded(struct profiler *prof,struct profile_stack *stacks)
+{
+	FILE *f = fopen(prof->folded_file,"w");
+	uint64_t n = 0;
+
+	if(f == NULL){
+		fatal("open %s file error(%s)\n",prof->folded_file,strerror(errno));
+	}
+
+	qsort(stacks,prof->nr_samples,sizeof(struct profile_stack),stack_cmp);
+	for(uint64_t i = 0;i<prof->nr_samples;i++){
+		if(n && strcmp(stacks[n - 1].folded,stacks[i].folded) == 0){
+			stacks[n - 1].count++;
+			free(stacks[i].folded);
+		}else{
+			stacks[n++] = stacks[i];
+		}
+	}
+	for(uint64_t i = 0;i<n;i++){
+		fprintf(f,"%s %lu\n",stacks[i].folded,stacks[i].count);
+		free(stacks[i].folded);
+	}
+	fclose(f);
+}
+
+static void print_functions(struct profiler *prof,struct profile_func *funcs)
+{
+	uint64_t n = 0;
+
+	qsort(funcs,prof->nr_samples,sizeof(struct profile_func),func_name_cmp);
+	for(uint64_t i = 0;i<prof->nr_samples;i++){
+		if(n && strcmp(funcs[n - 1].name,funcs[i].name) == 0){
+			funcs[n - 1].samples++;
+			for(int j = 0;j<4;j++) funcs[n - 1].counts[j] += funcs[i].counts[j];
+			free(funcs[i].name);
+		}else{
+			funcs[n++] = funcs[i];
+		}
+	}
+	qsort(funcs,n,sizeof(struct profile_func),func_insns_cmp);
+
+	fprintf(stderr,"%-32s %10s %14s %12s %12s %12s\n","function","samples","instructions","icache_miss","dcache_miss","cache_miss");
+	for(uint64_t i = 0;i<n;i++){
+		fprintf(stderr,"%-32s %10lu %14lu %12lu %12lu %12lu\n",funcs[i].name,funcs[i].samples,
+				funcs[i].counts[0],funcs[i].counts[1],funcs[i].counts[2],funcs[i].counts[3]);
+		free(funcs[i].name);
+	}
+}
+
+/*
+ * the counts of a sample are charged to the function it hit,
+ * so the per function table is a statistical estimate.
+ */
+void stop_profiler(struct profiler *prof)
+{
+	struct elf_symtab *symtab = prof->elf_file ? load_elf_symbols(prof->elf_file) : NULL;
+	struct profile_stack *stacks;
+	struct profile_func *funcs;
+	char name[NAME_SIZE];
+	uint64_t *s = prof->buf;
+	uint64_t n,len;
+
+	if(prof->period == 0){
+		__atomic_store_n(&prof->stop,1,__ATOMIC_RELEASE);
+		pthread_join(prof->timer,NULL);
+	}
+	prof->cpu->sample_at = UINT64_MAX;
+	prof->cpu->profiler = NULL;
+
+	stacks = calloc(prof->nr_samples + 1,sizeof(struct profile_stack));
+	funcs = calloc(prof->nr_samples + 1,sizeof(struct profile_func));
+	if(stacks == NULL || funcs == NULL){
+		fatal("alloc profiler report error(%s)\n",strerror(errno));
+	}
+
+	for(uint64_t i = 0;i<prof->nr_samples;i++){
+		n = s[0];
+
+		//root first,frames are stored leaf first
+		stacks[i].folded = malloc(n * (NAME_SIZE + 1));
+		if(stacks[i].folded == NULL){
+			fatal("alloc profiler report error(%s)\n",strerror(errno));
+		}
+		len = 0;
+		for(uint64_t j = n;j>0;j--){
+			symbolize(symtab,s[PROFILER_SAMPLE_HEADER + j - 1],name);
+			len += sprintf(stacks[i].folded + len,"%s%s",name,j > 1 ? ";" : "");
+		}
+		stacks[i].count = 1;
+
+		symbolize(symtab,s[PROFILER_SAMPLE_HEADER],name);
+		funcs[i].name = strdup(name);
+		funcs[i].samples = 1;
+		memcpy(funcs[i].counts,s + 1,4 * sizeof(uint64_t));
+
+		s += PROFILER_SAMPLE_HEADER + n;
+	}
+
+	fprintf(stderr,"profile: %lu samples,folded stacks in %s\n",prof->nr_samples,prof->folded_file);
+	write_folded(prof,stacks);
+	print_functions(prof,funcs);
+
+	free(stacks);
+	free(funcs);
+	free(prof->buf);
+	free(prof);
+}
@@ -1,4 +1,5 @@
 #include "ram.h"
+#include "error.h"
 #include <malloc.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,26 +7,143 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+static void alloc_dirty_bitmap(struct ram *ram)
+{
+	ram->nr_pages = (ram->size + RAM_PAGE_SIZE - 1) >> RAM_PAGE_SHIFT;
+	ram->dirty_bitmap = calloc((ram->nr_pages + 63)/64,sizeof(uint64_t));
+	if(ram->dirty_bitmap == NULL) {
+		fatal("alloc ram dirty bitmap error:%s\n",strerror(errno));
+	}
+}
+
 struct ram *alloc_ram(uint64_t size)
 {
 	struct ram *ram = malloc(sizeof(struct ram));
 	if(ram == NULL) {
-		printf("alloc ram error:%s\n",strerror(errno));
-		exit(-1);
+		fatal("alloc ram error:%s\n",strerror(errno));
 	}
 
 	ram->data = malloc(size);
 	if(ram->data == NULL) {
-		printf("alloc ram data error:%s\n",strerror(errno));
-		exit(-1);
+		fatal("alloc ram data error:%s\n",strerror(errno));
 	}
 	ram->size = size;
+	ram->mapped = 0;
+
+	alloc_dirty_bitmap(ram);
+	ram_mark_dirty(ram,0,size);//contents are unknown
 
 	return ram;
 }
 
+/*
+ * map a ram image stored in a file.
+ * the mapping is private,so pages are only copied when the guest writes them.
+ */
+struct ram *map_ram_from_file(int fd,uint64_t offset,uint64_t size)
+{
+	struct ram *ram = malloc(sizeof(struct ram));
+	if(ram == NULL) {
+		fatal("alloc ram error:%s\n",strerror(errno));
+	}
+
+	ram->data = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,offset);
+	if(ram->data == MAP_FAILED) {
+		fatal("map ram data error:%s\n",strerror(errno));
+	}
+	ram->size = size;
+	ram->mapped = 1;
+
+	alloc_dirty_bitmap(ram);//clean,the file holds every page
+
+	return ram;
+}
+
+void free_ram(struct ram *ram)
+{
+	if(ram->mapped){
+		munmap(ram->data,ram->size);
+	}else{
+		free(ram->data);
+	}
+	free(ram->dirty_bitmap);
+	free(ram);
+}
+
+//host address of a guest range,NULL if it is not all in ram
+uint8_t *ram_ptr(struct ram *ram,uint64_t addr,uint64_t size)
+{
+	if(addr >= ram->size || size > ram->size - addr){
+		return NULL;
+	}
+	return ram->data + addr;
+}
+
+void ram_mark_dirty(struct ram *ram,uint64_t addr,uint64_t size)
+{
+	uint64_t first,last;
+
+	if(size == 0) return;
+
+	first = addr >> RAM_PAGE_SHIFT;
+	last = (addr + size - 1) >> RAM_PAGE_SHIFT;
+	for(uint64_t page = first;page <= last && page < ram->nr_pages;page++){
+		__atomic_fetch_or(&ram->dirty_bitmap[page/64],1UL<<(page%64),__ATOMIC_RELAXED);
+	}
+}
+
+int ram_test_and_clear_dirty(struct ram *ram,uint64_t page)
+{
+	uint64_t bit = 1UL<<(page%64);
+
+	if(!(ram->dirty_bitmap[page/64] & bit)) return 0;
+
+	return (__atomic_fetch_and(&ram->dirty_bitmap[page/64],~bit,__ATOMIC_RELAXED) & bit) != 0;
+}
+
+uint64_t ram_page_size(struct ram *ram,uint64_t page)
+{
+	uint64_t addr = page << RAM_PAGE_SHIFT;
+
+	return ram->size - addr < RAM_PAGE_SIZE ? ram->size - addr : RAM_PAGE_SIZE;
+}
+
+int ram_page_is_zero(struct ram *ram,uint64_t page)
+{
+	uint8_t *p = ram->data + (page << RAM_PAGE_SHIFT);
+	uint64_t size = ram_page_size(ram,page);
+
+	for(uint64_t i = 0;i<size;i++){
+		if(p[i]) return 0;
+	}
+	return 1;
+}
+
+/*
+ * zero the pages written since the last call and mark them clean,
+ * untouched pages are still zero.return the number of pages zeroed.
+ */
+uint64_t ram_zero_dirty(struct ram *ram)
+{
+	uint64_t word,page,n = 0;
+
+	for(uint64_t i = 0;i<(ram->nr_pages + 63)/64;i++){
+		if(ram->dirty_bitmap[i] == 0) continue;
+
+		word = __atomic_exchange_n(&ram->dirty_bitmap[i],0,__ATOMIC_RELAXED);
+		while(word){
+			page = i*64 + __builtin_ctzl(word);
+			word &= word - 1;
+			memset(ram->data + (page << RAM_PAGE_SHIFT),0,ram_page_size(ram,page));
+			n++;
+		}
+	}
+	return n;
+}
+
 void write_to_ram(struct ram*ram,uint64_t addr,uint64_t size,uint8_t *data)
 {
 	addr = addr%ram->size;//wrap round
@@ -39,6 +157,7 @@ void write_to_ram(struct ram*ram,uint64_t addr,uint64_t size,uint8_t *data)
 #endif
 
 	memcpy(ram->data + addr,data,size);
+	ram_mark_dirty(ram,addr,size);
 }
 
 void read_from_ram(struct ram*ram,uint64_t addr,uint64_t size,uint8_t *data)
@@ -78,8 +197,7 @@ void load_data_from_file(struct ram*ram,uint64_t addr,char *filename)
 	uint64_t filesize = get_file_size(filename);
 
 	if(filesize == -1){
-		printf("get %s file size error(%s)\n",filename,strerror(errno));
-		exit(-1);
+		fatal("get %s file size error(%s)\n",filename,strerror(errno));
 	}
 
 #ifdef __RAM_LOAD_FILE_DEBUG__
@@ -93,13 +211,12 @@ void load_data_from_file(struct ram*ram,uint64_t addr,char *filename)
 
 	fd = open(filename,O_RDONLY);
 	if(fd == -1){
-		printf("open %s file error(%s)\n",filename,strerror(errno));
-		exit(-1);
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
 	}
 
 	ret = read(fd,ram->data+addr,size);
 	if(ret == -1){
-		printf("read %s file error(%s)\n",filename,strerror(errno));
-		exit(-1);
+		fatal("read %s file error(%s)\n",filename,strerror(errno));
 	}
+	ram_mark_dirty(ram,addr,ret);
 }
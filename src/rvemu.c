@@ -0,0 +1,160 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rvemu.h"
+#include "cpu.h"
+#include "ram.h"
+#include "bus.h"
+#include "display.h"
+#include "dma.h"
+#include "loader.h"
+#include "error.h"
+
+struct rvemu_vm{
+	struct ram *ram;
+	struct bus *bus;
+	struct cpu *cpu;
+
+	struct error_handler error;
+	struct error_handler *prev_error;
+	int failed;
+};
+
+//every call installs the handler of the vm,fatal() jumps back to its setjmp()
+static int unguard(struct rvemu_vm *vm,int ret)
+{
+	set_error_handler(vm->prev_error);
+	if(ret == RVEMU_ERROR) vm->failed = 1;
+	return ret;
+}
+
+int rvemu_create(struct rvemu_config *config,struct rvemu_vm **pvm)
+{
+	struct rvemu_vm *vm = calloc(1,sizeof(struct rvemu_vm));
+
+	*pvm = vm;
+	if(vm == NULL) return RVEMU_ERROR;
+
+	vm->prev_error = set_error_handler(&vm->error);
+	if(setjmp(vm->error.env)){
+		return unguard(vm,RVEMU_ERROR);
+	}
+
+	vm->ram = alloc_ram(config->ram_size ? config->ram_size : RVEMU_DEFAULT_RAM_SIZE);
+	ram_zero_dirty(vm->ram);//from now on only written pages need zeroing
+	vm->bus = alloc_bus();
+	add_device(vm->bus, alloc_display(config->out_fd,config->in_fd));
+	add_device(vm->bus, alloc_dma());
+	vm->cpu = alloc_cpu(vm->ram,vm->bus);
+	vm->cpu->quiet = 1;
+
+	return unguard(vm,RVEMU_OK);
+}
+
+void rvemu_destroy(struct rvemu_vm *vm)
+{
+	if(vm == NULL) return;
+
+	//after an error the devices are stopped without a sync,it may fail again
+	if(vm->bus && !vm->failed) sync_devices(vm->bus);
+	if(vm->bus) free_bus(vm->bus);
+	if(vm->cpu) free_cpu(vm->cpu);
+	if(vm->ram) free_ram(vm->ram);
+	free(vm);
+}
+
+int rvemu_load_file(struct rvemu_vm *vm,char *filename)
+{
+	struct elf_image image;
+
+	if(vm->failed) return RVEMU_ERROR;
+	vm->prev_error = set_error_handler(&vm->error);
+	if(setjmp(vm->error.env)){
+		return unguard(vm,RVEMU_ERROR);
+	}
+
+	if(is_elf_file(filename)){
+		load_elf(vm->ram,filename,&image);
+		vm->cpu->pc = image.entry;
+	}else{
+		load_data_from_file(vm->ram,0,filename);
+	}
+
+	return unguard(vm,RVEMU_OK);
+}
+
+int rvemu_load(struct rvemu_vm *vm,uint64_t addr,void *data,uint64_t size)
+{
+	uint8_t *dst;
+
+	if(vm->failed) return RVEMU_ERROR;
+
+	dst = ram_ptr(vm->ram,addr,size);
+	if(dst == NULL){
+		snprintf(vm->error.msg,ERROR_MSG_SIZE,"load 0x%lx-0x%lx is not in ram",addr,addr + size);
+		return RVEMU_ERROR;//the vm is still usable
+	}
+	memcpy(dst,data,size);
+	ram_mark_dirty(vm->ram,addr,size);
+	return RVEMU_OK;
+}
+
+int rvemu_run(struct rvemu_vm *vm,uint64_t count,uint64_t *executed)
+{
+	uint64_t start = vm->cpu->instret;
+	int ret;
+
+	if(vm->failed) return RVEMU_ERROR;
+	vm->prev_error = set_error_handler(&vm->error);
+	if(setjmp(vm->error.env)){
+		if(executed) *executed = vm->cpu->instret - start;
+		return unguard(vm,RVEMU_ERROR);
+	}
+
+	ret = cpu_run_for(vm->cpu,count) ? RVEMU_STOPPED : RVEMU_OK;
+	if(executed) *executed = vm->cpu->instret - start;
+	return unguard(vm,ret);
+}
+
+void rvemu_sync(struct rvemu_vm *vm)
+{
+	sync_devices(vm->bus);
+}
+
+int rvemu_reset(struct rvemu_vm *vm)
+{
+	vm->prev_error = set_error_handler(&vm->error);
+	if(setjmp(vm->error.env)){
+		return unguard(vm,RVEMU_ERROR);
+	}
+
+	reset_devices(vm->bus);
+	reset_cpu(vm->cpu);
+	ram_zero_dirty(vm->ram);
+	vm->error.msg[0] = '\0';
+	vm->failed = 0;
+
+	return unguard(vm,RVEMU_OK);
+}
+
+uint64_t rvemu_get_pc(struct rvemu_vm *vm)
+{
+	return vm->cpu->pc;
+}
+
+uint64_t rvemu_get_reg(struct rvemu_vm *vm,int idx)
+{
+	return idx > 0 && idx < 32 ? vm->cpu->regfile[idx] : 0;
+}
+
+uint64_t rvemu_instret(struct rvemu_vm *vm)
+{
+	return vm->cpu->instret;
+}
+
+const char *rvemu_error(struct rvemu_vm *vm)
+{
+	return vm->error.msg;
+}
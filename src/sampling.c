@@ -0,0 +1,158 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sampling.h"
+#include "cpu.h"
+#include "cache.h"
+#include "error.h"
+
+static const char *metric_names[NR_SAMPLE_METRICS] = {
+	"cpi","icache_miss_rate","dcache_miss_rate","cache_miss_rate","icache_mpki","dcache_mpki","cache_mpki",
+};
+
+struct sampler *alloc_sampler(uint64_t period,uint64_t warm,uint64_t measure)
+{
+	struct sampler *sampler = malloc(sizeof(struct sampler));
+	if(sampler == NULL){
+		fatal("alloc sampler error(%s)\n",strerror(errno));
+	}
+	memset(sampler,0,sizeof(struct sampler));
+
+	sampler->period = period;
+	sampler->warm = warm;
+	sampler->measure = measure;
+	return sampler;
+}
+
+void read_cache_counts(struct cpu *cpu,struct cache_counts *counts)
+{
+	struct cache *caches[3] = {&cpu->icache,&cpu->dcache,&cpu->cache};
+
+	for(int i = 0;i<3;i++){
+		counts->hits[i] = caches[i]->hits;
+		counts->misses[i] = caches[i]->misses;
+	}
+}
+
+void sampler_add_window(struct sampler *sampler,uint64_t insns,struct cache_counts *start,struct cache_counts *end)
+{
+	double x[NR_SAMPLE_METRICS];
+	uint64_t hits[3],misses[3];
+
+	for(int i = 0;i<3;i++){
+		hits[i] = end->hits[i] - start->hits[i];
+		misses[i] = end->misses[i] - start->misses[i];
+		x[SAMPLE_ICACHE_MISS_RATE + i] = hits[i] + misses[i] ? (double)misses[i]/(hits[i] + misses[i]) : 0.0;
+		x[SAMPLE_ICACHE_MPKI + i] = misses[i]*1000.0/insns;
+	}
+	//every level 1 miss is a level 2 hit or miss
+	x[SAMPLE_CPI] = (insns + hits[2]*SAMPLING_CACHE_LATENCY + misses[2]*SAMPLING_MEMORY_LATENCY)/(double)insns;
+
+	for(int i = 0;i<NR_SAMPLE_METRICS;i++){
+		sampler->sum[i] += x[i];
+		sampler->sum_sq[i] += x[i]*x[i];
+	}
+	sampler->nr_windows++;
+
+#ifdef __SAMPLING_DEBUG__
+	printf("sample window %lu: cpi %.3f cache mpki %.3f\n",sampler->nr_windows,x[SAMPLE_CPI],x[SAMPLE_CACHE_MPKI]);
+#endif
+}
+
+//the caches are emptied when they are bypassed,then warmed again
+static void set_functional(struct cpu *cpu,int functional)
+{
+	if(functional && !cpu->functional){
+		flush_all_caches(cpu);
+	}
+	cpu->functional = functional;
+}
+
+/*
+ * run at most count instructions,a period is laid out as
+ * [warm][measure][fast forward].
+ * return 1 when the guest has stopped,like cpu_run_for().
+ */
+int sampler_run_for(struct sampler *sampler,struct cpu *cpu,uint64_t count)
+{
+	struct cache_counts end;
+	uint64_t phase_end,n,start;
+	int ret;
+
+	while(count){
+		if(sampler->pos < sampler->warm){
+			set_functional(cpu,0);
+			phase_end = sampler->warm;
+		}else if(sampler->pos < sampler->warm + sampler->measure){
+			if(sampler->pos == sampler->warm) read_cache_counts(cpu,&sampler->start);
+			phase_end = sampler->warm + sampler->measure;
+		}else{
+			set_functional(cpu,1);
+			phase_end = sampler->period;
+		}
+
+		n = phase_end - sampler->pos < count ? phase_end - sampler->pos : count;
+		start = cpu->instret;
+		ret = cpu_run_for(cpu,n);
+		n = cpu->instret - start;
+		sampler->pos += n;
+		count -= n;
+
+		//a window cut short by the end of the run is dropped
+		if(sampler->pos == sampler->warm + sampler->measure){
+			read_cache_counts(cpu,&end);
+			sampler_add_window(sampler,sampler->measure,&sampler->start,&end);
+		}
+		if(sampler->pos == sampler->period){
+			sampler->pos = 0;
+		}
+		if(ret) return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * the metrics are estimated by the mean of the windows,with a confidence
+ * interval of z*s/sqrt(n).miss totals are extrapolated from the mpki.
+ */
+void report_sampler(struct sampler *sampler,uint64_t total,FILE *f)
+{
+	double n = sampler->nr_windows;
+	double mean[NR_SAMPLE_METRICS],var[NR_SAMPLE_METRICS],ci[NR_SAMPLE_METRICS];
+
+	if(sampler->nr_windows == 0){
+		fprintf(f,"sampling: no complete window in %lu instructions\n",total);
+		return;
+	}
+
+	for(int i = 0;i<NR_SAMPLE_METRICS;i++){
+		mean[i] = sampler->sum[i]/n;
+		var[i] = n > 1 ? (sampler->sum_sq[i] - n*mean[i]*mean[i])/(n - 1) : 0.0;
+		if(var[i] < 0) var[i] = 0;//rounding
+		ci[i] = SAMPLING_Z*sqrt(var[i]/n);
+	}
+
+	fprintf(f,"sampling: %lu windows of %lu instructions(warm %lu,period %lu),%.4f%% of %lu instructions measured\n",
+			sampler->nr_windows,sampler->measure,sampler->warm,sampler->period,
+			total ? sampler->nr_windows*sampler->measure*100.0/total : 0.0,total);
+	fprintf(f,"%-18s %14s %14s %9s\n","metric","mean","+-95%","error");
+	for(int i = 0;i<NR_SAMPLE_METRICS;i++){
+		fprintf(f,"%-18s %14.6f %14.6f %8.2f%%\n",metric_names[i],mean[i],ci[i],mean[i] > 0 ? ci[i]*100/mean[i] : 0.0);
+	}
+	for(int i = 0;i<3;i++){
+		fprintf(f,"%-18s %14.0f %14.0f\n",i == 0 ? "icache_misses" : i == 1 ? "dcache_misses" : "cache_misses",
+				mean[SAMPLE_ICACHE_MPKI + i]*total/1000,ci[SAMPLE_ICACHE_MPKI + i]*total/1000);
+	}
+	fprintf(f,"%-18s %14.0f %14.0f\n","cycles",mean[SAMPLE_CPI]*total,ci[SAMPLE_CPI]*total);
+
+	//windows needed for the target error on cpi,n = (z*cv/e)^2
+	if(n > 1){
+		fprintf(f,"windows for +-%.0f%% cpi: %.0f\n",SAMPLING_TARGET_ERROR*100,
+				ceil(pow(SAMPLING_Z*sqrt(var[SAMPLE_CPI])/mean[SAMPLE_CPI]/SAMPLING_TARGET_ERROR,2)));
+	}
+}
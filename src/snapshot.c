@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "cpu.h"
+#include "cache.h"
+#include "ram.h"
+#include "bus.h"
+#include "device.h"
+#include "pmu.h"
+#include "error.h"
+
+/*
+ * only lines that are valid or linked in a LRU list are saved,
+ * and only modified lines carry their data,clean ones are reloaded from ram.
+ */
+struct snapshot_cache_entry{
+	uint64_t tag;
+	uint32_t idx;
+	uint8_t coherency_state;
+
+	//LRU links saved as index in set,-1 means NULL
+	int32_t head;
+	int32_t prev;
+	int32_t next;
+};
+
+struct snapshot_device_header{
+	uint64_t start_addr;
+	uint64_t size;
+};
+
+void write_full(int fd,void *buf,uint64_t size)
+{
+	ssize_t ret;
+	uint8_t *p = buf;
+
+	while(size){
+		ret = write(fd,p,size);
+		if(ret == -1){
+			if(errno == EINTR) continue;
+			fatal("write snapshot error(%s)\n",strerror(errno));
+		}
+		p += ret;
+		size -= ret;
+	}
+}
+
+void read_full(int fd,void *buf,uint64_t size)
+{
+	ssize_t ret;
+	uint8_t *p = buf;
+
+	while(size){
+		ret = read(fd,p,size);
+		if(ret == -1){
+			if(errno == EINTR) continue;
+			fatal("read snapshot error(%s)\n",strerror(errno));
+		}
+		if(ret == 0){
+			fatal("read snapshot error(unexpected end of file)\n");
+		}
+		p += ret;
+		size -= ret;
+	}
+}
+
+static int32_t lru_to_idx(struct cache_entry *set,struct cache_entry *line)
+{
+	return line == NULL ? -1 : line - set;
+}
+
+static struct cache_entry *idx_to_lru(struct cache_entry *set,int32_t idx)
+{
+	return idx == -1 ? NULL : set + idx;
+}
+
+static int cache_entry_in_use(struct cache_entry *line)
+{
+	return line->coherency_state != CACHE_LINE_COHERENCY_INVALID_STATE || line->head || line->prev;
+}
+
+static void save_cache(struct cache *cache,int fd)
+{
+	struct snapshot_cache_entry e;
+	struct cache_entry *line,*set;
+	uint64_t nr_entrys = 0;
+
+	for(uint64_t i = 0;i<cache->entrys_count;i++){
+		if(cache_entry_in_use(cache->entrys + i)) nr_entrys++;
+	}
+	write_full(fd,&cache->entrys_count,sizeof(cache->entrys_count));
+	write_full(fd,&nr_entrys,sizeof(nr_entrys));
+
+	for(uint64_t i = 0;i<cache->entrys_count;i++){
+		line = cache->entrys + i;
+		set = cache->entrys + (i/cache->ways)*cache->ways;
+		if(!cache_entry_in_use(line)) continue;
+
+		memset(&e,0,sizeof(e));
+		e.tag = line->tag;
+		e.idx = i;
+		e.coherency_state = line->coherency_state;
+		e.head = lru_to_idx(set,line->head);
+		e.prev = lru_to_idx(set,line->prev);
+		e.next = lru_to_idx(set,line->next);
+
+		write_full(fd,&e,sizeof(e));
+		if(line->coherency_state == CACHE_LINE_COHERENCY_MODIFIED_STATE){
+			write_full(fd,line->data,CACHE_LINE_SIZE);
+		}
+	}
+}
+
+static void restore_cache(struct cache *cache,int fd)
+{
+	struct snapshot_cache_entry e;
+	struct cache_entry *line,*set;
+	uint64_t entrys_count,nr_entrys;
+
+	read_full(fd,&entrys_count,sizeof(entrys_count));
+	if(entrys_count != cache->entrys_count){
+		fatal("%s: cache %s geometry mismatch(%ld != %ld)\n",__func__,cache->name,entrys_count,cache->entrys_count);
+	}
+	read_full(fd,&nr_entrys,sizeof(nr_entrys));
+
+	memset(cache->entrys,0,cache->entrys_count * sizeof(struct cache_entry));
+	memset(cache->used_sets,0xff,(cache->entrys_count/cache->ways + 63)/64 * sizeof(uint64_t));//any set may be restored
+
+	while(nr_entrys--){
+		read_full(fd,&e,sizeof(e));
+		if(e.idx >= cache->entrys_count){
+			fatal("%s: cache %s bad entry index(%d)\n",__func__,cache->name,e.idx);
+		}
+
+		line = cache->entrys + e.idx;
+		set = cache->entrys + (e.idx/cache->ways)*cache->ways;
+		line->tag = e.tag;
+		line->coherency_state = e.coherency_state;
+		line->head = idx_to_lru(set,e.head);
+		line->prev = idx_to_lru(set,e.prev);
+		line->next = idx_to_lru(set,e.next);
+
+		if(line->coherency_state == CACHE_LINE_COHERENCY_MODIFIED_STATE){
+			read_full(fd,line->data,CACHE_LINE_SIZE);
+		}else if(line->coherency_state == CACHE_LINE_COHERENCY_SHARED_STATE){
+			reload_cache_line(cache,line);
+		}
+	}
+}
+
+static void save_devices(struct bus *bus,int fd)
+{
+	struct snapshot_device_header hdr;
+	struct device *dev;
+	uint32_t nr_devices = 0;
+	off_t start,end;
+
+	sync_devices(bus);
+
+	for(dev = bus->devices;dev;dev = dev->next){
+		if(dev->save_func) nr_devices++;
+	}
+	write_full(fd,&nr_devices,sizeof(nr_devices));
+
+	for(dev = bus->devices;dev;dev = dev->next){
+		if(dev->save_func == NULL) continue;
+
+		start = lseek(fd,0,SEEK_CUR);
+		memset(&hdr,0,sizeof(hdr));
+		write_full(fd,&hdr,sizeof(hdr));
+
+		dev->save_func(dev,fd);
+
+		end = lseek(fd,0,SEEK_CUR);
+		hdr.start_addr = dev->start_addr;
+		hdr.size = end - start - sizeof(hdr);
+		if(pwrite(fd,&hdr,sizeof(hdr),start) != sizeof(hdr)){
+			fatal("write snapshot error(%s)\n",strerror(errno));
+		}
+	}
+}
+
+static void restore_devices(struct bus *bus,int fd)
+{
+	struct snapshot_device_header hdr;
+	struct device *dev;
+	uint32_t nr_devices;
+
+	read_full(fd,&nr_devices,sizeof(nr_devices));
+
+	while(nr_devices--){
+		read_full(fd,&hdr,sizeof(hdr));
+
+		dev = find_device(bus,hdr.start_addr);
+		if(dev == NULL || dev->start_addr != hdr.start_addr || dev->restore_func == NULL){
+			fatal("%s: no device at 0x%lx can restore its state\n",__func__,hdr.start_addr);
+		}
+
+		dev->restore_func(dev,fd,hdr.size);
+	}
+}
+
+//zero pages are left as holes in the file
+static void save_ram_sparse(int fd,struct ram *ram,off_t off)
+{
+	uint64_t addr;
+
+	for(uint64_t page = 0;page<ram->nr_pages;page++){
+		if(ram_page_is_zero(ram,page)) continue;
+
+		addr = page << RAM_PAGE_SHIFT;
+		if(lseek(fd,off + addr,SEEK_SET) == -1){
+			fatal("seek snapshot error(%s)\n",strerror(errno));
+		}
+		write_full(fd,ram->data + addr,ram_page_size(ram,page));
+	}
+
+	if(ftruncate(fd,off + ram->size) == -1){
+		fatal("truncate snapshot error(%s)\n",strerror(errno));
+	}
+}
+
+/*
+ * cpu,caches and devices.
+ * ram is not included,it is saved by the caller.
+ */
+void save_machine_state(struct cpu *cpu,int fd)
+{
+	write_full(fd,cpu->regfile,sizeof(cpu->regfile));
+	write_full(fd,&cpu->pc,sizeof(cpu->pc));
+	write_full(fd,cpu->csrs,sizeof(cpu->csrs));
+	write_full(fd,cpu->vregs,sizeof(cpu->vregs));
+	write_full(fd,&cpu->inst.instruction,sizeof(cpu->inst.instruction));
+	write_full(fd,&cpu->instret,sizeof(cpu->instret));
+
+	save_cache(&cpu->icache,fd);
+	save_cache(&cpu->dcache,fd);
+	save_cache(&cpu->cache,fd);
+
+	save_devices(cpu->bus,fd);
+}
+
+void restore_machine_state(struct cpu *cpu,int fd)
+{
+	read_full(fd,cpu->regfile,sizeof(cpu->regfile));
+	read_full(fd,&cpu->pc,sizeof(cpu->pc));
+	read_full(fd,cpu->csrs,sizeof(cpu->csrs));
+	read_full(fd,cpu->vregs,sizeof(cpu->vregs));
+	read_full(fd,&cpu->inst.instruction,sizeof(cpu->inst.instruction));
+	read_full(fd,&cpu->instret,sizeof(cpu->instret));
+	pmu_update(cpu);
+
+	restore_cache(&cpu->icache,fd);
+	restore_cache(&cpu->dcache,fd);
+	restore_cache(&cpu->cache,fd);
+
+	restore_devices(cpu->bus,fd);
+}
+
+void save_snapshot(struct cpu *cpu,char *filename)
+{
+	struct snapshot_header hdr;
+	struct ram *ram = cpu->ram;
+	off_t off;
+	int fd;
+
+	fd = open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if(fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+
+	memset(&hdr,0,sizeof(hdr));
+	write_full(fd,&hdr,sizeof(hdr));
+
+	save_machine_state(cpu,fd);
+
+	off = lseek(fd,0,SEEK_CUR);
+	off = (off + SNAPSHOT_RAM_ALIGN - 1) & ~(off_t)(SNAPSHOT_RAM_ALIGN - 1);
+	save_ram_sparse(fd,ram,off);
+
+	memcpy(hdr.magic,SNAPSHOT_MAGIC,sizeof(hdr.magic));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.ram_size = ram->size;
+	hdr.ram_offset = off;
+	if(pwrite(fd,&hdr,sizeof(hdr),0) != sizeof(hdr)){
+		fatal("write %s file error(%s)\n",filename,strerror(errno));
+	}
+
+#ifdef __SNAPSHOT_DEBUG__
+	printf("%s: %s pc:0x%lx instret:%ld ram_offset:0x%lx\n",__func__,filename,cpu->pc,cpu->instret,hdr.ram_offset);
+#endif
+
+	close(fd);
+}
+
+/*
+ * the ram image is mapped private from the snapshot file,
+ * so restore cost does not depend on the ram size.
+ */
+struct cpu *restore_snapshot(struct bus *bus,char *filename)
+{
+	struct snapshot_header hdr;
+	struct ram *ram;
+	struct cpu *cpu;
+	int fd;
+
+	fd = open(filename,O_RDONLY);
+	if(fd == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+
+	read_full(fd,&hdr,sizeof(hdr));
+	if(memcmp(hdr.magic,SNAPSHOT_MAGIC,sizeof(hdr.magic)) || hdr.version != SNAPSHOT_VERSION){
+		fatal("%s is not a snapshot file\n",filename);
+	}
+
+	ram = map_ram_from_file(fd,hdr.ram_offset,hdr.ram_size);
+	cpu = alloc_cpu(ram,bus);
+
+	restore_machine_state(cpu,fd);
+
+#ifdef __SNAPSHOT_DEBUG__
+	printf("%s: %s pc:0x%lx instret:%ld\n",__func__,filename,cpu->pc,cpu->instret);
+#endif
+
+	close(fd);
+	return cpu;
+}
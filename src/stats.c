@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "stats.h"
+#include "cpu.h"
+#include "cache.h"
+#include "timing.h"
+#include "error.h"
+
+void write_stats(FILE *f,struct cpu *cpu,double seconds)
+{
+	struct cache *cache;
+	uint64_t accesses;
+
+	fprintf(f,"{\"instructions\":%lu,\"seconds\":%.6f,\"mips\":%.3f,",
+			cpu->instret,seconds,seconds > 0 ? cpu->instret/seconds/1e6 : 0.0);
+	if(cpu->timing){
+		fprintf(f,"\"cycles\":%lu,\"cpi\":%.6f,",timing_cycles(cpu->timing),
+				cpu->timing->insns ? (double)timing_cycles(cpu->timing)/cpu->timing->insns : 0.0);
+	}
+	fprintf(f,"\"caches\":{");
+
+	for(cache = get_caches(cpu);cache;cache = cache->next){
+		accesses = cache->hits + cache->misses;
+		fprintf(f,"\"%s\":{\"hits\":%lu,\"misses\":%lu,\"hit_rate\":%.6f}%s",cache->name,
+				cache->hits,cache->misses,accesses ? (double)cache->hits/accesses : 0.0,cache->next ? "," : "");
+	}
+	fprintf(f,"}}\n");
+}
+
+void write_stats_file(char *filename,struct cpu *cpu,double seconds)
+{
+	FILE *f = fopen(filename,"w");
+	if(f == NULL){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+	write_stats(f,cpu,seconds);
+	fclose(f);
+}
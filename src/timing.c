@@ -0,0 +1,226 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "timing.h"
+#include "cpu.h"
+#include "cache.h"
+#include "error.h"
+
+static const char *stall_names[NR_STALLS] = {"raw","load_use","branch","icache","dcache"};
+
+#define USES_RS1 0x1
+#define USES_RS2 0x2
+#define WRITES_RD 0x4
+#define IS_LOAD 0x8
+#define IS_MEMORY 0x10
+
+static int inst_flags(uint32_t inst)
+{
+	switch(inst & 0x7f){
+	case 0x33:
+	case 0x3B:
+		return USES_RS1 | USES_RS2 | WRITES_RD;
+	case 0x13:
+	case 0x1B:
+	case 0x67://jalr
+		return USES_RS1 | WRITES_RD;
+	case 0x37://lui
+	case 0x17://auipc
+	case 0x6F://jal
+		return WRITES_RD;
+	case 0x3:
+		return USES_RS1 | WRITES_RD | IS_LOAD | IS_MEMORY;
+	case 0x23:
+		return USES_RS1 | USES_RS2 | IS_MEMORY;
+	case 0x2F://the old value is loaded
+		return USES_RS1 | USES_RS2 | WRITES_RD | IS_LOAD | IS_MEMORY;
+	case 0x07://vector registers are not tracked
+	case 0x27:
+		return USES_RS1 | IS_MEMORY;
+	case 0x57:
+		switch((inst >> 12) & 7){
+		case 7://vsetvl
+			return USES_RS1 | USES_RS2 | WRITES_RD;
+		case 4://the scalar operand
+		case 6:
+			return USES_RS1;
+		case 2://vmv.x.s,vcpop,vfirst
+			return (inst >> 26) == 0x10 ? WRITES_RD : 0;
+		default:
+			return 0;
+		}
+	case 0x63:
+		return USES_RS1 | USES_RS2;
+	case 0x73:
+		switch((inst >> 12) & 7){
+		case 0:
+			return 0;
+		case 1:
+		case 2:
+		case 3:
+			return USES_RS1 | WRITES_RD;
+		default:
+			return WRITES_RD;
+		}
+	default:
+		return 0;
+	}
+}
+
+//cycles an access adds to its stage,from the counts of the levels that served it
+static uint64_t access_latency(struct timing *timing,struct cache_counts *now,int l1)
+{
+	uint64_t l1_accesses = now->hits[l1] - timing->seen.hits[l1] + now->misses[l1] - timing->seen.misses[l1];
+	uint64_t l1_misses = now->misses[l1] - timing->seen.misses[l1];
+	uint64_t l2_misses = now->misses[2] - timing->seen.misses[2];
+
+	if(l1_accesses == 0) return 0;//bypassed,see cpu->functional
+	return timing->l1_latency - 1 + l1_misses*timing->l2_latency + l2_misses*timing->memory_latency;
+}
+
+struct timing *start_timing(struct cpu *cpu,int stages,int forwarding,uint64_t l1_latency,uint64_t l2_latency,uint64_t memory_latency)
+{
+	struct timing *timing = malloc(sizeof(struct timing));
+	if(timing == NULL){
+		fatal("alloc timing error(%s)\n",strerror(errno));
+	}
+	memset(timing,0,sizeof(struct timing));
+
+	timing->stages = stages;
+	timing->forwarding = forwarding;
+	timing->l1_latency = l1_latency ? l1_latency : 1;
+	timing->l2_latency = l2_latency;
+	timing->memory_latency = memory_latency;
+	timing->front = stages - 3;
+
+	read_cache_counts(cpu,&timing->seen);
+	cpu->timing = timing;
+	return timing;
+}
+
+//the instruction at cpu->pc - 4 has been fetched
+void timing_fetched(struct cpu *cpu)
+{
+	struct timing *timing = cpu->timing;
+	struct cache_counts now;
+	uint64_t start;
+
+	read_cache_counts(cpu,&now);
+
+	if(timing->insns == 0){
+		start = 0;
+	}else{
+		if(cpu->pc - 4 != timing->next_pc){//a trap,resolved like a branch
+			timing->redirect = timing->issue + 1;
+		}
+		//the previous instruction leaves the first stage
+		start = timing->fetch_done + 1;
+		if(timing->issue + 1 > timing->front && timing->issue + 1 - timing->front > start){
+			start = timing->issue + 1 - timing->front;
+		}
+		if(timing->redirect > start) start = timing->redirect;
+	}
+
+	timing->pc = cpu->pc - 4;
+	timing->fetch_start = start;
+	timing->fetch_done = start + access_latency(timing,&now,0);
+	timing->seen = now;
+}
+
+void timing_executed(struct cpu *cpu)
+{
+	struct timing *timing = cpu->timing;
+	struct cache_counts now;
+	uint32_t inst = cpu->inst.instruction;
+	int flags = inst_flags(inst);
+	uint64_t t,mem_latency = 0,ready = 0;
+	int rd = (inst >> 7) & 0x1f,rs1 = (inst >> 15) & 0x1f,rs2 = (inst >> 20) & 0x1f;
+	uint64_t next_pc = timing->native_target ? timing->native_target : cpu->pc;
+	int native = timing->native_target != 0;
+	int src = 0;
+
+	//a routine run by the host accesses memory like one instruction
+	if((flags & IS_MEMORY) || native){
+		read_cache_counts(cpu,&now);
+		mem_latency = access_latency(timing,&now,1);
+		timing->seen = now;
+	}
+
+	t = timing->insns ? timing->issue + 1 : timing->front;
+	if(timing->mem_ready > t){
+		timing->stalls[STALL_DCACHE] += timing->mem_ready - t;
+		t = timing->mem_ready;
+	}
+	if(timing->fetch_start + timing->front > t){
+		timing->stalls[STALL_BRANCH] += timing->fetch_start + timing->front - t;
+		t = timing->fetch_start + timing->front;
+	}
+	if(timing->fetch_done + timing->front > t){
+		timing->stalls[STALL_ICACHE] += timing->fetch_done + timing->front - t;
+		t = timing->fetch_done + timing->front;
+	}
+
+	if((flags & USES_RS1) && rs1 && timing->ready[rs1] > ready){
+		ready = timing->ready[rs1];
+		src = rs1;
+	}
+	if((flags & USES_RS2) && rs2 && timing->ready[rs2] > ready){
+		ready = timing->ready[rs2];
+		src = rs2;
+	}
+	if(ready > t){
+		timing->stalls[timing->loaded[src] ? STALL_LOAD_USE : STALL_RAW] += ready - t;
+		t = ready;
+	}
+
+	//results are forwarded from the end of EX or MEM,else read after WB
+	if((flags & WRITES_RD) && rd){
+		if(timing->forwarding){
+			timing->ready[rd] = (flags & IS_LOAD) ? t + 2 + mem_latency : t + 1;
+		}else{
+			timing->ready[rd] = t + 3 + mem_latency;
+		}
+		timing->loaded[rd] = (flags & IS_LOAD) != 0;
+	}
+	if((flags & IS_MEMORY) || native){
+		timing->mem_ready = t + 1 + mem_latency;
+	}
+
+	//fall through is predicted,jal is redirected from the stage before EX.
+	//after a routine run by the host,the fetch of ra is redirected like its ret
+	if(next_pc != timing->pc + 4){
+		timing->redirect = (inst & 0x7f) == 0x6F ? t : t + 1;
+	}
+	timing->next_pc = next_pc;
+	timing->native_target = 0;
+	timing->issue = t;
+	timing->insns++;
+
+#ifdef __TIMING_DEBUG__
+	printf("timing: pc 0x%lx fetch %lu-%lu issue %lu\n",timing->pc,timing->fetch_start,timing->fetch_done,t);
+#endif
+}
+
+//the last instruction leaves WB two cycles after EX
+uint64_t timing_cycles(struct timing *timing)
+{
+	return timing->insns ? timing->issue + 3 : 0;
+}
+
+void report_timing(struct timing *timing,FILE *f)
+{
+	uint64_t cycles = timing_cycles(timing);
+
+	fprintf(f,"timing: %d stage pipeline,%s,latencies l1 %lu l2 %lu memory %lu\n",timing->stages,
+			timing->forwarding ? "forwarding" : "no forwarding",timing->l1_latency,timing->l2_latency,timing->memory_latency);
+	fprintf(f,"cycles %lu instructions %lu cpi %.6f\n",cycles,timing->insns,timing->insns ? (double)cycles/timing->insns : 0.0);
+	fprintf(f,"%-10s %14s %8s\n","stall","cycles","share");
+	for(int i = 0;i<NR_STALLS;i++){
+		fprintf(f,"%-10s %14lu %7.2f%%\n",stall_names[i],timing->stalls[i],cycles ? timing->stalls[i]*100.0/cycles : 0.0);
+	}
+	fprintf(f,"%-10s %14lu %7.2f%%\n","fill",timing->insns ? (uint64_t)timing->stages - 1 : 0,
+			cycles && timing->insns ? (timing->stages - 1)*100.0/cycles : 0.0);
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tracer.h"
+#include "error.h"
+
+uint32_t tracer_categories = 0;
+
+static uint32_t rates[NR_TRACER_CATEGORIES];
+static uint64_t start_ns;
+static struct tracer_buffer *buffers = NULL;
+static uint32_t nr_threads = 0;
+static __thread struct tracer_buffer *thread_buffer = NULL;
+
+static const char *category_names[NR_TRACER_CATEGORIES] = {
+	"cache","coherency","writeback","device","trap","sched",
+};
+
+//names of arg,addr and x in the trace
+static const char *arg_names[NR_TRACER_CATEGORIES][3] = {
+	{"cache","addr","size"},
+	{"cache","addr","size"},
+	{"cache","addr","size"},
+	{"device","addr","size"},
+	{NULL,"pc","code"},//cause or syscall number
+	{"executor","pc","instructions"},
+};
+
+static uint64_t host_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+//the buffer of the calling thread,registered on its first event,
+//NULL without memory and the thread records nothing,it may be a device thread
+static struct tracer_buffer *get_buffer(void)
+{
+	struct tracer_buffer *buf = thread_buffer;
+
+	if(buf) return buf;
+	buf = malloc(sizeof(struct tracer_buffer));
+	if(buf == NULL) return NULL;
+	memset(buf,0,sizeof(struct tracer_buffer));
+	buf->tid = __atomic_add_fetch(&nr_threads,1,__ATOMIC_RELAXED);
+	buf->next = __atomic_load_n(&buffers,__ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&buffers,&buf->next,buf,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+	thread_buffer = buf;
+	return buf;
+}
+
+//one event in rates[cat] is kept
+static int sampled(struct tracer_buffer *buf,enum tracer_category cat)
+{
+	if(buf->skip[cat]){
+		buf->skip[cat]--;
+		return 0;
+	}
+	buf->skip[cat] = rates[cat] - 1;
+	return 1;
+}
+
+static void record(struct tracer_buffer *buf,struct tracer_event *event)
+{
+	struct tracer_chunk *chunk = buf->last;
+	struct tracer_chunk *next;
+
+	if(buf->nr_events >= TRACER_THREAD_EVENTS){
+		__atomic_store_n(&buf->dropped,buf->dropped + 1,__ATOMIC_RELAXED);
+		return;
+	}
+	if(chunk == NULL || chunk->nr == TRACER_CHUNK_EVENTS){
+		next = malloc(sizeof(struct tracer_chunk));
+		if(next == NULL){
+			__atomic_store_n(&buf->dropped,buf->dropped + 1,__ATOMIC_RELAXED);
+			return;
+		}
+		next->next = NULL;
+		next->nr = 0;
+		if(chunk){
+			__atomic_store_n(&chunk->next,next,__ATOMIC_RELEASE);
+		}else{
+			__atomic_store_n(&buf->first,next,__ATOMIC_RELEASE);
+		}
+		buf->last = chunk = next;
+	}
+	chunk->events[chunk->nr] = *event;
+	__atomic_store_n(&chunk->nr,chunk->nr + 1,__ATOMIC_RELEASE);
+	buf->nr_events++;
+}
+
+uint64_t tracer_begin(enum tracer_category cat)
+{
+	struct tracer_buffer *buf;
+
+	if(!TRACER_ON(cat)) return 0;
+	buf = get_buffer();
+	if(buf == NULL || !sampled(buf,cat)) return 0;
+	return host_ns() - start_ns + 1;
+}
+
+void tracer_end(enum tracer_category cat,const char *name,uint64_t begin,const char *arg,uint64_t addr,uint64_t x)
+{
+	struct tracer_buffer *buf = thread_buffer;//begin != 0,got on this thread
+	struct tracer_event event;
+
+	if(begin == 0 || !TRACER_ON(cat)) return;
+	event.ts = begin - 1;
+	event.dur = host_ns() - start_ns - event.ts;
+	event.name = name;
+	event.arg = arg;
+	event.addr = addr;
+	event.x = x;
+	event.cat = cat;
+	event.span = 1;
+	record(buf,&event);
+}
+
+void tracer_instant(enum tracer_category cat,const char *name,const char *arg,uint64_t addr,uint64_t x)
+{
+	struct tracer_buffer *buf;
+	struct tracer_event event;
+
+	if(!TRACER_ON(cat)) return;
+	buf = get_buffer();
+	if(buf == NULL || !sampled(buf,cat)) return;
+	event.ts = host_ns() - start_ns;
+	event.dur = 0;
+	event.name = name;
+	event.arg = arg;
+	event.addr = addr;
+	event.x = x;
+	event.cat = cat;
+	event.span = 0;
+	record(buf,&event);
+}
+
+void tracer_thread_name(const char *name)
+{
+	struct tracer_buffer *buf;
+
+	if(tracer_categories == 0) return;
+	buf = get_buffer();
+	if(buf) __atomic_store_n(&buf->name,name,__ATOMIC_RELEASE);
+}
+
+/*
+ * list is "all" or categories separated by commas,
+ * "name:rate" keeps one event in rate,e.g. "cache:100,device,trap".
+ * return -1 on an unknown category.
+ */
+int parse_tracer_categories(char *list,uint32_t *rates)
+{
+	char *name,*rate,*save;
+	long r;
+	int i;
+
+	memset(rates,0,sizeof(uint32_t) * NR_TRACER_CATEGORIES);
+	for(name = strtok_r(list,",",&save);name;name = strtok_r(NULL,",",&save)){
+		r = 1;
+		rate = strchr(name,':');
+		if(rate){
+			*rate++ = '\0';
+			r = strtol(rate,&rate,0);
+			if(*rate || r <= 0 || r > UINT32_MAX) return -1;
+		}
+		if(strcmp(name,"all") == 0){
+			for(i = 0;i < NR_TRACER_CATEGORIES;i++) rates[i] = r;
+			continue;
+		}
+		for(i = 0;i < NR_TRACER_CATEGORIES;i++){
+			if(strcmp(name,category_names[i]) == 0) break;
+		}
+		if(i == NR_TRACER_CATEGORIES) return -1;
+		rates[i] = r;
+	}
+	return 0;
+}
+
+void start_tracer(uint32_t *r)
+{
+	uint32_t categories = 0;
+	int i;
+
+	for(i = 0;i < NR_TRACER_CATEGORIES;i++){
+		rates[i] = r[i];
+		if(r[i]) categories |= 1U << i;
+	}
+	start_ns = host_ns();
+	__atomic_store_n(&tracer_categories,categories,__ATOMIC_RELEASE);
+}
+
+static void write_event(FILE *f,struct tracer_buffer *buf,struct tracer_event *event)
+{
+	const char **names = arg_names[event->cat];
+
+	fprintf(f,",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+			event->name,category_names[event->cat],buf->tid,event->ts / 1000.0);
+	if(event->span){
+		fprintf(f,",\"ph\":\"X\",\"dur\":%.3f",event->dur / 1000.0);
+	}else{
+		fprintf(f,",\"ph\":\"i\",\"s\":\"t\"");
+	}
+	fprintf(f,",\"args\":{");
+	if(event->arg) fprintf(f,"\"%s\":\"%s\",",names[0],event->arg);
+	fprintf(f,"\"%s\":\"0x%lx\",\"%s\":%lu}}",names[1],event->addr,names[2],event->x);
+}
+
+/*
+ * tracing is turned off and the events published so far are written
+ * as chrome trace json,loaded by perfetto or chrome://tracing.
+ * the buffers are kept,a device thread may still hold its own.
+ */
+void stop_tracer(char *file)
+{
+	struct tracer_buffer *buf;
+	struct tracer_chunk *chunk;
+	uint64_t nr_events = 0,dropped = 0;
+	const char *name;
+	uint32_t i,nr;
+	FILE *f;
+
+	__atomic_store_n(&tracer_categories,0,__ATOMIC_RELEASE);
+	f = fopen(file,"w");
+	if(f == NULL){
+		fatal("open trace file %s error(%s)\n",file,strerror(errno));
+	}
+
+	fprintf(f,"{\"traceEvents\":[\n");
+	fprintf(f,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"rvemu\"}}");
+	for(buf = __atomic_load_n(&buffers,__ATOMIC_ACQUIRE);buf;buf = buf->next){
+		name = __atomic_load_n(&buf->name,__ATOMIC_ACQUIRE);
+		if(name){
+			fprintf(f,",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",buf->tid,name);
+		}
+		for(chunk = __atomic_load_n(&buf->first,__ATOMIC_ACQUIRE);chunk;chunk = __atomic_load_n(&chunk->next,__ATOMIC_ACQUIRE)){
+			nr = __atomic_load_n(&chunk->nr,__ATOMIC_ACQUIRE);
+			for(i = 0;i < nr;i++){
+				write_event(f,buf,&chunk->events[i]);
+			}
+			nr_events += nr;
+		}
+		dropped += __atomic_load_n(&buf->dropped,__ATOMIC_RELAXED);
+	}
+	fprintf(f,"\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%lu}}\n",dropped);
+	fclose(f);
+
+	fprintf(stderr,"trace: %lu events of %u threads,%lu dropped,written to %s\n",nr_events,nr_threads,dropped,file);
+}
@@ -0,0 +1,491 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <sys/random.h>
+#include <elf.h>
+
+#include "user.h"
+#include "cpu.h"
+#include "ram.h"
+#include "cache.h"
+#include "loader.h"
+#include "pmu.h"
+#include "tracer.h"
+#include "error.h"
+
+#define USER_MAP_FIXED     0x10
+#define USER_MAP_ANONYMOUS 0x20
+#define USER_IOV_MAX 1024
+
+#define PAGE_ALIGN(x) (((x) + RAM_PAGE_SIZE - 1) & ~(RAM_PAGE_SIZE - 1))
+
+//struct stat of the riscv64 linux abi
+struct user_stat{
+	uint64_t st_dev;
+	uint64_t st_ino;
+	uint32_t st_mode;
+	uint32_t st_nlink;
+	uint32_t st_uid;
+	uint32_t st_gid;
+	uint64_t st_rdev;
+	uint64_t __pad1;
+	int64_t  st_size;
+	int32_t  st_blksize;
+	int32_t  __pad2;
+	int64_t  st_blocks;
+	int64_t  st_atime_sec;
+	uint64_t st_atime_nsec;
+	int64_t  st_mtime_sec;
+	uint64_t st_mtime_nsec;
+	int64_t  st_ctime_sec;
+	uint64_t st_ctime_nsec;
+	uint32_t __unused4;
+	uint32_t __unused5;
+};
+
+struct user_iovec{
+	uint64_t base;
+	uint64_t len;
+};
+
+/*
+ * guest memory handed to the host,no copy.
+ * the caches are written back before the host reads the buffer,and
+ * flushed before the host writes it.
+ */
+static uint8_t *guest_buf(struct cpu *cpu,uint64_t addr,uint64_t len,int host_writes)
+{
+	uint8_t *ptr = ram_ptr(cpu->ram,addr,len);
+
+	if(ptr == NULL || len == 0) return ptr;
+
+	if(host_writes){
+		flush_cache_range(cpu,addr,len);
+	}else{
+		writeback_cache_range(cpu,addr,len);
+	}
+	return ptr;
+}
+
+static char *guest_string(struct cpu *cpu,uint64_t addr)
+{
+	uint64_t len;
+	char *s;
+
+	if(addr >= cpu->ram->size) return NULL;
+
+	len = cpu->ram->size - addr < PATH_MAX ? cpu->ram->size - addr : PATH_MAX;
+	s = (char *)guest_buf(cpu,addr,len,0);
+	return memchr(s,0,len) ? s : NULL;
+}
+
+//the guest may still hold lines of the range,drop them before zeroing
+static void zero_guest(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	memset(guest_buf(cpu,addr,len,1),0,len);
+	ram_mark_dirty(cpu->ram,addr,len);
+}
+
+static int64_t host_result(int64_t ret)
+{
+	return ret == -1 ? -errno : ret;
+}
+
+static int64_t user_read(struct cpu *cpu,int fd,uint64_t addr,uint64_t len)
+{
+	uint8_t *buf = guest_buf(cpu,addr,len,1);
+	int64_t ret;
+
+	if(buf == NULL) return -EFAULT;
+
+	ret = host_result(read(fd,buf,len));
+	if(ret > 0) ram_mark_dirty(cpu->ram,addr,ret);
+	return ret;
+}
+
+static int64_t user_write(struct cpu *cpu,int fd,uint64_t addr,uint64_t len)
+{
+	uint8_t *buf = guest_buf(cpu,addr,len,0);
+
+	if(buf == NULL) return -EFAULT;
+	return host_result(write(fd,buf,len));
+}
+
+static int64_t user_rwv(struct cpu *cpu,int fd,uint64_t addr,uint64_t count,int host_writes)
+{
+	struct user_iovec *giov;
+	struct iovec iov[USER_IOV_MAX];
+	int64_t ret;
+
+	if(count > USER_IOV_MAX) return -EINVAL;
+	giov = (struct user_iovec *)guest_buf(cpu,addr,count * sizeof(struct user_iovec),0);
+	if(giov == NULL) return -EFAULT;
+
+	for(uint64_t i = 0;i<count;i++){
+		iov[i].iov_base = guest_buf(cpu,giov[i].base,giov[i].len,host_writes);
+		iov[i].iov_len = giov[i].len;
+		if(iov[i].iov_base == NULL && giov[i].len) return -EFAULT;
+	}
+
+	ret = host_result(host_writes ? readv(fd,iov,count) : writev(fd,iov,count));
+	if(host_writes && ret > 0){
+		for(uint64_t i = 0;i<count;i++){
+			ram_mark_dirty(cpu->ram,giov[i].base,giov[i].len);
+		}
+	}
+	return ret;
+}
+
+static int64_t user_stat(struct cpu *cpu,struct stat *st,int64_t ret,uint64_t addr)
+{
+	struct user_stat *ust;
+
+	if(ret < 0) return ret;
+
+	ust = (struct user_stat *)guest_buf(cpu,addr,sizeof(struct user_stat),1);
+	if(ust == NULL) return -EFAULT;
+
+	memset(ust,0,sizeof(struct user_stat));
+	ust->st_dev = st->st_dev;
+	ust->st_ino = st->st_ino;
+	ust->st_mode = st->st_mode;
+	ust->st_nlink = st->st_nlink;
+	ust->st_uid = st->st_uid;
+	ust->st_gid = st->st_gid;
+	ust->st_rdev = st->st_rdev;
+	ust->st_size = st->st_size;
+	ust->st_blksize = st->st_blksize;
+	ust->st_blocks = st->st_blocks;
+	ust->st_atime_sec = st->st_atim.tv_sec;
+	ust->st_atime_nsec = st->st_atim.tv_nsec;
+	ust->st_mtime_sec = st->st_mtim.tv_sec;
+	ust->st_mtime_nsec = st->st_mtim.tv_nsec;
+	ust->st_ctime_sec = st->st_ctim.tv_sec;
+	ust->st_ctime_nsec = st->st_ctim.tv_nsec;
+	ram_mark_dirty(cpu->ram,addr,sizeof(struct user_stat));
+	return 0;
+}
+
+static int64_t user_brk(struct cpu *cpu,uint64_t addr)
+{
+	struct user *user = cpu->user;
+
+	if(addr < user->brk_start || addr > user->mmap_bottom){
+		return user->brk;
+	}
+	if(addr > user->brk){
+		zero_guest(cpu,user->brk,addr - user->brk);
+	}
+	user->brk = addr;
+	return user->brk;
+}
+
+static int64_t user_mmap(struct cpu *cpu,uint64_t addr,uint64_t len,int flags,int fd,uint64_t offset)
+{
+	struct user *user = cpu->user;
+	int64_t ret;
+
+	if(len == 0) return -EINVAL;
+	len = PAGE_ALIGN(len);
+
+	if(flags & USER_MAP_FIXED){
+		if(addr & (RAM_PAGE_SIZE - 1) || addr < user->brk || addr + len > user->stack_bottom){
+			return -ENOMEM;
+		}
+		if(addr < user->mmap_bottom) user->mmap_bottom = addr;
+	}else{
+		if(user->mmap_bottom - user->brk < len) return -ENOMEM;
+		user->mmap_bottom -= len;
+		addr = user->mmap_bottom;
+	}
+
+	zero_guest(cpu,addr,len);
+	if(!(flags & USER_MAP_ANONYMOUS)){//private copy of the file
+		ret = pread(fd,cpu->ram->data + addr,len,offset);
+		if(ret == -1) return -errno;
+	}
+	return addr;
+}
+
+static int64_t user_munmap(struct cpu *cpu,uint64_t addr,uint64_t len)
+{
+	struct user *user = cpu->user;
+
+	//only the lowest mapping gives its space back
+	if(addr == user->mmap_bottom && addr + PAGE_ALIGN(len) <= user->stack_bottom){
+		user->mmap_bottom += PAGE_ALIGN(len);
+	}
+	return 0;
+}
+
+static int64_t user_uname(struct cpu *cpu,uint64_t addr)
+{
+	struct utsname *uts = (struct utsname *)guest_buf(cpu,addr,sizeof(struct utsname),1);
+
+	if(uts == NULL) return -EFAULT;
+	if(uname(uts) == -1) return -errno;
+	strcpy(uts->machine,"riscv64");
+	ram_mark_dirty(cpu->ram,addr,sizeof(struct utsname));
+	return 0;
+}
+
+static int64_t user_clock_gettime(struct cpu *cpu,int clock,uint64_t addr)
+{
+	struct timespec *ts = (struct timespec *)guest_buf(cpu,addr,sizeof(struct timespec),1);
+
+	if(ts == NULL) return -EFAULT;
+	if(clock_gettime(clock,ts) == -1) return -errno;
+	ram_mark_dirty(cpu->ram,addr,sizeof(struct timespec));
+	return 0;
+}
+
+static int64_t user_getcwd(struct cpu *cpu,uint64_t addr,uint64_t size)
+{
+	char *buf = (char *)guest_buf(cpu,addr,size,1);
+
+	if(buf == NULL) return -EFAULT;
+	if(getcwd(buf,size) == NULL) return -errno;
+	ram_mark_dirty(cpu->ram,addr,size);
+	return strlen(buf) + 1;
+}
+
+static int64_t user_getrandom(struct cpu *cpu,uint64_t addr,uint64_t len,int flags)
+{
+	uint8_t *buf = guest_buf(cpu,addr,len,1);
+	int64_t ret;
+
+	if(buf == NULL) return -EFAULT;
+	ret = host_result(getrandom(buf,len,flags));
+	if(ret > 0) ram_mark_dirty(cpu->ram,addr,ret);
+	return ret;
+}
+
+void do_syscall(struct cpu *cpu)
+{
+	uint64_t *a = &cpu->regfile[10];
+	uint64_t nr = cpu->regfile[17];
+	uint64_t begin = TRACER_ON(TRACER_TRAP) ? tracer_begin(TRACER_TRAP) : 0;
+	struct stat st;
+	char *path;
+	int64_t ret;
+
+	switch(nr){
+	case USER_SYS_READ:
+		ret = user_read(cpu,a[0],a[1],a[2]);
+		break;
+	case USER_SYS_WRITE:
+		ret = user_write(cpu,a[0],a[1],a[2]);
+		break;
+	case USER_SYS_READV:
+		ret = user_rwv(cpu,a[0],a[1],a[2],1);
+		break;
+	case USER_SYS_WRITEV:
+		ret = user_rwv(cpu,a[0],a[1],a[2],0);
+		break;
+	case USER_SYS_OPENAT:
+		path = guest_string(cpu,a[1]);
+		ret = path ? host_result(openat(a[0],path,a[2],a[3])) : -EFAULT;
+		break;
+	case USER_SYS_CLOSE:
+		//keep the emulator's own stdio
+		ret = (int)a[0] <= STDERR_FILENO ? 0 : host_result(close(a[0]));
+		break;
+	case USER_SYS_LSEEK:
+		ret = host_result(lseek(a[0],a[1],a[2]));
+		break;
+	case USER_SYS_FSTAT:
+		ret = user_stat(cpu,&st,host_result(fstat(a[0],&st)),a[1]);
+		break;
+	case USER_SYS_NEWFSTATAT:
+		path = guest_string(cpu,a[1]);
+		ret = path ? user_stat(cpu,&st,host_result(fstatat(a[0],path,&st,a[3])),a[2]) : -EFAULT;
+		break;
+	case USER_SYS_GETCWD:
+		ret = user_getcwd(cpu,a[0],a[1]);
+		break;
+	case USER_SYS_BRK:
+		ret = user_brk(cpu,a[0]);
+		break;
+	case USER_SYS_MMAP:
+		ret = user_mmap(cpu,a[0],a[1],a[3],a[4],a[5]);
+		break;
+	case USER_SYS_MUNMAP:
+		ret = user_munmap(cpu,a[0],a[1]);
+		break;
+	case USER_SYS_MPROTECT:
+		ret = 0;
+		break;
+	case USER_SYS_CLOCK_GETTIME:
+		ret = user_clock_gettime(cpu,a[0],a[1]);
+		break;
+	case USER_SYS_UNAME:
+		ret = user_uname(cpu,a[0]);
+		break;
+	case USER_SYS_GETRANDOM:
+		ret = user_getrandom(cpu,a[0],a[1],a[2]);
+		break;
+	case USER_SYS_GETPID:
+	case USER_SYS_GETTID:
+	case USER_SYS_SET_TID_ADDRESS:
+		ret = getpid();
+		break;
+	case USER_SYS_GETUID:
+		ret = getuid();
+		break;
+	case USER_SYS_GETEUID:
+		ret = geteuid();
+		break;
+	case USER_SYS_GETGID:
+		ret = getgid();
+		break;
+	case USER_SYS_GETEGID:
+		ret = getegid();
+		break;
+	case USER_SYS_SET_ROBUST_LIST:
+	case USER_SYS_RT_SIGACTION:
+	case USER_SYS_RT_SIGPROCMASK:
+		ret = 0;//single thread,no signals
+		break;
+	case USER_SYS_IOCTL:
+		ret = -ENOTTY;
+		break;
+	case USER_SYS_EXIT:
+	case USER_SYS_EXIT_GROUP:
+		cpu->user->exit_code = a[0];
+		cpu->halted = 1;
+		ret = 0;
+		break;
+	default:
+		ret = -ENOSYS;
+		break;
+	}
+
+#ifdef __USER_SYSCALL_DEBUG__
+	printf("%s: %ld(0x%lx,0x%lx,0x%lx,0x%lx) = %ld\n",__func__,nr,a[0],a[1],a[2],a[3],ret);
+#endif
+
+	if(begin) tracer_end(TRACER_TRAP,"syscall",begin,NULL,cpu->pc - 4,nr);
+	cpu->regfile[10] = ret;
+}
+
+static uint64_t push_bytes(struct ram *ram,uint64_t *sp,void *data,uint64_t len)
+{
+	*sp -= len;
+	write_to_ram(ram,*sp,len,data);
+	return *sp;
+}
+
+//argc,argv,envp and auxv at the top of ram,as the linux loader does
+static void setup_stack(struct cpu *cpu,struct elf_image *image,int argc,char *argv[],char *envp[])
+{
+	struct ram *ram = cpu->ram;
+	uint64_t sp = ram->size;
+	uint64_t envc = 0,nr_words,pos;
+	uint64_t *argv_addrs,*envp_addrs,*words;
+	uint64_t random_addr,platform_addr;
+	uint8_t random[16];
+
+	while(envp[envc]) envc++;
+
+	argv_addrs = malloc((argc + envc + 1) * sizeof(uint64_t));
+	if(argv_addrs == NULL){
+		fatal("alloc user stack error(%s)\n",strerror(errno));
+	}
+	envp_addrs = argv_addrs + argc;
+
+	for(int i = 0;i<argc;i++){
+		argv_addrs[i] = push_bytes(ram,&sp,argv[i],strlen(argv[i]) + 1);
+	}
+	for(uint64_t i = 0;i<envc;i++){
+		envp_addrs[i] = push_bytes(ram,&sp,envp[i],strlen(envp[i]) + 1);
+	}
+	platform_addr = push_bytes(ram,&sp,"riscv64",8);
+	if(getrandom(random,sizeof(random),0) != sizeof(random)){
+		memset(random,0x5a,sizeof(random));
+	}
+	random_addr = push_bytes(ram,&sp,random,sizeof(random));
+
+	uint64_t auxv[] = {
+		AT_PHDR,image->phdr,
+		AT_PHENT,image->phent,
+		AT_PHNUM,image->phnum,
+		AT_PAGESZ,RAM_PAGE_SIZE,
+		AT_ENTRY,image->entry,
+		AT_UID,getuid(),
+		AT_EUID,geteuid(),
+		AT_GID,getgid(),
+		AT_EGID,getegid(),
+		AT_HWCAP,1UL<<('I' - 'A'),
+		AT_CLKTCK,100,
+		AT_RANDOM,random_addr,
+		AT_PLATFORM,platform_addr,
+		AT_NULL,0,
+	};
+
+	nr_words = 1 + argc + 1 + envc + 1 + sizeof(auxv)/sizeof(uint64_t);
+	words = malloc(nr_words * sizeof(uint64_t));
+	if(words == NULL){
+		fatal("alloc user stack error(%s)\n",strerror(errno));
+	}
+
+	pos = 0;
+	words[pos++] = argc;
+	for(int i = 0;i<argc;i++) words[pos++] = argv_addrs[i];
+	words[pos++] = 0;
+	for(uint64_t i = 0;i<envc;i++) words[pos++] = envp_addrs[i];
+	words[pos++] = 0;
+	memcpy(words + pos,auxv,sizeof(auxv));
+
+	sp = (sp - nr_words * sizeof(uint64_t)) & ~15UL;
+	write_to_ram(ram,sp,nr_words * sizeof(uint64_t),(uint8_t *)words);
+	cpu->regfile[2] = sp;
+
+	free(words);
+	free(argv_addrs);
+}
+
+struct user *setup_user(struct cpu *cpu,char *filename,int argc,char *argv[],char *envp[])
+{
+	struct elf_image image;
+	struct user *user = malloc(sizeof(struct user));
+	if(user == NULL){
+		fatal("alloc user error(%s)\n",strerror(errno));
+	}
+	memset(user,0,sizeof(struct user));
+
+	if(cpu->ram->size <= USER_STACK_SIZE){
+		fatal("%s: ram is too small for user mode\n",__func__);
+	}
+
+	load_elf(cpu->ram,filename,&image);
+	//rv64i and a with the lp64 abi,no m,f,d or c
+	if(image.flags & (EF_RISCV_RVC | EF_RISCV_FLOAT_ABI | EF_RISCV_RVE)){
+		fatal("%s: %s needs compressed,float or rve support(e_flags:0x%x),build it with -march=rv64ia -mabi=lp64\n",
+				__func__,filename,image.flags);
+	}
+
+	user->brk_start = PAGE_ALIGN(image.end);
+	user->brk = user->brk_start;
+	user->stack_bottom = cpu->ram->size - USER_STACK_SIZE;
+	user->mmap_bottom = user->stack_bottom;
+	if(user->brk_start > user->stack_bottom){
+		fatal("%s: %s does not fit in ram\n",__func__,filename);
+	}
+
+	setup_stack(cpu,&image,argc,argv,envp);
+	cpu->pc = image.entry;
+	cpu->user = user;
+	cpu->csrs[CSR_MCOUNTEREN] = MCOUNTEREN_CY | MCOUNTEREN_IR;//rdcycle and rdinstret,like linux
+
+	return user;
+}
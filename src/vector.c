@@ -0,0 +1,1123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "vector.h"
+#include "cpu.h"
+#include "cache.h"
+
+#define CANONICAL_NAN32 0x7FC00000U
+#define CANONICAL_NAN64 0x7FF8000000000000UL
+
+//the decoded fields and vtype of the instruction being executed
+struct vstate{
+	struct cpu *cpu;
+	int sew;//bytes of an element
+	int lmul;//log2 of lmul,negative when fractional
+	int group;//registers of a group,1 for fractional lmul
+	uint64_t vl;
+	uint64_t vlmax;
+	uint64_t vstart;
+	int vm;//unmasked
+	int vd,vs1,vs2;
+	uint8_t *mask;//v0
+};
+
+/*
+ * kernels run a vector op on the first len bytes of the operands,
+ * they return the bytes done and leave the tail to the scalar loop.
+ */
+typedef uint64_t (*vector_kernel)(uint8_t *vd,uint8_t *vs2,uint8_t *vs1,uint64_t len);
+
+static int host_simd;//the kernels below can be used
+
+static uint8_t *vreg(struct cpu *cpu,int r)
+{
+	return cpu->vregs[r];
+}
+
+static uint64_t xreg(struct cpu *cpu,int r)
+{
+	return r == 0 ? 0 : cpu->regfile[r];
+}
+
+static uint64_t get_elem(uint8_t *v,int sew,uint64_t i)
+{
+	uint64_t x = 0;
+
+	memcpy(&x,v + i*sew,sew);
+	return x;
+}
+
+static void set_elem(uint8_t *v,int sew,uint64_t i,uint64_t x)
+{
+	memcpy(v + i*sew,&x,sew);
+}
+
+static int64_t sext(uint64_t x,int sew)
+{
+	int shift = 64 - sew*8;
+
+	return (int64_t)(x << shift) >> shift;
+}
+
+static int mask_bit(uint8_t *m,uint64_t i)
+{
+	return m[i >> 3] >> (i & 7) & 1;
+}
+
+static void set_mask_bit(uint8_t *m,uint64_t i,int bit)
+{
+	m[i >> 3] = (m[i >> 3] & ~(1 << (i & 7))) | bit << (i & 7);
+}
+
+static int active(struct vstate *v,uint64_t i)
+{
+	return v->vm || mask_bit(v->mask,i);
+}
+
+//a register group starts at a multiple of its size
+static int vreg_aligned(int r,int group)
+{
+	return !(r & (group - 1));
+}
+
+static float f32(uint32_t x)
+{
+	float f;
+
+	memcpy(&f,&x,4);
+	return f;
+}
+
+static uint32_t f32_bits(float f)
+{
+	uint32_t x;
+
+	memcpy(&x,&f,4);
+	return isnan(f) ? CANONICAL_NAN32 : x;
+}
+
+static double f64(uint64_t x)
+{
+	double f;
+
+	memcpy(&f,&x,8);
+	return f;
+}
+
+static uint64_t f64_bits(double f)
+{
+	uint64_t x;
+
+	memcpy(&x,&f,8);
+	return isnan(f) ? CANONICAL_NAN64 : x;
+}
+
+#if defined(__x86_64__)
+/*
+ * avx2 kernels of the common element widths,selected at run time.
+ * nan results are made canonical like the scalar ops.
+ */
+#define AVX2_INT_KERNEL(name,expr) \
+static __attribute__((target("avx2"))) uint64_t name(uint8_t *vd,uint8_t *vs2,uint8_t *vs1,uint64_t len) \
+{ \
+	__m256i a,b; \
+	uint64_t i; \
+	for(i = 0;i + 32 <= len;i += 32){ \
+		a = _mm256_loadu_si256((__m256i *)(vs2 + i)); \
+		b = _mm256_loadu_si256((__m256i *)(vs1 + i)); \
+		_mm256_storeu_si256((__m256i *)(vd + i),expr); \
+	} \
+	return i; \
+}
+
+#define AVX2_FP_KERNEL(name,type,suffix,nan,expr) \
+static __attribute__((target("avx2,fma"))) uint64_t name(uint8_t *vd,uint8_t *vs2,uint8_t *vs1,uint64_t len) \
+{ \
+	type a,b,d,r; \
+	uint64_t i; \
+	for(i = 0;i + 32 <= len;i += 32){ \
+		a = _mm256_loadu_##suffix((void *)(vs2 + i)); \
+		b = _mm256_loadu_##suffix((void *)(vs1 + i)); \
+		d = _mm256_loadu_##suffix((void *)(vd + i)); \
+		r = expr; \
+		r = _mm256_blendv_##suffix(r,nan,_mm256_cmp_##suffix(r,r,_CMP_UNORD_Q)); \
+		_mm256_storeu_##suffix((void *)(vd + i),r); \
+	} \
+	(void)d; \
+	return i; \
+}
+
+AVX2_INT_KERNEL(avx2_add8,_mm256_add_epi8(a,b))
+AVX2_INT_KERNEL(avx2_add16,_mm256_add_epi16(a,b))
+AVX2_INT_KERNEL(avx2_add32,_mm256_add_epi32(a,b))
+AVX2_INT_KERNEL(avx2_add64,_mm256_add_epi64(a,b))
+AVX2_INT_KERNEL(avx2_sub8,_mm256_sub_epi8(a,b))
+AVX2_INT_KERNEL(avx2_sub16,_mm256_sub_epi16(a,b))
+AVX2_INT_KERNEL(avx2_sub32,_mm256_sub_epi32(a,b))
+AVX2_INT_KERNEL(avx2_sub64,_mm256_sub_epi64(a,b))
+AVX2_INT_KERNEL(avx2_rsub8,_mm256_sub_epi8(b,a))
+AVX2_INT_KERNEL(avx2_rsub16,_mm256_sub_epi16(b,a))
+AVX2_INT_KERNEL(avx2_rsub32,_mm256_sub_epi32(b,a))
+AVX2_INT_KERNEL(avx2_rsub64,_mm256_sub_epi64(b,a))
+AVX2_INT_KERNEL(avx2_minu8,_mm256_min_epu8(a,b))
+AVX2_INT_KERNEL(avx2_minu16,_mm256_min_epu16(a,b))
+AVX2_INT_KERNEL(avx2_minu32,_mm256_min_epu32(a,b))
+AVX2_INT_KERNEL(avx2_min8,_mm256_min_epi8(a,b))
+AVX2_INT_KERNEL(avx2_min16,_mm256_min_epi16(a,b))
+AVX2_INT_KERNEL(avx2_min32,_mm256_min_epi32(a,b))
+AVX2_INT_KERNEL(avx2_maxu8,_mm256_max_epu8(a,b))
+AVX2_INT_KERNEL(avx2_maxu16,_mm256_max_epu16(a,b))
+AVX2_INT_KERNEL(avx2_maxu32,_mm256_max_epu32(a,b))
+AVX2_INT_KERNEL(avx2_max8,_mm256_max_epi8(a,b))
+AVX2_INT_KERNEL(avx2_max16,_mm256_max_epi16(a,b))
+AVX2_INT_KERNEL(avx2_max32,_mm256_max_epi32(a,b))
+AVX2_INT_KERNEL(avx2_and,_mm256_and_si256(a,b))
+AVX2_INT_KERNEL(avx2_or,_mm256_or_si256(a,b))
+AVX2_INT_KERNEL(avx2_xor,_mm256_xor_si256(a,b))
+AVX2_INT_KERNEL(avx2_sll32,_mm256_sllv_epi32(a,_mm256_and_si256(b,_mm256_set1_epi32(31))))
+AVX2_INT_KERNEL(avx2_sll64,_mm256_sllv_epi64(a,_mm256_and_si256(b,_mm256_set1_epi64x(63))))
+AVX2_INT_KERNEL(avx2_srl32,_mm256_srlv_epi32(a,_mm256_and_si256(b,_mm256_set1_epi32(31))))
+AVX2_INT_KERNEL(avx2_srl64,_mm256_srlv_epi64(a,_mm256_and_si256(b,_mm256_set1_epi64x(63))))
+AVX2_INT_KERNEL(avx2_sra32,_mm256_srav_epi32(a,_mm256_and_si256(b,_mm256_set1_epi32(31))))
+AVX2_INT_KERNEL(avx2_mul16,_mm256_mullo_epi16(a,b))
+AVX2_INT_KERNEL(avx2_mul32,_mm256_mullo_epi32(a,b))
+
+AVX2_FP_KERNEL(avx2_fadd32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_add_ps(a,b))
+AVX2_FP_KERNEL(avx2_fadd64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_add_pd(a,b))
+AVX2_FP_KERNEL(avx2_fsub32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_sub_ps(a,b))
+AVX2_FP_KERNEL(avx2_fsub64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_sub_pd(a,b))
+AVX2_FP_KERNEL(avx2_fmul32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_mul_ps(a,b))
+AVX2_FP_KERNEL(avx2_fmul64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_mul_pd(a,b))
+AVX2_FP_KERNEL(avx2_fdiv32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_div_ps(a,b))
+AVX2_FP_KERNEL(avx2_fdiv64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_div_pd(a,b))
+AVX2_FP_KERNEL(avx2_fmacc32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_fmadd_ps(b,a,d))
+AVX2_FP_KERNEL(avx2_fmacc64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_fmadd_pd(b,a,d))
+AVX2_FP_KERNEL(avx2_fnmsac32,__m256,ps,_mm256_castsi256_ps(_mm256_set1_epi32(CANONICAL_NAN32)),_mm256_fnmadd_ps(b,a,d))
+AVX2_FP_KERNEL(avx2_fnmsac64,__m256d,pd,_mm256_castsi256_pd(_mm256_set1_epi64x(CANONICAL_NAN64)),_mm256_fnmadd_pd(b,a,d))
+
+//indexed by op and log2 of the element bytes
+static const vector_kernel avx2_kernels[NR_VECTOR_OPS][4] = {
+	[VOP_ADD]    = {avx2_add8,avx2_add16,avx2_add32,avx2_add64},
+	[VOP_SUB]    = {avx2_sub8,avx2_sub16,avx2_sub32,avx2_sub64},
+	[VOP_RSUB]   = {avx2_rsub8,avx2_rsub16,avx2_rsub32,avx2_rsub64},
+	[VOP_MINU]   = {avx2_minu8,avx2_minu16,avx2_minu32,NULL},
+	[VOP_MIN]    = {avx2_min8,avx2_min16,avx2_min32,NULL},
+	[VOP_MAXU]   = {avx2_maxu8,avx2_maxu16,avx2_maxu32,NULL},
+	[VOP_MAX]    = {avx2_max8,avx2_max16,avx2_max32,NULL},
+	[VOP_AND]    = {avx2_and,avx2_and,avx2_and,avx2_and},
+	[VOP_OR]     = {avx2_or,avx2_or,avx2_or,avx2_or},
+	[VOP_XOR]    = {avx2_xor,avx2_xor,avx2_xor,avx2_xor},
+	[VOP_SLL]    = {NULL,NULL,avx2_sll32,avx2_sll64},
+	[VOP_SRL]    = {NULL,NULL,avx2_srl32,avx2_srl64},
+	[VOP_SRA]    = {NULL,NULL,avx2_sra32,NULL},
+	[VOP_MUL]    = {NULL,avx2_mul16,avx2_mul32,NULL},
+	[VOP_FADD]   = {NULL,NULL,avx2_fadd32,avx2_fadd64},
+	[VOP_FSUB]   = {NULL,NULL,avx2_fsub32,avx2_fsub64},
+	[VOP_FMUL]   = {NULL,NULL,avx2_fmul32,avx2_fmul64},
+	[VOP_FDIV]   = {NULL,NULL,avx2_fdiv32,avx2_fdiv64},
+	[VOP_FMACC]  = {NULL,NULL,avx2_fmacc32,avx2_fmacc64},
+	[VOP_FNMSAC] = {NULL,NULL,avx2_fnmsac32,avx2_fnmsac64},
+};
+
+//replace the k bits of mask from element i,i is a multiple of k
+static void put_mask_bits(uint8_t *m,uint64_t i,uint32_t bits,int k)
+{
+	if(k >= 8){
+		memcpy(m + (i >> 3),&bits,k >> 3);
+	}else{
+		m[i >> 3] = (m[i >> 3] & ~(((1 << k) - 1) << (i & 7))) | bits << (i & 7);
+	}
+}
+
+//eq,ne and the signed lt,gt of 8,32 and 64 bit elements,return the elements done
+static __attribute__((target("avx2"))) uint64_t avx2_compare(enum vector_cmp cmp,int sew,uint8_t *m,uint8_t *vs2,uint8_t *vs1,uint64_t vl)
+{
+	__m256i a,b,r;
+	uint64_t i,len = vl*sew;
+	uint32_t bits;
+	int k = 32/sew;
+
+	if(sew == 2 || (cmp != VCMP_EQ && cmp != VCMP_NE && cmp != VCMP_LT && cmp != VCMP_GT)) return 0;
+
+	for(i = 0;i + 32 <= len;i += 32){
+		a = _mm256_loadu_si256((__m256i *)(vs2 + i));
+		b = _mm256_loadu_si256((__m256i *)(vs1 + i));
+		switch(sew){
+		case 1:
+			r = cmp == VCMP_LT ? _mm256_cmpgt_epi8(b,a) : cmp == VCMP_GT ? _mm256_cmpgt_epi8(a,b) : _mm256_cmpeq_epi8(a,b);
+			bits = _mm256_movemask_epi8(r);
+			break;
+		case 4:
+			r = cmp == VCMP_LT ? _mm256_cmpgt_epi32(b,a) : cmp == VCMP_GT ? _mm256_cmpgt_epi32(a,b) : _mm256_cmpeq_epi32(a,b);
+			bits = _mm256_movemask_ps(_mm256_castsi256_ps(r));
+			break;
+		default:
+			r = cmp == VCMP_LT ? _mm256_cmpgt_epi64(b,a) : cmp == VCMP_GT ? _mm256_cmpgt_epi64(a,b) : _mm256_cmpeq_epi64(a,b);
+			bits = _mm256_movemask_pd(_mm256_castsi256_pd(r));
+			break;
+		}
+		if(cmp == VCMP_NE) bits = ~bits & (uint32_t)((1UL << k) - 1);
+		put_mask_bits(m,i/sew,bits,k);
+	}
+	return i/sew;
+}
+#endif
+
+static uint64_t host_kernel(enum vector_op op,int sew,uint8_t *vd,uint8_t *vs2,uint8_t *vs1,uint64_t len)
+{
+#if defined(__x86_64__)
+	vector_kernel kernel;
+
+	if(host_simd && (kernel = avx2_kernels[op][__builtin_ctz(sew)])){
+		return kernel(vd,vs2,vs1,len);
+	}
+#endif
+	return 0;
+}
+
+static uint64_t host_compare(enum vector_cmp cmp,int sew,uint8_t *m,uint8_t *vs2,uint8_t *vs1,uint64_t vl)
+{
+#if defined(__x86_64__)
+	if(host_simd) return avx2_compare(cmp,sew,m,vs2,vs1,vl);
+#endif
+	return 0;
+}
+
+static uint64_t int_op(enum vector_op op,int sew,uint64_t a,uint64_t b,uint64_t d)
+{
+	int bits = sew*8;
+	int64_t sa = sext(a,sew),sb = sext(b,sew);
+	int64_t min = sext(1UL << (bits - 1),sew);
+
+	switch(op){
+	case VOP_ADD:    return a + b;
+	case VOP_SUB:    return a - b;
+	case VOP_RSUB:   return b - a;
+	case VOP_MINU:   return a < b ? a : b;
+	case VOP_MIN:    return sa < sb ? a : b;
+	case VOP_MAXU:   return a > b ? a : b;
+	case VOP_MAX:    return sa > sb ? a : b;
+	case VOP_AND:    return a & b;
+	case VOP_OR:     return a | b;
+	case VOP_XOR:    return a ^ b;
+	case VOP_SLL:    return a << (b & (bits - 1));
+	case VOP_SRL:    return a >> (b & (bits - 1));
+	case VOP_SRA:    return sa >> (b & (bits - 1));
+	case VOP_MUL:    return a*b;
+	case VOP_MULH:   return (__int128)sa*sb >> bits;
+	case VOP_MULHU:  return (unsigned __int128)a*b >> bits;
+	case VOP_MULHSU: return (__int128)sa*(__int128)b >> bits;
+	case VOP_DIVU:   return b == 0 ? UINT64_MAX : a/b;
+	case VOP_DIV:    return sb == 0 ? UINT64_MAX : (sa == min && sb == -1) ? a : (uint64_t)(sa/sb);
+	case VOP_REMU:   return b == 0 ? a : a%b;
+	case VOP_REM:    return sb == 0 ? a : (sa == min && sb == -1) ? 0 : (uint64_t)(sa%sb);
+	case VOP_MACC:   return d + a*b;
+	case VOP_NMSAC:  return d - a*b;
+	case VOP_MADD:   return a + d*b;
+	case VOP_NMSUB:  return a - d*b;
+	default:         return 0;
+	}
+}
+
+//a is vs2,b is vs1,d is vd
+static uint64_t fp32_op(enum vector_op op,uint32_t a,uint32_t b,uint32_t d)
+{
+	float x = f32(a),y = f32(b),z = f32(d);
+
+	switch(op){
+	case VOP_FADD:   return f32_bits(x + y);
+	case VOP_FSUB:   return f32_bits(x - y);
+	case VOP_FMUL:   return f32_bits(x*y);
+	case VOP_FDIV:   return f32_bits(x/y);
+	case VOP_FMIN:
+		if(isnan(x) && isnan(y)) return CANONICAL_NAN32;
+		if(isnan(x) || isnan(y)) return isnan(x) ? b : a;
+		return x < y || (x == y && (a >> 31)) ? a : b;
+	case VOP_FMAX:
+		if(isnan(x) && isnan(y)) return CANONICAL_NAN32;
+		if(isnan(x) || isnan(y)) return isnan(x) ? b : a;
+		return x > y || (x == y && !(a >> 31)) ? a : b;
+	case VOP_FSGNJ:  return (a & 0x7FFFFFFF) | (b & 0x80000000);
+	case VOP_FSGNJN: return (a & 0x7FFFFFFF) | (~b & 0x80000000);
+	case VOP_FSGNJX: return a ^ (b & 0x80000000);
+	case VOP_FMACC:  return f32_bits(fmaf(y,x,z));
+	case VOP_FNMACC: return f32_bits(fmaf(-y,x,-z));
+	case VOP_FMSAC:  return f32_bits(fmaf(y,x,-z));
+	case VOP_FNMSAC: return f32_bits(fmaf(-y,x,z));
+	default:         return 0;
+	}
+}
+
+static uint64_t fp64_op(enum vector_op op,uint64_t a,uint64_t b,uint64_t d)
+{
+	double x = f64(a),y = f64(b),z = f64(d);
+
+	switch(op){
+	case VOP_FADD:   return f64_bits(x + y);
+	case VOP_FSUB:   return f64_bits(x - y);
+	case VOP_FMUL:   return f64_bits(x*y);
+	case VOP_FDIV:   return f64_bits(x/y);
+	case VOP_FMIN:
+		if(isnan(x) && isnan(y)) return CANONICAL_NAN64;
+		if(isnan(x) || isnan(y)) return isnan(x) ? b : a;
+		return x < y || (x == y && (a >> 63)) ? a : b;
+	case VOP_FMAX:
+		if(isnan(x) && isnan(y)) return CANONICAL_NAN64;
+		if(isnan(x) || isnan(y)) return isnan(x) ? b : a;
+		return x > y || (x == y && !(a >> 63)) ? a : b;
+	case VOP_FSGNJ:  return (a & ~(1UL << 63)) | (b & (1UL << 63));
+	case VOP_FSGNJN: return (a & ~(1UL << 63)) | (~b & (1UL << 63));
+	case VOP_FSGNJX: return a ^ (b & (1UL << 63));
+	case VOP_FMACC:  return f64_bits(fma(y,x,z));
+	case VOP_FNMACC: return f64_bits(fma(-y,x,-z));
+	case VOP_FMSAC:  return f64_bits(fma(y,x,-z));
+	case VOP_FNMSAC: return f64_bits(fma(-y,x,z));
+	default:         return 0;
+	}
+}
+
+static uint64_t elem_op(enum vector_op op,int sew,uint64_t a,uint64_t b,uint64_t d)
+{
+	if(op < VOP_FADD) return int_op(op,sew,a,b,d);
+	return sew == 4 ? fp32_op(op,a,b,d) : fp64_op(op,a,b,d);
+}
+
+static int elem_compare(enum vector_cmp cmp,int sew,uint64_t a,uint64_t b)
+{
+	int64_t sa = sext(a,sew),sb = sext(b,sew);
+	double x = 0,y = 0;
+
+	if(cmp >= VCMP_FEQ){
+		x = sew == 4 ? f32(a) : f64(a);
+		y = sew == 4 ? f32(b) : f64(b);
+	}
+
+	switch(cmp){
+	case VCMP_EQ:  return a == b;
+	case VCMP_NE:  return a != b;
+	case VCMP_LTU: return a < b;
+	case VCMP_LT:  return sa < sb;
+	case VCMP_LEU: return a <= b;
+	case VCMP_LE:  return sa <= sb;
+	case VCMP_GTU: return a > b;
+	case VCMP_GT:  return sa > sb;
+	case VCMP_FEQ: return x == y;
+	case VCMP_FNE: return x != y;
+	case VCMP_FLT: return x < y;
+	case VCMP_FLE: return x <= y;
+	default:       return 0;
+	}
+}
+
+//vd = vs2 op vs1,the body is left to the host kernels when it is not masked
+static void vector_arith(struct vstate *v,enum vector_op op,uint8_t *vd,uint8_t *vs2,uint8_t *vs1)
+{
+	uint64_t i = v->vstart;
+
+	if(v->vm && i == 0) i = host_kernel(op,v->sew,vd,vs2,vs1,v->vl*v->sew)/v->sew;
+	for(;i<v->vl;i++){
+		if(!active(v,i)) continue;
+		set_elem(vd,v->sew,i,elem_op(op,v->sew,get_elem(vs2,v->sew,i),get_elem(vs1,v->sew,i),get_elem(vd,v->sew,i)));
+	}
+}
+
+//the mask is built aside,vd may be one of the sources
+static void vector_compare(struct vstate *v,enum vector_cmp cmp,uint8_t *vd,uint8_t *vs2,uint8_t *vs1)
+{
+	uint8_t m[VLENB];
+	uint64_t i = v->vstart;
+
+	memcpy(m,vd,VLENB);
+	if(v->vm && i == 0 && cmp < VCMP_FEQ) i = host_compare(cmp,v->sew,m,vs2,vs1,v->vl);
+	for(;i<v->vl;i++){
+		if(!active(v,i)) continue;
+		set_mask_bit(m,i,elem_compare(cmp,v->sew,get_elem(vs2,v->sew,i),get_elem(vs1,v->sew,i)));
+	}
+	memcpy(vd,m,VLENB);
+}
+
+/*
+ * add,min,max and the logical reductions are folded by halves with the host kernels,
+ * return the elements of vs2 folded into acc.
+ */
+static uint64_t host_reduce(struct vstate *v,enum vector_op op,uint8_t *vs2,uint64_t *acc)
+{
+#if defined(__x86_64__)
+	uint8_t tmp[8*VLENB];
+	uint64_t len = v->vl*v->sew,n = 32,done;
+	vector_kernel kernel = avx2_kernels[op][__builtin_ctz(v->sew)];
+
+	if(!host_simd || !v->vm || kernel == NULL || len < 64) return 0;
+	if(op != VOP_ADD && (op < VOP_MINU || op > VOP_XOR)) return 0;
+
+	while(n*2 <= len) n *= 2;
+	done = n;
+	memcpy(tmp,vs2,n);
+	while(n > 32){
+		n /= 2;
+		kernel(tmp,tmp,tmp + n,n);
+	}
+	for(uint64_t i = 0;i<32/v->sew;i++){
+		*acc = int_op(op,v->sew,*acc,get_elem(tmp,v->sew,i),0);
+	}
+	return done/v->sew;
+#else
+	return 0;
+#endif
+}
+
+//vd[0] = vs1[0] op vs2[*],in element order
+static void vector_reduce(struct vstate *v,enum vector_op op,uint8_t *vd,uint8_t *vs2,uint8_t *vs1)
+{
+	uint64_t acc = get_elem(vs1,v->sew,0);
+	uint64_t i;
+
+	if(v->vl == 0) return;
+
+	i = host_reduce(v,op,vs2,&acc);
+	for(;i<v->vl;i++){
+		if(!active(v,i)) continue;
+		acc = elem_op(op,v->sew,acc,get_elem(vs2,v->sew,i),0);
+	}
+	set_elem(vd,v->sew,0,acc);
+}
+
+//vmand.mm and the others,on whole bytes first
+static void vector_mask_logical(struct vstate *v,int funct6,uint8_t *vd,uint8_t *vs2,uint8_t *vs1)
+{
+	uint8_t m[VLENB],a,b,x;
+	uint64_t n = (v->vl + 7) >> 3;
+
+	memcpy(m,vd,VLENB);
+	for(uint64_t i = 0;i<n;i++){
+		a = vs2[i];
+		b = vs1[i];
+		switch(funct6){
+		case 0x18: x = a & ~b;    break;//vmandn
+		case 0x19: x = a & b;     break;//vmand
+		case 0x1A: x = a | b;     break;//vmor
+		case 0x1B: x = a ^ b;     break;//vmxor
+		case 0x1C: x = a | ~b;    break;//vmorn
+		case 0x1D: x = ~(a & b);  break;//vmnand
+		case 0x1E: x = ~(a | b);  break;//vmnor
+		default:   x = ~(a ^ b);  break;//vmxnor
+		}
+		if(i == n - 1 && (v->vl & 7)){
+			b = (1 << (v->vl & 7)) - 1;
+			x = (m[i] & ~b) | (x & b);
+		}
+		m[i] = x;
+	}
+	memcpy(vd,m,VLENB);
+}
+
+static uint64_t vector_cpop(struct vstate *v,uint8_t *vs2)
+{
+	uint64_t n = 0;
+
+	for(uint64_t i = 0;i<v->vl;i++){
+		n += active(v,i) && mask_bit(vs2,i);
+	}
+	return n;
+}
+
+static uint64_t vector_first(struct vstate *v,uint8_t *vs2)
+{
+	for(uint64_t i = 0;i<v->vl;i++){
+		if(active(v,i) && mask_bit(vs2,i)) return i;
+	}
+	return UINT64_MAX;
+}
+
+//vmsbf,vmsif and vmsof
+static void vector_set_first(struct vstate *v,int sel,uint8_t *vd,uint8_t *vs2)
+{
+	int found = 0,bit;
+
+	for(uint64_t i = 0;i<v->vl;i++){
+		if(!active(v,i)) continue;
+		bit = mask_bit(vs2,i);
+		switch(sel){
+		case 1: set_mask_bit(vd,i,!found && !bit); break;//vmsbf
+		case 2: set_mask_bit(vd,i,!found && bit);  break;//vmsof
+		default: set_mask_bit(vd,i,!found);        break;//vmsif
+		}
+		found |= bit;
+	}
+}
+
+//elements above vlmax are read as 0
+static uint64_t gather_elem(struct vstate *v,uint8_t *vs2,uint64_t idx)
+{
+	return idx < v->vlmax ? get_elem(vs2,v->sew,idx) : 0;
+}
+
+static void vector_slide(struct vstate *v,int up,uint64_t off,uint8_t *vd,uint8_t *vs2)
+{
+	uint64_t i;
+
+	if(up){
+		for(i = v->vl;i-- > v->vstart && i >= off;){
+			if(active(v,i)) set_elem(vd,v->sew,i,get_elem(vs2,v->sew,i - off));
+		}
+	}else{
+		for(i = v->vstart;i<v->vl;i++){
+			if(active(v,i)) set_elem(vd,v->sew,i,off < v->vlmax - i ? get_elem(vs2,v->sew,i + off) : 0);
+		}
+	}
+}
+
+//vmerge and vmv.v,src[i] where v0 is set and vs2[i] elsewhere
+static void vector_merge(struct vstate *v,uint8_t *vd,uint8_t *vs2,uint8_t *src)
+{
+	if(v->vm){
+		memmove(vd + v->vstart*v->sew,src + v->vstart*v->sew,(v->vl - v->vstart)*v->sew);
+		return;
+	}
+	for(uint64_t i = v->vstart;i<v->vl;i++){
+		set_elem(vd,v->sew,i,get_elem(mask_bit(v->mask,i) ? src : vs2,v->sew,i));
+	}
+}
+
+static void splat(struct vstate *v,uint8_t *dst,uint64_t x)
+{
+	for(uint64_t i = 0;i<v->vl;i++){
+		set_elem(dst,v->sew,i,x);
+	}
+}
+
+//vfcvt,nan converts to the largest integer
+static uint64_t fp_convert(int sel,int sew,uint64_t a)
+{
+	int bits = sew*8;
+	double x,max_u = ldexp(1,bits),max_s = ldexp(1,bits - 1);
+
+	if(sel == 2) return sew == 4 ? f32_bits((float)(uint32_t)a) : f64_bits((double)a);
+	if(sel == 3) return sew == 4 ? f32_bits((float)(int32_t)a) : f64_bits((double)(int64_t)a);
+
+	x = sew == 4 ? f32(a) : f64(a);
+	x = sel >= 6 ? trunc(x) : nearbyint(x);
+	if(sel == 0 || sel == 6){
+		if(isnan(x) || x >= max_u) return UINT64_MAX;
+		return x <= 0 ? 0 : (uint64_t)x;
+	}
+	if(isnan(x) || x >= max_s) return (1UL << (bits - 1)) - 1;
+	if(x <= -max_s) return 1UL << (bits - 1);
+	return (int64_t)x;
+}
+
+static uint64_t vlmax_of(int sew,int lmul)
+{
+	return lmul >= 0 ? (uint64_t)(VLENB/sew) << lmul : (uint64_t)(VLENB/sew) >> -lmul;
+}
+
+//vsetvli,vsetivli and vsetvl,an unsupported vtype sets vill
+static void vector_set_vl(struct cpu *cpu,int rd,int rs1,uint64_t avl,uint64_t vtype)
+{
+	int sew = 1 << (vtype >> 3 & 7);
+	int lmul = vtype & 7;
+	uint64_t vlmax = 0,vl;
+
+	if(lmul > 4) lmul -= 8;
+	if((vtype >> 8) || sew > 8 || lmul == 4 || (lmul < 0 && sew*8 > (ELEN >> -lmul))){
+		vtype = VTYPE_VILL;
+		vl = 0;
+	}else{
+		vlmax = vlmax_of(sew,lmul);
+		if(rs1 == 0 && rd != 0) avl = UINT64_MAX;
+		vl = avl < vlmax ? avl : vlmax;
+	}
+
+	cpu->csrs[CSR_VTYPE] = vtype;
+	cpu->csrs[CSR_VL] = vl;
+	cpu->csrs[CSR_VSTART] = 0;
+	if(rd) cpu->regfile[rd] = vl;
+
+#ifdef __VECTOR_DEBUG__
+	printf("vector: vtype 0x%lx vl %lu vlmax %lu\n",vtype,vl,vlmax);
+#endif
+}
+
+static int vector_config(struct cpu *cpu,uint32_t inst)
+{
+	int rd = inst >> 7 & 0x1F,rs1 = inst >> 15 & 0x1F;
+
+	if(!(inst >> 31)){//vsetvli
+		vector_set_vl(cpu,rd,rs1,rs1 ? xreg(cpu,rs1) : cpu->csrs[CSR_VL],inst >> 20 & 0x7FF);
+	}else if(inst >> 30 == 3){//vsetivli
+		vector_set_vl(cpu,rd,1,rs1,inst >> 20 & 0x3FF);
+	}else if(inst >> 25 == 0x40){//vsetvl
+		vector_set_vl(cpu,rd,rs1,rs1 ? xreg(cpu,rs1) : cpu->csrs[CSR_VL],xreg(cpu,inst >> 20 & 0x1F));
+	}else{
+		return -1;
+	}
+	return 0;
+}
+
+//return -1 when vtype is illegal
+static int vector_state(struct cpu *cpu,uint32_t inst,struct vstate *v)
+{
+	uint64_t vtype = cpu->csrs[CSR_VTYPE];
+
+	if(vtype & VTYPE_VILL) return -1;
+
+	v->cpu = cpu;
+	v->sew = 1 << (vtype >> 3 & 7);
+	v->lmul = vtype & 7;
+	if(v->lmul > 4) v->lmul -= 8;
+	v->group = v->lmul > 0 ? 1 << v->lmul : 1;
+	v->vl = cpu->csrs[CSR_VL];
+	v->vlmax = vlmax_of(v->sew,v->lmul);
+	v->vstart = cpu->csrs[CSR_VSTART];
+	v->vm = inst >> 25 & 1;
+	v->vd = inst >> 7 & 0x1F;
+	v->vs1 = inst >> 15 & 0x1F;
+	v->vs2 = inst >> 20 & 0x1F;
+	v->mask = vreg(cpu,0);
+	return 0;
+}
+
+//the vector operands are register groups,masked results may not overwrite v0
+static int vector_operands_ok(struct vstate *v,int vd_group,int vs1_group)
+{
+	if(!vreg_aligned(v->vs2,v->group)) return 0;
+	if(vd_group && (!vreg_aligned(v->vd,v->group) || (!v->vm && v->vd == 0))) return 0;
+	if(vs1_group && !vreg_aligned(v->vs1,v->group)) return 0;
+	return 1;
+}
+
+static const uint8_t opi_ops[64] = {
+	[0x00] = VOP_ADD,[0x02] = VOP_SUB,[0x03] = VOP_RSUB,
+	[0x04] = VOP_MINU,[0x05] = VOP_MIN,[0x06] = VOP_MAXU,[0x07] = VOP_MAX,
+	[0x09] = VOP_AND,[0x0A] = VOP_OR,[0x0B] = VOP_XOR,
+	[0x25] = VOP_SLL,[0x28] = VOP_SRL,[0x29] = VOP_SRA,
+};
+
+static const uint8_t opi_cmps[64] = {
+	[0x18] = VCMP_EQ,[0x19] = VCMP_NE,[0x1A] = VCMP_LTU,[0x1B] = VCMP_LT,
+	[0x1C] = VCMP_LEU,[0x1D] = VCMP_LE,[0x1E] = VCMP_GTU,[0x1F] = VCMP_GT,
+};
+
+static const uint8_t opm_ops[64] = {
+	[0x20] = VOP_DIVU,[0x21] = VOP_DIV,[0x22] = VOP_REMU,[0x23] = VOP_REM,
+	[0x24] = VOP_MULHU,[0x25] = VOP_MUL,[0x26] = VOP_MULHSU,[0x27] = VOP_MULH,
+	[0x29] = VOP_MADD,[0x2B] = VOP_NMSUB,[0x2D] = VOP_MACC,[0x2F] = VOP_NMSAC,
+};
+
+static const uint8_t opm_reductions[8] = {
+	VOP_ADD,VOP_AND,VOP_OR,VOP_XOR,VOP_MINU,VOP_MIN,VOP_MAXU,VOP_MAX,
+};
+
+static const uint8_t opf_ops[64] = {
+	[0x00] = VOP_FADD,[0x02] = VOP_FSUB,[0x04] = VOP_FMIN,[0x06] = VOP_FMAX,
+	[0x08] = VOP_FSGNJ,[0x09] = VOP_FSGNJN,[0x0A] = VOP_FSGNJX,
+	[0x20] = VOP_FDIV,[0x24] = VOP_FMUL,
+	[0x2C] = VOP_FMACC,[0x2D] = VOP_FNMACC,[0x2E] = VOP_FMSAC,[0x2F] = VOP_FNMSAC,
+};
+
+static const uint8_t opf_reductions[64] = {
+	[0x01] = VOP_FADD,[0x03] = VOP_FADD,[0x05] = VOP_FMIN,[0x07] = VOP_FMAX,
+};
+
+static const uint8_t opf_cmps[64] = {
+	[0x18] = VCMP_FEQ,[0x19] = VCMP_FLE,[0x1B] = VCMP_FLT,[0x1C] = VCMP_FNE,
+};
+
+//OPIVV,OPIVX and OPIVI,the scalar is splat so that all forms share the kernels
+static int vector_opi(struct vstate *v,int funct3,int funct6)
+{
+	struct cpu *cpu = v->cpu;
+	uint8_t scalar[8*VLENB] __attribute__((aligned(32)));
+	uint8_t *vd = vreg(cpu,v->vd),*vs2 = vreg(cpu,v->vs2),*src;
+	uint64_t x;
+
+	if(funct3 == 0){
+		src = vreg(cpu,v->vs1);
+		x = 0;
+	}else{
+		x = funct3 == 4 ? xreg(cpu,v->vs1) : (uint64_t)((int64_t)((uint64_t)v->vs1 << 59) >> 59);
+		//shifts,slides and gathers take an unsigned immediate
+		if(funct3 == 3 && (funct6 == 0x0C || funct6 == 0x0E || funct6 == 0x0F || funct6 >= 0x25)) x = v->vs1;
+		src = scalar;
+	}
+
+	if(opi_ops[funct6]){
+		if(!vector_operands_ok(v,1,funct3 == 0)) return -1;
+		if(src == scalar) splat(v,scalar,x);
+		vector_arith(v,opi_ops[funct6],vd,vs2,src);
+	}else if(opi_cmps[funct6]){
+		if(!vector_operands_ok(v,0,funct3 == 0)) return -1;
+		if(src == scalar) splat(v,scalar,x);
+		vector_compare(v,opi_cmps[funct6],vd,vs2,src);
+	}else{
+		switch(funct6){
+		case 0x0C://vrgather
+			if(!vector_operands_ok(v,1,funct3 == 0) || v->vd == v->vs2) return -1;
+			for(uint64_t i = v->vstart;i<v->vl;i++){
+				if(active(v,i)) set_elem(vd,v->sew,i,gather_elem(v,vs2,funct3 == 0 ? get_elem(src,v->sew,i) : x));
+			}
+			break;
+		case 0x0E://vslideup
+		case 0x0F://vslidedown
+			if(funct3 == 0 || !vector_operands_ok(v,1,0) || (funct6 == 0x0E && v->vd == v->vs2)) return -1;
+			vector_slide(v,funct6 == 0x0E,x,vd,vs2);
+			break;
+		case 0x17://vmerge,vmv.v
+			if(!vector_operands_ok(v,0,funct3 == 0) || !vreg_aligned(v->vd,v->group)) return -1;
+			if(v->vm && v->vs2) return -1;
+			if(src == scalar) splat(v,scalar,x);
+			vector_merge(v,vd,vs2,src);
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//OPMVV and OPMVX
+static int vector_opm(struct vstate *v,int funct3,int funct6)
+{
+	struct cpu *cpu = v->cpu;
+	uint8_t scalar[8*VLENB] __attribute__((aligned(32)));
+	uint8_t *vd = vreg(cpu,v->vd),*vs2 = vreg(cpu,v->vs2),*vs1 = vreg(cpu,v->vs1);
+	uint64_t x = funct3 == 6 ? xreg(cpu,v->vs1) : 0;
+
+	if(opm_ops[funct6]){
+		if(!vector_operands_ok(v,1,funct3 == 2)) return -1;
+		if(funct3 == 6){
+			splat(v,scalar,x);
+			vs1 = scalar;
+		}
+		vector_arith(v,opm_ops[funct6],vd,vs2,vs1);
+		return 0;
+	}
+
+	if(funct3 == 2){
+		switch(funct6){
+		case 0x00 ... 0x07://vredsum and the other reductions
+			if(!vreg_aligned(v->vs2,v->group) || v->vstart) return -1;
+			vector_reduce(v,opm_reductions[funct6],vd,vs2,vs1);
+			break;
+		case 0x10:
+			switch(v->vs1){
+			case 0x00://vmv.x.s
+				if(!v->vm) return -1;
+				if(v->vd) cpu->regfile[v->vd] = sext(get_elem(vs2,v->sew,0),v->sew);
+				break;
+			case 0x10://vcpop.m
+				if(v->vd) cpu->regfile[v->vd] = vector_cpop(v,vs2);
+				break;
+			case 0x11://vfirst.m
+				if(v->vd) cpu->regfile[v->vd] = vector_first(v,vs2);
+				break;
+			default:
+				return -1;
+			}
+			break;
+		case 0x14:
+			switch(v->vs1){
+			case 0x01://vmsbf.m
+			case 0x02://vmsof.m
+			case 0x03://vmsif.m
+				if(v->vd == v->vs2 || (!v->vm && v->vd == 0)) return -1;
+				vector_set_first(v,v->vs1,vd,vs2);
+				break;
+			case 0x10://viota.m
+				if(!vreg_aligned(v->vd,v->group) || (!v->vm && v->vd == 0) || v->vstart) return -1;
+				x = 0;
+				for(uint64_t i = 0;i<v->vl;i++){
+					if(!active(v,i)) continue;
+					set_elem(vd,v->sew,i,x);
+					x += mask_bit(vs2,i);
+				}
+				break;
+			case 0x11://vid.v
+				if(v->vs2 || !vreg_aligned(v->vd,v->group) || (!v->vm && v->vd == 0)) return -1;
+				for(uint64_t i = v->vstart;i<v->vl;i++){
+					if(active(v,i)) set_elem(vd,v->sew,i,i);
+				}
+				break;
+			default:
+				return -1;
+			}
+			break;
+		case 0x18 ... 0x1F://vmand.mm and the others
+			if(!v->vm) return -1;
+			vector_mask_logical(v,funct6,vd,vs2,vs1);
+			break;
+		default:
+			return -1;
+		}
+		return 0;
+	}
+
+	switch(funct6){
+	case 0x0E://vslide1up
+		if(!vector_operands_ok(v,1,0) || v->vd == v->vs2) return -1;
+		vector_slide(v,1,1,vd,vs2);
+		if(v->vl && v->vstart == 0 && active(v,0)) set_elem(vd,v->sew,0,x);
+		break;
+	case 0x0F://vslide1down
+		if(!vector_operands_ok(v,1,0)) return -1;
+		vector_slide(v,0,1,vd,vs2);
+		if(v->vl && v->vstart < v->vl && active(v,v->vl - 1)) set_elem(vd,v->sew,v->vl - 1,x);
+		break;
+	case 0x10://vmv.s.x
+		if(v->vs2 || !v->vm) return -1;
+		if(v->vl && v->vstart == 0) set_elem(vd,v->sew,0,x);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * OPFVV of 32 and 64 bit elements,
+ * the vector-scalar forms need the f registers and are illegal.
+ */
+static int vector_opf(struct vstate *v,int funct6)
+{
+	struct cpu *cpu = v->cpu;
+	uint8_t *vd = vreg(cpu,v->vd),*vs2 = vreg(cpu,v->vs2),*vs1 = vreg(cpu,v->vs1);
+	uint64_t x;
+
+	if(v->sew != 4 && v->sew != 8) return -1;
+
+	if(opf_ops[funct6]){
+		if(!vector_operands_ok(v,1,1)) return -1;
+		vector_arith(v,opf_ops[funct6],vd,vs2,vs1);
+	}else if(opf_reductions[funct6]){
+		if(!vreg_aligned(v->vs2,v->group) || v->vstart) return -1;
+		vector_reduce(v,opf_reductions[funct6],vd,vs2,vs1);
+	}else if(opf_cmps[funct6]){
+		if(!vector_operands_ok(v,0,1)) return -1;
+		vector_compare(v,opf_cmps[funct6],vd,vs2,vs1);
+	}else if(funct6 == 0x12){//vfcvt
+		if(!vector_operands_ok(v,1,0) || v->vs1 > 7 || v->vs1 == 4 || v->vs1 == 5) return -1;
+		for(uint64_t i = v->vstart;i<v->vl;i++){
+			if(active(v,i)) set_elem(vd,v->sew,i,fp_convert(v->vs1,v->sew,get_elem(vs2,v->sew,i)));
+		}
+	}else if(funct6 == 0x13 && v->vs1 == 0){//vfsqrt
+		if(!vector_operands_ok(v,1,0)) return -1;
+		for(uint64_t i = v->vstart;i<v->vl;i++){
+			if(!active(v,i)) continue;
+			x = get_elem(vs2,v->sew,i);
+			set_elem(vd,v->sew,i,v->sew == 4 ? f32_bits(sqrtf(f32(x))) : f64_bits(sqrt(f64(x))));
+		}
+	}else{
+		return -1;
+	}
+	return 0;
+}
+
+void init_vector(struct cpu *cpu)
+{
+	memset(cpu->vregs,0,sizeof(cpu->vregs));
+	cpu->csrs[CSR_VTYPE] = VTYPE_VILL;
+	cpu->csrs[CSR_VL] = 0;
+	cpu->csrs[CSR_VLENB] = VLENB;
+
+#if defined(__x86_64__) && !defined(__VECTOR_SCALAR__)
+	host_simd = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+//OP-V,return -1 for an illegal instruction
+int vector_exec(struct cpu *cpu)
+{
+	uint32_t inst = cpu->inst.instruction;
+	int funct3 = inst >> 12 & 7,funct6 = inst >> 26;
+	struct vstate v;
+	int nr,ret;
+
+	if(funct3 == 7) return vector_config(cpu,inst);
+
+	//vmv<nr>r.v does not depend on vtype
+	if(funct3 == 3 && funct6 == 0x27){
+		nr = (inst >> 15 & 0x1F) + 1;
+		if((nr & (nr - 1)) || nr > 8 || !(inst >> 25 & 1)) return -1;
+		if(!vreg_aligned(inst >> 7 & 0x1F,nr) || !vreg_aligned(inst >> 20 & 0x1F,nr)) return -1;
+		memmove(vreg(cpu,inst >> 7 & 0x1F),vreg(cpu,inst >> 20 & 0x1F),nr*VLENB);
+		cpu->csrs[CSR_VSTART] = 0;
+		return 0;
+	}
+
+	if(vector_state(cpu,inst,&v)) return -1;
+
+	switch(funct3){
+	case 0://OPIVV
+	case 3://OPIVI
+	case 4://OPIVX
+		ret = vector_opi(&v,funct3,funct6);
+		break;
+	case 2://OPMVV
+	case 6://OPMVX
+		ret = vector_opm(&v,funct3,funct6);
+		break;
+	case 1://OPFVV
+		ret = vector_opf(&v,funct6);
+		break;
+	default://OPFVF
+		ret = -1;
+		break;
+	}
+
+	if(ret == 0) cpu->csrs[CSR_VSTART] = 0;
+	return ret;
+}
+
+static void load_elem(struct cpu *cpu,uint64_t addr,int size,uint8_t *p)
+{
+	uint64_t x;
+
+	switch(size){
+	case 1:  x = get_byte_from_cache(&cpu->dcache,addr);  break;
+	case 2:  x = get_word_from_cache(&cpu->dcache,addr);  break;
+	case 4:  x = get_dword_from_cache(&cpu->dcache,addr); break;
+	default: x = get_qword_from_cache(&cpu->dcache,addr); break;
+	}
+	memcpy(p,&x,size);
+}
+
+static void store_elem(struct cpu *cpu,uint64_t addr,int size,uint8_t *p)
+{
+	uint64_t x = 0;
+
+	memcpy(&x,p,size);
+	switch(size){
+	case 1:  put_byte_to_cache(&cpu->dcache,addr,x);  break;
+	case 2:  put_word_to_cache(&cpu->dcache,addr,x);  break;
+	case 4:  put_dword_to_cache(&cpu->dcache,addr,x); break;
+	default: put_qword_to_cache(&cpu->dcache,addr,x); break;
+	}
+}
+
+static void transfer_block(struct cpu *cpu,int store,uint64_t addr,uint8_t *p,uint64_t len)
+{
+	if(store){
+		put_data_to_cache(&cpu->dcache,addr,p,len);
+	}else{
+		get_data_from_cache(&cpu->dcache,addr,p,len);
+	}
+}
+
+/*
+ * LOAD-FP and STORE-FP of the vector widths,through the dcache.
+ * unmasked unit-stride accesses are moved a cache line at a time,
+ * the others an element at a time.fault-only-first loads cannot fault here.
+ */
+int vector_load_store(struct cpu *cpu,int store)
+{
+	uint32_t inst = cpu->inst.instruction;
+	int width = inst >> 12 & 7,nf = (inst >> 29) + 1,mop = inst >> 26 & 3,lumop = inst >> 20 & 0x1F;
+	uint64_t base = xreg(cpu,inst >> 15 & 0x1F),stride = 0,addr,off;
+	int eew,size,emul,group,idx_emul,indexed = mop & 1;
+	uint8_t *p;
+	struct vstate v;
+
+	switch(width){
+	case 0: eew = 1; break;
+	case 5: eew = 2; break;
+	case 6: eew = 4; break;
+	case 7: eew = 8; break;
+	default: return -1;//scalar fp
+	}
+	if(inst >> 28 & 1) return -1;//mew
+
+	//whole registers
+	if(mop == 0 && lumop == 0x08){
+		if((nf & (nf - 1)) || !(inst >> 25 & 1) || !vreg_aligned(inst >> 7 & 0x1F,nf)) return -1;
+		if(store && eew != 1) return -1;
+		transfer_block(cpu,store,base,vreg(cpu,inst >> 7 & 0x1F),nf*VLENB);
+		cpu->csrs[CSR_VSTART] = 0;
+		return 0;
+	}
+
+	if(vector_state(cpu,inst,&v)) return -1;
+
+	//vlm.v and vsm.v
+	if(mop == 0 && lumop == 0x0B){
+		if(eew != 1 || nf != 1 || !v.vm) return -1;
+		transfer_block(cpu,store,base,vreg(cpu,v.vd),(v.vl + 7) >> 3);
+		cpu->csrs[CSR_VSTART] = 0;
+		return 0;
+	}
+	if(mop == 0 && lumop != 0 && !(lumop == 0x10 && !store)) return -1;
+
+	//log2 of the registers of the data and index groups
+	idx_emul = v.lmul + __builtin_ctz(eew) - __builtin_ctz(v.sew);
+	emul = indexed ? v.lmul : idx_emul;
+	size = indexed ? v.sew : eew;
+	if(idx_emul > 3 || idx_emul < -3) return -1;
+	group = emul > 0 ? 1 << emul : 1;
+	if(nf*group > 8 || v.vd + nf*group > 32 || !vreg_aligned(v.vd,group) || (!v.vm && v.vd == 0)) return -1;
+	if(indexed && !vreg_aligned(v.vs2,idx_emul > 0 ? 1 << idx_emul : 1)) return -1;
+	if(mop == 2) stride = xreg(cpu,v.vs2);
+
+	if(mop == 0 && nf == 1 && v.vm && v.vstart == 0){
+		transfer_block(cpu,store,base,vreg(cpu,v.vd),v.vl*eew);
+		cpu->csrs[CSR_VSTART] = 0;
+		return 0;
+	}
+
+	for(uint64_t i = v.vstart;i<v.vl;i++){
+		if(!active(&v,i)) continue;
+
+		switch(mop){
+		case 0:  addr = base + i*nf*eew;                                break;
+		case 2:  addr = base + i*stride;                                break;
+		default: addr = base + get_elem(vreg(cpu,v.vs2),eew,i);         break;
+		}
+		for(int f = 0;f<nf;f++){
+			off = addr + f*size;
+			p = vreg(cpu,v.vd + f*group) + i*size;
+			if(store){
+				store_elem(cpu,off,size,p);
+			}else{
+				load_elem(cpu,off,size,p);
+			}
+		}
+	}
+
+#ifdef __VECTOR_DEBUG__
+	printf("vector: %s mop %d eew %d vl %lu at 0x%lx\n",store ? "store" : "load",mop,eew,v.vl,base);
+#endif
+	cpu->csrs[CSR_VSTART] = 0;
+	return 0;
+}
+
+//vcsr mirrors vxrm and vxsat
+int vector_csr(uint64_t csr)
+{
+	return csr == CSR_VCSR || csr == CSR_VXSAT || csr == CSR_VXRM;
+}
+
+uint64_t vector_read_csr(struct cpu *cpu,uint64_t csr)
+{
+	if(csr == CSR_VCSR) return cpu->csrs[CSR_VXRM] << 1 | cpu->csrs[CSR_VXSAT];
+	return cpu->csrs[csr];
+}
+
+void vector_write_csr(struct cpu *cpu,uint64_t csr,uint64_t x)
+{
+	switch(csr){
+	case CSR_VCSR:
+		cpu->csrs[CSR_VXSAT] = x & 1;
+		cpu->csrs[CSR_VXRM] = x >> 1 & 3;
+		break;
+	case CSR_VXSAT:
+		cpu->csrs[csr] = x & 1;
+		break;
+	default:
+		cpu->csrs[csr] = x & 3;
+		break;
+	}
+}
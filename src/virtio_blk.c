@@ -0,0 +1,611 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "virtio_blk.h"
+#include "bus.h"
+#include "ram.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "tracer.h"
+#include "error.h"
+
+#define VIRTIO_STATUS_DEVICE_NEEDS_RESET 0x40
+
+static uint64_t virtio_blk_features(struct virtio_blk *blk)
+{
+	return (1UL<<VIRTIO_F_VERSION_1) | (1UL<<VIRTIO_BLK_F_SEG_MAX) | (1UL<<VIRTIO_BLK_F_FLUSH) |
+		((uint64_t)blk->read_only<<VIRTIO_BLK_F_RO);
+}
+
+static void virtio_blk_update_irq(struct virtio_blk *blk)
+{
+	bus_set_irq(blk->dev.bus,blk->dev.irq,blk->interrupt_status != 0);
+}
+
+static void virtio_blk_fail(struct virtio_blk *blk,char *reason)
+{
+#ifdef __VIRTIO_BLK_DEBUG__
+	printf("%s: %s\n",__func__,reason);
+#endif
+	blk->status |= VIRTIO_STATUS_DEVICE_NEEDS_RESET;
+}
+
+//preadv/pwritev until done,the iovec array is consumed
+static int virtio_blk_rw(int fd,struct iovec *iov,int nr_iov,uint64_t offset,int write)
+{
+	ssize_t ret;
+	uint64_t total = 0;
+
+	while(nr_iov){
+		ret = write ? pwritev(fd,iov,nr_iov,offset) : preadv(fd,iov,nr_iov,offset);
+		if(ret == -1 && errno == EINTR) continue;
+		if(ret <= 0) return -1;
+
+		total += ret;
+		offset += ret;
+		while(nr_iov && (size_t)ret >= iov->iov_len){
+			ret -= iov->iov_len;
+			iov++;
+			nr_iov--;
+		}
+		if(nr_iov){
+			iov->iov_base = (uint8_t *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return total;
+}
+
+static void virtio_blk_handle(struct virtio_blk *blk,struct virtio_blk_req *req)
+{
+	struct iovec iov[VIRTIO_BLK_SEG_MAX];
+	uint64_t len = 0;
+	char id[VIRTIO_BLK_ID_BYTES] = "rvemu-virtio-blk";
+
+	for(int i = 0;i<req->nr_iov;i++){
+		len += req->iov[i].iov_len;
+	}
+	memcpy(iov,req->iov,req->nr_iov * sizeof(struct iovec));
+
+	switch(req->type){
+	case VIRTIO_BLK_T_OUT:
+		if(blk->read_only){
+			req->status = VIRTIO_BLK_S_UNSUPP;
+			break;
+		}
+		//fall through
+	case VIRTIO_BLK_T_IN:
+		//in bytes,a partial sector past the end is refused too
+		if(req->sector > blk->capacity || len > (blk->capacity - req->sector) * VIRTIO_BLK_SECTOR_SIZE){
+			req->status = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		if(virtio_blk_rw(blk->fd,iov,req->nr_iov,req->sector*VIRTIO_BLK_SECTOR_SIZE,req->type == VIRTIO_BLK_T_OUT) == -1){
+			req->status = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		req->status = VIRTIO_BLK_S_OK;
+		req->len = req->type == VIRTIO_BLK_T_IN ? len : 0;
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		req->status = fdatasync(blk->fd) ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		if(req->nr_iov == 0){
+			req->status = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		len = req->iov[0].iov_len < VIRTIO_BLK_ID_BYTES ? req->iov[0].iov_len : VIRTIO_BLK_ID_BYTES;
+		memcpy(req->iov[0].iov_base,id,len);
+		req->status = VIRTIO_BLK_S_OK;
+		req->len = len;
+		break;
+	default:
+		req->status = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+}
+
+static void *virtio_blk_io_thread(void *arg)
+{
+	struct virtio_blk *blk = arg;
+	struct ram *ram;
+	struct virtio_blk_req *req;
+	uint64_t begin,len;
+
+	tracer_thread_name("virtio_blk");
+	while(1){
+		pthread_mutex_lock(&blk->lock);
+		while(blk->work == NULL && !blk->stop){
+			pthread_cond_wait(&blk->work_cond,&blk->lock);
+		}
+		if(blk->work == NULL){
+			pthread_mutex_unlock(&blk->lock);
+			break;
+		}
+		req = blk->work;
+		blk->work = req->next;
+		if(blk->work == NULL) blk->work_tail = NULL;
+		pthread_mutex_unlock(&blk->lock);
+
+		begin = tracer_begin(TRACER_DEVICE);
+		virtio_blk_handle(blk,req);
+		if(begin){
+			len = 0;
+			for(int i = 0;i<req->nr_iov;i++) len += req->iov[i].iov_len;
+			tracer_end(TRACER_DEVICE,req->type == VIRTIO_BLK_T_OUT ? "disk_write" : "disk_read",
+					begin,blk->dev.name,req->sector * VIRTIO_BLK_SECTOR_SIZE,len);
+		}
+
+		ram = blk->dev.bus->ram;
+		*ram_ptr(ram,req->status_addr,1) = req->status;
+		ram_mark_dirty(ram,req->status_addr,1);
+		if(req->type != VIRTIO_BLK_T_OUT){
+			for(int i = 0;i<req->nr_iov;i++){
+				ram_mark_dirty(ram,req->iov_addr[i],req->iov[i].iov_len);
+			}
+		}
+
+		pthread_mutex_lock(&blk->lock);
+		req->next = blk->done;
+		blk->done = req;
+		blk->inflight--;
+		pthread_cond_broadcast(&blk->done_cond);
+		pthread_mutex_unlock(&blk->lock);
+
+		bus_request_poll(blk->dev.bus);
+	}
+
+	return NULL;
+}
+
+/*
+ * walk a descriptor chain:header,data buffers,status.
+ * the data buffers are not copied,the io threads use them in ram.
+ */
+static struct virtio_blk_req *virtio_blk_parse(struct virtio_blk *blk,struct virtq_desc *descs,uint16_t head)
+{
+	struct virtio_blk_queue *q = &blk->queue;
+	struct ram *ram = blk->dev.bus->ram;
+	struct cpu *cpu = blk->dev.bus->cpu;
+	struct virtio_blk_req *req;
+	struct virtq_desc *chain[VIRTIO_BLK_SEG_MAX + 2];
+	int nr_chain = 0;
+	uint16_t idx = head;
+	uint8_t *hdr;
+
+	while(1){
+		if(idx >= q->num || nr_chain == VIRTIO_BLK_SEG_MAX + 2){
+			return NULL;
+		}
+		chain[nr_chain++] = descs + idx;
+		if(!(descs[idx].flags & VIRTQ_DESC_F_NEXT)) break;
+		idx = descs[idx].next;
+	}
+	if(nr_chain < 2 || chain[0]->len < 16 || !(chain[nr_chain - 1]->flags & VIRTQ_DESC_F_WRITE) ||
+			ram_ptr(ram,chain[nr_chain - 1]->addr,1) == NULL){
+		return NULL;
+	}
+
+	hdr = ram_ptr(ram,chain[0]->addr,16);
+	if(hdr == NULL) return NULL;
+	writeback_cache_range(cpu,chain[0]->addr,16);
+
+	req = calloc(1,sizeof(struct virtio_blk_req));
+	if(req == NULL) return NULL;//the device needs reset,the machine goes on
+	req->head = head;
+	memcpy(&req->type,hdr,4);
+	memcpy(&req->sector,hdr + 8,8);
+	req->status_addr = chain[nr_chain - 1]->addr;
+	req->status = VIRTIO_BLK_S_OK;
+
+	for(int i = 1;i<nr_chain - 1;i++){
+		req->iov[req->nr_iov].iov_base = ram_ptr(ram,chain[i]->addr,chain[i]->len);
+		req->iov[req->nr_iov].iov_len = chain[i]->len;
+		req->iov_addr[req->nr_iov] = chain[i]->addr;
+		if(req->iov[req->nr_iov].iov_base == NULL){
+			free(req);
+			return NULL;
+		}
+		req->nr_iov++;
+
+		//the device writes guest memory for reads,and reads it for writes
+		if(req->type == VIRTIO_BLK_T_OUT){
+			writeback_cache_range(cpu,chain[i]->addr,chain[i]->len);
+		}else{
+			flush_cache_range(cpu,chain[i]->addr,chain[i]->len);
+		}
+	}
+	flush_cache_range(cpu,req->status_addr,1);
+
+	return req;
+}
+
+static void virtio_blk_submit(struct virtio_blk *blk,struct virtio_blk_req *req)
+{
+	pthread_mutex_lock(&blk->lock);
+	req->next = NULL;
+	if(blk->work_tail){
+		blk->work_tail->next = req;
+	}else{
+		blk->work = req;
+	}
+	blk->work_tail = req;
+	blk->inflight++;
+	pthread_cond_signal(&blk->work_cond);
+	pthread_mutex_unlock(&blk->lock);
+}
+
+static void virtio_blk_notify(struct virtio_blk *blk)
+{
+	struct virtio_blk_queue *q = &blk->queue;
+	struct ram *ram = blk->dev.bus->ram;
+	struct cpu *cpu = blk->dev.bus->cpu;
+	struct virtio_blk_req *req;
+	struct virtq_desc *descs;
+	uint8_t *avail;
+	uint16_t avail_idx,head;
+
+	if(!q->ready) return;
+	if(q->num == 0){//reset or restored without a queue size
+		virtio_blk_fail(blk,"queue size not set");
+		return;
+	}
+
+	//the driver wrote the rings through the caches
+	writeback_cache_range(cpu,q->desc_addr,q->num * sizeof(struct virtq_desc));
+	writeback_cache_range(cpu,q->driver_addr,6 + 2*q->num);
+
+	descs = (struct virtq_desc *)ram_ptr(ram,q->desc_addr,q->num * sizeof(struct virtq_desc));
+	avail = ram_ptr(ram,q->driver_addr,6 + 2*q->num);
+	if(descs == NULL || avail == NULL){
+		virtio_blk_fail(blk,"queue outside of ram");
+		return;
+	}
+
+	memcpy(&avail_idx,avail + 2,2);
+	while(q->last_avail_idx != avail_idx){
+		memcpy(&head,avail + 4 + 2*(q->last_avail_idx % q->num),2);
+		q->last_avail_idx++;
+
+		req = virtio_blk_parse(blk,descs,head);
+		if(req == NULL){
+			virtio_blk_fail(blk,"bad descriptor chain");
+			return;
+		}
+		virtio_blk_submit(blk,req);
+	}
+}
+
+//completions are published to the used ring on the cpu thread
+static void virtio_blk_poll(struct device *dev)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+	struct virtio_blk_queue *q = &blk->queue;
+	struct ram *ram = dev->bus->ram;
+	struct cpu *cpu = dev->bus->cpu;
+	struct virtio_blk_req *req,*done = NULL,*next;
+	uint64_t used_size = 4 + 8*q->num;
+	uint8_t *used;
+	uint32_t elem[2];
+
+	pthread_mutex_lock(&blk->lock);
+	req = blk->done;
+	blk->done = NULL;
+	pthread_mutex_unlock(&blk->lock);
+
+	if(req == NULL) return;
+
+	while(req){//oldest first
+		next = req->next;
+		req->next = done;
+		done = req;
+		req = next;
+	}
+
+	//the queue was reset,the completions are dropped
+	used = q->num ? ram_ptr(ram,q->device_addr,used_size) : NULL;
+	if(used) flush_cache_range(cpu,q->device_addr,used_size);
+
+	for(req = done;req;req = next){
+		next = req->next;
+
+		if(req->type != VIRTIO_BLK_T_OUT){
+			for(int i = 0;i<req->nr_iov;i++){
+				invalid_cache_range(cpu,req->iov_addr[i],req->iov[i].iov_len);
+			}
+		}
+		invalid_cache_range(cpu,req->status_addr,1);
+
+		if(used){
+			elem[0] = req->head;
+			elem[1] = req->len + 1;//with the status byte
+			memcpy(used + 4 + 8*(q->used_idx % q->num),elem,sizeof(elem));
+			q->used_idx++;
+		}
+		free(req);
+	}
+
+	if(used == NULL){
+		virtio_blk_fail(blk,q->num ? "used ring outside of ram" : "queue size not set");
+		return;
+	}
+	__atomic_store_n((uint16_t *)(used + 2),q->used_idx,__ATOMIC_RELEASE);
+	ram_mark_dirty(ram,q->device_addr,used_size);
+
+	blk->interrupt_status |= VIRTIO_INT_USED_RING;
+	virtio_blk_update_irq(blk);
+}
+
+static void virtio_blk_sync(struct device *dev)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+
+	pthread_mutex_lock(&blk->lock);
+	while(blk->inflight){
+		pthread_cond_wait(&blk->done_cond,&blk->lock);
+	}
+	pthread_mutex_unlock(&blk->lock);
+
+	virtio_blk_poll(dev);
+}
+
+static void virtio_blk_reset(struct virtio_blk *blk)
+{
+	virtio_blk_sync(&blk->dev);
+
+	blk->status = 0;
+	blk->device_features_sel = 0;
+	blk->driver_features_sel = 0;
+	blk->driver_features = 0;
+	blk->interrupt_status = 0;
+	memset(&blk->queue,0,sizeof(blk->queue));
+	virtio_blk_update_irq(blk);
+}
+
+static uint64_t virtio_blk_read_config(struct virtio_blk *blk,uint64_t off,int size)
+{
+	uint8_t config[16] = {0};
+	uint32_t seg_max = VIRTIO_BLK_SEG_MAX;
+	uint64_t x = 0;
+
+	memcpy(config,&blk->capacity,8);
+	memcpy(config + 12,&seg_max,4);
+
+	for(int i = 0;i<size && off + i < sizeof(config);i++){
+		x |= (uint64_t)config[off + i] << (i*8);
+	}
+	return x;
+}
+
+static uint64_t virtio_blk_read(struct device *dev,uint64_t addr,int size)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+	uint64_t off = addr - dev->start_addr;
+
+	if(off >= VIRTIO_MMIO_CONFIG){
+		return virtio_blk_read_config(blk,off - VIRTIO_MMIO_CONFIG,size);
+	}
+
+	switch(off){
+	case VIRTIO_MMIO_MAGIC_VALUE:
+		return VIRTIO_MMIO_MAGIC;
+	case VIRTIO_MMIO_VERSION:
+		return 2;
+	case VIRTIO_MMIO_DEVICE_ID:
+		return VIRTIO_ID_BLOCK;
+	case VIRTIO_MMIO_VENDOR_ID:
+		return VIRTIO_VENDOR_ID;
+	case VIRTIO_MMIO_DEVICE_FEATURES:
+		return blk->device_features_sel ? virtio_blk_features(blk) >> 32 : virtio_blk_features(blk) & 0xffffffff;
+	case VIRTIO_MMIO_QUEUE_NUM_MAX:
+		return blk->queue_size_max;
+	case VIRTIO_MMIO_QUEUE_READY:
+		return blk->queue.ready;
+	case VIRTIO_MMIO_INTERRUPT_STATUS:
+		return blk->interrupt_status;
+	case VIRTIO_MMIO_STATUS:
+		return blk->status;
+	case VIRTIO_MMIO_CONFIG_GENERATION:
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void virtio_blk_write(struct device *dev,uint64_t addr,int size,uint64_t data)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+	struct virtio_blk_queue *q = &blk->queue;
+	uint64_t off = addr - dev->start_addr;
+
+	switch(off){
+	case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+		blk->device_features_sel = data;
+		break;
+	case VIRTIO_MMIO_DRIVER_FEATURES:
+		if(blk->driver_features_sel){
+			blk->driver_features = (blk->driver_features & 0xffffffff) | (data << 32);
+		}else{
+			blk->driver_features = (blk->driver_features & ~0xffffffffUL) | (data & 0xffffffff);
+		}
+		break;
+	case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+		blk->driver_features_sel = data;
+		break;
+	case VIRTIO_MMIO_QUEUE_SEL:
+		break;//one queue
+	case VIRTIO_MMIO_QUEUE_NUM:
+		if(data == 0 || data > blk->queue_size_max || (data & (data - 1))){
+			virtio_blk_fail(blk,"bad queue size");
+		}else{
+			q->num = data;
+		}
+		break;
+	case VIRTIO_MMIO_QUEUE_READY:
+		if((data & 1) && q->num == 0){
+			virtio_blk_fail(blk,"queue ready without a size");
+			break;
+		}
+		q->ready = data & 1;
+		break;
+	case VIRTIO_MMIO_QUEUE_NOTIFY:
+		virtio_blk_notify(blk);
+		break;
+	case VIRTIO_MMIO_INTERRUPT_ACK:
+		blk->interrupt_status &= ~data;
+		virtio_blk_update_irq(blk);
+		break;
+	case VIRTIO_MMIO_STATUS:
+		if(data == 0){
+			virtio_blk_reset(blk);
+		}else{
+			blk->status = data;
+		}
+		break;
+	case VIRTIO_MMIO_QUEUE_DESC_LOW:
+		q->desc_addr = (q->desc_addr & ~0xffffffffUL) | (data & 0xffffffff);
+		break;
+	case VIRTIO_MMIO_QUEUE_DESC_HIGH:
+		q->desc_addr = (q->desc_addr & 0xffffffff) | (data << 32);
+		break;
+	case VIRTIO_MMIO_QUEUE_DRIVER_LOW:
+		q->driver_addr = (q->driver_addr & ~0xffffffffUL) | (data & 0xffffffff);
+		break;
+	case VIRTIO_MMIO_QUEUE_DRIVER_HIGH:
+		q->driver_addr = (q->driver_addr & 0xffffffff) | (data << 32);
+		break;
+	case VIRTIO_MMIO_QUEUE_DEVICE_LOW:
+		q->device_addr = (q->device_addr & ~0xffffffffUL) | (data & 0xffffffff);
+		break;
+	case VIRTIO_MMIO_QUEUE_DEVICE_HIGH:
+		q->device_addr = (q->device_addr & 0xffffffff) | (data << 32);
+		break;
+	default:
+		break;//config space is read only
+	}
+}
+
+//called after sync,no request is in flight
+static void virtio_blk_save(struct device *dev,int fd)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+
+	write_full(fd,&blk->status,sizeof(blk->status));
+	write_full(fd,&blk->device_features_sel,sizeof(blk->device_features_sel));
+	write_full(fd,&blk->driver_features_sel,sizeof(blk->driver_features_sel));
+	write_full(fd,&blk->driver_features,sizeof(blk->driver_features));
+	write_full(fd,&blk->interrupt_status,sizeof(blk->interrupt_status));
+	write_full(fd,&blk->queue,sizeof(blk->queue));
+}
+
+static void virtio_blk_restore(struct device *dev,int fd,uint64_t size)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+
+	read_full(fd,&blk->status,sizeof(blk->status));
+	read_full(fd,&blk->device_features_sel,sizeof(blk->device_features_sel));
+	read_full(fd,&blk->driver_features_sel,sizeof(blk->driver_features_sel));
+	read_full(fd,&blk->driver_features,sizeof(blk->driver_features));
+	read_full(fd,&blk->interrupt_status,sizeof(blk->interrupt_status));
+	read_full(fd,&blk->queue,sizeof(blk->queue));
+	virtio_blk_update_irq(blk);
+}
+
+//completions not published yet are dropped
+static void virtio_blk_reset_device(struct device *dev)
+{
+	virtio_blk_reset((struct virtio_blk *)dev);
+}
+
+static void virtio_blk_free(struct device *dev)
+{
+	struct virtio_blk *blk = (struct virtio_blk *)dev;
+	struct virtio_blk_req *req;
+
+	pthread_mutex_lock(&blk->lock);
+	blk->stop = 1;
+	pthread_cond_broadcast(&blk->work_cond);
+	pthread_mutex_unlock(&blk->lock);
+	for(int i = 0;i<blk->nr_threads;i++){
+		pthread_join(blk->threads[i],NULL);
+	}
+
+	while((req = blk->done)){
+		blk->done = req->next;
+		free(req);
+	}
+	pthread_mutex_destroy(&blk->lock);
+	pthread_cond_destroy(&blk->work_cond);
+	pthread_cond_destroy(&blk->done_cond);
+	close(blk->fd);
+	free(blk->threads);
+	free(blk);
+}
+
+struct device *alloc_virtio_blk(char *filename,uint32_t queue_size,int nr_threads)
+{
+	struct virtio_blk *blk;
+	struct stat statbuff;
+
+	if(queue_size == 0 || queue_size > VIRTIO_BLK_QUEUE_SIZE_MAX || (queue_size & (queue_size - 1))){
+		fatal("%s: bad queue size %d\n",__func__,queue_size);
+	}
+
+	blk = malloc(sizeof(struct virtio_blk));
+	if(blk == NULL){
+		fatal("alloc virtio blk error(%s)\n",strerror(errno));
+	}
+	memset(blk,0,sizeof(struct virtio_blk));
+
+	blk->fd = open(filename,O_RDWR);
+	if(blk->fd == -1 && (errno == EACCES || errno == EROFS)){//read only,writes are refused
+		blk->fd = open(filename,O_RDONLY);
+		blk->read_only = 1;
+	}
+	if(blk->fd == -1 || fstat(blk->fd,&statbuff) == -1){
+		fatal("open %s file error(%s)\n",filename,strerror(errno));
+	}
+	blk->capacity = statbuff.st_size / VIRTIO_BLK_SECTOR_SIZE;
+	blk->queue_size_max = queue_size;
+
+	blk->dev.name = "virtio_blk";
+	blk->dev.start_addr = VIRTIO_BLK_START_PHY_ADDR;
+	blk->dev.end_addr   = VIRTIO_BLK_END_PHY_ADDR;
+	blk->dev.irq = VIRTIO_BLK_IRQ;
+	blk->dev.read_func  = virtio_blk_read;
+	blk->dev.write_func = virtio_blk_write;
+	blk->dev.poll_func = virtio_blk_poll;
+	blk->dev.sync_func = virtio_blk_sync;
+	blk->dev.save_func = virtio_blk_save;
+	blk->dev.restore_func = virtio_blk_restore;
+	blk->dev.free_func = virtio_blk_free;
+	blk->dev.reset_func = virtio_blk_reset_device;
+
+	pthread_mutex_init(&blk->lock,NULL);
+	pthread_cond_init(&blk->work_cond,NULL);
+	pthread_cond_init(&blk->done_cond,NULL);
+
+	blk->nr_threads = nr_threads;
+	blk->threads = malloc(nr_threads * sizeof(pthread_t));
+	if(blk->threads == NULL){
+		fatal("alloc virtio blk threads error(%s)\n",strerror(errno));
+	}
+	for(int i = 0;i<nr_threads;i++){
+		if(pthread_create(&blk->threads[i],NULL,virtio_blk_io_thread,blk)){
+			fatal("create virtio blk io thread error\n");
+		}
+	}
+
+	return (struct device *)blk;
+}